@@ -0,0 +1,3 @@
+cd build
+for %%f in (1 2 3) do Debug\Diffuse.exe --frames-in-flight %%f --benchmark 2000
+PAUSE
@@ -5,11 +5,13 @@
 namespace Diffuse {
     class Application {
     public:
-        void Init();
+        // benchmark_frames > 0 closes the application after that many frames
+        void Init(const Config& config = {}, uint32_t benchmark_frames = 0);
         void Update();
         void Destroy();
      private:
         GraphicsDevice* m_graphics;
         Config m_config;
+        uint32_t m_benchmark_frames = 0;
     };
 }
\ No newline at end of file
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Model.hpp"
+
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Diffuse {
+
+	// Bounding volume hierarchy over the world space boxes of items identified by the index they were added with.
+	// Built top down with a binned surface area heuristic. Nodes are 32 bytes and stored depth first, so a node's left child
+	// follows it directly and every subtree covers a contiguous range of the item order. Moving items refit their leaf and
+	// its ancestors only, the tree is rebuilt once refitting has doubled its estimated traversal cost.
+	class BVH {
+	public:
+		// Returns the item id, the hierarchy is rebuilt by the next Refit
+		uint32_t Add(const BoundingBox& box);
+		void Clear();
+		// Records the item's new box, applied by the next Refit
+		void Update(uint32_t id, const BoundingBox& box);
+		void Refit();
+		void Build();
+
+		// Appends the items whose boxes intersect the frustum, planes as from FrustumCuller::ExtractPlanes.
+		// Subtrees entirely inside are taken without testing their items. Returns the number of nodes visited
+		uint32_t QueryFrustum(const glm::vec4* planes, std::vector<uint32_t>& items) const;
+		// Appends the items whose boxes overlap the box
+		void QueryBox(const BoundingBox& box, std::vector<uint32_t>& items) const;
+		// Finds the item whose box the ray enters first within max_distance, direction does not need to be normalized
+		bool Raycast(const glm::vec3& origin, const glm::vec3& direction, float max_distance, uint32_t& item, float& distance) const;
+
+		uint32_t GetItemCount() const { return static_cast<uint32_t>(m_boxes.size()); }
+		uint32_t GetNodeCount() const { return static_cast<uint32_t>(m_nodes.size()); }
+		uint32_t GetBuildCount() const { return m_builds; }
+	private:
+		struct Node {
+			glm::vec3 min;
+			uint32_t first;    // First entry of the subtree in m_order
+			glm::vec3 max;
+			uint32_t count;    // Items of the subtree
+		};
+
+		void Subdivide(uint32_t node, uint32_t depth);
+		void ComputeBounds(uint32_t node);
+		float NodeCost(uint32_t node) const;
+		bool IsLeaf(uint32_t node) const { return m_right[node] == 0; }
+	private:
+		std::vector<BoundingBox> m_boxes;
+		std::vector<glm::vec3> m_centers;
+		std::vector<uint32_t> m_order;        // Item ids, leaves and subtrees reference ranges of it
+		std::vector<Node> m_nodes;
+		std::vector<uint32_t> m_right;        // Right child of inner nodes, 0 for leaves
+		std::vector<uint32_t> m_parent;
+		std::vector<uint32_t> m_item_leaf;
+		std::vector<uint32_t> m_dirty;
+		std::vector<uint8_t> m_is_dirty;
+
+		bool m_needs_build = false;
+		float m_cost = 0.0f;          // Surface area heuristic cost of the current tree
+		float m_built_cost = 0.0f;
+		uint32_t m_builds = 0;
+	};
+}
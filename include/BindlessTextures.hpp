@@ -0,0 +1,43 @@
+#pragma once
+
+#include "Texture2D.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// One partially bound, update after bind array of every scene texture, indexed by the texture indices in the
+	// materials. There is a copy of the set per frame in flight so the TextureStreamer can point a slot at a new image
+	// while older frames still read the old one, writes never invalidate command buffers that bound the set.
+	// Textures added later, e.g. by models loaded at runtime, take the next free element and are written into every copy,
+	// elements no draw has used yet can be written while frames are in flight.
+	class BindlessTextures {
+	public:
+		// capacity: elements of the array, at most the device's maxDescriptorSetUpdateAfterBindSampledImages
+		BindlessTextures(GraphicsDevice* device, uint32_t frame_count, uint32_t capacity);
+
+		// Returns the element of the texture, adding it when it is new
+		uint32_t Add(Texture2D* texture);
+
+		VkDescriptorSetLayout GetSetLayout() const { return m_set_layout; }
+		VkDescriptorSet GetDescriptorSet(uint32_t frame_index) const { return m_descriptor_sets[frame_index]; }
+		uint32_t GetCount() const { return static_cast<uint32_t>(m_textures.size()); }
+		uint32_t GetCapacity() const { return m_capacity; }
+		void CleanUp();
+	private:
+		GraphicsDevice* m_device;
+		uint32_t m_capacity;
+		VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+		VkDescriptorPool m_descriptor_pool = VK_NULL_HANDLE;
+		std::vector<VkDescriptorSet> m_descriptor_sets;
+
+		std::vector<Texture2D*> m_textures;
+		std::unordered_map<Texture2D*, uint32_t> m_indices;
+	};
+}
@@ -6,7 +6,7 @@ namespace Diffuse {
 	struct Buffer {
 		VkDevice device;
 		VkBuffer buffer = VK_NULL_HANDLE;
-		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;    // Shared block owned by the MemoryAllocator
 		VkDescriptorBufferInfo descriptor;
 		VkDeviceSize size = 0;
 		VkDeviceSize alignment = 0;
@@ -17,7 +17,6 @@ namespace Diffuse {
 		VkMemoryPropertyFlags memoryPropertyFlags;
 		VkResult Map(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 		void Unmap();
-		VkResult Bind(VkDeviceSize offset = 0);
 		void SetupDescriptor(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
 		void CopyTo(void* data, VkDeviceSize size);
 		VkResult Flush(VkDeviceSize size = VK_WHOLE_SIZE, VkDeviceSize offset = 0);
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace Diffuse {
+
+	// Defers destroying objects the GPU may still be reading until the frames that could reference them have finished.
+	// Destructors pushed while frame slot i is current run the next time slot i begins, after its fence was waited on.
+	// By then every frame submitted before the push has completed, whatever the number of frames in flight.
+	class DeletionQueue {
+	public:
+		explicit DeletionQueue(uint32_t frames_in_flight);
+
+		void Push(std::function<void()> destroy);
+		// Must be called after the fence of the frame slot has been waited on
+		void BeginFrame(uint32_t frame_index);
+		// Runs everything still queued, the device must be idle
+		void Flush();
+
+		uint64_t GetDeferredCount() const { return m_deferred; }
+	private:
+		std::mutex m_mutex;
+		std::vector<std::vector<std::function<void()>>> m_frames;
+		uint32_t m_frame_index = 0;
+		uint64_t m_deferred = 0;
+	};
+}
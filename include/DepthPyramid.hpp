@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Hierarchical depth of the frame's depth buffer for occlusion tests. The first level is the largest power of two
+	// that fits in the depth buffer, every level below halves it down to a single texel. A texel holds the farthest depth
+	// of the area it covers, since the depth buffer is cleared to 1 and tested with less, so a box whose nearest depth is
+	// behind it is hidden. The levels are reduced one after another by a compute shader and stay in the general layout.
+	class DepthPyramid {
+	public:
+		explicit DepthPyramid(GraphicsDevice* device);
+
+		// Creates the pyramid for a depth buffer, again when it is recreated. The device must be idle
+		void Resize(VkImageView depth_view, uint32_t width, uint32_t height);
+		// Reduces the depth buffer, which must be in DEPTH_STENCIL_READ_ONLY_OPTIMAL layout, outside of a render pass.
+		// The caller brings every level into GENERAL before, discarding the previous contents, and orders the reads of the
+		// pyramid after it
+		void Build(VkCommandBuffer command_buffer);
+
+		VkImage GetImage() const { return m_image; }
+		VkImageView GetView() const { return m_view; }
+		VkSampler GetSampler() const { return m_sampler; }
+		uint32_t GetWidth() const { return m_width; }
+		uint32_t GetHeight() const { return m_height; }
+		uint32_t GetLevelCount() const { return static_cast<uint32_t>(m_levels.size()); }
+		void CleanUp();
+	private:
+		struct Level {
+			VkImageView view = VK_NULL_HANDLE;
+			VkDescriptorSet descriptor_set = VK_NULL_HANDLE;    // Previous level or the depth buffer in, this level out
+			uint32_t width = 0;
+			uint32_t height = 0;
+		};
+
+		void DestroyImage();
+	private:
+		GraphicsDevice* m_device;
+		VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+		VkPipelineLayout m_pipeline_layout = VK_NULL_HANDLE;
+		VkPipeline m_pipeline = VK_NULL_HANDLE;
+		VkSampler m_sampler = VK_NULL_HANDLE;
+		VkDescriptorPool m_descriptor_pool = VK_NULL_HANDLE;
+
+		VkImage m_image = VK_NULL_HANDLE;
+		VkDeviceMemory m_memory = VK_NULL_HANDLE;
+		VkImageView m_view = VK_NULL_HANDLE;    // All levels
+		std::vector<Level> m_levels;
+		uint32_t m_width = 0;
+		uint32_t m_height = 0;
+		uint32_t m_depth_width = 0;
+		uint32_t m_depth_height = 0;
+	};
+}
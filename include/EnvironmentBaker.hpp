@@ -0,0 +1,112 @@
+#pragma once
+
+#include "PipelineCompiler.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Turns an equirectangular HDR into the environment cubemap and the irradiance and prefiltered cubemaps of image based
+	// lighting, all with compute shaders so a bake can run on a compute only queue family beside rendering. A bake is
+	// submitted on its own and signals a timeline semaphore, the frame that finds it finished acquires the maps for the
+	// graphics family and its submission waits on the value, which has already been reached. Without a separate compute
+	// family or timeline semaphore support the bakes go to the graphics queue behind a fence, in submission order with
+	// the frames, so callers use the same code path either way.
+	class EnvironmentBaker {
+	public:
+		struct Cubemap {
+			VkImage image = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			VkSampler sampler = VK_NULL_HANDLE;
+			uint32_t mip_levels = 0;
+			VkDescriptorImageInfo descriptor{};    // In SHADER_READ_ONLY_OPTIMAL once acquired
+		};
+
+		struct Environment {
+			std::string path;
+			Cubemap environment;    // Drawn by the skybox, the others are filtered from it
+			Cubemap irradiance;
+			Cubemap prefiltered;
+		};
+
+		struct Stats {
+			uint32_t bakes = 0;
+			uint32_t discarded = 0;        // Replaced by a newer bake before they were acquired
+			double load_ms = 0.0;          // Reading the HDR and recording the last bake, on the calling thread
+		};
+
+		// compute_queue is VK_NULL_HANDLE when bakes have to fall back to the graphics queue. size is the edge of the
+		// environment and prefiltered cubemaps
+		EnvironmentBaker(GraphicsDevice* device, VkQueue compute_queue, uint32_t compute_family, VkQueue graphics_queue, uint32_t graphics_family, uint32_t size);
+
+		bool IsAsync() const { return m_queue != VK_NULL_HANDLE; }
+
+		// Loads the HDR at path and submits its bake. A bake not acquired yet is replaced, its maps are destroyed once
+		// it has finished
+		void Bake(const std::string& path);
+		// Blocks until the last bake has finished
+		void Wait() const;
+		// Hands over the last bake once it has finished, recording the acquire of its images into graphics_command_buffer.
+		// They are sampled by fragment shaders after it
+		bool Acquire(VkCommandBuffer graphics_command_buffer, Environment& environment);
+		// Returns true if the graphics submission of the frame that acquired a bake has to wait for value on semaphore
+		// at dst_stage, once per acquired bake
+		bool GetFrameWait(VkSemaphore& semaphore, uint64_t& value, VkPipelineStageFlags& dst_stage);
+		// The GPU must be done with the environment
+		void Destroy(Environment& environment);
+
+		const Stats& GetStats() const { return m_stats; }
+		void CleanUp();
+	private:
+		// What a bake needs until it has finished
+		struct Job {
+			Environment environment;
+			VkCommandBuffer command_buffer = VK_NULL_HANDLE;
+			VkFence fence = VK_NULL_HANDLE;    // Without the compute queue
+			uint64_t value = 0;                // Timeline value with it
+			VkBuffer staging_buffer = VK_NULL_HANDLE;
+			VkDeviceMemory staging_memory = VK_NULL_HANDLE;
+			VkImage equirect = VK_NULL_HANDLE;
+			VkDeviceMemory equirect_memory = VK_NULL_HANDLE;
+			VkImageView equirect_view = VK_NULL_HANDLE;
+			std::vector<VkImageView> level_views;    // Storage views of single mip levels
+			VkDescriptorPool descriptor_pool = VK_NULL_HANDLE;
+		};
+
+		bool IsFinished(const Job& job) const;
+		void CreateCubemap(Cubemap& cubemap, VkFormat format, uint32_t size, uint32_t mip_levels);
+		// Everything but the environment
+		void ReleaseJob(Job& job);
+		// Records the image barriers of every map at the end of a bake or at the acquire, the three images share them
+		void RecordHandOver(VkCommandBuffer command_buffer, const Environment& environment, bool acquire);
+	private:
+		GraphicsDevice* m_device;
+		VkQueue m_queue;
+		uint32_t m_compute_family;
+		VkQueue m_graphics_queue;
+		uint32_t m_graphics_family;
+		uint32_t m_size;
+
+		VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+		VkPipelineLayout m_pipeline_layout = VK_NULL_HANDLE;
+		VkPipeline m_equirect_pipeline = VK_NULL_HANDLE;
+		VkPipeline m_irradiance_pipeline = VK_NULL_HANDLE;
+		VkPipeline m_prefilter_pipeline = VK_NULL_HANDLE;
+		VkSampler m_sampler = VK_NULL_HANDLE;
+		std::vector<PipelineCompiler::Ticket> m_tickets;    // Waited on by the first bake
+
+		VkCommandPool m_command_pool = VK_NULL_HANDLE;
+		VkSemaphore m_timeline = VK_NULL_HANDLE;
+		uint64_t m_value = 0;
+		std::vector<Job> m_jobs;    // Oldest first, only the last one is acquired
+		uint64_t m_wait_value = 0;  // Value the acquiring frame waits on, 0 when there is none
+		Stats m_stats;
+	};
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <chrono>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Measures how well CPU and GPU overlap. Every frame records how long the CPU blocked on the frame slot's fence and
+	// brackets its command buffer with timestamps, which are read back once the slot's fence has signaled again.
+	class FrameTimer {
+	public:
+		struct Stats {
+			uint32_t frames = 0;
+			double frame_ms = 0.0;         // Average time between frames
+			double fence_wait_ms = 0.0;    // Average time the CPU blocked on the frame fence
+			double gpu_ms = 0.0;           // Average time between the first and last command of a frame on the GPU
+		double record_ms = 0.0;        // Average CPU time spent recording the frame's command buffer
+			double cpu_busy = 0.0;         // Fraction of the frame the CPU was not waiting for the GPU
+			double gpu_busy = 0.0;         // Fraction of the frame the GPU was executing this renderer's commands
+		};
+
+		FrameTimer(GraphicsDevice* device, uint32_t frames_in_flight, uint32_t queue_family);
+
+		// Called right after the fence of the frame slot was waited on, wait_ms is how long that took
+		void BeginFrame(uint32_t frame_index, double wait_ms);
+		// First and last commands of the frame's command buffer, outside of a render pass
+		void WriteBegin(VkCommandBuffer command_buffer);
+		void WriteEnd(VkCommandBuffer command_buffer);
+		void AddRecordTime(double record_ms) { m_record_ms += record_ms; }
+
+		Stats GetStats() const;
+		void PrintStats() const;
+		void CleanUp();
+	private:
+		GraphicsDevice* m_device;
+		uint32_t m_frames_in_flight;
+		VkQueryPool m_query_pool = VK_NULL_HANDLE;
+		double m_timestamp_period = 0.0;    // Nanoseconds per tick
+		uint64_t m_timestamp_mask = 0;
+		std::vector<bool> m_written;
+		uint32_t m_frame_index = 0;
+
+		std::chrono::high_resolution_clock::time_point m_last_frame;
+		bool m_started = false;
+		uint32_t m_frames = 0;
+		uint32_t m_gpu_frames = 0;
+		double m_frame_ms = 0.0;
+		double m_wait_ms = 0.0;
+		double m_gpu_ms = 0.0;
+		double m_record_ms = 0.0;
+	};
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Model.hpp"
+#include "WorkerPool.hpp"
+
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace Diffuse {
+
+	// Tests world space bounding boxes against the view frustum. Boxes are kept as centers and half extents in structure
+	// of arrays layout and tested 8 at a time with AVX2 when the CPU has it, 4 at a time with SSE otherwise.
+	// Large sets are split into blocks culled in parallel on the worker pool.
+	class FrustumCuller {
+	public:
+		explicit FrustumCuller(Utils::WorkerPool* workers);
+
+		void Clear();
+		// Returns the index of the box, boxes that are not valid are always visible
+		uint32_t Add(const BoundingBox& box);
+		// Planes are extracted from the matrix, clip space depth is zero to one
+		void Cull(const glm::mat4& view_projection);
+
+		uint32_t GetCount() const { return m_count; }
+		uint32_t GetVisibleCount() const { return m_visible_count; }
+		bool IsVisible(uint32_t index) const { return m_visible[index] != 0; }
+		// Identifies the set of visible boxes, equal when the same boxes are visible
+		uint64_t GetVisibilityHash() const;
+
+		// Six planes with normals pointing inside, a point p is inside when dot(plane.xyz, p) + plane.w >= 0 for all of them
+		static void ExtractPlanes(const glm::mat4& view_projection, glm::vec4* planes);
+		static bool HasAVX2();
+	private:
+		void CullBlock(const glm::vec4* planes, uint32_t first, uint32_t last);
+	private:
+		Utils::WorkerPool* m_workers;
+		bool m_avx2;
+		uint32_t m_count = 0;
+		uint32_t m_visible_count = 0;
+		// Padded to a multiple of 8 so the last boxes can be loaded as a full vector
+		std::vector<float> m_center_x, m_center_y, m_center_z;
+		std::vector<float> m_extent_x, m_extent_y, m_extent_z;
+		std::vector<uint8_t> m_visible;
+	};
+}
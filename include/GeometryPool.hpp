@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Model.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <map>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// One device local vertex buffer and one index buffer shared by every model.
+	// Models sub-allocate ranges from a free list per buffer, their indices stay relative to the model, so primitives
+	// are drawn with the allocation's vertex offset as base vertex. A frame binds the two buffers once.
+	// When a buffer runs out of space it is reallocated at twice the size and the old contents are copied over.
+	class GeometryPool {
+	public:
+		struct Stats {
+			uint32_t allocations = 0;
+			uint32_t vertices_used = 0;
+			uint32_t vertex_capacity = 0;
+			uint32_t indices_used = 0;
+			uint32_t index_capacity = 0;
+			uint32_t free_ranges = 0;
+			uint32_t grows = 0;
+		};
+
+		GeometryPool(GraphicsDevice* device, uint32_t vertex_capacity, uint32_t index_capacity);
+
+		GeometryAllocation Allocate(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count);
+		// The caller has to make sure no pending command buffer still draws from the allocation
+		void Free(const GeometryAllocation& allocation);
+
+		void Bind(VkCommandBuffer command_buffer) const;
+		VkBuffer GetVertexBuffer() const { return m_vertices.buffer; }
+		VkBuffer GetIndexBuffer() const { return m_indices.buffer; }
+
+		Stats GetStats() const;
+		void PrintStats() const;
+		void CleanUp();
+	private:
+		struct Range {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkBufferUsageFlags usage = 0;
+			VkDeviceSize stride = 0;
+			uint32_t capacity = 0;
+			uint32_t used = 0;
+			std::map<uint32_t, uint32_t> free;    // offset -> count, ordered so neighbours can be merged
+		};
+
+		void CreateRange(Range& range, uint32_t capacity);
+		uint32_t AllocateRange(Range& range, uint32_t count);
+		void FreeRange(Range& range, uint32_t offset, uint32_t count);
+		void Grow(Range& range, uint32_t count);
+	private:
+		GraphicsDevice* m_device;
+		Range m_vertices;
+		Range m_indices;
+		uint32_t m_allocations = 0;
+		uint32_t m_grows = 0;
+	};
+}
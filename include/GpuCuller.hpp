@@ -0,0 +1,168 @@
+#pragma once
+
+#include "Model.hpp"
+#include "RenderQueue.hpp"
+#include "Scene.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include "glm/glm.hpp"
+
+#include <cstdint>
+#include <map>
+#include <tuple>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Culls the scene's opaque and masked primitives on the GPU and draws them through indirect commands.
+	// Every primitive becomes a draw record in a device local buffer built once per scene. Records sharing pipeline,
+	// material, object and material index form a bucket with a reserved range of the command buffer. Each frame a
+	// compute pass tests the records against the frustum, using the per object matrices and boxes written by the CPU,
+	// and writes the visible commands. Buckets are then drawn with vkCmdDrawIndexedIndirectCount, or with
+	// vkCmdDrawIndexedIndirect and zero instance counts for culled records when the device lacks drawIndirectCount.
+	// The CPU cost of a frame grows with the objects and buckets, not with the primitives.
+	// With occlusion culling a frame is culled in two phases that write separate command ranges. The early phase draws the
+	// records visible last frame, the late phase tests the others against a DepthPyramid of the early phase's depth and
+	// draws the ones that became visible. Which records were visible is kept in a buffer shared by all frame slots.
+	class GpuCuller {
+	public:
+		enum Phase : uint32_t {
+			PHASE_ALL = 0,      // Frustum culling only
+			PHASE_EARLY = 1,
+			PHASE_LATE = 2,
+		};
+
+		struct Stats {
+			uint32_t records = 0;
+			uint32_t buckets = 0;
+			uint32_t visible = 0;               // Visible records of the frame that last used the slot
+			uint32_t occluded = 0;              // Records in the frustum hidden behind the depth pyramid
+			uint32_t occluded_triangles = 0;
+		};
+
+		// draw_indirect_count: the device has the Vulkan 1.2 drawIndirectCount feature enabled
+		// occlusion: cull in two phases, SetDepthPyramid has to be called before the first frame
+		GpuCuller(GraphicsDevice* device, uint32_t frame_count, bool draw_indirect_count, bool occlusion);
+
+		// Starts a new set of draws for instance_count objects, the device must be idle
+		void Clear(uint32_t instance_count);
+		// local_bounds are in the space of the instance's matrix, depth_pipeline is null when the draw skips the depth pre-pass
+		void AddDraw(uint32_t instance, VkPipeline pipeline, VkPipeline depth_pipeline, const Material* material, int32_t material_index, RenderQueue::Pass pass,
+			const BoundingBox& local_bounds, uint32_t index_count, uint32_t first_index, int32_t vertex_offset);
+		// Sorts the records into buckets and uploads them
+		void Build();
+
+		// Must be called after the fence of the frame slot has been waited on
+		void BeginFrame(uint32_t frame_index);
+		void SetInstance(uint32_t instance, const glm::mat4& world, const BoundingBox& local_bounds, bool render);
+		// The pyramid is read by the late phase, again after it was resized. The device must be idle
+		void SetDepthPyramid(VkImageView view, VkSampler sampler, uint32_t width, uint32_t height, uint32_t levels);
+		// Writes this frame's commands of the phase, outside of a render pass. PHASE_ALL, or PHASE_EARLY followed by PHASE_LATE
+		// once the pyramid was built from the early phase's draws. The caller orders the indirect reads after it
+		void Cull(VkCommandBuffer command_buffer, const glm::mat4& view_projection, Phase phase = PHASE_ALL);
+		// Records the indirect draws of every bucket with the same set layout as RenderQueue::Record, the geometry pool's
+		// buffers must be bound. Instances are the indices of the scene's objects. The commands are only read when the command
+		// buffer executes, so it can be replayed in later frames of the same slot. With depth_prepass the buckets are drawn
+		// with their depth pipelines, the same commands then fill the depth before shading
+		RenderQueue::Stats Record(VkCommandBuffer command_buffer, VkPipelineLayout layout, VkDescriptorSet ibl_set, VkDescriptorSet texture_set, uint32_t shader_values_offset,
+			const Scene& scene, Phase phase = PHASE_ALL, bool depth_prepass = false) const;
+
+		// This frame's indirect commands and draw counts, null when there is nothing to draw
+		VkBuffer GetIndirectBuffer() const { return m_records.empty() ? VK_NULL_HANDLE : m_frames[m_frame_index].commands; }
+		VkBuffer GetCountBuffer() const { return m_records.empty() ? VK_NULL_HANDLE : m_frames[m_frame_index].counts; }
+		uint32_t GetBucketCount() const { return static_cast<uint32_t>(m_buckets.size()); }
+		bool IsOcclusionCulling() const { return m_occlusion; }
+		const Stats& GetStats() const { return m_stats; }
+		void PrintStats() const;
+		void CleanUp();
+	private:
+		struct Instance {
+			glm::mat4 world;
+			glm::vec4 box_min;    // w: 1 when the object is drawn
+			glm::vec4 box_max;    // w: 1 when the box is valid
+		};
+
+		// Matches DrawRecord in shaders/culling/draw_cull.comp
+		struct DrawRecord {
+			glm::vec4 box_min;    // w: 1 when the box is valid
+			glm::vec4 box_max;
+			uint32_t index_count;
+			uint32_t first_index;
+			int32_t vertex_offset;
+			uint32_t instance;
+			uint32_t bucket;
+			uint32_t bucket_first;
+			uint32_t slot;
+			uint32_t padding;
+		};
+
+		// Matches View in shaders/culling/draw_cull.comp
+		struct View {
+			glm::mat4 view_projection;
+			glm::vec4 planes[6];
+			glm::vec2 pyramid_size;
+			uint32_t pyramid_levels;
+			uint32_t padding;
+		};
+
+		struct Bucket {
+			VkPipeline pipeline;
+			VkPipeline depth_pipeline;
+			const Material* material;
+			uint32_t instance;
+			int32_t material_index;
+			RenderQueue::Pass pass;
+			uint32_t first_command;
+			uint32_t command_count;
+		};
+
+		struct Frame {
+			VkBuffer instances = VK_NULL_HANDLE;
+			VkBuffer commands = VK_NULL_HANDLE;
+			VkBuffer counts = VK_NULL_HANDLE;
+			VkBuffer readback = VK_NULL_HANDLE;    // Counts copied back for the stats
+			VkBuffer view = VK_NULL_HANDLE;
+			Instance* mapped_instances = nullptr;
+			View* mapped_view = nullptr;
+			const uint32_t* mapped_readback = nullptr;
+			VkDescriptorSet descriptor_set = VK_NULL_HANDLE;
+			bool pending = false;                  // Counts were copied back by a submitted frame
+		};
+
+		using BucketKey = std::tuple<RenderQueue::Pass, VkPipeline, const Material*, uint32_t, int32_t>;
+
+		// Counts of the phases' buckets followed by the occlusion stats
+		uint32_t GetCountOffset(Phase phase) const { return phase == PHASE_LATE ? GetBucketCount() : 0; }
+		uint32_t GetStatsOffset() const { return 2 * GetBucketCount(); }
+		void DestroyBuffers();
+	private:
+		GraphicsDevice* m_device;
+		bool m_draw_indirect_count;
+		bool m_occlusion;
+		VkDescriptorSetLayout m_set_layout = VK_NULL_HANDLE;
+		VkPipelineLayout m_pipeline_layout = VK_NULL_HANDLE;
+		VkPipeline m_pipeline = VK_NULL_HANDLE;
+		VkDescriptorPool m_descriptor_pool = VK_NULL_HANDLE;
+
+		std::vector<DrawRecord> m_records;
+		std::vector<Bucket> m_buckets;
+		std::map<BucketKey, uint32_t> m_bucket_lookup;
+		uint32_t m_instance_count = 0;
+		VkBuffer m_record_buffer = VK_NULL_HANDLE;
+		VkBuffer m_visibility_buffer = VK_NULL_HANDLE;    // Per record, 1 when it was visible last frame
+		VkDescriptorImageInfo m_pyramid{};
+		glm::vec2 m_pyramid_size{ 0.0f };
+		uint32_t m_pyramid_levels = 0;
+		std::vector<Frame> m_frames;
+		uint32_t m_frame_index = 0;
+
+		Stats m_stats;
+		uint64_t m_total_visible = 0;
+		uint64_t m_total_occluded = 0;
+		uint64_t m_total_occluded_triangles = 0;
+		uint64_t m_counted_frames = 0;
+	};
+}
@@ -6,6 +6,27 @@
 #include "Swapchain.hpp"
 #include "Model.hpp"
 #include "Scene.hpp"
+#include "TextureStreamer.hpp"
+#include "TextureRegistry.hpp"
+#include "TexturePacker.hpp"
+#include "VulkanObjectCache.hpp"
+#include "PipelineCache.hpp"
+#include "PipelineCompiler.hpp"
+#include "MemoryAllocator.hpp"
+#include "GeometryPool.hpp"
+#include "UniformRing.hpp"
+#include "UploadQueue.hpp"
+#include "DeletionQueue.hpp"
+#include "FrameTimer.hpp"
+#include "RenderQueue.hpp"
+#include "WorkerPool.hpp"
+#include "FrustumCuller.hpp"
+#include "GpuCuller.hpp"
+#include "DepthPyramid.hpp"
+#include "BindlessTextures.hpp"
+#include "MaterialFeatures.hpp"
+#include "RenderGraph.hpp"
+#include "EnvironmentBaker.hpp"
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -13,11 +34,15 @@
 #include <glm/glm.hpp>
 #include <glm/gtx/hash.hpp>
 
+#include <chrono>
+#include <unordered_map>
 #include <vector>
 
 namespace Diffuse {
     struct Config {
         bool enable_validation_layers = true;
+        // Frames the CPU may record while the GPU still works on earlier ones, 1 to 3
+        uint32_t frames_in_flight = 2;
         const std::vector<const char*> validation_layers = {
             "VK_LAYER_KHRONOS_validation"
         };
@@ -25,6 +50,61 @@ namespace Diffuse {
             VK_KHR_SWAPCHAIN_EXTENSION_NAME,
             //VK_KHR_RAY_TRACING_PIPELINE_EXTENSION_NAME,
         };
+        // Texture mip streaming
+        bool enable_texture_streaming = true;
+        VkDeviceSize texture_vram_budget = 256ull * 1024 * 1024;
+        VkDeviceSize texture_upload_budget = 8ull * 1024 * 1024;   // per frame
+        // Share byte identical glTF images between textures and models
+        bool enable_texture_dedup = true;
+        // Pack glTF textures up to this size into shared atlas pages, 0 disables packing. Textures with more mips
+        // than the pages carry are never packed
+        uint32_t texture_atlas_max_extent = 16;
+        uint32_t texture_atlas_page_extent = 2048;
+        // Size of the device memory blocks buffers and images are sub-allocated from
+        VkDeviceSize memory_block_size = 64ull * 1024 * 1024;
+        // Initial size of the scene wide vertex and index buffers, both grow on demand
+        uint32_t geometry_vertex_capacity = 256u * 1024;
+        uint32_t geometry_index_capacity = 1024u * 1024;
+        // Bytes of per object constants a frame can push into the uniform ring
+        VkDeviceSize uniform_ring_frame_size = 1ull * 1024 * 1024;
+        // Record runtime uploads on a transfer only queue family when the device has one
+        bool enable_transfer_queue = true;
+        // Bake environment maps on a compute only queue family when the device has one, so a new environment does not
+        // hold up the frames
+        bool enable_compute_queue = true;
+        // Equirectangular HDR the image based lighting starts with
+        std::string environment_path = "../assets/skybox/Desert/desert.hdr";
+        // Device memory report per category and owning asset, written at shutdown as .csv or .json, empty disables it
+        std::string memory_report_path = "memory_report.json";
+        // Warn when a heap goes over its budget, or device local memory over memory_budget_limit if that is not 0
+        bool enable_memory_budget_warning = true;
+        VkDeviceSize memory_budget_limit = 0;
+        // Replay the scene from cached secondary command buffers, false records them again every frame
+        bool enable_static_command_buffers = true;
+        // Threads recording scene draws besides the main thread, -1 uses one less than the core count
+        int32_t recording_threads = -1;
+        // Cull opaque and masked primitives in a compute pass and draw them indirectly, needs multiDrawIndirect and the
+        // draw_cull shaders compiled by shaders/culling/compile_shader.bat
+        bool enable_gpu_culling = false;
+        // Draw what was visible last frame first and test the rest against its depth, needs GPU culling and the
+        // depth_reduce shader compiled by shaders/culling/compile_shader.bat
+        bool enable_occlusion_culling = false;
+        // Lay down the depth of opaque and masked draws first so the PBR shader runs about once per pixel, pays off on
+        // scenes with a lot of overdraw. Needs the depth shaders compiled by shaders/pbr_ibl/compile_shader.bat
+        bool enable_depth_prepass = false;
+        // Bind every scene texture through one descriptor indexed array instead of a descriptor set per material, needs the
+        // Vulkan 1.2 descriptor indexing features and the bindless shaders compiled by shaders/pbr_ibl/compile_shader.bat.
+        // Capacity is clamped to the device's update after bind limits
+        bool enable_bindless_textures = false;
+        uint32_t bindless_texture_capacity = 4096;
+        // Pipeline cache kept between runs, loaded at startup and written at shutdown, empty disables it
+        std::string pipeline_cache_path = "pipeline_cache.bin";
+        // Threads compiling pipelines during setup, -1 uses one less than the hardware threads, 0 compiles on the main thread
+        int32_t pipeline_compile_threads = -1;
+        // Draw every material with scene pipelines specialized for the textures and paths it uses, one variant per
+        // combination of material features in the scene. A variant is compiled when a material first draws with it, the
+        // generic pipelines draw the material until then
+        bool enable_material_variants = true;
     };
 
     struct ObjectMaterial {
@@ -66,10 +146,15 @@ namespace Diffuse {
         // Constructor: Initializes Vulkan instances and creates a window
         GraphicsDevice(Config config = {});
         void Setup(std::shared_ptr<Scene> scene);
+        void CreateSkyboxPipeline();
+        // The environment map is written into the skybox sets when a bake is acquired
         void SetupSkybox(std::shared_ptr<Skybox> skybox);
-        void SetupIBL();
-        void SetupIBLCubemaps(std::shared_ptr<Scene> scene);
-        void GenerateBRDF_LUT();
+        void GenerateBRDF_LUT(RenderGraph& graph);
+        // Bakes the environment, irradiance and prefiltered cubemaps of the equirectangular HDR at path. The frames go on
+        // with the current environment and switch to the new one in the first frame after the bake finished
+        void LoadEnvironment(const std::string& path);
+        // Switches to a finished bake, at most once every frames in flight so the spare descriptor sets are unused
+        void AcquireEnvironment(VkCommandBuffer command_buffer);
         void SetupSceneData();
 
         // Getters
@@ -79,19 +164,75 @@ namespace Diffuse {
         const VkCommandPool& CommandPool() const { return m_command_pool; }
         const VkPhysicalDevice& PhysicalDevice() const { return m_physical_device; }
         const VkSurfaceKHR& Surface() const { return m_surface; }
+        TextureStreamer* GetTextureStreamer() const { return m_texture_streamer.get(); }
+        TextureRegistry* GetTextureRegistry() const { return m_texture_registry.get(); }
+        TexturePacker* GetTexturePacker() const { return m_texture_packer.get(); }
+        VulkanObjectCache* GetObjectCache() const { return m_object_cache.get(); }
+        VkPipelineCache GetPipelineCache() const { return m_pipeline_cache->Get(); }
+        PipelineCompiler* GetPipelineCompiler() const { return m_pipeline_compiler.get(); }
+        MemoryAllocator* GetMemoryAllocator() const { return m_memory_allocator.get(); }
+        GeometryPool* GetGeometryPool() const { return m_geometry_pool.get(); }
+        UniformRing* GetUniformRing() const { return m_uniform_ring.get(); }
+        UploadQueue* GetUploadQueue() const { return m_upload_queue.get(); }
+        DeletionQueue* GetDeletionQueue() const { return m_deletion_queue.get(); }
+        FrameTimer* GetFrameTimer() const { return m_frame_timer.get(); }
+        RenderQueue* GetRenderQueue() const { return m_render_queue.get(); }
+        EnvironmentBaker* GetEnvironmentBaker() const { return m_environment_baker.get(); }
+        // The environment the frames sample, empty until the first bake was acquired
+        const EnvironmentBaker::Environment& GetEnvironment() const { return m_environment; }
+        // nullptr when GPU culling is disabled or the device lacks multiDrawIndirect
+        GpuCuller* GetGpuCuller() const { return m_gpu_culler.get(); }
+        // nullptr without occlusion culling or when the depth format cannot be sampled
+        DepthPyramid* GetDepthPyramid() const { return m_depth_pyramid.get(); }
+        // nullptr when bindless textures are disabled or the device lacks descriptor indexing
+        BindlessTextures* GetBindlessTextures() const { return m_bindless_textures.get(); }
+        struct CullStats {
+            uint64_t objects = 0;
+            uint64_t objects_culled = 0;    // Outside the frustum or not flagged for rendering
+            uint64_t bvh_nodes = 0;         // Scene hierarchy nodes the frustum query visited
+            uint64_t primitives = 0;
+            uint64_t primitives_culled = 0;
+        };
+        // Counts of the last frame, primitives of culled objects are not counted. With GPU culling only blended primitives
+        // are culled on the CPU, GpuCuller::GetStats has the rest
+        const CullStats& GetCullStats() const { return m_cull_stats; }
+        uint32_t GetFramesInFlight() const { return m_render_ahead; }
+
+        // Writes the device memory report now, to path or the configured memory_report_path
+        bool WriteMemoryReport(const std::string& path = {}) const;
 
         void Draw(std::shared_ptr<Scene> scene, std::shared_ptr<EditorCamera> camera, float dt);
-        void DrawNode(const std::shared_ptr<SceneObject> object, Node* node, VkCommandBuffer commandBuffer, Material::AlphaMode alpha_mode);
-        void DrawNodeSkybox(Node* node, VkCommandBuffer commandBuffer);
+        // Adds the node's primitives to the draw candidates and their world space boxes to the culler, view gives their depth
+        void GatherNode(const std::shared_ptr<SceneObject>& object, Node* node, const glm::mat4& view);
+        void GatherPrimitive(const std::shared_ptr<SceneObject>& object, Primitive* primitive, const glm::mat4& view);
+        // Scene pipeline of the material's draws, the generic one while the material's variant is still compiling
+        VkPipeline SelectPipeline(const Material& material, RenderQueue::Pass& pass);
+        // Pipeline of the material's draws in the depth pre-pass, VK_NULL_HANDLE for blended materials or without the pre-pass
+        VkPipeline SelectDepthPipeline(const Material& material) const;
+        // Hands the opaque and masked primitives of the scene to the GPU culler, blended ones stay sorted on the CPU
+        void BuildGpuDraws(const std::shared_ptr<Scene>& scene);
+        void DrawNodeSkybox(const Model& model, Node* node, VkCommandBuffer commandBuffer);
 
-        void CreateVertexBuffer(VkBuffer& vertex_buffer, VkDeviceMemory& vertex_buffer_memory, uint32_t buffer_size, const Vertex* vertices);
-        void CreateIndexBuffer(VkBuffer& index_buffer, VkDeviceMemory& index_buffer_memory, uint32_t buffer_size, const uint32_t* indices);
-        void CreateUniformBuffer(const std::shared_ptr<Scene> scene);
 
         void DeleteUniformBuffers(const std::shared_ptr<Scene> scene);
 
         void RecordCommandBuffer(std::shared_ptr<Scene> scene, std::shared_ptr<EditorCamera> camera, VkCommandBuffer command_buffer, uint32_t image_index);
-        void CreateGraphicsPipeline();
+        // Records draw_count sorted draws from first_draw into a secondary command buffer inside the render pass, the first
+        // chunk also records the GPU culled draws of gpu_phase before them and the skybox unless it is the late phase.
+        // Thread safe as long as every thread records into a command buffer of a different pool
+        RenderQueue::Stats RecordScene(std::shared_ptr<Scene> scene, VkCommandBuffer command_buffer, uint32_t first_draw, uint32_t draw_count, bool first_chunk,
+            GpuCuller::Phase gpu_phase);
+        // Records the depth pre-pass of the same draws, every chunk's pre-pass has to execute before any chunk's draws
+        RenderQueue::Stats RecordDepthPrepass(std::shared_ptr<Scene> scene, VkCommandBuffer command_buffer, uint32_t first_draw, uint32_t draw_count, bool first_chunk,
+            GpuCuller::Phase gpu_phase);
+        // Viewport, scissor and the geometry pool's buffers for a secondary scene command buffer
+        void BeginSceneCommands(VkCommandBuffer command_buffer);
+        // Everything a static command buffer bakes in, a different signature means it has to be recorded again
+        void BuildStaticSignature(const std::shared_ptr<Scene>& scene, std::vector<uint64_t>& signature) const;
+        // Scene pipelines specialized for the material features, GENERIC builds the unspecialized ones and the depth pre-pass
+        void CreateGraphicsPipeline(uint32_t features = MaterialFeatures::GENERIC);
+        // Assigns every material its variant features and prints the estimated savings
+        void SetupMaterialVariants(const std::shared_ptr<Scene>& scene);
 
         VkCommandBuffer CreateCommandBuffer(VkCommandBufferLevel level, bool begin = false)
         {
@@ -159,6 +300,10 @@ namespace Diffuse {
         // Cleanup
         void CleanUp(const Config& config = {});
         void CleanUpSwapchain();
+        void CreatePresentSemaphores();
+        // Secondary command buffers per frame slot, framebuffer and recording chunk, recreated with the swapchain
+        void CreateStaticCommandBuffers();
+        void FreeStaticCommandBuffers();
 
         //friend class Model;
         //friend class Texture2D;
@@ -173,21 +318,22 @@ namespace Diffuse {
         VkImage                         m_depth_image;
         VkRect2D                        m_frame_rect;
         VkDevice                        m_device;
-        VkSampler                       m_compute_sampler;
-        VkSampler                       m_skybox_sampler;
-        VkSampler                       m_brdf_sampler;
         VkInstance                      m_instance;
         VkImageView                     m_depth_image_view;
+        VkFormat                        m_depth_format = VK_FORMAT_UNDEFINED;
         VkSubmitInfo                    m_submit_info;
         VkSurfaceKHR                    m_surface;
         VkRenderPass                    m_render_pass;
+        // Compatible with m_render_pass, with occlusion culling the early pass keeps the depth for the pyramid and the
+        // late pass continues on the attachments
+        VkRenderPass                    m_early_render_pass = VK_NULL_HANDLE;
+        VkRenderPass                    m_late_render_pass = VK_NULL_HANDLE;
         VkRenderPass                    m_offscreen_render_pass;
         VkCommandPool                   m_command_pool;
         VkDeviceMemory                  m_index_buffer_memory;
         VkDeviceMemory                  m_depth_image_memory;
         std::unique_ptr<Swapchain>      m_swapchain;
         VkDeviceMemory                  m_vertex_buffer_memory;
-        VkPipelineCache                 m_pipeline_cache;
         //VkPipelineLayout                m_pipeline_layout;
         VkPhysicalDevice                m_physical_device;
         std::vector<void*>              m_uniform_buffers_mapped;
@@ -204,12 +350,37 @@ namespace Diffuse {
         //std::unordered_map<std::string, VkPipeline> pipelines;
         //VkPipeline boundPipeline;
         std::shared_ptr<Scene> m_active_scene;
-
-        struct SpecularFilterPushConstants
-        {
-            uint32_t level;
-            float roughness;
-        };
+        std::unique_ptr<TextureStreamer> m_texture_streamer;
+        std::unique_ptr<TextureRegistry> m_texture_registry;
+        std::unique_ptr<TexturePacker> m_texture_packer;
+        std::unique_ptr<VulkanObjectCache> m_object_cache;
+        std::unique_ptr<PipelineCache> m_pipeline_cache;
+        std::unique_ptr<PipelineCompiler> m_pipeline_compiler;
+        std::unique_ptr<MemoryAllocator> m_memory_allocator;
+        std::unique_ptr<GeometryPool> m_geometry_pool;
+        std::unique_ptr<UniformRing> m_uniform_ring;
+        std::unique_ptr<UploadQueue> m_upload_queue;
+        std::unique_ptr<DeletionQueue> m_deletion_queue;
+        std::unique_ptr<FrameTimer> m_frame_timer;
+        std::unique_ptr<RenderQueue> m_render_queue;
+        VkQueue m_transfer_queue = VK_NULL_HANDLE;
+        uint32_t m_transfer_family = 0;
+        VkQueue m_compute_queue = VK_NULL_HANDLE;
+        uint32_t m_compute_family = 0;
+        std::unique_ptr<EnvironmentBaker> m_environment_baker;
+        EnvironmentBaker::Environment m_environment;
+        std::string m_environment_path;
+        uint64_t m_environment_generation = 0;    // Acquired environments, the static command buffers bake in their sets
+        uint64_t m_environment_frame = 0;         // Frame number of the last switch
+        uint32_t m_api_version = VK_API_VERSION_1_0;
+        // Vulkan 1.2 features enabled on the device, all false on a 1.0 instance or device
+        VkPhysicalDeviceVulkan12Features m_features12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+        uint32_t m_shader_values_offset = 0;    // Shared by every object, pushed once per frame
+        std::string m_memory_report_path;
+        bool m_memory_budget_warning = false;
+        VkDeviceSize m_memory_budget_limit = 0;
+        uint64_t m_frame_number = 0;
+        std::chrono::high_resolution_clock::time_point m_startup_start;    // Reported with the pipeline cache state after Setup
 
         enum PBRWorkflows { PBR_WORKFLOW_METALLIC_ROUGHNESS = 0, PBR_WORKFLOW_SPECULAR_GLOSINESS = 1 };
 
@@ -218,6 +389,12 @@ namespace Diffuse {
             glm::vec4 emissiveFactor;
             glm::vec4 diffuseFactor;
             glm::vec4 specularFactor;
+            // Atlas tile scale (xy) and offset (zw) of each texture, (1, 1, 0, 0) when not packed
+            glm::vec4 baseColorAtlasRect;
+            glm::vec4 physicalDescriptorAtlasRect;
+            glm::vec4 normalAtlasRect;
+            glm::vec4 occlusionAtlasRect;
+            glm::vec4 emissiveAtlasRect;
             float workflow;
             int colorTextureSet;
             int PhysicalDescriptorTextureSet;
@@ -229,6 +406,12 @@ namespace Diffuse {
             float alphaMask;
             float alphaMaskCutoff;
             float emissiveStrength;
+            // Elements of the bindless texture array, -1 when material textures are bound per material
+            int baseColorTexture = -1;
+            int physicalDescriptorTexture = -1;
+            int normalTexture = -1;
+            int occlusionTexture = -1;
+            int emissiveTexture = -1;
         };
 
         struct DescriptorPools {
@@ -239,7 +422,6 @@ namespace Diffuse {
         struct DescriptorSetLayouts {
             VkDescriptorSetLayout model;
             VkDescriptorSetLayout skybox;
-            VkDescriptorSetLayout compute;
             VkDescriptorSetLayout env_texuture;
             VkDescriptorSetLayout material;
             VkDescriptorSetLayout node;
@@ -251,40 +433,42 @@ namespace Diffuse {
             VkPipelineLayout scene;
             VkPipelineLayout ibl;
             VkPipelineLayout skybox;
-            VkPipelineLayout compute;
             VkPipelineLayout env_texuture;
         } m_pipeline_layouts;
         struct Pipelines {
             VkPipeline pbr;
             VkPipeline alpha_blending;
             VkPipeline double_sided;
+            // Depth pre-pass, position only for opaque materials and with the alpha test for masked ones
+            VkPipeline depth_prepass = VK_NULL_HANDLE;
+            VkPipeline depth_prepass_double_sided = VK_NULL_HANDLE;
+            VkPipeline depth_prepass_mask = VK_NULL_HANDLE;
+            VkPipeline depth_prepass_mask_double_sided = VK_NULL_HANDLE;
             VkPipeline skybox;
-            VkPipeline compute;
             VkPipeline env_texuture;
         } m_pipelines;
+        struct PipelineVariant {
+            VkPipeline pbr = VK_NULL_HANDLE;
+            VkPipeline alpha_blending = VK_NULL_HANDLE;
+            VkPipeline double_sided = VK_NULL_HANDLE;
+            std::vector<PipelineCompiler::Ticket> pending;    // Empty once the pipelines above are compiled
+        };
+        std::unordered_map<uint32_t, PipelineVariant> m_pipeline_variants;    // By MaterialFeatures, created on first use
+        uint64_t m_variant_generation = 0;    // Compiled variants, the static command buffers bake in their pipelines
+        // Starts compiling the variant on its first use, nullptr until all its pipelines are compiled
+        const PipelineVariant* GetPipelineVariant(uint32_t features);
 
         struct DescriptorSets {
-            std::vector<VkDescriptorSet> scene;
+            std::vector<VkDescriptorSet> scene;    // Per frame slot, the object UBO set every material shares with bindless textures
             VkDescriptorSet skybox;
-            VkDescriptorSet compute;
             VkDescriptorSet env_texuture;
             VkDescriptorSet ibl;
+            // The next environment is written into these while frames in flight may still use the current ones
+            VkDescriptorSet skybox_spare;
+            VkDescriptorSet ibl_spare;
             VkDescriptorSet materialBuffer;
         } m_descriptor_sets;
 
-        struct Cubemap {
-            VkImageView view;
-            VkImage image;
-            VkDeviceMemory memory;
-            VkSampler sampler;
-            VkImageLayout layout;
-            uint32_t mipLevels = 0;
-            VkDescriptorImageInfo descriptor;
-        };
-
-        Cubemap m_Irradiance_cubemap;
-        Cubemap m_Prefilter_cubemap;
-
         struct {
             VkImageView view;
             VkImage image;
@@ -295,41 +479,64 @@ namespace Diffuse {
             VkDescriptorImageInfo descriptor;
         } m_brdf_lut;
 
-        struct {
-            VkImageView view;
-            VkImage image;
-            VkDeviceMemory memory;
-            VkSampler sampler;
-            VkImageLayout layout;
-        } m_cubemap;
-
-        struct {
-            VkImageView view;
-            VkImage image;
-            VkDeviceMemory memory;
-            VkSampler sampler;
-            VkImageLayout layout;
-        } m_env_texuture;
-
         //struct {
         //    VkImageView view;
         //    VkImage image;
         //    VkDeviceMemory memory;
         //} m_offscreen;
         //std::array<VkImageView, 6> m_cubemap_face_image_views;
-        VkSampler computeSampler;
 
         std::vector<VkFence> m_wait_fences;
         std::vector<VkCommandBuffer> commandBuffers;
-        std::vector<VkSemaphore> m_render_complete_semaphores;
-        std::vector<VkSemaphore> m_present_complete_semaphores;
+        struct StaticCommands {
+            std::vector<VkCommandBuffer> command_buffers;    // One per recording chunk, from the slot's pool of that chunk
+            std::vector<VkCommandBuffer> depth_command_buffers;    // Depth pre-pass of each chunk, from the same pools
+            VkCommandBuffer early = VK_NULL_HANDLE;           // Early occlusion phase, from the pool of the first chunk
+            uint32_t chunk_count = 0;                         // Chunks the scene was last recorded in
+            uint32_t frame_index = 0;
+            std::vector<uint64_t> signature;
+            bool valid = false;
+        };
+        static constexpr uint32_t s_min_draws_per_chunk = 256;    // Fewer draws are not worth handing to another thread
+        bool m_enable_static_commands = true;
+        bool m_gpu_culling = false;    // Enabled and the device has multiDrawIndirect
+        bool m_depth_prepass = false;
+        bool m_material_variants = false;
+        uint32_t m_bindless_capacity = 0;    // Elements of the bindless texture array, 0 without bindless textures
+        std::unique_ptr<Utils::WorkerPool> m_worker_pool;
+        std::vector<VkCommandPool> m_recording_pools;     // frame slot * worker count + chunk
+        std::vector<StaticCommands> m_static_commands;    // frame slot * framebuffer count + framebuffer
+        std::vector<uint64_t> m_static_signature;
+
+        struct DrawCandidate {
+            DrawItem item;
+            RenderQueue::Pass pass;
+            float depth;
+        };
+        std::unique_ptr<FrustumCuller> m_culler;
+        std::unique_ptr<GpuCuller> m_gpu_culler;
+        std::unique_ptr<DepthPyramid> m_depth_pyramid;
+        std::unique_ptr<RenderGraph> m_frame_graph;    // Rebuilt every frame from imported resources
+        std::unique_ptr<BindlessTextures> m_bindless_textures;
+        std::vector<std::vector<Primitive*>> m_blend_primitives;    // Per scene object, while the GPU culls the rest
+        std::vector<uint32_t> m_visible_object_ids;
+        std::vector<std::shared_ptr<SceneObject>> m_visible_objects;
+        std::vector<DrawCandidate> m_draw_candidates;    // Indexed like the culler's boxes
+        uint64_t m_object_visibility_hash = 0;
+        CullStats m_cull_stats;
+        CullStats m_cull_totals;
+        uint64_t m_cull_frames = 0;
+        uint64_t m_static_frames = 0;
+        uint64_t m_static_records = 0;
+        std::vector<VkSemaphore> m_render_complete_semaphores;     // Per frame slot, signaled by image acquisition
+        std::vector<VkSemaphore> m_present_complete_semaphores;    // Per swapchain image, waited on by presentation
 
         // Other variables
         uint32_t m_current_frame_index = 0;
+        static constexpr uint32_t s_max_frames_in_flight = 3;
         uint32_t m_render_ahead = 1;
         //bool m_framebuffer_resized = false;
         uint32_t m_render_samples = 0;
-        Texture2D* hdr;
         bool only_once = false;
         uint32_t offscreen_size = 1024;
         uint32_t prefilter_mips = 1.0;
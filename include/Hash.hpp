@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace Utils {
+	struct Hash128 {
+		uint64_t low = 0;
+		uint64_t high = 0;
+
+		bool operator==(const Hash128& other) const { return low == other.low && high == other.high; }
+		bool operator!=(const Hash128& other) const { return !(*this == other); }
+	};
+
+	class Hash {
+	public:
+		// MurmurHash3 x64 128 bit variant, fast and well distributed for content addressing (not cryptographic)
+		static Hash128 Murmur3_128(const void* data, size_t size, uint64_t seed = 0);
+	};
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "Model.hpp"
+
+#include <cstdint>
+
+namespace Diffuse {
+
+	// The material paths of pbr.frag a pipeline variant keeps. The bits match the FEATURE_ constants of the shader, which
+	// gets them as specialization constants, so the tests on the material resolve at pipeline creation and the paths of
+	// missing features compile out. GENERIC is the unspecialized pipeline that tests the material for every fragment.
+	struct MaterialFeatures {
+		enum Bits : uint32_t {
+			BASE_COLOR_TEXTURE = 1 << 0,
+			PHYSICAL_DESCRIPTOR_TEXTURE = 1 << 1,    // Metallic roughness or specular glossiness
+			NORMAL_TEXTURE = 1 << 2,
+			OCCLUSION_TEXTURE = 1 << 3,
+			PACKED_OCCLUSION = 1 << 4,               // Occlusion in the red channel of the metallic roughness texture
+			EMISSIVE_TEXTURE = 1 << 5,
+			ALPHA_MASK = 1 << 6,
+			SPECULAR_GLOSSINESS = 1 << 7,
+		};
+		static constexpr uint32_t GENERIC = ~0u;
+
+		// Per fragment work of pbr.frag for a material, estimated from the shader's structure
+		struct Cost {
+			uint32_t texture_fetches = 0;
+			uint32_t branches = 0;    // Tests on the material evaluated at runtime
+		};
+
+		// Textures equal to fallback stand in for missing ones and count as absent. With a null fallback the result is
+		// what the generic pipeline sees in the shader material
+		static uint32_t Get(const Material& material, const Texture2D* fallback);
+		// specialized: a variant built for the features, otherwise the generic pipeline shading a material with them
+		static Cost Estimate(uint32_t features, bool specialized);
+	};
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Diffuse {
+
+	// What an allocation is used for, every allocation is reported under one
+	enum class MemoryCategory : uint8_t { Other, Geometry, Texture, IBL, Uniform, Staging, Attachment, Count };
+	const char* MemoryCategoryName(MemoryCategory category);
+
+	// Sub-allocates buffers and images from large VkDeviceMemory blocks.
+	// Each block is managed by a two level segregated fit (TLSF) allocator, so finding and freeing a range is O(1).
+	// Buffers and optimal tiling images never share a block, which keeps bufferImageGranularity from ever applying.
+	// Resources at or above the dedicated threshold get a VkDeviceMemory of their own. Host visible blocks stay mapped.
+	// Allocations are looked up by their buffer or image handle, so callers only keep the handle.
+	// Each allocation is tagged with the category and owning asset of the innermost Tag alive on the allocating thread,
+	// which feeds the per asset residency report and the budget checks against VK_EXT_memory_budget.
+	class MemoryAllocator {
+	public:
+		// Tags the allocations made on this thread while alive. Tags nest, an empty asset keeps the enclosing one
+		class Tag {
+		public:
+			Tag(MemoryCategory category, const std::string& asset = {});
+			~Tag();
+			Tag(const Tag&) = delete;
+			Tag& operator=(const Tag&) = delete;
+
+			static MemoryCategory Category();
+			static const std::string& Asset();
+		private:
+			MemoryCategory m_category;
+			std::string m_asset;
+			const Tag* m_previous;
+			static thread_local const Tag* s_current;
+		};
+
+		struct HeapBudget {
+			bool device_local = false;
+			VkDeviceSize size = 0;
+			VkDeviceSize budget = 0;       // What the process can use without the OS or driver degrading it
+			VkDeviceSize usage = 0;        // Process wide usage, including memory not allocated through this allocator
+			VkDeviceSize allocated = 0;    // Device memory objects owned by this allocator
+		};
+
+		struct Stats {
+			uint32_t blocks = 0;
+			uint32_t dedicated = 0;
+			uint32_t allocations = 0;
+			VkDeviceSize block_bytes = 0;
+			VkDeviceSize used_bytes = 0;
+			VkDeviceSize dedicated_bytes = 0;
+			// Defragmentation
+			uint32_t free_ranges = 0;
+			VkDeviceSize largest_free_range = 0;
+			uint32_t movable_allocations = 0;    // Allocations behind the first hole of their block, what a compaction would move
+			float fragmentation = 0.0f;          // 1 - largest free range / free bytes
+		};
+
+		// memory_budget: VK_EXT_memory_budget is enabled on device (with vkGetPhysicalDeviceMemoryProperties2 available)
+		MemoryAllocator(VkDevice device, VkPhysicalDevice physical_device, VkDeviceSize block_size, bool memory_budget);
+		~MemoryAllocator();
+
+		// The allocator created for device, used by the vkUtilities helpers that only get the device
+		static MemoryAllocator* Get(VkDevice device);
+
+		// Allocates and binds memory, memory receives the backing VkDeviceMemory which must not be freed by the caller
+		void BindBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, VkDeviceMemory* memory = nullptr);
+		void BindImage(VkImage image, VkMemoryPropertyFlags properties, VkDeviceMemory* memory = nullptr);
+		// Images never in use at the same time share one allocation sized and aligned for the largest. Each is freed on
+		// its own, the memory returns when the last one is
+		void BindAliased(const std::vector<VkImage>& images, VkMemoryPropertyFlags properties);
+		void Free(VkBuffer buffer);
+		void Free(VkImage image);
+
+		// Persistently mapped pointer to the start of a host visible buffer
+		void* GetMapped(VkBuffer buffer) const;
+		VkResult Flush(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) const;
+		VkResult Invalidate(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) const;
+
+		// Per heap budget and usage, estimated as 80% of the heap and this allocator's own memory without VK_EXT_memory_budget
+		std::vector<HeapBudget> QueryBudget() const;
+		// Returns true when a heap is over its budget, or device local usage over device_local_limit if that is not 0.
+		// Prints a warning each time the budget is crossed
+		bool CheckBudget(VkDeviceSize device_local_limit);
+		// Writes usage per heap, category and asset, as CSV if path ends in .csv and JSON otherwise
+		bool WriteReport(const std::string& path) const;
+
+		Stats GetStats() const;
+		void PrintStats() const;
+		void CleanUp();
+	private:
+		static constexpr uint32_t s_sl_bits = 4;
+		static constexpr uint32_t s_sl_count = 1u << s_sl_bits;
+		static constexpr uint32_t s_fl_count = 64;
+		static constexpr VkDeviceSize s_min_chunk = 256;
+
+		enum class Kind { Linear, Optimal };
+
+		struct Chunk {
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+			bool free = true;
+			Chunk* prev_phys = nullptr;
+			Chunk* next_phys = nullptr;
+			Chunk* prev_free = nullptr;
+			Chunk* next_free = nullptr;
+		};
+
+		struct Block {
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize size = 0;
+			uint32_t memory_type = 0;
+			Kind kind = Kind::Linear;
+			unsigned char* mapped = nullptr;
+			uint32_t allocations = 0;
+			Chunk* first = nullptr;
+			uint64_t fl_bitmap = 0;
+			std::array<uint32_t, s_fl_count> sl_bitmap{};
+			std::array<std::array<Chunk*, s_sl_count>, s_fl_count> heads{};
+		};
+
+		struct Allocation {
+			Block* block = nullptr;    // nullptr for dedicated allocations
+			Chunk* chunk = nullptr;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			VkDeviceSize offset = 0;
+			VkDeviceSize size = 0;
+			unsigned char* mapped = nullptr;
+			bool coherent = true;
+			uint32_t memory_type = 0;
+			MemoryCategory category = MemoryCategory::Other;
+			uint32_t asset = 0;        // Index into m_assets
+			uint64_t alias_group = 0;  // Shared with the images aliasing the memory, 0 when not aliased
+		};
+
+		// Non-dispatchable handles of different object types may have the same value
+		struct HandleKey {
+			VkObjectType type;
+			uint64_t handle;
+			bool operator==(const HandleKey& other) const { return type == other.type && handle == other.handle; }
+		};
+		struct HandleKeyHash {
+			size_t operator()(const HandleKey& key) const { return static_cast<size_t>(key.handle * 0x9e3779b97f4a7c15ull) ^ static_cast<size_t>(key.type); }
+		};
+		static HandleKey KeyOf(VkBuffer buffer) { return { VK_OBJECT_TYPE_BUFFER, (uint64_t)buffer }; }
+		static HandleKey KeyOf(VkImage image) { return { VK_OBJECT_TYPE_IMAGE, (uint64_t)image }; }
+
+		Allocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, Kind kind);
+		void Release(const HandleKey& key);
+		Block* CreateBlock(uint32_t memory_type, Kind kind, VkDeviceSize size);
+		void DestroyBlock(Block* block);
+		bool AllocateFromBlock(Block* block, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation);
+		void FreeChunk(Block* block, Chunk* chunk);
+
+		static void Mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl);
+		void InsertFree(Block* block, Chunk* chunk);
+		void RemoveFree(Block* block, Chunk* chunk);
+		Chunk* FindFree(Block* block, VkDeviceSize size);
+
+		VkResult FlushOrInvalidate(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, bool flush) const;
+		uint32_t FindMemoryType(uint32_t type_bits, VkMemoryPropertyFlags properties) const;
+		void Track(const HandleKey& key, Allocation& allocation);
+	private:
+		VkDevice m_device;
+		VkPhysicalDevice m_physical_device;
+		bool m_memory_budget;
+		bool m_over_budget = false;
+		VkPhysicalDeviceMemoryProperties m_memory_properties;
+		VkDeviceSize m_block_size;
+		VkDeviceSize m_dedicated_threshold;
+		VkDeviceSize m_non_coherent_atom_size;
+		uint32_t m_max_allocation_count;
+		uint32_t m_device_allocations = 0;
+
+		mutable std::mutex m_mutex;
+		std::vector<std::unique_ptr<Block>> m_blocks;
+		std::unordered_map<HandleKey, Allocation, HandleKeyHash> m_allocations;
+		std::vector<std::string> m_assets;    // Owning assets of allocations, interned
+		std::unordered_map<std::string, uint32_t> m_asset_ids;
+		std::unordered_map<uint64_t, uint32_t> m_alias_refs;    // Images still bound per alias group
+		uint64_t m_alias_groups = 0;
+	};
+}
@@ -8,6 +8,7 @@
 #include "glm/gtc/type_ptr.hpp"
 #include "vulkan/vulkan.hpp"
 #include "vulkan/vulkan.h"
+#include <cfloat>
 #include <iostream>
 
 namespace Diffuse {
@@ -71,10 +72,44 @@ namespace Diffuse {
 			bool metallicRoughness = true;
 			bool specularGlossiness = false;
 		} pbrWorkflows;
-		VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+		// One per frame in flight, so streamed textures can be rewritten while other frames still read the old image
+		std::vector<VkDescriptorSet> descriptorSets;
 		int index = 0;
 		bool unlit = false;
 		float emissiveStrength = 1.0f;
+		// Occlusion is read from the red channel of the metallic roughness texture
+		bool occlusionInMetallicRoughness = false;
+		// MaterialFeatures of the pipeline variant it is drawn with, ~0 for the generic pipeline
+		uint32_t shaderFeatures = ~0u;
+	};
+
+	struct BoundingBox {
+		glm::vec3 min = glm::vec3(FLT_MAX);
+		glm::vec3 max = glm::vec3(-FLT_MAX);
+		bool valid = false;
+		void Expand(const glm::vec3& p) { min = glm::min(min, p); max = glm::max(max, p); valid = true; }
+		glm::vec3 Center() const { return (min + max) * 0.5f; }
+		glm::vec3 Extent() const { return (max - min) * 0.5f; }
+		// Returns the world space box enclosing this box transformed by the given matrix
+		BoundingBox Transform(const glm::mat4& m) const {
+			BoundingBox result;
+			if (!valid) return result;
+			glm::vec3 center = glm::vec3(m * glm::vec4(Center(), 1.0f));
+			glm::vec3 extent = Extent();
+			glm::vec3 world_extent = glm::abs(glm::vec3(m[0])) * extent.x + glm::abs(glm::vec3(m[1])) * extent.y + glm::abs(glm::vec3(m[2])) * extent.z;
+			result.min = center - world_extent;
+			result.max = center + world_extent;
+			result.valid = true;
+			return result;
+		}
+	};
+
+	// Range a model occupies in the device's GeometryPool, counted in vertices and indices
+	struct GeometryAllocation {
+		uint32_t vertex_offset = 0;
+		uint32_t vertex_count = 0;
+		uint32_t first_index = 0;
+		uint32_t index_count = 0;
 	};
 
 	struct Primitive {
@@ -83,6 +118,9 @@ namespace Diffuse {
 		uint32_t vertex_count = 0;
 		int material_index;
 		bool has_indices = false;
+		BoundingBox bb;
+		// Texture coordinate units per object space unit for uv set 0 and 1, used to estimate texel density on screen
+		float uv_density[2] = { 0.0f, 0.0f };
 		Primitive(uint32_t _first_index, uint32_t _index_count, uint32_t _vertex_count, int index)
 			:first_index(_first_index), index_count(_index_count), vertex_count(_vertex_count), material_index(index) {}
 	};
@@ -126,28 +164,34 @@ namespace Diffuse {
 		void Load(const std::string& path, GraphicsDevice* device);
 		void GetNodeProps(const tinygltf::Node& node, const tinygltf::Model& model, uint32_t& vertex_count, uint32_t& index_count);
 		void LoadNode(Node* parent, const tinygltf::Node& node, uint32_t node_index, const tinygltf::Model& model);
-		void LoadMaterials(tinygltf::Model model);
+		// textures is indexed like model.textures
+		void LoadMaterials(tinygltf::Model& model, const std::vector<Texture2D*>& textures);
 
 		const std::vector<Node*> GetNodes() const { return m_nodes; }
 		const std::vector<Node*> GetLinearNodes() const { return m_linear_nodes; }
 		const std::vector<Material>& GetMaterials() const { return m_materials; }
 		const Material& GetMaterial(int i) const { return m_materials[i]; }
 		Material& GetMaterial(int i) { return m_materials[i]; }
+		// Shared through the device's TextureRegistry, one reference per entry, never nullptr
+		const std::vector<Texture2D*>& GetTextures() const { return m_textures; }
+		// Vertices and indices live in the device's GeometryPool, primitives are drawn relative to this range
+		const GeometryAllocation& GetGeometry() const { return m_geometry; }
+		const std::string& GetPath() const { return m_path; }
+		// Object space box around all primitives
+		const BoundingBox& GetBounds() const { return m_bounds; }
 	private:
+		std::string m_path;
 		std::vector<Node*> m_nodes;
 		std::vector<Node*> m_linear_nodes;
 		std::vector<Texture2D*> m_textures;
+		std::vector<Texture2D*> m_orm_textures;    // Per glTF material, packed occlusion roughness metallic texture or nullptr
 		std::vector<TextureSampler> m_texture_samplers;
 		std::vector<Material> m_materials;
 		uint32_t* m_index_buffer;
 		Vertex* m_vertex_buffer;
 		uint32_t m_vertex_pos = 0;
 		uint32_t m_index_pos = 0;
-
-	public:
-		struct {
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-		} m_vertices, m_indices;
+		GeometryAllocation m_geometry;
+		BoundingBox m_bounds;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Diffuse {
+
+	// VkPipelineCache kept on disk between runs, so pipelines compile from the driver's cache after the first launch.
+	// The file starts with a header naming the GPU, driver version and cache UUID it was written for and a hash of the
+	// data, a file that doesn't match the current device is ignored and the cache starts cold. Save writes a temporary
+	// file next to the cache and renames it over the old one, an interrupted write never leaves a truncated cache behind.
+	class PipelineCache {
+	public:
+		// An empty path keeps the cache in memory only
+		PipelineCache(VkDevice device, VkPhysicalDevice physical_device, const std::string& path);
+
+		VkPipelineCache Get() const { return m_cache; }
+		// Data from an earlier run was loaded
+		bool IsWarm() const { return m_loaded_size > 0; }
+		size_t GetLoadedSize() const { return m_loaded_size; }
+
+		bool Save() const;
+		void CleanUp();
+	private:
+		// Written in front of the data vkGetPipelineCacheData returns
+		struct FileHeader {
+			uint32_t magic;
+			uint32_t version;
+			uint32_t vendor_id;
+			uint32_t device_id;
+			uint32_t driver_version;
+			uint8_t uuid[VK_UUID_SIZE];
+			uint64_t data_size;
+			uint64_t data_hash_low;
+			uint64_t data_hash_high;
+		};
+
+		FileHeader MakeHeader() const;
+		// Returns the cache data of the file, empty when it is missing or was written for another device or driver
+		std::vector<char> Load() const;
+	private:
+		VkDevice m_device;
+		VkPhysicalDeviceProperties m_properties;
+		std::string m_path;
+		VkPipelineCache m_cache = VK_NULL_HANDLE;
+		size_t m_loaded_size = 0;
+	};
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace Diffuse {
+
+	// Compiles pipelines on its own threads while the caller goes on with other setup work. Compile copies the create info
+	// and every state it points to, so the caller may change or drop its structures right away, and reads the SPIR-V and
+	// creates the shader modules on the compiling thread. All pipelines go through the shared pipeline cache, pNext chains
+	// of the create info and its states are not copied.
+	// A ticket is waited on by the step that needs the pipeline, WaitIdle waits for everything submitted so far.
+	class PipelineCompiler {
+	public:
+		struct ShaderStage {
+			VkShaderStageFlagBits stage;
+			std::string path;    // SPIR-V file
+			std::vector<uint32_t> constants;    // Specialization constants, constant_id i takes constants[i]
+		};
+		using Ticket = std::shared_future<VkPipeline>;
+
+		// thread_count threads compile, 0 compiles on the calling thread inside Compile
+		PipelineCompiler(VkDevice device, VkPipelineCache cache, uint32_t thread_count);
+		~PipelineCompiler();
+
+		PipelineCompiler(const PipelineCompiler&) = delete;
+		PipelineCompiler& operator=(const PipelineCompiler&) = delete;
+
+		// The stages of create_info are replaced by shaders. target, when not null, receives the pipeline once it is compiled
+		Ticket Compile(const VkGraphicsPipelineCreateInfo& create_info, const std::vector<ShaderStage>& shaders, VkPipeline* target = nullptr);
+		Ticket Compile(const VkComputePipelineCreateInfo& create_info, const ShaderStage& shader, VkPipeline* target = nullptr);
+		// Rethrows the first compile error
+		void WaitIdle();
+
+		uint32_t GetThreadCount() const { return static_cast<uint32_t>(m_threads.size()); }
+		void PrintStats() const;
+	private:
+		struct GraphicsJob;
+
+		Ticket Submit(std::function<VkPipeline()> compile, VkPipeline* target);
+		std::shared_ptr<const std::vector<char>> ReadSpirv(const std::string& path);
+		VkShaderModule CreateModule(const std::string& path);
+		VkPipeline CompileGraphics(const GraphicsJob& job);
+		void Run();
+	private:
+		VkDevice m_device;
+		VkPipelineCache m_cache;
+		std::vector<std::thread> m_threads;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::deque<std::function<void()>> m_queue;
+		std::vector<Ticket> m_pending;
+		bool m_stop = false;
+
+		std::mutex m_spirv_mutex;
+		std::unordered_map<std::string, std::shared_ptr<const std::vector<char>>> m_spirv;    // Files shared by several pipelines are read once
+
+		// Stats, under m_mutex
+		uint32_t m_compiled = 0;
+		double m_compile_ms = 0.0;    // Summed over all threads
+	};
+}
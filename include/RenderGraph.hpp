@@ -0,0 +1,216 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Passes that declare the resources they read and write, with the synchronization between them derived from the
+	// declarations. Passes run in the order they are added. Compile drops the passes nothing depends on, places transient
+	// images whose lifetimes do not overlap in the same memory and works out the barrier every subresource a pass uses
+	// needs against its previous use: the stages and accesses of that use, a layout transition where the layout differs,
+	// nothing for reads that follow reads or a write already made visible to them. All barriers of a pass are recorded
+	// with one vkCmdPipelineBarrier. Execute records the passes into one command buffer, Submit does it in one submission.
+	// Resources from outside the graph are imported in their current state. A pass can have the graph begin a VkRenderPass
+	// around it, whose attachments must start and end in the layouts of their subpass, or begin its own render pass and
+	// declare the attachments with Attachment, in which case the render pass's subpass dependencies order the accesses.
+	class RenderGraph {
+	public:
+		using Resource = uint32_t;
+
+		enum class Usage : uint8_t {
+			ColorAttachment,
+			DepthAttachment,
+			DepthRead,          // Depth sampled by compute shaders in DEPTH_STENCIL_READ_ONLY_OPTIMAL
+			FragmentSampled,
+			ComputeSampled,
+			ComputeRead,        // Storage buffers, and images in GENERAL
+			ComputeWrite,
+			TransferSrc,
+			TransferDst,
+			IndirectRead,
+			Present,
+		};
+
+		// What happened to a resource before the graph. access holds the writes not made visible yet, when it is 0 stages
+		// are the stages that last read it
+		struct State {
+			VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkPipelineStageFlags stages = 0;
+			VkAccessFlags access = 0;
+		};
+
+		// Mip levels and array layers of an image, all of them by default
+		struct Range {
+			uint32_t base_mip = 0;
+			uint32_t mip_count = VK_REMAINING_MIP_LEVELS;
+			uint32_t base_layer = 0;
+			uint32_t layer_count = VK_REMAINING_ARRAY_LAYERS;
+		};
+
+		class Pass {
+		public:
+			Pass& Read(Resource resource, Usage usage, const Range& range = {});
+			// discard: the previous contents are not needed, the image may start from an undefined layout
+			Pass& Write(Resource resource, Usage usage, const Range& range = {}, bool discard = false);
+			// An attachment of the render pass the pass begins itself. The graph only brings the image into initial_layout
+			// when that is another defined layout, the render pass's dependencies order the accesses and it leaves the image
+			// in final_layout. visible_stages and visible_access are what its dependency on VK_SUBPASS_EXTERNAL makes the
+			// attachment's writes visible to, later uses inside them need no barrier
+			Pass& Attachment(Resource resource, Usage usage, VkImageLayout initial_layout, VkImageLayout final_layout,
+				VkPipelineStageFlags visible_stages = 0, VkAccessFlags visible_access = 0);
+			// Begins render_pass around the pass, on a framebuffer of the views of the ColorAttachment and DepthAttachment
+			// images in the order they were declared
+			Pass& SetRenderPass(VkRenderPass render_pass, VkExtent2D extent, const std::vector<VkClearValue>& clear_values);
+			// Kept even when nothing reads what it writes
+			Pass& SideEffect() { m_side_effect = true; return *this; }
+		private:
+			friend class RenderGraph;
+
+			struct Access {
+				Resource resource;
+				Usage usage;
+				Range range;
+				bool write;
+				bool discard;
+				bool attachment;          // Declared with Attachment
+				VkImageLayout initial_layout;
+				VkImageLayout final_layout;
+				VkPipelineStageFlags visible_stages;
+				VkAccessFlags visible_access;
+			};
+
+			std::string m_name;
+			std::function<void(VkCommandBuffer)> m_execute;
+			std::vector<Access> m_accesses;
+			bool m_side_effect = false;
+			VkRenderPass m_render_pass = VK_NULL_HANDLE;
+			VkExtent2D m_extent{};
+			std::vector<VkClearValue> m_clear_values;
+		};
+
+		struct Stats {
+			uint32_t passes = 0;
+			uint32_t culled_passes = 0;
+			uint32_t barriers = 0;              // vkCmdPipelineBarrier calls
+			uint32_t image_barriers = 0;
+			uint32_t buffer_barriers = 0;
+			uint32_t transient_images = 0;
+			uint32_t transient_allocations = 0;
+			VkDeviceSize transient_bytes = 0;   // What the transient images would take on their own
+			VkDeviceSize allocated_bytes = 0;   // What they take aliased
+		};
+
+		explicit RenderGraph(GraphicsDevice* device);
+		~RenderGraph();
+
+		RenderGraph(const RenderGraph&) = delete;
+		RenderGraph& operator=(const RenderGraph&) = delete;
+
+		// view may be null when the image is not an attachment of a render pass the graph begins. Null handles are accepted
+		// and get no barriers
+		Resource ImportImage(const std::string& name, VkImage image, VkImageView view, VkFormat format, uint32_t mip_levels, uint32_t layers, const State& state);
+		Resource ImportBuffer(const std::string& name, VkBuffer buffer, const State& state);
+		// Created by Compile and destroyed by Reset, its contents are undefined before the first pass that writes it
+		Resource CreateImage(const std::string& name, const VkImageCreateInfo& create_info, VkImageViewType view_type);
+		// The resource is used as usage after the graph, so the passes writing it are kept and it ends in usage's layout
+		void Output(Resource resource, Usage usage);
+
+		// The reference is valid until the next AddPass
+		Pass& AddPass(const std::string& name, std::function<void(VkCommandBuffer)> execute);
+
+		void Compile();
+		// Records the passes Compile kept, outside of a render pass
+		void Execute(VkCommandBuffer command_buffer);
+		// Executes into a new command buffer, submits it to queue and waits for it
+		void Submit(VkQueue queue);
+		// Destroys the transient images and framebuffers and clears the graph for the next set of passes. The GPU must be
+		// done with them, a graph executed every frame should only import resources
+		void Reset();
+
+		// Valid after Compile
+		VkImage GetImage(Resource resource) const { return m_resources[resource].image; }
+		VkImageView GetView(Resource resource) const { return m_resources[resource].view; }
+		VkBuffer GetBuffer(Resource resource) const { return m_resources[resource].buffer; }
+
+		const Stats& GetStats() const { return m_stats; }
+		void PrintStats(const std::string& label) const;
+	private:
+		// Per mip and layer of an image, once for a buffer
+		struct SubresourceState {
+			VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+			VkPipelineStageFlags write_stages = 0;      // Last write or layout transition
+			VkAccessFlags write_access = 0;             // Not made available yet
+			VkPipelineStageFlags read_stages = 0;       // Reads since the last write
+			VkPipelineStageFlags visible_stages = 0;    // Stages and accesses the last write is visible to
+			VkAccessFlags visible_access = 0;
+		};
+
+		struct ResourceData {
+			std::string name;
+			bool transient = false;
+			bool output = false;
+			Usage output_usage = Usage::FragmentSampled;
+			VkImage image = VK_NULL_HANDLE;
+			VkImageView view = VK_NULL_HANDLE;
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkImageAspectFlags aspect = 0;
+			uint32_t mip_levels = 1;
+			uint32_t layers = 1;
+			VkImageCreateInfo create_info{};
+			VkImageViewType view_type = VK_IMAGE_VIEW_TYPE_2D;
+			std::vector<SubresourceState> states;
+			// Transient lifetime in pass indices and the image that had its memory before, ~0u when none
+			uint32_t first_pass = ~0u;
+			uint32_t last_pass = 0;
+			uint32_t alias_previous = ~0u;
+			bool alias_pending = false;    // The states still have to take over the previous image's last accesses
+		};
+
+		struct Barriers {
+			VkPipelineStageFlags src_stages = 0;
+			VkPipelineStageFlags dst_stages = 0;
+			std::vector<VkImageMemoryBarrier> images;
+			std::vector<VkBufferMemoryBarrier> buffers;
+		};
+
+		struct UsageInfo {
+			VkPipelineStageFlags stages;
+			VkAccessFlags access;
+			VkImageLayout layout;
+			bool write;
+		};
+		static UsageInfo GetUsageInfo(Usage usage);
+
+		void CullPasses();
+		void AllocateTransients();
+		void AddBarriers(Barriers& barriers, ResourceData& resource, const Range& range, VkPipelineStageFlags stages, VkAccessFlags access,
+			VkImageLayout layout, bool write, bool discard);
+		void RecordBarriers(VkCommandBuffer command_buffer, const Barriers& barriers);
+		VkFramebuffer GetFramebuffer(const Pass& pass);
+	private:
+		struct Framebuffer {
+			VkRenderPass render_pass;
+			std::vector<VkImageView> views;
+			VkExtent2D extent;
+			VkFramebuffer framebuffer;
+		};
+
+		GraphicsDevice* m_device;
+		std::vector<ResourceData> m_resources;
+		std::vector<Pass> m_passes;
+		std::vector<bool> m_live;
+		std::vector<Barriers> m_barriers;       // Per pass, before it
+		Barriers m_output_barriers;             // After the last pass
+		std::vector<VkFramebuffer> m_pass_framebuffers;
+		std::vector<Framebuffer> m_framebuffers;    // Shared by the passes beginning the same render pass on the same views
+		bool m_compiled = false;
+		Stats m_stats;
+	};
+}
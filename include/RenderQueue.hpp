@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Diffuse {
+
+	// One indexed draw together with the state it needs
+	struct DrawItem {
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkPipeline depth_pipeline = VK_NULL_HANDLE;    // Depth pre-pass, null when the draw is not part of it
+		VkDescriptorSet material_set = VK_NULL_HANDLE;
+		VkDescriptorSet object_set = VK_NULL_HANDLE;
+		uint32_t ubo_offset = 0;         // Dynamic offset of the object's UBO in the uniform ring
+		int32_t material_index = 0;      // Push constant read by the fragment shader
+		uint32_t index_count = 0;
+		uint32_t first_index = 0;
+		int32_t vertex_offset = 0;
+	};
+
+	// Gathers the frame's draws into a flat array, radix sorts them by a 64 bit key and records them, emitting
+	// pipeline, descriptor set and push constant commands only where the state differs from the previous draw.
+	// Key layout from the most significant bit:
+	//   opaque and mask: pass (2) | pipeline (8) | material (22) | depth front to back (32)
+	//   blend:           pass (2) | depth back to front (32) | pipeline (8) | material (22)
+	// Material variants are separate pipelines, so the draws of a variant come out together
+	class RenderQueue {
+	public:
+		enum Pass : uint32_t { PASS_OPAQUE = 0, PASS_MASK = 1, PASS_BLEND = 2 };
+
+		struct Stats {
+			uint32_t draws = 0;
+			uint32_t indirect_draws = 0;      // Indirect calls, each draws up to a bucket of GPU culled primitives
+			uint32_t pipeline_binds = 0;
+			uint32_t descriptor_binds = 0;    // vkCmdBindDescriptorSets calls
+			uint32_t push_constants = 0;
+
+			Stats& operator+=(const Stats& other) {
+				draws += other.draws;
+				indirect_draws += other.indirect_draws;
+				pipeline_binds += other.pipeline_binds;
+				descriptor_binds += other.descriptor_binds;
+				push_constants += other.push_constants;
+				return *this;
+			}
+		};
+
+		void Begin();
+		// view_depth is the view space distance of the draw, it orders draws with equal state and blended draws
+		void Push(Pass pass, float view_depth, const DrawItem& item);
+		void Sort();
+		// Identifies the sorted order of the pass's draws, equal when the same draws come out in the same order
+		uint64_t GetOrderHash(Pass pass) const;
+		uint32_t GetDrawCount() const { return static_cast<uint32_t>(m_sorted.size()); }
+		// Records count sorted draws starting at first. Ranges can be recorded into different command buffers on different
+		// threads, each starts from unknown state. The geometry pool's buffers must be bound. Set 0 is the material with the
+		// dynamic offsets of the object UBO and the shader values, set 1 the IBL set, set 2 the object's material buffer and
+		// set 3 the bindless texture array when texture_set is not null.
+		// With depth_prepass only the draws with a depth pipeline are recorded, with that pipeline
+		Stats Record(VkCommandBuffer command_buffer, VkPipelineLayout layout, VkDescriptorSet ibl_set, VkDescriptorSet texture_set, uint32_t shader_values_offset,
+			uint32_t first, uint32_t count, bool depth_prepass = false) const;
+		// Counters of all ranges recorded for a frame
+		void AddFrameStats(const Stats& stats);
+
+		// Counters of the last recorded frame
+		const Stats& GetFrameStats() const { return m_frame_stats; }
+		void PrintStats() const;
+	private:
+		uint32_t PipelineId(VkPipeline pipeline);
+		uint32_t MaterialId(VkDescriptorSet material_set);
+	private:
+		struct SortEntry {
+			uint64_t key;
+			uint32_t item;
+		};
+
+		std::vector<DrawItem> m_items;
+		std::vector<SortEntry> m_sorted;
+		std::vector<SortEntry> m_scratch;
+		std::vector<VkPipeline> m_pipelines;
+		std::unordered_map<VkDescriptorSet, uint32_t> m_materials;
+
+		Stats m_frame_stats;
+		Stats m_total_stats;
+		uint32_t m_frames = 0;
+	};
+}
@@ -2,6 +2,7 @@
 
 #include "Camera.hpp"
 #include "Model.hpp"
+#include "BVH.hpp"
 
 #include <vulkan/vulkan.hpp>
 
@@ -36,17 +37,10 @@ namespace Diffuse {
 		//
 		VkDescriptorSet p_mat_descritpor_set;
 
-		struct {
-			std::vector<VkBuffer> uniformBuffers;
-			std::vector<VkDeviceMemory> uniformBuffersMemory;
-			std::vector<void*> uniformBuffersMapped;
-		} p_ubo;
-
-		struct {
-			std::vector<VkBuffer> uniformBuffers;
-			std::vector<VkDeviceMemory> uniformBuffersMemory;
-			std::vector<void*> uniformBuffersMapped;
-		} p_shader_values_ubo;
+		// Dynamic offset of this frame's UBO in the device's UniformRing
+		uint32_t p_ubo_offset = 0;
+		// Model matrix written to this frame's UBO
+		glm::mat4 p_world = glm::mat4(1.0f);
 
 		struct {
 			VkBuffer buffer = VK_NULL_HANDLE;
@@ -58,11 +52,7 @@ namespace Diffuse {
 	struct Skybox {
 		Model p_model;
 
-		struct {
-			std::vector<VkBuffer> uniformBuffers;
-			std::vector<VkDeviceMemory> uniformBuffersMemory;
-			std::vector<void*> uniformBuffersMapped;
-		} p_ubo;
+		uint32_t p_ubo_offset = 0;
 
 		bool p_render = true;
 	};
@@ -79,18 +69,24 @@ namespace Diffuse {
 
 	class Scene {
 	public:
-		void AddSceneObect(const std::shared_ptr<SceneObject> object) { m_scene_objects.push_back(object); }
+		void AddSceneObect(const std::shared_ptr<SceneObject> object) { m_scene_objects.push_back(object); m_bvh.Add(BoundingBox{}); }
 		void AddSkybox(const std::shared_ptr<Skybox> skybox) { m_skybox = skybox; }
 		//void AddSceneCamera(const std::shared_ptr<SceneCamera> camera) { m_scene_camera = camera; }
 		void AddEditorCamera(const std::shared_ptr<EditorCamera> camera) { m_editor_camera = camera; }
 
 		std::shared_ptr<SceneCamera> GetSceneCamera() { return m_scene_camera; }
-		std::vector<std::shared_ptr<SceneObject>> GetSceneObjects() const { return m_scene_objects; }
+		const std::vector<std::shared_ptr<SceneObject>>& GetSceneObjects() const { return m_scene_objects; }
 		std::shared_ptr<Skybox> GetSkybox() const { return m_skybox; }
+
+		// Moves the world space boxes of the objects to their p_world matrices, refitting or rebuilding the hierarchy
+		void UpdateBounds();
+		// Item ids are indices into GetSceneObjects()
+		const BVH& GetBVH() const { return m_bvh; }
 	private:
 		std::shared_ptr<SceneCamera> m_scene_camera;
 		std::shared_ptr<EditorCamera> m_editor_camera;
 		std::shared_ptr<Skybox> m_skybox;
 		std::vector<std::shared_ptr<SceneObject>> m_scene_objects;
+		BVH m_bvh;
 	};
 }
\ No newline at end of file
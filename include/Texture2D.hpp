@@ -2,6 +2,7 @@
 
 #include "tiny_gltf.h"
 #include <vulkan/vulkan.hpp>
+#include <glm/glm.hpp>
 
 namespace Diffuse {
 
@@ -21,7 +22,13 @@ namespace Diffuse {
         Texture2D(tinygltf::Image image, TextureSampler sampler, VkQueue copy_queue, GraphicsDevice* graphics_device);
 		Texture2D(const std::string& path, VkFormat format, TextureSampler sampler, VkImageUsageFlags additionalUsage, GraphicsDevice* graphics_device, bool null_texture = false);
 		Texture2D(uint32_t width, uint32_t height, uint32_t layers, VkFormat format, uint32_t levels, VkImageUsageFlags additionalUsage, GraphicsDevice* graphics_device);
+        // Resident RGBA8 texture with a CPU built mip chain of mip_levels, used for atlas pages
+        Texture2D(const unsigned char* rgba, uint32_t width, uint32_t height, uint32_t mip_levels, TextureSampler sampler, VkQueue copy_queue, GraphicsDevice* graphics_device);
+        // Alias sharing the image of owner, sampled with another sampler
+        Texture2D(Texture2D* owner, TextureSampler sampler);
         void UpdateDescriptor();
+        // Picks up the owner's current image after it was rebuilt
+        void SyncWithOwner();
 
 
 
@@ -34,19 +41,54 @@ namespace Diffuse {
         const VkImageLayout& GetLayout() const { return m_imageLayout; }
         const VkDeviceMemory& GetMemory() const { return m_texture_image_memory; }
         const VkSampler& GetSampler() const { return m_texture_sampler; }
+
+        bool IsAtlased() const { return m_atlas_rect != glm::vec4(1.0f, 1.0f, 0.0f, 0.0f); }
+
+        // Creates an image holding the mips [base_mip, m_mip_levels) of this texture, used for (re)building the resident mip range
+        void CreateMipImage(uint32_t base_mip, VkImage& image, VkDeviceMemory& memory, VkImageView& view, VkDeviceSize& size) const;
+        // Creates the GPU image from the CPU mip chain, used directly by the glTF constructor and by the packer for textures it could not place
+        void Upload(VkQueue copy_queue, const TextureSampler& sampler, bool allow_streaming);
+    private:
+        void BuildMipChain(const unsigned char* rgba);
 	public:
 		GraphicsDevice* m_graphics_device;
 
 		uint32_t m_width = 0, m_height = 0, m_mip_levels = 0;
         uint32_t m_layers = 0;
         bool m_is_hdr = false;
-
-		VkImage m_texture_image;
-		VkSampler m_texture_sampler;
-        VkImageLayout m_imageLayout;
-		VkImageView m_texture_image_view;
-		VkDeviceMemory m_texture_image_memory;
-        VkDescriptorImageInfo m_descriptor;
+        std::string m_asset;    // Owner reported by the memory allocator
+
+		VkImage m_texture_image = VK_NULL_HANDLE;
+		VkSampler m_texture_sampler = VK_NULL_HANDLE;
+        VkImageLayout m_imageLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		VkImageView m_texture_image_view = VK_NULL_HANDLE;
+		VkDeviceMemory m_texture_image_memory = VK_NULL_HANDLE;
+        VkDescriptorImageInfo m_descriptor{};
+
+        // Mip streaming
+        struct MipLevel {
+            uint32_t width;
+            uint32_t height;
+            VkDeviceSize offset;
+            VkDeviceSize size;
+        };
+        VkFormat m_format = VK_FORMAT_UNDEFINED;
+        std::vector<MipLevel> m_mips;
+        std::vector<unsigned char> m_mip_data;      // CPU copy of the full mip chain, kept while the texture is streamed
+        bool m_streamed = false;
+        uint32_t m_resident_mip = 0;                // Finest mip currently in m_texture_image
+        uint32_t m_requested_mip = 0;               // Finest mip needed on screen, updated every frame
+        uint64_t m_last_used_frame = 0;
+        VkDeviceSize m_resident_size = 0;
+
+        // Deduplication, aliases never own the image
+        Texture2D* m_alias_of = nullptr;
+        std::vector<Texture2D*> m_aliases;
+
+        // Atlas packing, packed textures are aliases of their page
+        TextureSampler m_sampler_desc{};
+        bool m_pack_pending = false;    // Waiting for the packer, there is no GPU image to share yet
+        glm::vec4 m_atlas_rect = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f);    // Tile scale (xy) and offset (zw) in page UVs
 	};
 
     class TextureCubemap {
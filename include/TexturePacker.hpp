@@ -0,0 +1,62 @@
+#pragma once
+
+#include "Texture2D.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Packs small glTF textures into shared atlas pages at load time.
+	// Candidates keep their CPU mip chain until Pack, which shelf packs them into RGBA8 pages with wrapped borders wide
+	// enough for the page mips, so repeat addressing can be emulated in the shader through the material's atlas rect.
+	// Only textures whose whole mip chain fits into the page mips are candidates, larger ones would lose their last mips.
+	// Packed textures become aliases of their page, materials whose textures share pages end up with equal descriptors.
+	// Setup packs the textures of the models loaded before it, models loaded later pack their own.
+	class TexturePacker {
+	public:
+		struct Stats {
+			uint32_t pages = 0;
+			uint32_t packed = 0;
+			uint32_t standalone = 0;
+			VkDeviceSize page_bytes = 0;
+		};
+
+		TexturePacker(GraphicsDevice* device, uint32_t max_extent, uint32_t page_extent);
+
+		bool IsCandidate(const Texture2D& texture, const TextureSampler& sampler) const;
+		// Takes a texture that has its mip chain built but no GPU image yet
+		void Add(Texture2D* texture);
+		// Uploads all pending textures, either into atlas pages or on their own
+		void Pack(VkQueue copy_queue);
+		bool HasPacked() const { return m_has_packed; }
+		void CleanUp();
+
+		const Stats& GetStats() const { return m_stats; }
+
+		// Tile origins and sizes are aligned to the border, which keeps the border at least one texel wide in the last page mip
+		static constexpr uint32_t s_border = 16;
+		static constexpr uint32_t s_page_mips = 5;
+	private:
+		struct Placement {
+			Texture2D* texture;
+			uint32_t x, y;
+		};
+
+		void UploadStandalone(Texture2D* texture, VkQueue copy_queue);
+		void BuildPage(const std::vector<Placement>& placements, uint32_t height, VkQueue copy_queue);
+		static uint32_t TileExtent(uint32_t extent);
+	private:
+		GraphicsDevice* m_device;
+		uint32_t m_max_extent;
+		uint32_t m_page_extent;
+		Stats m_stats;
+		bool m_has_packed = false;
+
+		std::vector<Texture2D*> m_pending;
+		std::vector<Texture2D*> m_pages;
+	};
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "Texture2D.hpp"
+#include "Hash.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Content addressed owner of all glTF textures.
+	// Images are keyed by a 128 bit hash of their encoded bytes, so byte identical images from any model resolve to one
+	// GPU texture. The same image used with another sampler becomes an alias that shares the image.
+	// Textures are reference counted and destroyed once the last user releases them.
+	class TextureRegistry {
+	public:
+		struct Stats {
+			uint32_t references = 0;
+			uint32_t duplicates = 0;
+			uint32_t skipped_decodes = 0;
+			VkDeviceSize saved_bytes = 0;
+		};
+
+		TextureRegistry(GraphicsDevice* device, bool deduplicate);
+
+		bool Contains(const Utils::Hash128& content) const;
+		// Returns the texture for content and sampler with its reference count raised, or nullptr if the content is unknown
+		Texture2D* Acquire(const Utils::Hash128& content, const TextureSampler& sampler);
+		// Takes ownership of a newly created texture, with one reference held by the caller
+		Texture2D* Insert(const Utils::Hash128& content, const TextureSampler& sampler, Texture2D* texture);
+		// Must only be called once the GPU no longer uses the texture
+		void Release(Texture2D* texture);
+
+		void CountSkippedDecode() { m_stats.skipped_decodes++; }
+		// Prints what deduplication saved since the last report, called once per loaded scene
+		void ReportScene();
+		void CleanUp();
+	private:
+		struct Entry {
+			Utils::Hash128 content;
+			std::vector<std::pair<TextureSampler, Texture2D*>> textures;    // First one owns the image, the rest are aliases
+		};
+
+		struct HashKey {
+			size_t operator()(const Utils::Hash128& hash) const { return static_cast<size_t>(hash.low ^ (hash.high * 0x9e3779b97f4a7c15ull)); }
+		};
+
+		void Destroy(Texture2D* texture);
+		static VkDeviceSize TextureBytes(const Texture2D& texture);
+	private:
+		GraphicsDevice* m_device;
+		bool m_deduplicate;
+		Stats m_stats;
+
+		std::unordered_map<Utils::Hash128, Entry, HashKey> m_entries;
+		std::unordered_map<Texture2D*, Utils::Hash128> m_contents;
+		std::unordered_map<Texture2D*, uint32_t> m_references;
+	};
+}
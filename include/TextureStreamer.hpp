@@ -0,0 +1,97 @@
+#pragma once
+
+#include "Texture2D.hpp"
+#include "Scene.hpp"
+#include "Camera.hpp"
+
+#include <vulkan/vulkan.hpp>
+
+#include <unordered_map>
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Streams the fine mips of glTF textures in and out at runtime.
+	// Textures start with only their low mips resident. Every frame the on-screen texel density of each material is
+	// estimated from primitive bounds and the camera, finer mips are uploaded within a per frame budget and, once the
+	// VRAM budget is reached, mips that are no longer needed are evicted least recently used first.
+	// With an async UploadQueue the transfer queue cannot read the old image, so uploads rewrite the whole new mip chain
+	// from the CPU copy there, evictions only copy on the GPU and stay on the graphics queue.
+	class TextureStreamer {
+	public:
+		struct Stats {
+			uint32_t uploads = 0;
+			uint32_t evictions = 0;
+			uint32_t pending = 0;
+			VkDeviceSize uploaded_bytes = 0;
+			VkDeviceSize resident_bytes = 0;
+		};
+
+		TextureStreamer(GraphicsDevice* device, uint32_t frames_in_flight, VkDeviceSize vram_budget, VkDeviceSize upload_budget);
+
+		uint32_t InitialResidentMip(const Texture2D& texture) const;
+		void Register(Texture2D* texture);
+		void Unregister(Texture2D* texture);
+		// Descriptor sets referencing a streamed texture are rewritten whenever its resident image changes.
+		// A set used by frame slot frame_index is only rewritten while that slot is current, older frames may still read it.
+		// Rewriting an update_after_bind binding leaves command buffers that bound the set valid
+		void RegisterDescriptor(Texture2D* texture, VkDescriptorSet descriptor_set, uint32_t binding, uint32_t frame_index,
+			uint32_t array_element = 0, bool update_after_bind = false);
+		// Changes whenever descriptor sets of the frame slot were rewritten, command buffers binding them are invalid then
+		uint64_t GetDescriptorVersion(uint32_t frame_index) const { return m_descriptor_versions[frame_index]; }
+
+		// Must be called after the fence of the frame slot has been waited on
+		void BeginFrame(uint32_t frame_index);
+		void Request(const SceneObject& object, const glm::mat4& model, const EditorCamera& camera, float viewport_height);
+		// Records this frame's uploads and evictions, must be recorded outside of a render pass
+		void Update(VkCommandBuffer command_buffer);
+		void CleanUp();
+
+		const Stats& GetStats() const { return m_stats; }
+		VkDeviceSize GetResidentBytes() const { return m_resident_bytes; }
+
+		// Mips at or below this size are always resident
+		static constexpr uint32_t s_resident_tail_extent = 64;
+	private:
+		struct Staging {
+			VkBuffer buffer = VK_NULL_HANDLE;
+			VkDeviceMemory memory = VK_NULL_HANDLE;
+			unsigned char* mapped = nullptr;
+			VkDeviceSize capacity = 0;
+		};
+
+		struct DescriptorBinding {
+			VkDescriptorSet descriptor_set;
+			uint32_t binding;
+			uint32_t frame_index;
+			uint32_t array_element;
+			bool update_after_bind;
+		};
+
+		void RequestTexture(Texture2D* texture, float texcoords_per_unit, float pixels_per_unit);
+		bool Evict(VkDeviceSize required, Texture2D* keep, VkCommandBuffer command_buffer);
+		void Rebuild(Texture2D* texture, uint32_t base_mip, VkCommandBuffer command_buffer, VkDeviceSize& staging_offset);
+		void WriteDescriptors(Texture2D* texture, uint32_t frame_index);
+		// Writes the current slot's descriptors now and those of the other slots when they come around
+		void UpdateDescriptors(Texture2D* texture);
+	private:
+		GraphicsDevice* m_device;
+		VkDeviceSize m_vram_budget;
+		VkDeviceSize m_upload_budget;
+		VkDeviceSize m_resident_bytes = 0;
+		VkDeviceSize m_largest_mip = 0;
+		VkDeviceSize m_largest_chain = 0;
+
+		uint64_t m_frame = 1;
+		uint32_t m_frame_index = 0;
+		Stats m_stats;
+
+		std::vector<Texture2D*> m_textures;
+		std::unordered_map<Texture2D*, std::vector<DescriptorBinding>> m_descriptors;
+		std::vector<Staging> m_staging;
+		std::vector<std::vector<Texture2D*>> m_pending_descriptors;    // Per frame slot, textures whose sets of that slot are stale
+		std::vector<uint64_t> m_descriptor_versions;    // Per frame slot, raised whenever sets of that slot are rewritten
+	};
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// One persistently mapped host visible buffer split into a region per frame in flight.
+	// Per object and per frame constants are bump allocated from the current frame's region and bound through
+	// dynamic uniform buffer descriptors, so every descriptor points at the same buffer and only the offsets change.
+	class UniformRing {
+	public:
+		UniformRing(GraphicsDevice* device, uint32_t frame_count, VkDeviceSize frame_size);
+
+		// Starts allocating from the region of frame, the caller has waited for the GPU to be done with it
+		void BeginFrame(uint32_t frame);
+		// Copies data into the current frame's region and returns the dynamic offset to bind it with
+		uint32_t Push(const void* data, VkDeviceSize size);
+		template<typename T>
+		uint32_t Push(const T& value) { return Push(&value, sizeof(T)); }
+
+		VkBuffer GetBuffer() const { return m_buffer; }
+		// Descriptor for a dynamic uniform buffer binding that reads range bytes at the bound offset
+		VkDescriptorBufferInfo GetDescriptor(VkDeviceSize range) const { return { m_buffer, 0, range }; }
+
+		void PrintStats() const;
+		void CleanUp();
+	private:
+		GraphicsDevice* m_device;
+		VkBuffer m_buffer = VK_NULL_HANDLE;
+		unsigned char* m_mapped = nullptr;
+		uint32_t m_frame_count;
+		VkDeviceSize m_frame_size;
+		VkDeviceSize m_alignment;
+		VkDeviceSize m_frame_start = 0;
+		VkDeviceSize m_head = 0;
+		VkDeviceSize m_peak = 0;
+	};
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <vector>
+
+namespace Diffuse {
+
+	class GraphicsDevice;
+
+	// Records runtime uploads on a transfer only queue so they overlap rendering instead of occupying the graphics queue.
+	// Each frame's copies go into one transfer command buffer which signals a timeline semaphore, written images are
+	// released to the graphics family and acquired in the frame's graphics command buffer, whose submission waits on
+	// the timeline value. Without a separate transfer family or timeline semaphore support the copies are recorded
+	// straight into the graphics command buffer, so callers use the same code path either way.
+	class UploadQueue {
+	public:
+		struct Stats {
+			uint32_t batches = 0;
+			uint32_t handovers = 0;
+		};
+
+		// transfer_queue is VK_NULL_HANDLE when uploads have to fall back to the graphics queue
+		UploadQueue(GraphicsDevice* device, uint32_t frames_in_flight, VkQueue transfer_queue, uint32_t transfer_family, uint32_t graphics_family);
+
+		bool IsAsync() const { return m_queue != VK_NULL_HANDLE; }
+
+		// Must be called after the fence of the frame slot has been waited on
+		void BeginFrame(uint32_t frame_index);
+		// Command buffer this frame's copies are recorded into, the transfer one or graphics_command_buffer
+		VkCommandBuffer Begin(VkCommandBuffer graphics_command_buffer);
+		// Makes image, written by transfer commands in old_layout, available to the graphics queue in new_layout at dst_stage
+		void HandOver(VkCommandBuffer graphics_command_buffer, VkImage image, const VkImageSubresourceRange& range, VkImageLayout old_layout,
+			VkImageLayout new_layout, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access);
+		// Submits this frame's batch, returns true if the graphics submission has to wait for value on semaphore at dst_stage
+		bool Submit(VkSemaphore& semaphore, uint64_t& value, VkPipelineStageFlags& dst_stage);
+
+		const Stats& GetStats() const { return m_stats; }
+		void CleanUp();
+	private:
+		GraphicsDevice* m_device;
+		VkQueue m_queue;
+		uint32_t m_transfer_family;
+		uint32_t m_graphics_family;
+
+		VkCommandPool m_command_pool = VK_NULL_HANDLE;
+		std::vector<VkCommandBuffer> m_command_buffers;
+		std::vector<uint64_t> m_frame_values;    // Timeline value the last batch of each frame slot signals
+		VkSemaphore m_timeline = VK_NULL_HANDLE;
+		uint64_t m_value = 0;
+
+		uint32_t m_frame_index = 0;
+		bool m_recording = false;
+		VkPipelineStageFlags m_dst_stages = 0;
+		Stats m_stats;
+	};
+}
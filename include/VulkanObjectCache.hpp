@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vulkan/vulkan.hpp>
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Diffuse {
+
+	// Deduplicates immutable Vulkan state objects by the contents of their create info.
+	// Returned handles are owned by the cache and stay valid until CleanUp, callers must not destroy them.
+	// All Get* functions are safe to call from multiple threads.
+	class VulkanObjectCache {
+	public:
+		struct Counter {
+			uint32_t hits = 0;
+			uint32_t misses = 0;
+		};
+
+		VulkanObjectCache(VkDevice device);
+
+		VkSampler GetSampler(const VkSamplerCreateInfo& create_info);
+		VkDescriptorSetLayout GetDescriptorSetLayout(const VkDescriptorSetLayoutCreateInfo& create_info);
+		VkPipelineLayout GetPipelineLayout(const VkPipelineLayoutCreateInfo& create_info);
+		VkRenderPass GetRenderPass(const VkRenderPassCreateInfo& create_info);
+
+		void PrintStats() const;
+		void CleanUp();
+	private:
+		template<typename Handle>
+		struct Table {
+			std::unordered_map<std::string, Handle> objects;
+			// Create infos with an unknown pNext chain can't be keyed and are created every time
+			std::vector<Handle> uncached;
+			Counter counter;
+		};
+
+		template<typename Handle, typename CreateFn>
+		Handle Get(Table<Handle>& table, const std::string& key, bool cacheable, CreateFn create);
+	private:
+		VkDevice m_device;
+		mutable std::mutex m_mutex;
+
+		Table<VkSampler> m_samplers;
+		Table<VkDescriptorSetLayout> m_descriptor_set_layouts;
+		Table<VkPipelineLayout> m_pipeline_layouts;
+		Table<VkRenderPass> m_render_passes;
+	};
+}
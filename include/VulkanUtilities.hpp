@@ -8,6 +8,7 @@
 #include "Camera.hpp"
 #include "Model.hpp"
 #include "Buffer.hpp"
+#include "MemoryAllocator.hpp"
 
 namespace Diffuse {
 #define VK_FLAGS_NONE 0
@@ -19,6 +20,10 @@ namespace Diffuse {
 	struct QueueFamilyIndices {
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		// Transfer capable family without graphics, preferably without compute as well
+		std::optional<uint32_t> transferFamily;
+		// Compute capable family without graphics
+		std::optional<uint32_t> computeFamily;
 
 		bool isComplete() {
 			return graphicsFamily.has_value() && presentFamily.has_value();
@@ -53,8 +58,13 @@ namespace Diffuse {
 		static void DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator);
 		static void FramebufferResizeCallback(GLFWwindow* window, int width, int height);
 		static uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties, VkPhysicalDevice physical_device);
+		// Buffers and images are backed by the device's MemoryAllocator, the returned memory is shared and must not be freed
 		static void CreateBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory, 
 			VkPhysicalDevice physical_device, VkDevice device);
+		static void DestroyBuffer(VkDevice device, VkBuffer buffer);
+		static void DestroyImage(VkDevice device, VkImage image);
+		// Host visible buffers stay mapped for their whole lifetime
+		static void* MapBuffer(VkDevice device, VkBuffer buffer);
 		static void CreateVertexBuffer(const std::vector<Vertex>& vertices, VkDevice device, VkBuffer vertex_buffer, VkDeviceMemory vertex_buffer_memory,
 			VkCommandPool command_pool, VkQueue graphics_queue, VkPhysicalDevice physical_device);
 		static 	void CopyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size, VkCommandPool command_pool, VkDevice device, VkQueue graphics_queue);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Utils {
+	// A fixed set of threads that run the indices of a job in parallel, the calling thread works along and waits for the rest.
+	// Indices are handed out one at a time, so a thread that finishes early takes over the remaining ones.
+	class WorkerPool {
+	public:
+		// thread_count threads besides the caller, 0 runs every job on the calling thread
+		explicit WorkerPool(uint32_t thread_count);
+		~WorkerPool();
+
+		WorkerPool(const WorkerPool&) = delete;
+		WorkerPool& operator=(const WorkerPool&) = delete;
+
+		// Threads a job runs on including the caller
+		uint32_t GetWorkerCount() const { return static_cast<uint32_t>(m_threads.size()) + 1; }
+		// Calls job(index, worker) for every index below count and returns once all calls have returned.
+		// worker is below GetWorkerCount() and 0 on the calling thread
+		void ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t worker)>& job);
+	private:
+		void Run(uint32_t worker);
+		void Work(uint32_t worker);
+	private:
+		std::vector<std::thread> m_threads;
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		std::condition_variable m_done;
+
+		const std::function<void(uint32_t, uint32_t)>* m_job = nullptr;
+		std::atomic<uint32_t> m_next{ 0 };
+		uint32_t m_count = 0;
+		uint32_t m_generation = 0;
+		uint32_t m_active = 0;    // Threads that have not finished the current job
+		bool m_stop = false;
+	};
+}
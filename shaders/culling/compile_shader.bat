@@ -0,0 +1,4 @@
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe draw_cull.comp -o draw_cull_comp.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe draw_cull.comp -DOCCLUSION_CULLING -o draw_cull_occlusion_comp.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe depth_reduce.comp -o depth_reduce_comp.spv
+pause
\ No newline at end of file
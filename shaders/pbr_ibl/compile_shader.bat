@@ -1,3 +1,10 @@
 C:/VulkanSDK/1.3.250.1/Bin/glslc.exe pbr.vert       -o pbribl_vert.spv
 C:/VulkanSDK/1.3.250.1/Bin/glslc.exe pbr.frag    -o pbribl_frag.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe pbr.frag -DBINDLESS_TEXTURES -o pbribl_bindless_frag.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe depth.vert     -o depth_vert.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe depth_mask.vert -o depth_mask_vert.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe depth_mask.frag -o depth_mask_frag.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe depth_mask.frag -DBINDLESS_TEXTURES -o depth_mask_bindless_frag.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe irradiance_cube.comp -o irradiance_cube_comp.spv
+C:/VulkanSDK/1.3.250.1/Bin/glslc.exe prefilter_cube.comp -o prefilter_cube_comp.spv
 pause
\ No newline at end of file
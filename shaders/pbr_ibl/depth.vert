@@ -0,0 +1,18 @@
+#version 450
+
+// Depth pre-pass, reads only the position of the scene's interleaved vertices
+
+layout(location = 0) in vec3 inPosition;
+
+layout(set = 0, binding = 0) uniform UniformBufferObect {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+// Must match pbr.vert bit for bit
+invariant gl_Position;
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+}
@@ -0,0 +1,75 @@
+#version 450
+
+#ifdef BINDLESS_TEXTURES
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
+// Depth pre-pass of alpha masked materials, discards like pbr.frag without shading anything
+
+layout (location = 2) in vec2 inUV0;
+layout (location = 3) in vec2 inUV1;
+
+#ifdef BINDLESS_TEXTURES
+layout (set = 3, binding = 0) uniform sampler2D textures[];
+#define colorMap textures[material.baseColorTexture]
+#else
+layout (set = 0, binding = 2) uniform sampler2D colorMap;
+#endif
+
+// Laid out like ShaderMaterial in pbr.frag
+struct ShaderMaterial {
+	vec4 baseColorFactor;
+	vec4 emissiveFactor;
+	vec4 diffuseFactor;
+	vec4 specularFactor;
+	vec4 baseColorAtlasRect;
+	vec4 physicalDescriptorAtlasRect;
+	vec4 normalAtlasRect;
+	vec4 occlusionAtlasRect;
+	vec4 emissiveAtlasRect;
+	float workflow;
+	int baseColorTextureSet;
+	int physicalDescriptorTextureSet;
+	int normalTextureSet;
+	int occlusionTextureSet;
+	int emissiveTextureSet;
+	float metallicFactor;
+	float roughnessFactor;
+	float alphaMask;
+	float alphaMaskCutoff;
+	float emissiveStrength;
+	// Elements of the bindless texture array
+	int baseColorTexture;
+	int physicalDescriptorTexture;
+	int normalTexture;
+	int occlusionTexture;
+	int emissiveTexture;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer SSBO
+{
+   ShaderMaterial materials[ ];
+};
+
+layout (push_constant) uniform PushConstants {
+	int materialIndex;
+} pushConstants;
+
+void main()
+{
+	ShaderMaterial material = materials[pushConstants.materialIndex];
+	float alpha = material.baseColorFactor.a;
+	if (material.baseColorTextureSet > -1) {
+		vec2 uv = material.baseColorTextureSet == 0 ? inUV0 : inUV1;
+		vec4 atlasRect = material.baseColorAtlasRect;
+		// Alpha is not sRGB encoded, so it is used as sampled
+		if (atlasRect.xy == vec2(1.0)) {
+			alpha *= texture(colorMap, uv).a;
+		} else {
+			alpha *= textureGrad(colorMap, atlasRect.zw + fract(uv) * atlasRect.xy, dFdx(uv) * atlasRect.xy, dFdy(uv) * atlasRect.xy).a;
+		}
+	}
+	if (alpha < material.alphaMaskCutoff) {
+		discard;
+	}
+}
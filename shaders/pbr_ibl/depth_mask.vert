@@ -0,0 +1,26 @@
+#version 450
+
+// Depth pre-pass of alpha masked materials, passes on the texture coordinates for the mask
+
+layout(location = 0) in vec3 inPosition;
+layout(location = 2) in vec2 inUV0;
+layout(location = 3) in vec2 inUV1;
+
+layout(set = 0, binding = 0) uniform UniformBufferObect {
+    mat4 model;
+    mat4 view;
+    mat4 proj;
+} ubo;
+
+// Must match pbr.vert bit for bit
+invariant gl_Position;
+
+layout (location = 2) out vec2 outUV0;
+layout (location = 3) out vec2 outUV1;
+
+void main() {
+    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+
+    outUV0 = inUV0;
+    outUV1 = inUV1;
+}
@@ -4,6 +4,10 @@
 
 #version 450
 
+#ifdef BINDLESS_TEXTURES
+#extension GL_EXT_nonuniform_qualifier : require
+#endif
+
 layout (location = 0) in vec3 inWorldPos;
 layout (location = 1) in vec3 inNormal;
 layout (location = 2) in vec2 inUV0;
@@ -30,11 +34,22 @@ layout (set = 0, binding = 1) uniform UBOParams {
 } uboParams;
 
 // Textures
+#ifdef BINDLESS_TEXTURES
+// Every scene texture, the material holds the elements. The material index is a push constant, so the indices are
+// dynamically uniform and need no nonuniformEXT
+layout (set = 3, binding = 0) uniform sampler2D textures[];
+#define colorMap textures[material.baseColorTexture]
+#define physicalDescriptorMap textures[material.physicalDescriptorTexture]
+#define normalMap textures[material.normalTexture]
+#define aoMap textures[material.occlusionTexture]
+#define emissiveMap textures[material.emissiveTexture]
+#else
 layout (set = 0, binding = 2) uniform sampler2D colorMap;
 layout (set = 0, binding = 3) uniform sampler2D physicalDescriptorMap;
 layout (set = 0, binding = 4) uniform sampler2D normalMap;
 layout (set = 0, binding = 5) uniform sampler2D aoMap;
 layout (set = 0, binding = 6) uniform sampler2D emissiveMap;
+#endif
 
 layout (set = 1, binding = 0) uniform samplerCube samplerIrradiance;
 layout (set = 1, binding = 1) uniform samplerCube prefilteredMap;
@@ -49,6 +64,11 @@ struct ShaderMaterial {
 	vec4 emissiveFactor;
 	vec4 diffuseFactor;
 	vec4 specularFactor;
+	vec4 baseColorAtlasRect;
+	vec4 physicalDescriptorAtlasRect;
+	vec4 normalAtlasRect;
+	vec4 occlusionAtlasRect;
+	vec4 emissiveAtlasRect;
 	float workflow;
 	int baseColorTextureSet;
 	int physicalDescriptorTextureSet;
@@ -60,6 +80,12 @@ struct ShaderMaterial {
 	float alphaMask;	
 	float alphaMaskCutoff;
 	float emissiveStrength;
+	// Elements of the bindless texture array
+	int baseColorTexture;
+	int physicalDescriptorTexture;
+	int normalTexture;
+	int occlusionTexture;
+	int emissiveTexture;
 };
 
 layout(std430, set = 2, binding = 0) buffer SSBO
@@ -71,6 +97,20 @@ layout (push_constant) uniform PushConstants {
 	int materialIndex;
 } pushConstants;
 
+// Material features of a specialized pipeline, the bits match MaterialFeatures in MaterialFeatures.hpp. The generic
+// pipeline leaves MATERIAL_SPECIALIZED false and tests the material at runtime
+layout (constant_id = 0) const bool MATERIAL_SPECIALIZED = false;
+layout (constant_id = 1) const uint MATERIAL_FEATURES = 0u;
+
+const uint FEATURE_BASE_COLOR_TEXTURE = 1u;
+const uint FEATURE_PHYSICAL_DESCRIPTOR_TEXTURE = 2u;
+const uint FEATURE_NORMAL_TEXTURE = 4u;
+const uint FEATURE_OCCLUSION_TEXTURE = 8u;
+const uint FEATURE_PACKED_OCCLUSION = 16u;
+const uint FEATURE_EMISSIVE_TEXTURE = 32u;
+const uint FEATURE_ALPHA_MASK = 64u;
+const uint FEATURE_SPECULAR_GLOSSINESS = 128u;
+
 layout (location = 0) out vec4 outColor;
 
 // Encapsulate the various inputs used by the various functions in the shading equation
@@ -97,6 +137,8 @@ const float c_MinRoughness = 0.04;
 
 const float PBR_WORKFLOW_METALLIC_ROUGHNESS = 0.0;
 const float PBR_WORKFLOW_SPECULAR_GLOSINESS = 1.0f;
+// Occlusion packed into the red channel of the metallic roughness texture, read with the same fetch
+const int TEXTURE_SET_PACKED_OCCLUSION = -2;
 
 vec4 SRGBtoLINEAR(vec4 srgbIn)
 {
@@ -133,12 +175,29 @@ vec4 tonemap(vec4 color)
 	return vec4(pow(outcol, vec3(1.0f / uboParams.gamma)), color.a);
 }
 
+// Packed textures live in a tile of a shared atlas page, atlasRect holds the tile scale (xy) and offset (zw).
+// Repeat addressing is done here, the gradients of the unwrapped coordinates keep the wrap from selecting a coarse mip
+vec4 sampleMaterialTexture(sampler2D map, int uvSet, vec4 atlasRect)
+{
+	vec2 uv = uvSet == 0 ? inUV0 : inUV1;
+	if (atlasRect.xy == vec2(1.0)) {
+		return texture(map, uv);
+	}
+	return textureGrad(map, atlasRect.zw + fract(uv) * atlasRect.xy, dFdx(uv) * atlasRect.xy, dFdy(uv) * atlasRect.xy);
+}
+
+// Constant for specialized pipelines, so the paths of missing features are removed when the pipeline is created
+bool hasFeature(uint feature, bool materialTest)
+{
+	return MATERIAL_SPECIALIZED ? (MATERIAL_FEATURES & feature) != 0u : materialTest;
+}
+
 // Find the normal for this fragment, pulling either from a predefined normal map
 // or from the interpolated mesh normal and tangent attributes.
 vec3 getNormal(ShaderMaterial material)
 {
 	// Perturb normal, see http://www.thetenthplanet.de/archives/1180
-	vec3 tangentNormal = texture(normalMap, material.normalTextureSet == 0 ? inUV0 : inUV1).xyz * 2.0 - 1.0;
+	vec3 tangentNormal = sampleMaterialTexture(normalMap, material.normalTextureSet, material.normalAtlasRect).xyz * 2.0 - 1.0;
 
 	vec3 q1 = dFdx(inWorldPos);
 	vec3 q2 = dFdy(inWorldPos);
@@ -238,12 +297,16 @@ void main()
 	float metallic;
 	vec3 diffuseColor;
 	vec4 baseColor;
+	float packedOcclusion = 1.0;
 
 	vec3 f0 = vec3(0.04);
 
-	if (material.alphaMask == 1.0f) {
-		if (material.baseColorTextureSet > -1) {
-			baseColor = SRGBtoLINEAR(texture(colorMap, material.baseColorTextureSet == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
+	bool baseColorTexture = hasFeature(FEATURE_BASE_COLOR_TEXTURE, material.baseColorTextureSet > -1);
+	bool physicalDescriptorTexture = hasFeature(FEATURE_PHYSICAL_DESCRIPTOR_TEXTURE, material.physicalDescriptorTextureSet > -1);
+
+	if (hasFeature(FEATURE_ALPHA_MASK, material.alphaMask == 1.0f)) {
+		if (baseColorTexture) {
+			baseColor = SRGBtoLINEAR(sampleMaterialTexture(colorMap, material.baseColorTextureSet, material.baseColorAtlasRect)) * material.baseColorFactor;
 		} else {
 			baseColor = material.baseColorFactor;
 		}
@@ -252,16 +315,19 @@ void main()
 		}
 	}
 
-	if (material.workflow == PBR_WORKFLOW_METALLIC_ROUGHNESS) {
+	bool specularGlossiness = hasFeature(FEATURE_SPECULAR_GLOSSINESS, material.workflow == PBR_WORKFLOW_SPECULAR_GLOSINESS);
+
+	if (!specularGlossiness) {
 		// Metallic and Roughness material properties are packed together
 		// In glTF, these factors can be specified by fixed scalar values
 		// or from a metallic-roughness map
 		perceptualRoughness = material.roughnessFactor;
 		metallic = material.metallicFactor;
-		if (material.physicalDescriptorTextureSet > -1) {
+		if (physicalDescriptorTexture) {
 			// Roughness is stored in the 'g' channel, metallic is stored in the 'b' channel.
 			// This layout intentionally reserves the 'r' channel for (optional) occlusion map data
-			vec4 mrSample = texture(physicalDescriptorMap, material.physicalDescriptorTextureSet == 0 ? inUV0 : inUV1);
+			vec4 mrSample = sampleMaterialTexture(physicalDescriptorMap, material.physicalDescriptorTextureSet, material.physicalDescriptorAtlasRect);
+			packedOcclusion = mrSample.r;
 			perceptualRoughness = mrSample.g * perceptualRoughness;
 			metallic = mrSample.b * metallic;
 		} else {
@@ -272,25 +338,25 @@ void main()
 		// convert to material roughness by squaring the perceptual roughness [2].
 
 		// The albedo may be defined from a base texture or a flat color
-		if (material.baseColorTextureSet > -1) {
-			baseColor = SRGBtoLINEAR(texture(colorMap, material.baseColorTextureSet == 0 ? inUV0 : inUV1)) * material.baseColorFactor;
+		if (baseColorTexture) {
+			baseColor = SRGBtoLINEAR(sampleMaterialTexture(colorMap, material.baseColorTextureSet, material.baseColorAtlasRect)) * material.baseColorFactor;
 		} else {
 			baseColor = material.baseColorFactor;
 		}
 	}
 
-	if (material.workflow == PBR_WORKFLOW_SPECULAR_GLOSINESS) {
+	if (specularGlossiness) {
 		// Values from specular glossiness workflow are converted to metallic roughness
-		if (material.physicalDescriptorTextureSet > -1) {
-			perceptualRoughness = 1.0 - texture(physicalDescriptorMap, material.physicalDescriptorTextureSet == 0 ? inUV0 : inUV1).a;
+		if (physicalDescriptorTexture) {
+			perceptualRoughness = 1.0 - sampleMaterialTexture(physicalDescriptorMap, material.physicalDescriptorTextureSet, material.physicalDescriptorAtlasRect).a;
 		} else {
 			perceptualRoughness = 0.0;
 		}
 
 		const float epsilon = 1e-6;
 
-		vec4 diffuse = SRGBtoLINEAR(texture(colorMap, inUV0));
-		vec3 specular = SRGBtoLINEAR(texture(physicalDescriptorMap, inUV0)).rgb;
+		vec4 diffuse = SRGBtoLINEAR(sampleMaterialTexture(colorMap, 0, material.baseColorAtlasRect));
+		vec3 specular = SRGBtoLINEAR(sampleMaterialTexture(physicalDescriptorMap, 0, material.physicalDescriptorAtlasRect)).rgb;
 
 		float maxSpecular = max(max(specular.r, specular.g), specular.b);
 
@@ -321,7 +387,7 @@ void main()
 	vec3 specularEnvironmentR0 = specularColor.rgb;
 	vec3 specularEnvironmentR90 = vec3(1.0, 1.0, 1.0) * reflectance90;
 
-	vec3 n = (material.normalTextureSet > -1) ? getNormal(material) : normalize(inNormal);
+	vec3 n = hasFeature(FEATURE_NORMAL_TEXTURE, material.normalTextureSet > -1) ? getNormal(material) : normalize(inNormal);
 	vec3 v = normalize(ubo.camPos - inWorldPos);    // Vector from surface point to camera
 	vec3 l = normalize(uboParams.lightDir.xyz);     // Vector from surface point to light
 	vec3 h = normalize(l+v);                        // Half vector between both l and v
@@ -367,14 +433,16 @@ void main()
 
 	const float u_OcclusionStrength = 1.0f;
 	// Apply optional PBR terms for additional (optional) shading
-	if (material.occlusionTextureSet > -1) {
-		float ao = texture(aoMap, (material.occlusionTextureSet == 0 ? inUV0 : inUV1)).r;
+	if (hasFeature(FEATURE_PACKED_OCCLUSION, material.occlusionTextureSet == TEXTURE_SET_PACKED_OCCLUSION)) {
+		color = mix(color, color * packedOcclusion, u_OcclusionStrength);
+	} else if (hasFeature(FEATURE_OCCLUSION_TEXTURE, material.occlusionTextureSet > -1)) {
+		float ao = sampleMaterialTexture(aoMap, material.occlusionTextureSet, material.occlusionAtlasRect).r;
 		color = mix(color, color * ao, u_OcclusionStrength);
 	}
 
 	vec3 emissive = material.emissiveFactor.rgb * material.emissiveStrength;
-	if (material.emissiveTextureSet > -1) {
-		emissive *= SRGBtoLINEAR(texture(emissiveMap, material.emissiveTextureSet == 0 ? inUV0 : inUV1)).rgb;
+	if (hasFeature(FEATURE_EMISSIVE_TEXTURE, material.emissiveTextureSet > -1)) {
+		emissive *= SRGBtoLINEAR(sampleMaterialTexture(emissiveMap, material.emissiveTextureSet, material.emissiveAtlasRect)).rgb;
 	};
 	color += emissive;
 	
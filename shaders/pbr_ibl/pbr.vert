@@ -12,6 +12,9 @@ layout(set = 0, binding = 0) uniform UniformBufferObect {
     mat4 proj;
 } ubo;
 
+// The depth pre-pass computes the same position, the main pass tests its depth for equality
+invariant gl_Position;
+
 layout (location = 0) out vec3 pos;
 layout (location = 1) out vec3 outNormal;
 layout (location = 2) out vec2 outUV0;
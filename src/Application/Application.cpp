@@ -46,8 +46,10 @@ namespace Diffuse {
         g_editor_camera->OnMouseScroll(yoffset);
     }
 
-    void Application::Init() {
-        m_graphics = new GraphicsDevice();
+    void Application::Init(const Config& config, uint32_t benchmark_frames) {
+        m_config = config;
+        m_benchmark_frames = benchmark_frames;
+        m_graphics = new GraphicsDevice(m_config);
         {
             // Creating scene
             g_scene = std::make_shared<Scene>();
@@ -90,10 +92,37 @@ namespace Diffuse {
     void Application::Update()
     {
         auto current_time = std::chrono::high_resolution_clock::now();
+        bool report_key_down = false;
+        bool environment_key_down = false;
+        uint32_t environment_index = 0;
+        uint32_t frame_count = 0;
 
         while (!m_graphics->GetWindow()->WindowShouldClose()) {
+            if (m_benchmark_frames > 0 && frame_count++ >= m_benchmark_frames)
+                break;
             m_graphics->GetWindow()->PollEvents();
 
+            // F9 writes the device memory report on demand
+            bool report_key = glfwGetKey(m_graphics->GetWindow()->window(), GLFW_KEY_F9) == GLFW_PRESS;
+            if (report_key && !report_key_down) {
+                m_graphics->WriteMemoryReport();
+            }
+            report_key_down = report_key;
+
+            // F8 cycles the environment, it is baked on the compute queue while the frames go on
+            bool environment_key = glfwGetKey(m_graphics->GetWindow()->window(), GLFW_KEY_F8) == GLFW_PRESS;
+            if (environment_key && !environment_key_down) {
+                static const char* environments[] = {
+                    "../assets/skybox/Desert/desert.hdr",
+                    "../assets/skybox/Shangai/shangai.hdr",
+                    "../assets/skybox/Apartment/Apartment.hdr",
+                    "../assets/skybox/misty_morning.hdr",
+                };
+                environment_index = (environment_index + 1) % std::size(environments);
+                m_graphics->LoadEnvironment(environments[environment_index]);
+            }
+            environment_key_down = environment_key;
+
             auto new_time = std::chrono::high_resolution_clock::now();
             float frame_time = std::chrono::duration<float, std::chrono::seconds::period>(new_time - current_time).count();
             current_time = new_time;
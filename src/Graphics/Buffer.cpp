@@ -1,8 +1,10 @@
 #include "Buffer.hpp"
+#include "MemoryAllocator.hpp"
 
 namespace Diffuse {
 	/**
 	* Map a memory range of this buffer. If successful, mapped points to the specified buffer range.
+	* The allocator keeps host visible memory mapped, this only looks up the pointer.
 	*
 	* @param size (Optional) Size of the memory range to map. Pass VK_WHOLE_SIZE to map the complete buffer range.
 	* @param offset (Optional) Byte offset from beginning
@@ -11,33 +13,21 @@ namespace Diffuse {
 	*/
 	VkResult Buffer::Map(VkDeviceSize size, VkDeviceSize offset)
 	{
-		return vkMapMemory(device, memory, offset, size, 0, &mapped);
+		unsigned char* base = static_cast<unsigned char*>(MemoryAllocator::Get(device)->GetMapped(buffer));
+		if (base == nullptr)
+			return VK_ERROR_MEMORY_MAP_FAILED;
+		mapped = base + offset;
+		return VK_SUCCESS;
 	}
 
 	/**
 	* Unmap a mapped memory range
 	*
-	* @note Does not return a result as vkUnmapMemory can't fail
+	* @note The memory itself stays mapped by the allocator
 	*/
 	void Buffer::Unmap()
 	{
-		if (mapped)
-		{
-			vkUnmapMemory(device, memory);
-			mapped = nullptr;
-		}
-	}
-
-	/**
-	* Attach the allocated memory block to the buffer
-	*
-	* @param offset (Optional) Byte offset (from the beginning) for the memory region to bind
-	*
-	* @return VkResult of the bindBufferMemory call
-	*/
-	VkResult Buffer::Bind(VkDeviceSize offset)
-	{
-		return vkBindBufferMemory(device, buffer, memory, offset);
+		mapped = nullptr;
 	}
 
 	/**
@@ -79,12 +69,7 @@ namespace Diffuse {
 	*/
 	VkResult Buffer::Flush(VkDeviceSize size, VkDeviceSize offset)
 	{
-		VkMappedMemoryRange mappedRange = {};
-		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
-		return vkFlushMappedMemoryRanges(device, 1, &mappedRange);
+		return MemoryAllocator::Get(device)->Flush(buffer, offset, size);
 	}
 
 	/**
@@ -99,12 +84,7 @@ namespace Diffuse {
 	*/
 	VkResult Buffer::Invalidate(VkDeviceSize size, VkDeviceSize offset)
 	{
-		VkMappedMemoryRange mappedRange = {};
-		mappedRange.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
-		mappedRange.memory = memory;
-		mappedRange.offset = offset;
-		mappedRange.size = size;
-		return vkInvalidateMappedMemoryRanges(device, 1, &mappedRange);
+		return MemoryAllocator::Get(device)->Invalidate(buffer, offset, size);
 	}
 
 	/**
@@ -114,11 +94,8 @@ namespace Diffuse {
 	{
 		if (buffer)
 		{
+			MemoryAllocator::Get(device)->Free(buffer);
 			vkDestroyBuffer(device, buffer, nullptr);
 		}
-		if (memory)
-		{
-			vkFreeMemory(device, memory, nullptr);
-		}
 	}
 }
\ No newline at end of file
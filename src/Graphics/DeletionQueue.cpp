@@ -0,0 +1,38 @@
+#include "DeletionQueue.hpp"
+
+namespace Diffuse {
+	DeletionQueue::DeletionQueue(uint32_t frames_in_flight) {
+		m_frames.resize(frames_in_flight);
+	}
+
+	void DeletionQueue::Push(std::function<void()> destroy) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_frames[m_frame_index].push_back(std::move(destroy));
+		m_deferred++;
+	}
+
+	void DeletionQueue::BeginFrame(uint32_t frame_index) {
+		std::vector<std::function<void()>> ready;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_frame_index = frame_index;
+			ready.swap(m_frames[frame_index]);
+		}
+		for (auto& destroy : ready) {
+			destroy();
+		}
+	}
+
+	void DeletionQueue::Flush() {
+		for (uint32_t i = 0; i < m_frames.size(); i++) {
+			std::vector<std::function<void()>> ready;
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				ready.swap(m_frames[i]);
+			}
+			for (auto& destroy : ready) {
+				destroy();
+			}
+		}
+	}
+}
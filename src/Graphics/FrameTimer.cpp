@@ -0,0 +1,104 @@
+#include "FrameTimer.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	FrameTimer::FrameTimer(GraphicsDevice* device, uint32_t frames_in_flight, uint32_t queue_family)
+		:m_device(device), m_frames_in_flight(frames_in_flight) {
+		m_written.resize(frames_in_flight, false);
+
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device->PhysicalDevice(), &properties);
+		uint32_t family_count = 0;
+		vkGetPhysicalDeviceQueueFamilyProperties(device->PhysicalDevice(), &family_count, nullptr);
+		std::vector<VkQueueFamilyProperties> families(family_count);
+		vkGetPhysicalDeviceQueueFamilyProperties(device->PhysicalDevice(), &family_count, families.data());
+		uint32_t valid_bits = families[queue_family].timestampValidBits;
+		if (valid_bits == 0) {
+			std::cout << "Frame timer: the graphics queue has no timestamps, GPU time is not measured" << std::endl;
+			return;
+		}
+		m_timestamp_period = properties.limits.timestampPeriod;
+		m_timestamp_mask = valid_bits >= 64 ? ~0ull : (1ull << valid_bits) - 1;
+
+		VkQueryPoolCreateInfo pool_info{};
+		pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+		pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+		pool_info.queryCount = 2 * frames_in_flight;
+		if (vkCreateQueryPool(device->Device(), &pool_info, nullptr, &m_query_pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create timestamp query pool!");
+		}
+	}
+
+	void FrameTimer::BeginFrame(uint32_t frame_index, double wait_ms) {
+		m_frame_index = frame_index;
+		auto now = std::chrono::high_resolution_clock::now();
+		if (m_started) {
+			m_frames++;
+			m_frame_ms += std::chrono::duration<double, std::milli>(now - m_last_frame).count();
+			m_wait_ms += wait_ms;
+		}
+		m_started = true;
+		m_last_frame = now;
+
+		// The fence of this slot has signaled, so its timestamps are available
+		if (m_query_pool != VK_NULL_HANDLE && m_written[frame_index]) {
+			uint64_t timestamps[2];
+			if (vkGetQueryPoolResults(m_device->Device(), m_query_pool, frame_index * 2, 2, sizeof(timestamps), timestamps, sizeof(uint64_t),
+				VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+				uint64_t ticks = ((timestamps[1] & m_timestamp_mask) - (timestamps[0] & m_timestamp_mask)) & m_timestamp_mask;
+				m_gpu_ms += static_cast<double>(ticks) * m_timestamp_period / 1e6;
+				m_gpu_frames++;
+			}
+			m_written[frame_index] = false;
+		}
+	}
+
+	void FrameTimer::WriteBegin(VkCommandBuffer command_buffer) {
+		if (m_query_pool == VK_NULL_HANDLE)
+			return;
+		vkCmdResetQueryPool(command_buffer, m_query_pool, m_frame_index * 2, 2);
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_query_pool, m_frame_index * 2);
+	}
+
+	void FrameTimer::WriteEnd(VkCommandBuffer command_buffer) {
+		if (m_query_pool == VK_NULL_HANDLE)
+			return;
+		vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, m_query_pool, m_frame_index * 2 + 1);
+		m_written[m_frame_index] = true;
+	}
+
+	FrameTimer::Stats FrameTimer::GetStats() const {
+		Stats stats;
+		stats.frames = m_frames;
+		if (m_frames == 0)
+			return stats;
+		stats.frame_ms = m_frame_ms / m_frames;
+		stats.fence_wait_ms = m_wait_ms / m_frames;
+		stats.record_ms = m_record_ms / m_frames;
+		stats.gpu_ms = m_gpu_frames > 0 ? m_gpu_ms / m_gpu_frames : 0.0;
+		if (stats.frame_ms > 0.0) {
+			stats.cpu_busy = std::clamp(1.0 - stats.fence_wait_ms / stats.frame_ms, 0.0, 1.0);
+			stats.gpu_busy = std::clamp(stats.gpu_ms / stats.frame_ms, 0.0, 1.0);
+		}
+		return stats;
+	}
+
+	void FrameTimer::PrintStats() const {
+		Stats stats = GetStats();
+		std::cout << "Frame timer: " << m_frames_in_flight << " frames in flight, " << stats.frames << " frames, " << stats.frame_ms << " ms per frame ("
+			<< (stats.frame_ms > 0.0 ? 1000.0 / stats.frame_ms : 0.0) << " fps)" << std::endl;
+		std::cout << "  CPU blocked on fence " << stats.fence_wait_ms << " ms (" << static_cast<int>(stats.cpu_busy * 100.0) << "% busy), GPU "
+			<< stats.gpu_ms << " ms (" << static_cast<int>(stats.gpu_busy * 100.0) << "% busy), recording " << stats.record_ms << " ms" << std::endl;
+	}
+
+	void FrameTimer::CleanUp() {
+		if (m_query_pool != VK_NULL_HANDLE)
+			vkDestroyQueryPool(m_device->Device(), m_query_pool, nullptr);
+		m_query_pool = VK_NULL_HANDLE;
+	}
+}
@@ -0,0 +1,177 @@
+#include "GeometryPool.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+namespace Diffuse {
+	GeometryPool::GeometryPool(GraphicsDevice* device, uint32_t vertex_capacity, uint32_t index_capacity)
+		:m_device(device) {
+		m_vertices.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+		m_vertices.stride = sizeof(Vertex);
+		m_indices.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+		m_indices.stride = sizeof(uint32_t);
+		CreateRange(m_vertices, std::max(vertex_capacity, 1u));
+		CreateRange(m_indices, std::max(index_capacity, 1u));
+	}
+
+	GeometryAllocation GeometryPool::Allocate(const Vertex* vertices, uint32_t vertex_count, const uint32_t* indices, uint32_t index_count) {
+		GeometryAllocation allocation;
+		allocation.vertex_count = vertex_count;
+		allocation.index_count = index_count;
+		if (vertex_count > 0)
+			allocation.vertex_offset = AllocateRange(m_vertices, vertex_count);
+		if (index_count > 0)
+			allocation.first_index = AllocateRange(m_indices, index_count);
+
+		// Vertices and indices go through one staging buffer and one submit
+		VkDeviceSize vertex_bytes = (VkDeviceSize)vertex_count * m_vertices.stride;
+		VkDeviceSize index_bytes = (VkDeviceSize)index_count * m_indices.stride;
+		if (vertex_bytes + index_bytes == 0)
+			return allocation;
+
+		VkBuffer staging;
+		VkDeviceMemory staging_memory;
+		vkUtilities::CreateBuffer(vertex_bytes + index_bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			staging, staging_memory, m_device->PhysicalDevice(), m_device->Device());
+		unsigned char* data = (unsigned char*)vkUtilities::MapBuffer(m_device->Device(), staging);
+		if (vertex_bytes > 0)
+			memcpy(data, vertices, (size_t)vertex_bytes);
+		if (index_bytes > 0)
+			memcpy(data + vertex_bytes, indices, (size_t)index_bytes);
+
+		VkCommandBuffer copy_cmd = m_device->CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		if (vertex_bytes > 0) {
+			VkBufferCopy region{ 0, allocation.vertex_offset * m_vertices.stride, vertex_bytes };
+			vkCmdCopyBuffer(copy_cmd, staging, m_vertices.buffer, 1, &region);
+		}
+		if (index_bytes > 0) {
+			VkBufferCopy region{ vertex_bytes, allocation.first_index * m_indices.stride, index_bytes };
+			vkCmdCopyBuffer(copy_cmd, staging, m_indices.buffer, 1, &region);
+		}
+		m_device->FlushCommandBuffer(copy_cmd, m_device->Queue(), true);
+		vkUtilities::DestroyBuffer(m_device->Device(), staging);
+
+		m_allocations++;
+		return allocation;
+	}
+
+	void GeometryPool::Free(const GeometryAllocation& allocation) {
+		if (allocation.vertex_count == 0 && allocation.index_count == 0)
+			return;
+		if (allocation.vertex_count > 0) {
+			FreeRange(m_vertices, allocation.vertex_offset, allocation.vertex_count);
+			m_vertices.used -= allocation.vertex_count;
+		}
+		if (allocation.index_count > 0) {
+			FreeRange(m_indices, allocation.first_index, allocation.index_count);
+			m_indices.used -= allocation.index_count;
+		}
+		m_allocations--;
+	}
+
+	void GeometryPool::Bind(VkCommandBuffer command_buffer) const {
+		VkDeviceSize offsets[] = { 0 };
+		vkCmdBindVertexBuffers(command_buffer, 0, 1, &m_vertices.buffer, offsets);
+		vkCmdBindIndexBuffer(command_buffer, m_indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+	}
+
+	void GeometryPool::CreateRange(Range& range, uint32_t capacity) {
+		// Shared by every model, the pool is the owner
+		MemoryAllocator::Tag tag(MemoryCategory::Geometry, "geometry pool");
+		VkDeviceMemory memory;
+		vkUtilities::CreateBuffer(capacity * range.stride, range.usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, range.buffer, memory, m_device->PhysicalDevice(), m_device->Device());
+		range.free.clear();
+		range.free[0] = capacity;
+		range.capacity = capacity;
+		range.used = 0;
+	}
+
+	uint32_t GeometryPool::AllocateRange(Range& range, uint32_t count) {
+		// First fit, models are loaded rarely and the list stays short
+		auto it = std::find_if(range.free.begin(), range.free.end(), [count](const auto& entry) { return entry.second >= count; });
+		if (it == range.free.end()) {
+			Grow(range, count);
+			it = std::find_if(range.free.begin(), range.free.end(), [count](const auto& entry) { return entry.second >= count; });
+		}
+		uint32_t offset = it->first;
+		uint32_t remaining = it->second - count;
+		range.free.erase(it);
+		if (remaining > 0)
+			range.free[offset + count] = remaining;
+		range.used += count;
+		return offset;
+	}
+
+	void GeometryPool::FreeRange(Range& range, uint32_t offset, uint32_t count) {
+		auto next = range.free.lower_bound(offset);
+		if (next != range.free.end() && offset + count == next->first) {
+			count += next->second;
+			next = range.free.erase(next);
+		}
+		if (next != range.free.begin()) {
+			auto prev = std::prev(next);
+			if (prev->first + prev->second == offset) {
+				prev->second += count;
+				return;
+			}
+		}
+		range.free[offset] = count;
+	}
+
+	void GeometryPool::Grow(Range& range, uint32_t count) {
+		uint32_t old_capacity = range.capacity;
+		VkBuffer old_buffer = range.buffer;
+		std::map<uint32_t, uint32_t> old_free = std::move(range.free);
+		uint32_t used = range.used;
+
+		CreateRange(range, std::max(old_capacity * 2, old_capacity + count));
+
+		VkCommandBuffer copy_cmd = m_device->CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		VkBufferCopy region{ 0, 0, old_capacity * range.stride };
+		vkCmdCopyBuffer(copy_cmd, old_buffer, range.buffer, 1, &region);
+		m_device->FlushCommandBuffer(copy_cmd, m_device->Queue(), true);
+		// Frames in flight may still draw from the old buffer, it goes once they have finished
+		VkDevice device = m_device->Device();
+		m_device->GetDeletionQueue()->Push([device, old_buffer]() { vkUtilities::DestroyBuffer(device, old_buffer); });
+
+		// Keep the old holes and append the new space, merged with a trailing hole
+		range.free = std::move(old_free);
+		range.used = used;
+		FreeRange(range, old_capacity, range.capacity - old_capacity);
+		m_grows++;
+	}
+
+	GeometryPool::Stats GeometryPool::GetStats() const {
+		Stats stats;
+		stats.allocations = m_allocations;
+		stats.vertices_used = m_vertices.used;
+		stats.vertex_capacity = m_vertices.capacity;
+		stats.indices_used = m_indices.used;
+		stats.index_capacity = m_indices.capacity;
+		stats.free_ranges = static_cast<uint32_t>(m_vertices.free.size() + m_indices.free.size());
+		stats.grows = m_grows;
+		return stats;
+	}
+
+	void GeometryPool::PrintStats() const {
+		Stats stats = GetStats();
+		std::cout << "Geometry pool: " << stats.allocations << " models, "
+			<< stats.vertices_used << "/" << stats.vertex_capacity << " vertices, "
+			<< stats.indices_used << "/" << stats.index_capacity << " indices, "
+			<< stats.free_ranges << " free ranges, " << stats.grows << " grows" << std::endl;
+	}
+
+	void GeometryPool::CleanUp() {
+		for (Range* range : { &m_vertices, &m_indices }) {
+			if (range->buffer != VK_NULL_HANDLE)
+				vkUtilities::DestroyBuffer(m_device->Device(), range->buffer);
+			range->buffer = VK_NULL_HANDLE;
+			range->free.clear();
+			range->used = 0;
+		}
+	}
+}
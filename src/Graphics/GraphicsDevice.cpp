@@ -3,11 +3,13 @@
 #include "Renderer.hpp"
 #include "Texture2D.hpp"
 #include "Scene.hpp"
+#include "Hash.hpp"
 
 #include "stb_image.h"
 #include "tiny_gltf.h"
 
 #include <math.h>
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <set>
@@ -28,6 +30,7 @@
 
 namespace Diffuse {
     GraphicsDevice::GraphicsDevice(Config config) {
+        m_startup_start = std::chrono::high_resolution_clock::now();
         // === Initializing GLFW ===
         {
             int result = glfwInit();
@@ -49,7 +52,14 @@ namespace Diffuse {
             app_info.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
             app_info.pEngineName = "Diffuse";
             app_info.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-            app_info.apiVersion = VK_API_VERSION_1_0;
+            // Vulkan 1.2 brings timeline semaphores, older loaders get a 1.0 instance
+            uint32_t instance_version = VK_API_VERSION_1_0;
+            auto enumerate_instance_version = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+            if (enumerate_instance_version) {
+                enumerate_instance_version(&instance_version);
+            }
+            app_info.apiVersion = instance_version >= VK_API_VERSION_1_2 ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;
+            m_api_version = app_info.apiVersion;
 
             std::vector<const char*> extensions = vkUtilities::GetRequiredExtensions(config.enable_validation_layers); // TODO: add a boolean for if validation layers is enabled
 
@@ -126,10 +136,58 @@ namespace Diffuse {
         vkUtilities::CheckAvailableExtensions(m_physical_device);
 
         // === Create Logical Device ===
+        bool memory_budget = false;
         {
             QueueFamilyIndices indices = vkUtilities::FindQueueFamilies(m_physical_device, m_surface);
+
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(m_physical_device, &properties);
+            VkPhysicalDeviceVulkan12Features supported_features12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES };
+            bool vulkan12 = m_api_version >= VK_API_VERSION_1_2 && properties.apiVersion >= VK_API_VERSION_1_2;
+            if (vulkan12) {
+                VkPhysicalDeviceFeatures2 features2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+                features2.pNext = &supported_features12;
+                vkGetPhysicalDeviceFeatures2(m_physical_device, &features2);
+            }
+            m_features12.timelineSemaphore = supported_features12.timelineSemaphore;
+            // GPU culled buckets are drawn with the count the culling pass wrote when the device can read it
+            m_features12.drawIndirectCount = supported_features12.drawIndirectCount;
+            VkPhysicalDeviceFeatures supported_features;
+            vkGetPhysicalDeviceFeatures(m_physical_device, &supported_features);
+            m_gpu_culling = config.enable_gpu_culling && supported_features.multiDrawIndirect;
+            // Materials index one array of every scene texture, it is bound partially and written while frames are in flight
+            bool bindless = config.enable_bindless_textures && supported_features.shaderSampledImageArrayDynamicIndexing &&
+                supported_features12.runtimeDescriptorArray && supported_features12.descriptorBindingPartiallyBound &&
+                supported_features12.descriptorBindingSampledImageUpdateAfterBind && supported_features12.descriptorBindingUpdateUnusedWhilePending &&
+                supported_features12.descriptorBindingVariableDescriptorCount;
+            if (bindless) {
+                VkPhysicalDeviceVulkan12Properties properties12{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES };
+                VkPhysicalDeviceProperties2 properties2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2 };
+                properties2.pNext = &properties12;
+                vkGetPhysicalDeviceProperties2(m_physical_device, &properties2);
+                m_bindless_capacity = std::min({ config.bindless_texture_capacity, properties12.maxDescriptorSetUpdateAfterBindSampledImages,
+                    properties12.maxPerStageDescriptorUpdateAfterBindSampledImages });
+                m_features12.runtimeDescriptorArray = VK_TRUE;
+                m_features12.descriptorBindingPartiallyBound = VK_TRUE;
+                m_features12.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+                m_features12.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+                m_features12.descriptorBindingVariableDescriptorCount = VK_TRUE;
+            }
+
             std::vector<VkDeviceQueueCreateInfo> queue_create_infos;
             std::set<uint32_t> unique_queue_families = { indices.graphicsFamily.value(), indices.presentFamily.value() };
+            // Runtime uploads hand over to the graphics queue through a timeline semaphore
+            bool transfer_queue = config.enable_transfer_queue && indices.transferFamily.has_value() && m_features12.timelineSemaphore;
+            if (transfer_queue) {
+                m_transfer_family = indices.transferFamily.value();
+                unique_queue_families.insert(m_transfer_family);
+            }
+            // Environment bakes as well, the family may be the transfer one and then both submit to its single queue
+            bool compute_queue = config.enable_compute_queue && indices.computeFamily.has_value() && m_features12.timelineSemaphore;
+            if (compute_queue) {
+                m_compute_family = indices.computeFamily.value();
+                unique_queue_families.insert(m_compute_family);
+            }
             float queue_priority = 1.0f;
             for (uint32_t queue_family : unique_queue_families) {
                 VkDeviceQueueCreateInfo queue_create_info{};
@@ -142,13 +200,24 @@ namespace Diffuse {
 
             VkPhysicalDeviceFeatures device_features{};
             device_features.samplerAnisotropy = VK_TRUE;
+            device_features.multiDrawIndirect = m_gpu_culling ? VK_TRUE : VK_FALSE;
+            device_features.shaderSampledImageArrayDynamicIndexing = m_bindless_capacity > 0 ? VK_TRUE : VK_FALSE;
             VkDeviceCreateInfo device_create_info{};
             device_create_info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
             device_create_info.queueCreateInfoCount = static_cast<uint32_t>(queue_create_infos.size());
             device_create_info.pQueueCreateInfos = queue_create_infos.data();
             device_create_info.pEnabledFeatures = &device_features;
-            device_create_info.enabledExtensionCount = static_cast<uint32_t>(config.required_device_extensions.size());
-            device_create_info.ppEnabledExtensionNames = config.required_device_extensions.data();
+            if (vulkan12) {
+                device_create_info.pNext = &m_features12;
+            }
+            // Memory budget queries go through vkGetPhysicalDeviceMemoryProperties2, core in the 1.2 path
+            std::vector<const char*> device_extensions = config.required_device_extensions;
+            memory_budget = vulkan12 && vkUtilities::CheckDeviceExtensionSupport(m_physical_device, { VK_EXT_MEMORY_BUDGET_EXTENSION_NAME });
+            if (memory_budget) {
+                device_extensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+            }
+            device_create_info.enabledExtensionCount = static_cast<uint32_t>(device_extensions.size());
+            device_create_info.ppEnabledExtensionNames = device_extensions.data();
             if (config.enable_validation_layers) {
                 device_create_info.enabledLayerCount = static_cast<uint32_t>(config.validation_layers.size());
                 device_create_info.ppEnabledLayerNames = config.validation_layers.data();
@@ -161,8 +230,34 @@ namespace Diffuse {
             }
             vkGetDeviceQueue(m_device, indices.graphicsFamily.value(), 0, &m_graphics_queue);
             vkGetDeviceQueue(m_device, indices.presentFamily.value(), 0, &m_present_queue);
+            if (transfer_queue) {
+                vkGetDeviceQueue(m_device, m_transfer_family, 0, &m_transfer_queue);
+            }
+            if (compute_queue) {
+                vkGetDeviceQueue(m_device, m_compute_family, 0, &m_compute_queue);
+            }
         }
 
+        // Samplers, set layouts, pipeline layouts and render passes are shared through this cache
+        m_object_cache = std::make_unique<VulkanObjectCache>(m_device);
+        // Every pipeline, including the compute ones built below, compiles through this cache
+        m_pipeline_cache = std::make_unique<PipelineCache>(m_device, m_physical_device, config.pipeline_cache_path);
+        {
+            uint32_t threads = config.pipeline_compile_threads >= 0 ? static_cast<uint32_t>(config.pipeline_compile_threads)
+                : std::max(std::thread::hardware_concurrency(), 2u) - 1;
+            m_pipeline_compiler = std::make_unique<PipelineCompiler>(m_device, m_pipeline_cache->Get(), threads);
+        }
+
+        // Buffers and images are sub-allocated from shared device memory blocks
+        m_memory_allocator = std::make_unique<MemoryAllocator>(m_device, m_physical_device, config.memory_block_size, memory_budget);
+        m_memory_report_path = config.memory_report_path;
+        m_environment_path = config.environment_path;
+        m_memory_budget_warning = config.enable_memory_budget_warning;
+        m_enable_static_commands = config.enable_static_command_buffers;
+        m_depth_prepass = config.enable_depth_prepass;
+        m_material_variants = config.enable_material_variants;
+        m_memory_budget_limit = config.memory_budget_limit;
+
         // Create Command Pool
         {
             QueueFamilyIndices queueFamilyIndices = vkUtilities::FindQueueFamilies(m_physical_device, m_surface);
@@ -178,8 +273,9 @@ namespace Diffuse {
 
         // === Create Sync Obects ===
         {
+            m_render_ahead = std::clamp(config.frames_in_flight, 1u, s_max_frames_in_flight);
+            std::cout << "Frames in flight: " << m_render_ahead << std::endl;
             m_render_complete_semaphores.resize(m_render_ahead);
-            m_present_complete_semaphores.resize(m_render_ahead);
             m_wait_fences.resize(m_render_ahead);
 
             VkSemaphoreCreateInfo semaphore_info{};
@@ -191,17 +287,73 @@ namespace Diffuse {
 
             for (size_t i = 0; i < m_render_ahead; i++) {
                 if (vkCreateSemaphore(m_device, &semaphore_info, nullptr, &m_render_complete_semaphores[i]) != VK_SUCCESS ||
-                    vkCreateSemaphore(m_device, &semaphore_info, nullptr, &m_present_complete_semaphores[i]) != VK_SUCCESS ||
                     vkCreateFence(m_device, &fence_info, nullptr, &m_wait_fences[i]) != VK_SUCCESS) {
                     LOG_ERROR(false, "Failed to create synchronization objects for a frame!");
                 }
             }
         }
+
+        // === Texture Streaming ===
+        if (config.enable_texture_streaming) {
+            m_texture_streamer = std::make_unique<TextureStreamer>(this, m_render_ahead, config.texture_vram_budget, config.texture_upload_budget);
+        }
+        m_geometry_pool = std::make_unique<GeometryPool>(this, config.geometry_vertex_capacity, config.geometry_index_capacity);
+        m_uniform_ring = std::make_unique<UniformRing>(this, m_render_ahead, config.uniform_ring_frame_size);
+        m_upload_queue = std::make_unique<UploadQueue>(this, m_render_ahead, m_transfer_queue, m_transfer_family,
+            vkUtilities::FindQueueFamilies(m_physical_device, m_surface).graphicsFamily.value());
+        m_deletion_queue = std::make_unique<DeletionQueue>(m_render_ahead);
+        m_frame_timer = std::make_unique<FrameTimer>(this, m_render_ahead, vkUtilities::FindQueueFamilies(m_physical_device, m_surface).graphicsFamily.value());
+        m_render_queue = std::make_unique<RenderQueue>();
+        m_frame_graph = std::make_unique<RenderGraph>(this);
+        m_environment_baker = std::make_unique<EnvironmentBaker>(this, m_compute_queue, m_compute_family, m_graphics_queue,
+            vkUtilities::FindQueueFamilies(m_physical_device, m_surface).graphicsFamily.value(), offscreen_size);
+
+        // Scene recording threads, each chunk of draws has a command pool per frame slot
+        {
+            uint32_t threads = config.recording_threads >= 0 ? static_cast<uint32_t>(config.recording_threads)
+                : std::min(std::max(std::thread::hardware_concurrency(), 1u) - 1, 7u);
+            m_worker_pool = std::make_unique<Utils::WorkerPool>(threads);
+            m_culler = std::make_unique<FrustumCuller>(m_worker_pool.get());
+            std::cout << "Recording threads: " << m_worker_pool->GetWorkerCount() << std::endl;
+
+            VkCommandPoolCreateInfo pool_info{};
+            pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+            pool_info.queueFamilyIndex = vkUtilities::FindQueueFamilies(m_physical_device, m_surface).graphicsFamily.value();
+            m_recording_pools.resize(m_render_ahead * m_worker_pool->GetWorkerCount());
+            for (auto& pool : m_recording_pools) {
+                if (vkCreateCommandPool(m_device, &pool_info, nullptr, &pool) != VK_SUCCESS) {
+                    LOG_ERROR(false, "Failed to create recording command pool!");
+                }
+            }
+        }
+        if (m_gpu_culling) {
+            bool occlusion = false;
+            if (config.enable_occlusion_culling) {
+                // The depth pyramid is reduced from the sampled depth buffer
+                VkFormatProperties format_properties;
+                vkGetPhysicalDeviceFormatProperties(m_physical_device, vkUtilities::FindDepthFormat(m_physical_device), &format_properties);
+                occlusion = (format_properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+            }
+            m_gpu_culler = std::make_unique<GpuCuller>(this, m_render_ahead, m_features12.drawIndirectCount, occlusion);
+            if (occlusion) {
+                m_depth_pyramid = std::make_unique<DepthPyramid>(this);
+            }
+        }
+        if (m_bindless_capacity > 0) {
+            m_bindless_textures = std::make_unique<BindlessTextures>(this, m_render_ahead, m_bindless_capacity);
+            std::cout << "Bindless textures: " << m_bindless_capacity << " elements" << std::endl;
+        }
+        m_texture_registry = std::make_unique<TextureRegistry>(this, config.enable_texture_dedup);
+        m_texture_packer = std::make_unique<TexturePacker>(this, config.texture_atlas_max_extent, config.texture_atlas_page_extent);
         // SUCCESS
     }
 
     void GraphicsDevice::Setup(std::shared_ptr<Scene> scene) {
         m_active_scene = scene;
+        m_texture_registry->ReportScene();
+        // Small textures of the loaded models are still on the CPU, place them before any descriptor references them
+        m_texture_packer->Pack(m_graphics_queue);
 
         TextureSampler sampler{};
         sampler.mag_filter = VK_FILTER_LINEAR;
@@ -209,11 +361,13 @@ namespace Diffuse {
         sampler.address_modeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
         sampler.address_modeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
         sampler.address_modeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
-        //hdr = new Texture2D("../assets/skybox/Shangai/shangai.hdr", VK_FORMAT_R32G32B32A32_SFLOAT, sampler, 0, this);
-        hdr = new Texture2D("../assets/skybox/Desert/desert.hdr", VK_FORMAT_R32G32B32A32_SFLOAT, sampler, 0, this);
-        //hdr = new Texture2D("../assets/skybox/Apartment/Apartment.hdr", VK_FORMAT_R32G32B32A32_SFLOAT, sampler, 0, this);
-        //hdr = new Texture2D("../assets/skybox/misty_morning.hdr", VK_FORMAT_R32G32B32A32_SFLOAT, sampler, 0, this);
-        m_white_texture = new Texture2D("NA", VK_FORMAT_R8G8B8A8_UNORM, sampler, 0, this, true);
+        // The environment bakes while the rest of the setup runs
+        auto ibl_start = std::chrono::high_resolution_clock::now();
+        m_environment_baker->Bake(m_environment_path);
+        {
+            MemoryAllocator::Tag tag(MemoryCategory::Texture, "white texture");
+            m_white_texture = new Texture2D("NA", VK_FORMAT_R8G8B8A8_UNORM, sampler, 0, this, true);
+        }
         // === Create Swap Chain ===
         m_swapchain = std::make_unique<Swapchain>(this);
         m_swapchain->Initialize();
@@ -272,15 +426,62 @@ namespace Diffuse {
             render_pass_info.dependencyCount = 1;
             render_pass_info.pDependencies = &dependency;
 
-            if (vkCreateRenderPass(m_device, &render_pass_info, nullptr, &m_render_pass) != VK_SUCCESS) {
-                LOG_ERROR(false, "Failed to create render pass!");
+            m_render_pass = m_object_cache->GetRenderPass(render_pass_info);
+
+            if (m_depth_pyramid) {
+                // The early pass stores the depth for the pyramid and leaves the color for the late pass
+                color_attachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+                depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+                std::array<VkSubpassDependency, 2> early_dependencies = { dependency, VkSubpassDependency{} };
+                early_dependencies[1].srcSubpass = 0;
+                early_dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+                early_dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+                early_dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                early_dependencies[1].dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                early_dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+                attachments = { color_attachment, depth_attachment };
+                render_pass_info.dependencyCount = static_cast<uint32_t>(early_dependencies.size());
+                render_pass_info.pDependencies = early_dependencies.data();
+                m_early_render_pass = m_object_cache->GetRenderPass(render_pass_info);
+
+                // The late pass loads both, after the compute passes read the depth
+                color_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                color_attachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+                color_attachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+                depth_attachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                depth_attachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+                depth_attachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+                depth_attachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+                VkSubpassDependency late_dependency{};
+                late_dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+                late_dependency.dstSubpass = 0;
+                late_dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                late_dependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+                late_dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+                late_dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+                    VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+                attachments = { color_attachment, depth_attachment };
+                render_pass_info.dependencyCount = 1;
+                render_pass_info.pDependencies = &late_dependency;
+                m_late_render_pass = m_object_cache->GetRenderPass(render_pass_info);
             }
         }
         
         // === Create Depth Resource ===
         VkFormat depthFormat = vkUtilities::FindDepthFormat(m_physical_device);
-        vkUtilities::CreateImage(m_swapchain->GetExtentWidth(), m_swapchain->GetExtentHeight(), m_device, m_physical_device, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depth_image, m_depth_image_memory, 1, 1);
+        m_depth_format = depthFormat;
+        {
+            MemoryAllocator::Tag tag(MemoryCategory::Attachment, "depth buffer");
+            VkImageUsageFlags depth_usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (m_depth_pyramid ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+            vkUtilities::CreateImage(m_swapchain->GetExtentWidth(), m_swapchain->GetExtentHeight(), m_device, m_physical_device, depthFormat, VK_IMAGE_TILING_OPTIMAL, depth_usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depth_image, m_depth_image_memory, 1, 1);
+        }
         m_depth_image_view = vkUtilities::CreateImageView(m_depth_image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, m_device, 1, 0, 1);
+        if (m_depth_pyramid) {
+            m_depth_pyramid->Resize(m_depth_image_view, m_swapchain->GetExtentWidth(), m_swapchain->GetExtentHeight());
+            m_gpu_culler->SetDepthPyramid(m_depth_pyramid->GetView(), m_depth_pyramid->GetSampler(), m_depth_pyramid->GetWidth(), m_depth_pyramid->GetHeight(),
+                m_depth_pyramid->GetLevelCount());
+        }
 
         // === Create Framebuffers ===
         {
@@ -307,9 +508,11 @@ namespace Diffuse {
             }
         }
 
+        CreatePresentSemaphores();
+
         // === Create Command Buffers ===
         {
-            m_command_buffers.resize(m_swapchain->GetSwapchainImages().size());
+            m_command_buffers.resize(m_render_ahead);
             VkCommandBufferAllocateInfo alloc_info{};
             alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
             alloc_info.commandPool = m_command_pool;
@@ -320,26 +523,28 @@ namespace Diffuse {
                 LOG_ERROR(false, "Failed to allocate command buffers!");
             }
         }
+        CreateStaticCommandBuffers();
 
-        CreateUniformBuffer(scene);
-
+        // The uniform buffers are bound with per object offsets into the uniform ring
         std::vector<VkDescriptorSetLayoutBinding> set_layout_bindings_model = {
-            { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,   nullptr },
-            { 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,         1, VK_SHADER_STAGE_FRAGMENT_BIT,   nullptr },
+            { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT,   nullptr },
+            { 1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_FRAGMENT_BIT,   nullptr },
             { 2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
             { 3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
             { 4, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
             { 5, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
             { 6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
         };
+        // Material textures come from the bindless array in set 3 instead
+        if (m_bindless_textures) {
+            set_layout_bindings_model.resize(2);
+        }
 
         VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI_model{};
         descriptorSetLayoutCI_model.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
         descriptorSetLayoutCI_model.pBindings = set_layout_bindings_model.data();
         descriptorSetLayoutCI_model.bindingCount = set_layout_bindings_model.size();
-        if (vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutCI_model, nullptr, &m_descriptorSetLayouts.model)) {
-            throw std::runtime_error("Failed to create descriptor pool");
-        }
+        m_descriptorSetLayouts.model = m_object_cache->GetDescriptorSetLayout(descriptorSetLayoutCI_model);
 
         std::vector<VkDescriptorSetLayoutBinding> set_layout_bindings_mat = {
             { 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
@@ -349,9 +554,7 @@ namespace Diffuse {
         descriptorSetLayoutCI_mat.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
         descriptorSetLayoutCI_mat.pBindings = set_layout_bindings_mat.data();
         descriptorSetLayoutCI_mat.bindingCount = set_layout_bindings_mat.size();
-        if (vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutCI_mat, nullptr, &m_descriptorSetLayouts.materialBuffer)) {
-            throw std::runtime_error("Failed to create descriptor pool");
-        }
+        m_descriptorSetLayouts.materialBuffer = m_object_cache->GetDescriptorSetLayout(descriptorSetLayoutCI_mat);
 
         uint32_t imageSamplerCount = 0;
         uint32_t materialCount = 0;
@@ -368,48 +571,67 @@ namespace Diffuse {
             }
         }
 
+        // Material sets exist once per frame in flight, not per swapchain image
+        const uint32_t setCopies = m_render_ahead;
+        // The skybox and IBL sets have a spare each to switch environments
+        const uint32_t environmentSets = 2 * 2;
         const std::array<VkDescriptorPoolSize, 4> poolSizes = { {
-            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 8 + imageSamplerCount * m_swapchain->GetImageCount() + 2 },
-            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, (8 + meshCount) * m_swapchain->GetImageCount() },
+            { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 12 + imageSamplerCount * setCopies + 2 },
+            { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 8 + 2 * materialCount * setCopies },
             { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE , 8 },
             { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER , meshCount },
         } };
 
         VkDescriptorPoolCreateInfo createInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
-        createInfo.maxSets = (2 * (8 + meshCount) + materialCount) * m_swapchain->GetImageCount();
+        createInfo.maxSets = (2 * (8 + meshCount) + materialCount) * setCopies + environmentSets;
         createInfo.poolSizeCount = (uint32_t)poolSizes.size();
         createInfo.pPoolSizes = poolSizes.data();
         if (vkCreateDescriptorPool(m_device, &createInfo, nullptr, &m_descriptor_pools.scene)) {
             throw std::runtime_error("Failed to create descriptor pool");
         }
 
-        VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {};
-        pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
-        if (vkCreatePipelineCache(m_device, &pipelineCacheCreateInfo, nullptr, &m_pipeline_cache)) {
-            throw std::runtime_error("Failed to create descriptor pool");
+        // With bindless textures only the uniform buffers are left in set 0, every material shares one set per frame slot
+        if (m_bindless_textures) {
+            VkDescriptorBufferInfo bufferInfo = m_uniform_ring->GetDescriptor(sizeof(UBO));
+            VkDescriptorBufferInfo shaderValuesBufferInfo = m_uniform_ring->GetDescriptor(sizeof(UBOShaderValues));
+            std::vector<VkDescriptorSetLayout> layouts(m_render_ahead, m_descriptorSetLayouts.model);
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = m_descriptor_pools.scene;
+            allocInfo.descriptorSetCount = m_render_ahead;
+            allocInfo.pSetLayouts = layouts.data();
+            m_descriptor_sets.scene.resize(m_render_ahead);
+            if (vkAllocateDescriptorSets(m_device, &allocInfo, m_descriptor_sets.scene.data()) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate descriptor sets!");
+            }
+            for (VkDescriptorSet descriptor_set : m_descriptor_sets.scene) {
+                std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+                descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                descriptorWrites[0].dstSet = descriptor_set;
+                descriptorWrites[0].dstBinding = 0;
+                descriptorWrites[0].descriptorCount = 1;
+                descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+                descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                descriptorWrites[1].dstSet = descriptor_set;
+                descriptorWrites[1].dstBinding = 1;
+                descriptorWrites[1].descriptorCount = 1;
+                descriptorWrites[1].pBufferInfo = &shaderValuesBufferInfo;
+
+                vkUpdateDescriptorSets(m_device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+            }
         }
 
+        uint32_t materialSetCount = 0;
+        uint32_t sharedMaterialSetCount = 0;
+        // Every material references the uniform ring with dynamic offsets, so equal textures mean an equal descriptor set across objects
+        std::vector<std::pair<std::vector<VkDescriptorImageInfo>, std::vector<VkDescriptorSet>>> material_sets;
         for (auto& scene_object : scene->GetSceneObjects()) {
             for (size_t i = 0; i < scene_object->p_model.GetMaterials().size(); i++) {
-                VkDescriptorSetAllocateInfo allocInfo{};
-                allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-                allocInfo.descriptorPool = m_descriptor_pools.scene;
-                allocInfo.descriptorSetCount = 1;
-                allocInfo.pSetLayouts = &m_descriptorSetLayouts.model;
-
-                if (vkAllocateDescriptorSets(m_device, &allocInfo, &(scene_object->p_model.GetMaterial(i).descriptorSet)) != VK_SUCCESS) {
-                    throw std::runtime_error("failed to allocate descriptor sets!");
-                }
-
-                VkDescriptorBufferInfo bufferInfo{};
-                bufferInfo.buffer = scene_object->p_ubo.uniformBuffers[0];
-                bufferInfo.offset = 0;
-                bufferInfo.range = sizeof(UBO);
-
-                VkDescriptorBufferInfo shaderValuesBufferInfo{};
-                shaderValuesBufferInfo.buffer = scene_object->p_shader_values_ubo.uniformBuffers[0];
-                shaderValuesBufferInfo.offset = 0;
-                shaderValuesBufferInfo.range = sizeof(UBOShaderValues);
+                VkDescriptorBufferInfo bufferInfo = m_uniform_ring->GetDescriptor(sizeof(UBO));
+                VkDescriptorBufferInfo shaderValuesBufferInfo = m_uniform_ring->GetDescriptor(sizeof(UBOShaderValues));
 
                 if (scene_object->p_model.GetMaterial(i).baseColorTexture == nullptr) {
                     scene_object->p_model.GetMaterial(i).baseColorTexture = m_white_texture;
@@ -440,67 +662,82 @@ namespace Diffuse {
                     scene_object->p_model.GetMaterial(i).emissiveTexture->m_descriptor,
                 };
 
-                std::vector<VkWriteDescriptorSet> descriptorWrites;
-                descriptorWrites.resize(7);
-                descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                descriptorWrites[0].dstSet = scene_object->p_model.GetMaterial(i).descriptorSet;
-                descriptorWrites[0].dstBinding = 0;
-                descriptorWrites[0].descriptorCount = 1;
-                descriptorWrites[0].pBufferInfo = &bufferInfo;
+                auto shared = std::find_if(material_sets.begin(), material_sets.end(), [&](const auto& material_set) {
+                    return std::equal(image_descriptors.begin(), image_descriptors.end(), material_set.first.begin(), [](const VkDescriptorImageInfo& a, const VkDescriptorImageInfo& b) {
+                        return a.sampler == b.sampler && a.imageView == b.imageView && a.imageLayout == b.imageLayout;
+                    });
+                });
+                Material& material = scene_object->p_model.GetMaterial(i);
+                if (m_bindless_textures) {
+                    material.descriptorSets = m_descriptor_sets.scene;
+                    sharedMaterialSetCount++;
+                    continue;
+                }
+                if (shared != material_sets.end()) {
+                    material.descriptorSets = shared->second;
+                    sharedMaterialSetCount++;
+                    continue;
+                }
 
-                descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-                descriptorWrites[1].dstSet = scene_object->p_model.GetMaterial(i).descriptorSet;
-                descriptorWrites[1].dstBinding = 1;
-                descriptorWrites[1].descriptorCount = 1;
-                descriptorWrites[1].pBufferInfo = &shaderValuesBufferInfo;
+                // One copy per frame in flight, the streamer rewrites a frame's copy once that frame is no longer executing
+                std::vector<VkDescriptorSetLayout> layouts(m_render_ahead, m_descriptorSetLayouts.model);
+                VkDescriptorSetAllocateInfo allocInfo{};
+                allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+                allocInfo.descriptorPool = m_descriptor_pools.scene;
+                allocInfo.descriptorSetCount = m_render_ahead;
+                allocInfo.pSetLayouts = layouts.data();
+
+                material.descriptorSets.resize(m_render_ahead);
+                if (vkAllocateDescriptorSets(m_device, &allocInfo, material.descriptorSets.data()) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to allocate descriptor sets!");
+                }
+                material_sets.push_back({ image_descriptors, material.descriptorSets });
+                materialSetCount++;
+
+                for (uint32_t frame = 0; frame < m_render_ahead; frame++) {
+                    VkDescriptorSet descriptor_set = material.descriptorSets[frame];
+                    std::vector<VkWriteDescriptorSet> descriptorWrites;
+                    descriptorWrites.resize(7);
+                    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                    descriptorWrites[0].dstSet = descriptor_set;
+                    descriptorWrites[0].dstBinding = 0;
+                    descriptorWrites[0].descriptorCount = 1;
+                    descriptorWrites[0].pBufferInfo = &bufferInfo;
+
+                    descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                    descriptorWrites[1].dstSet = descriptor_set;
+                    descriptorWrites[1].dstBinding = 1;
+                    descriptorWrites[1].descriptorCount = 1;
+                    descriptorWrites[1].pBufferInfo = &shaderValuesBufferInfo;
+
+                    // Bindings 2 to 6 are the material textures
+                    for (uint32_t t = 0; t < 5; t++) {
+                        descriptorWrites[2 + t].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                        descriptorWrites[2 + t].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                        descriptorWrites[2 + t].dstSet = descriptor_set;
+                        descriptorWrites[2 + t].dstBinding = 2 + t;
+                        descriptorWrites[2 + t].descriptorCount = 1;
+                        descriptorWrites[2 + t].pImageInfo = &image_descriptors[t];
+                    }
 
-                descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                descriptorWrites[2].dstSet = scene_object->p_model.GetMaterial(i).descriptorSet;
-                descriptorWrites[2].dstBinding = 2;
-                descriptorWrites[2].descriptorCount = 1;
-                descriptorWrites[2].pImageInfo = &image_descriptors[0];
-
-                descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                descriptorWrites[3].dstSet = scene_object->p_model.GetMaterial(i).descriptorSet;
-                descriptorWrites[3].dstBinding = 3;
-                descriptorWrites[3].descriptorCount = 1;
-                descriptorWrites[3].pImageInfo = &image_descriptors[1];
-
-                descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                descriptorWrites[4].dstSet = scene_object->p_model.GetMaterial(i).descriptorSet;
-                descriptorWrites[4].dstBinding = 4;
-                descriptorWrites[4].descriptorCount = 1;
-                descriptorWrites[4].pImageInfo = &image_descriptors[2];
-
-                descriptorWrites[5].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[5].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                descriptorWrites[5].dstSet = scene_object->p_model.GetMaterial(i).descriptorSet;
-                descriptorWrites[5].dstBinding = 5;
-                descriptorWrites[5].descriptorCount = 1;
-                descriptorWrites[5].pImageInfo = &image_descriptors[3];
-
-                descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-                descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                descriptorWrites[6].dstSet = scene_object->p_model.GetMaterial(i).descriptorSet;
-                descriptorWrites[6].dstBinding = 6;
-                descriptorWrites[6].descriptorCount = 1;
-                descriptorWrites[6].pImageInfo = &image_descriptors[4];
+                    vkUpdateDescriptorSets(m_device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
 
-                vkUpdateDescriptorSets(m_device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+                    if (m_texture_streamer) {
+                        m_texture_streamer->RegisterDescriptor(material.baseColorTexture, descriptor_set, 2, frame);
+                        m_texture_streamer->RegisterDescriptor(material.metallicRoughnessTexture, descriptor_set, 3, frame);
+                        m_texture_streamer->RegisterDescriptor(material.normalTexture, descriptor_set, 4, frame);
+                        m_texture_streamer->RegisterDescriptor(material.occlusionTexture, descriptor_set, 5, frame);
+                        m_texture_streamer->RegisterDescriptor(material.emissiveTexture, descriptor_set, 6, frame);
+                    }
+                }
             }
         }
+        std::cout << "Material descriptor sets: " << materialSetCount << " allocated, " << sharedMaterialSetCount << " shared" << std::endl;
 
-        SetupIBL();
-        SetupIBLCubemaps(scene);
-        SetupSkybox(scene->GetSkybox());
-        GenerateBRDF_LUT();
-
-        // IBL cubemaps
+        // The scene and skybox pipelines only need their layouts and render passes, they compile on the pipeline compiler's
+        // threads while the BRDF LUT is generated. It waits for its own pipeline only
         {
             std::vector<VkDescriptorSetLayoutBinding> set_layout_bindings = {
                 { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr },
@@ -512,42 +749,71 @@ namespace Diffuse {
             descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
             descriptorSetLayoutCI.pBindings = set_layout_bindings.data();
             descriptorSetLayoutCI.bindingCount = set_layout_bindings.size();
-            if (vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutCI, nullptr, &m_descriptorSetLayouts.ibl)) {
-                throw std::runtime_error("Failed to create descriptor pool");
+            m_descriptorSetLayouts.ibl = m_object_cache->GetDescriptorSetLayout(descriptorSetLayoutCI);
+
+            std::vector<VkDescriptorSetLayout> set_layouts = {
+                m_descriptorSetLayouts.model,
+                m_descriptorSetLayouts.ibl,
+                m_descriptorSetLayouts.materialBuffer
+            };
+            if (m_bindless_textures) {
+                set_layouts.push_back(m_bindless_textures->GetSetLayout());
             }
+            VkPipelineLayoutCreateInfo pipelineLayoutCI{};
+            pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            pipelineLayoutCI.setLayoutCount = set_layouts.size();
+            pipelineLayoutCI.pSetLayouts = set_layouts.data();
+            VkPushConstantRange pushConstantRange{};
+            pushConstantRange.size = sizeof(uint32_t);
+            pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+            pipelineLayoutCI.pushConstantRangeCount = 1;
+            pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
+            m_pipeline_layouts.scene = m_object_cache->GetPipelineLayout(pipelineLayoutCI);
+        }
+        CreateGraphicsPipeline();
+        CreateSkyboxPipeline();
+        SetupMaterialVariants(scene);
+
+        // The BRDF LUT on the graphics queue while the environment maps bake, on the compute queue when there is one
+        {
+            RenderGraph graph(this);
+            GenerateBRDF_LUT(graph);
+            graph.Compile();
+            graph.Submit(m_graphics_queue);
+            graph.PrintStats("BRDF LUT");
+            // The first frame acquires the maps, the scene is not drawn without them
+            m_environment_baker->Wait();
+            auto ibl_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - ibl_start).count();
+            std::cout << "Generating the IBL maps took " << ibl_ms << " ms" << std::endl;
+        }
+        SetupSkybox(scene->GetSkybox());
 
+        // IBL cubemaps, written when a bake is acquired. The BRDF LUT stays the same
+        {
+            VkDescriptorSetLayout layouts[] = { m_descriptorSetLayouts.ibl, m_descriptorSetLayouts.ibl };
+            VkDescriptorSet sets[2];
             VkDescriptorSetAllocateInfo allocInfo{};
             allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
             allocInfo.descriptorPool = m_descriptor_pools.scene;
-            allocInfo.descriptorSetCount = 1;
-            allocInfo.pSetLayouts = &m_descriptorSetLayouts.ibl;
+            allocInfo.descriptorSetCount = 2;
+            allocInfo.pSetLayouts = layouts;
 
-            if (vkAllocateDescriptorSets(m_device, &allocInfo, &m_descriptor_sets.ibl) != VK_SUCCESS) {
+            if (vkAllocateDescriptorSets(m_device, &allocInfo, sets) != VK_SUCCESS) {
                 throw std::runtime_error("failed to allocate descriptor sets!");
             }
+            m_descriptor_sets.ibl = sets[0];
+            m_descriptor_sets.ibl_spare = sets[1];
 
             std::vector<VkWriteDescriptorSet> descriptorWrites;
-            descriptorWrites.resize(3);
-            descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWrites[0].dstSet = m_descriptor_sets.ibl;
-            descriptorWrites[0].dstBinding = 0;
-            descriptorWrites[0].descriptorCount = 1;
-            descriptorWrites[0].pImageInfo = &m_Irradiance_cubemap.descriptor;
-
-            descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWrites[1].dstSet = m_descriptor_sets.ibl;
-            descriptorWrites[1].dstBinding = 1;
-            descriptorWrites[1].descriptorCount = 1;
-            descriptorWrites[1].pImageInfo = &m_Prefilter_cubemap.descriptor;
-
-            descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            descriptorWrites[2].dstSet = m_descriptor_sets.ibl;
-            descriptorWrites[2].dstBinding = 2;
-            descriptorWrites[2].descriptorCount = 1;
-            descriptorWrites[2].pImageInfo = &m_brdf_lut.descriptor;
+            descriptorWrites.resize(2);
+            for (uint32_t i = 0; i < 2; i++) {
+                descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+                descriptorWrites[i].dstSet = sets[i];
+                descriptorWrites[i].dstBinding = 2;
+                descriptorWrites[i].descriptorCount = 1;
+                descriptorWrites[i].pImageInfo = &m_brdf_lut.descriptor;
+            }
 
             vkUpdateDescriptorSets(m_device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
         }
@@ -579,6 +845,10 @@ namespace Diffuse {
                     shaderMaterial.roughnessFactor = material.roughnessFactor;
                     shaderMaterial.PhysicalDescriptorTextureSet = material.metallicRoughnessTexture != nullptr ? material.texCoordSets.metallicRoughness : -1;
                     shaderMaterial.colorTextureSet = material.baseColorTexture != nullptr ? material.texCoordSets.baseColor : -1;
+                    // -2 = occlusion comes from the red channel of the metallic roughness fetch
+                    if (material.occlusionInMetallicRoughness) {
+                        shaderMaterial.occlusionTextureSet = -2;
+                    }
                 }
 
                 if (material.pbrWorkflows.specularGlossiness) {
@@ -590,16 +860,31 @@ namespace Diffuse {
                     shaderMaterial.specularFactor = glm::vec4(material.extension.specularFactor, 1.0f);
                 }
 
+                shaderMaterial.baseColorAtlasRect = material.baseColorTexture->m_atlas_rect;
+                shaderMaterial.physicalDescriptorAtlasRect = material.metallicRoughnessTexture->m_atlas_rect;
+                shaderMaterial.normalAtlasRect = material.normalTexture->m_atlas_rect;
+                shaderMaterial.occlusionAtlasRect = material.occlusionTexture->m_atlas_rect;
+                shaderMaterial.emissiveAtlasRect = material.emissiveTexture->m_atlas_rect;
+
+                // Same textures as bindings 2 to 6 of the per material sets
+                if (m_bindless_textures) {
+                    shaderMaterial.baseColorTexture = m_bindless_textures->Add(material.baseColorTexture);
+                    shaderMaterial.physicalDescriptorTexture = m_bindless_textures->Add(material.metallicRoughnessTexture);
+                    shaderMaterial.normalTexture = m_bindless_textures->Add(material.normalTexture);
+                    shaderMaterial.occlusionTexture = m_bindless_textures->Add(material.occlusionTexture);
+                    shaderMaterial.emissiveTexture = m_bindless_textures->Add(material.emissiveTexture);
+                }
+
                 shaderMaterials.push_back(shaderMaterial);
             }
 
             if (scene_object->p_shader_material_buffer.buffer != VK_NULL_HANDLE) {
-                vkDestroyBuffer(m_device, scene_object->p_shader_material_buffer.buffer, nullptr);
-                vkFreeMemory(m_device, scene_object->p_shader_material_buffer.memory, nullptr);
+                vkUtilities::DestroyBuffer(m_device, scene_object->p_shader_material_buffer.buffer);
                 scene_object->p_shader_material_buffer.buffer = VK_NULL_HANDLE;
                 scene_object->p_shader_material_buffer.memory = VK_NULL_HANDLE;
             }
             VkDeviceSize bufferSize = shaderMaterials.size() * sizeof(ShaderMaterial);
+            MemoryAllocator::Tag tag(MemoryCategory::Uniform, scene_object->p_model.GetPath());
             Buffer stagingBuffer;
             VK_CHECK_RESULT(vkUtilities::CreateBuffer(m_device, m_physical_device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, bufferSize,
                 &stagingBuffer.buffer, &stagingBuffer.memory, shaderMaterials.data()));
@@ -613,8 +898,7 @@ namespace Diffuse {
             vkCmdCopyBuffer(copyCmd, stagingBuffer.buffer, scene_object->p_shader_material_buffer.buffer, 1, &copyRegion);
             FlushCommandBuffer(copyCmd, m_graphics_queue, true);
             //
-            vkDestroyBuffer(m_device, stagingBuffer.buffer, nullptr);
-            vkFreeMemory(m_device, stagingBuffer.memory, nullptr);
+            vkUtilities::DestroyBuffer(m_device, stagingBuffer.buffer);
             stagingBuffer.buffer = VK_NULL_HANDLE;
             stagingBuffer.memory = VK_NULL_HANDLE;
 
@@ -645,998 +929,18 @@ namespace Diffuse {
             vkUpdateDescriptorSets(m_device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
         }
 
-        std::vector<VkDescriptorSetLayout> set_layouts = {
-            m_descriptorSetLayouts.model,
-            m_descriptorSetLayouts.ibl,
-            m_descriptorSetLayouts.materialBuffer
-        };
-        VkPipelineLayoutCreateInfo pipelineLayoutCI{};
-        pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-        pipelineLayoutCI.setLayoutCount = set_layouts.size();
-        pipelineLayoutCI.pSetLayouts = set_layouts.data();
-        VkPushConstantRange pushConstantRange{};
-        pushConstantRange.size = sizeof(uint32_t);
-        pushConstantRange.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-        pipelineLayoutCI.pushConstantRangeCount = 1;
-        pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
-        if (vkCreatePipelineLayout(m_device, &pipelineLayoutCI, nullptr, &m_pipeline_layouts.scene) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create pipeline layout!");
-        }
-        CreateGraphicsPipeline();
-    }
-
-    void GraphicsDevice::SetupIBL() {
-        // --------------- Converting equirectangular to cubemap ------------------
-        uint32_t width = offscreen_size;
-        uint32_t height = offscreen_size;
-        VkFormat format = VK_FORMAT_R32G32B32A32_SFLOAT;
-        // Cubemap image
-        {
-            VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-            // Cube map image description
-            VkImageCreateInfo imageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
-            imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageCreateInfo.format = format;
-            imageCreateInfo.extent = { width, height, 1 };
-            imageCreateInfo.mipLevels = 1;
-            imageCreateInfo.arrayLayers = 6;
-            imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-            imageCreateInfo.usage = usage;
-            imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageCreateInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-            if (vkCreateImage(m_device, &imageCreateInfo, nullptr, &m_cubemap.image) != VK_SUCCESS) {
-                assert(false);
-            }
-
-            VkMemoryRequirements memReqs{};
-            vkGetImageMemoryRequirements(m_device, m_cubemap.image, &memReqs);
-            VkMemoryAllocateInfo memAlloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-            memAlloc.allocationSize = memReqs.size;
-            memAlloc.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physical_device);
-
-            if (vkAllocateMemory(m_device, &memAlloc, nullptr, &m_cubemap.memory) != VK_SUCCESS) {
-                assert(false);
-            }
-            if (vkBindImageMemory(m_device, m_cubemap.image, m_cubemap.memory, 0) != VK_SUCCESS) {
-                assert(false);
-            }
-
-            m_cubemap.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-            // Create sampler
-            VkSamplerCreateInfo sampler_create_info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-            sampler_create_info.magFilter = VK_FILTER_LINEAR;
-            sampler_create_info.minFilter = VK_FILTER_LINEAR;
-            sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-            sampler_create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler_create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler_create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler_create_info.mipLodBias = 0.0f;
-            sampler_create_info.maxAnisotropy = 1.0f;
-            sampler_create_info.compareOp = VK_COMPARE_OP_NEVER;
-            sampler_create_info.minLod = 0.0f;
-            sampler_create_info.maxLod = 1.0f;
-            sampler_create_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-            if (vkCreateSampler(m_device, &sampler_create_info, nullptr, &m_cubemap.sampler) != VK_SUCCESS) {
-                assert(false);
-            }
-
-            // Create image view
-            VkImageViewCreateInfo view_create_info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
-            view_create_info.image = m_cubemap.image;
-            view_create_info.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-            view_create_info.format = format;
-            view_create_info.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
-            view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            view_create_info.subresourceRange.baseMipLevel = 0;
-            view_create_info.subresourceRange.levelCount = 1;
-            view_create_info.subresourceRange.baseArrayLayer = 0;
-            view_create_info.subresourceRange.layerCount = 6;
-            if (vkCreateImageView(m_device, &view_create_info, nullptr, &m_cubemap.view) != VK_SUCCESS) {
-                assert(false);
-            }
-
-        } // END - Cubemap image
-
-        {
-            VkSamplerCreateInfo createInfo = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-
-            // Linear, non-anisotropic sampler, wrap address mode (post processing compute shaders)
-            createInfo.minFilter = VK_FILTER_LINEAR;
-            createInfo.magFilter = VK_FILTER_LINEAR;
-            createInfo.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
-            if (vkCreateSampler(m_device, &createInfo, nullptr, &computeSampler) != VK_SUCCESS) {
-                throw std::runtime_error("Failed to create pre-processing sampler");
-            }
-
-            {
-                uint32_t kEnvMapLevels = 1;
-                std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindings = {
-                    { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, &computeSampler },
-                    { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
-                    { 2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, kEnvMapLevels - 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
-                };
-
-                VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
-                descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-                descriptorSetLayoutCI.pBindings = descriptorSetLayoutBindings.data();
-                descriptorSetLayoutCI.bindingCount = descriptorSetLayoutBindings.size();
-                if (vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutCI, nullptr, &m_descriptorSetLayouts.compute)) {
-                    throw std::runtime_error("Failed to create descriptor pool");
-                }
-
-                VkDescriptorSetAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
-                allocateInfo.descriptorPool = m_descriptor_pools.scene;
-                allocateInfo.descriptorSetCount = 1;
-                allocateInfo.pSetLayouts = &m_descriptorSetLayouts.compute;
-                if (vkAllocateDescriptorSets(m_device, &allocateInfo, &m_descriptor_sets.compute) != VK_SUCCESS) {
-                    throw std::runtime_error("Failed to allocate descriptor set");
-                }
-
-                const std::vector<VkDescriptorSetLayout> pipelineSetLayouts = {
-                    m_descriptorSetLayouts.compute,
-                };
-                const std::vector<VkPushConstantRange> pipelinePushConstantRanges = {
-                    { VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SpecularFilterPushConstants) },
-                };
-
-                VkPipelineLayoutCreateInfo pipelineLayoutCI{};
-                pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-                pipelineLayoutCI.setLayoutCount = 1;
-                pipelineLayoutCI.pSetLayouts = &m_descriptorSetLayouts.compute;
-                if (vkCreatePipelineLayout(m_device, &pipelineLayoutCI, nullptr, &m_pipeline_layouts.compute) != VK_SUCCESS) {
-                    throw std::runtime_error("failed to create pipeline layout!");
-                }
-            }
-
-            auto compute_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/equirect_to_cube_cs.spv");
-            VkShaderModule compute_shader_module = vkUtilities::CreateShaderModule(compute_shader_code, m_device);
-
-            const VkPipelineShaderStageCreateInfo shaderStage = {
-                VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, VK_SHADER_STAGE_COMPUTE_BIT, compute_shader_module, "main", nullptr,
-            };
-
-            VkComputePipelineCreateInfo compute_create_Info = { VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
-            compute_create_Info.stage = shaderStage;
-            compute_create_Info.layout = m_pipeline_layouts.compute;
-            compute_create_Info.pNext = nullptr;
-            compute_create_Info.basePipelineHandle = VK_NULL_HANDLE;
-
-            if (vkCreateComputePipelines(m_device, VK_NULL_HANDLE, 1, &compute_create_Info, nullptr, &m_pipelines.compute) != VK_SUCCESS) {
-                throw std::runtime_error("Failed to create compute pipeline");
-            }
-
-            vkDestroyShaderModule(m_device, compute_shader_module, nullptr);
-        }
-
-        // converting equirenctangular to cubemap
-        {
-            const VkDescriptorImageInfo inputTexture = { VK_NULL_HANDLE, hdr->GetView(), VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
-            const VkDescriptorImageInfo outputTexture = { VK_NULL_HANDLE, m_cubemap.view, VK_IMAGE_LAYOUT_GENERAL };
-            {
-                VkWriteDescriptorSet writeDescriptorSet = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-                writeDescriptorSet.dstSet = m_descriptor_sets.compute;
-                writeDescriptorSet.dstBinding = 0;
-                writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-                writeDescriptorSet.descriptorCount = 1;
-                writeDescriptorSet.pImageInfo = &inputTexture;
-                vkUpdateDescriptorSets(m_device, 1, &writeDescriptorSet, 0, nullptr);
-            }
-
-            {
-                VkWriteDescriptorSet writeDescriptorSet = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
-                writeDescriptorSet.dstSet = m_descriptor_sets.compute;
-                writeDescriptorSet.dstBinding = 1;
-                writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
-                writeDescriptorSet.descriptorCount = 1;
-                writeDescriptorSet.pImageInfo = &outputTexture;
-                vkUpdateDescriptorSets(m_device, 1, &writeDescriptorSet, 0, nullptr);
-            }
-
-            VkCommandBuffer layoutCmd = vkUtilities::BeginSingleTimeCommands(m_command_pool, m_device);
-            {
-                {
-                    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-                    barrier.srcAccessMask = 0;
-                    barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-                    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-                    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-                    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier.image = m_cubemap.image;
-                    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-                    barrier.subresourceRange.baseMipLevel = 0;
-                    barrier.subresourceRange.levelCount = 1;
-                    vkCmdPipelineBarrier(layoutCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-                }
-
-                vkCmdBindPipeline(layoutCmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipelines.compute);
-                vkCmdBindDescriptorSets(layoutCmd, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layouts.compute, 0, 1, &m_descriptor_sets.compute, 0, nullptr);
-                vkCmdDispatch(layoutCmd, offscreen_size / 32, offscreen_size / 32, 6);
-
-                {
-                    VkImageMemoryBarrier barrier = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-                    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-                    barrier.dstAccessMask = 0;
-                    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-                    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier.image = m_cubemap.image;
-                    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-                    barrier.subresourceRange.baseMipLevel = 0;
-                    barrier.subresourceRange.levelCount = 1;
-                    vkCmdPipelineBarrier(layoutCmd, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-                }
-            }
-            vkUtilities::EndSingleTimeCommands(layoutCmd, m_device, m_graphics_queue, m_command_pool);
-
-            vkDestroyPipeline(m_device, m_pipelines.compute, nullptr);
-            //destroyTexture(envTextureEquirect);
-        }
-        // --------------- END - Converting equirectangular to cubemap - END --------------
-        // 
-        // --------------- Copying cubemap image texture to main texture ------------------
-        // Main Environment texture
-        {
-            VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-            // Cube map image description
-            VkImageCreateInfo imageCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
-            imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
-            imageCreateInfo.format = format;
-            imageCreateInfo.extent = { width, height, 1 };
-            imageCreateInfo.mipLevels = 1;
-            imageCreateInfo.arrayLayers = 6;
-            imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-            imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
-            imageCreateInfo.usage = usage;
-            imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-            imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            imageCreateInfo.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-            if (vkCreateImage(m_device, &imageCreateInfo, nullptr, &m_env_texuture.image) != VK_SUCCESS) {
-                assert(false);
-            }
-
-            VkMemoryRequirements memReqs{};
-            vkGetImageMemoryRequirements(m_device, m_env_texuture.image, &memReqs);
-            VkMemoryAllocateInfo memAlloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-            memAlloc.allocationSize = memReqs.size;
-            memAlloc.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physical_device);
-
-            if (vkAllocateMemory(m_device, &memAlloc, nullptr, &m_env_texuture.memory) != VK_SUCCESS) {
-                assert(false);
-            }
-            if (vkBindImageMemory(m_device, m_env_texuture.image, m_env_texuture.memory, 0) != VK_SUCCESS) {
-                assert(false);
-            }
-
-            m_env_texuture.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-            // Create sampler
-            VkSamplerCreateInfo sampler_create_info = { VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
-            sampler_create_info.magFilter = VK_FILTER_LINEAR;
-            sampler_create_info.minFilter = VK_FILTER_LINEAR;
-            sampler_create_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-            sampler_create_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler_create_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler_create_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-            sampler_create_info.mipLodBias = 0.0f;
-            sampler_create_info.maxAnisotropy = 1.0f;
-            sampler_create_info.compareOp = VK_COMPARE_OP_NEVER;
-            sampler_create_info.minLod = 0.0f;
-            sampler_create_info.maxLod = 1.0f;
-            sampler_create_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-            if (vkCreateSampler(m_device, &sampler_create_info, nullptr, &m_env_texuture.sampler) != VK_SUCCESS) {
-                assert(false);
-            }
-
-            // Create image view
-            VkImageViewCreateInfo view_create_info = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
-            view_create_info.image = m_env_texuture.image;
-            view_create_info.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-            view_create_info.format = format;
-            view_create_info.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
-            view_create_info.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            view_create_info.subresourceRange.baseMipLevel = 0;
-            view_create_info.subresourceRange.levelCount = 1;
-            view_create_info.subresourceRange.baseArrayLayer = 0;
-            view_create_info.subresourceRange.layerCount = 6;
-            if (vkCreateImageView(m_device, &view_create_info, nullptr, &m_env_texuture.view) != VK_SUCCESS) {
-                assert(false);
-            }
-
-        } // END - Main Environment texture
-
-        // Copying the converted texture to main texture
-        {   
-            VkCommandBuffer layoutCmd = vkUtilities::BeginSingleTimeCommands(m_command_pool, m_device);
-            {
-                std::vector<VkImageMemoryBarrier> preCopyBarriers;
-                preCopyBarriers.resize(2);
-                {
-                    VkImageMemoryBarrier barrier1 = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-                    barrier1.srcAccessMask = 0;
-                    barrier1.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-                    barrier1.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                    barrier1.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-                    barrier1.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier1.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier1.image = m_cubemap.image;
-                    barrier1.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    barrier1.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-                    barrier1.subresourceRange.baseMipLevel = 0;
-                    barrier1.subresourceRange.levelCount = 1;
-
-                    VkImageMemoryBarrier barrier2 = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-                    barrier2.srcAccessMask = 0;
-                    barrier2.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-                    barrier2.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-                    barrier2.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-                    barrier2.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier2.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier2.image = m_env_texuture.image;
-                    barrier2.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    barrier2.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-                    barrier2.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-                    preCopyBarriers[0] = barrier1;
-                    preCopyBarriers[1] = barrier2;
-                }
-
-                std::vector<VkImageMemoryBarrier> postCopyBarriers;
-                postCopyBarriers.resize(2);
-                {
-                    VkImageMemoryBarrier barrier1 = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-                    barrier1.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-                    barrier1.dstAccessMask = 0;
-                    barrier1.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-                    barrier1.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                    barrier1.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier1.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier1.image = m_cubemap.image;
-                    barrier1.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    barrier1.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-                    barrier1.subresourceRange.baseMipLevel = 0;
-                    barrier1.subresourceRange.levelCount = 1;
-
-                    VkImageMemoryBarrier barrier2 = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
-                    barrier2.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-                    barrier2.dstAccessMask = 0;
-                    barrier2.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-                    barrier2.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                    barrier2.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier2.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-                    barrier2.image = m_env_texuture.image;
-                    barrier2.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    barrier2.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
-                    barrier2.subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
-                    postCopyBarriers[0] = barrier1;
-                    postCopyBarriers[1] = barrier2;
-                }
-
-                vkCmdPipelineBarrier(layoutCmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, preCopyBarriers.size(), preCopyBarriers.data());
-
-                VkImageCopy copyRegion = {};
-                uint32_t width = offscreen_size;
-                uint32_t height = offscreen_size;
-                copyRegion.extent = { width, height, 1 };
-                copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                copyRegion.srcSubresource.layerCount = 6;
-                copyRegion.dstSubresource = copyRegion.srcSubresource;
-                vkCmdCopyImage(layoutCmd,
-                    m_cubemap.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                    m_env_texuture.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                    1, &copyRegion);
-
-                vkCmdPipelineBarrier(layoutCmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, postCopyBarriers.size(), postCopyBarriers.data());
-            }
-            vkUtilities::EndSingleTimeCommands(layoutCmd, m_device, m_graphics_queue, m_command_pool);
-        }
-        // --------------- END - Copying cubemap image texture to main texture - END ------------------
-    }
-
-    void GraphicsDevice::SetupIBLCubemaps(std::shared_ptr<Scene> scene) {
-        enum Target { IRRADIANCE = 0, PREFILTEREDENV = 1 };
-
-        for (uint32_t target = 0; target < PREFILTEREDENV + 1; target++) {
-            Cubemap cubemap_texture;
-
-            auto tStart = std::chrono::high_resolution_clock::now();
-
-            VkFormat format;
-            int32_t dim;
-            uint32_t numMips;
-            switch (target) {
-            case IRRADIANCE:
-                format = VK_FORMAT_R32G32B32A32_SFLOAT;
-                dim = 32;
-                //numMips = 1;
-                break;
-            case PREFILTEREDENV:
-                format = VK_FORMAT_R16G16B16A16_SFLOAT;
-                dim = offscreen_size;
-                break;
-            };
-            numMips = static_cast<uint32_t>(floor(log2(dim))) + 1;
-
-            // Create target cubemap
-            {
-                // Image
-                VkImageCreateInfo imageCI{};
-                imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-                imageCI.imageType = VK_IMAGE_TYPE_2D;
-                imageCI.format = format;
-                imageCI.extent.width = dim;
-                imageCI.extent.height = dim;
-                imageCI.extent.depth = 1;
-                imageCI.mipLevels = numMips;
-                imageCI.arrayLayers = 6;
-                imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
-                imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
-                imageCI.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-                imageCI.flags = VK_IMAGE_CREATE_CUBE_COMPATIBLE_BIT;
-                VK_CHECK_RESULT(vkCreateImage(m_device, &imageCI, nullptr, &cubemap_texture.image));
-
-                VkMemoryRequirements memReqs{};
-                vkGetImageMemoryRequirements(m_device, cubemap_texture.image, &memReqs);
-                VkMemoryAllocateInfo memAlloc = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-                memAlloc.allocationSize = memReqs.size;
-                memAlloc.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physical_device);
-                VK_CHECK_RESULT(vkAllocateMemory(m_device, &memAlloc, nullptr, &cubemap_texture.memory));
-                VK_CHECK_RESULT(vkBindImageMemory(m_device, cubemap_texture.image, cubemap_texture.memory, 0));
-
-                // View
-                VkImageViewCreateInfo viewCI{};
-                viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-                viewCI.viewType = VK_IMAGE_VIEW_TYPE_CUBE;
-                viewCI.format = format;
-                viewCI.subresourceRange = {};
-                viewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                viewCI.subresourceRange.levelCount = numMips;
-                viewCI.subresourceRange.layerCount = 6;
-                viewCI.image = cubemap_texture.image;
-                VK_CHECK_RESULT(vkCreateImageView(m_device, &viewCI, nullptr, &cubemap_texture.view));
-
-                // Sampler
-                VkSamplerCreateInfo samplerCI{};
-                samplerCI.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-                samplerCI.magFilter = VK_FILTER_LINEAR;
-                samplerCI.minFilter = VK_FILTER_LINEAR;
-                samplerCI.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-                samplerCI.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-                samplerCI.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-                samplerCI.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
-                samplerCI.minLod = 0.0f;
-                samplerCI.maxLod = static_cast<float>(numMips);
-                samplerCI.maxAnisotropy = 1.0f;
-                samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-                VK_CHECK_RESULT(vkCreateSampler(m_device, &samplerCI, nullptr, &cubemap_texture.sampler));
-            }
-
-            // FB, Att, RP, Pipe, etc.
-            VkAttachmentDescription attDesc{};
-            // Color attachment
-            attDesc.format = format;
-            attDesc.samples = VK_SAMPLE_COUNT_1_BIT;
-            attDesc.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-            attDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-            attDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-            attDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-            attDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-            attDesc.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-            VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
-
-            VkSubpassDescription subpassDescription{};
-            subpassDescription.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-            subpassDescription.colorAttachmentCount = 1;
-            subpassDescription.pColorAttachments = &colorReference;
-
-            // Use subpass dependencies for layout transitions
-            std::array<VkSubpassDependency, 2> dependencies;
-            dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-            dependencies[0].dstSubpass = 0;
-            dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-            dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-            dependencies[1].srcSubpass = 0;
-            dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-            dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-            dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-            dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-            dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-            dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
-            // Renderpass
-            VkRenderPassCreateInfo renderPassCI{};
-            renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-            renderPassCI.attachmentCount = 1;
-            renderPassCI.pAttachments = &attDesc;
-            renderPassCI.subpassCount = 1;
-            renderPassCI.pSubpasses = &subpassDescription;
-            renderPassCI.dependencyCount = 2;
-            renderPassCI.pDependencies = dependencies.data();
-            VkRenderPass renderpass;
-            VK_CHECK_RESULT(vkCreateRenderPass(m_device, &renderPassCI, nullptr, &renderpass));
-
-            struct Offscreen {
-                VkImage image;
-                VkImageView view;
-                VkDeviceMemory memory;
-                VkFramebuffer framebuffer;
-            } offscreen;
-
-            // Create offscreen framebuffer
-            {
-                // Image
-                VkImageCreateInfo imageCI{};
-                imageCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-                imageCI.imageType = VK_IMAGE_TYPE_2D;
-                imageCI.format = format;
-                imageCI.extent.width = dim;
-                imageCI.extent.height = dim;
-                imageCI.extent.depth = 1;
-                imageCI.mipLevels = 1;
-                imageCI.arrayLayers = 1;
-                imageCI.samples = VK_SAMPLE_COUNT_1_BIT;
-                imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
-                imageCI.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-                imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
-                imageCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-                VK_CHECK_RESULT(vkCreateImage(m_device, &imageCI, nullptr, &offscreen.image));
-                VkMemoryRequirements memReqs;
-                vkGetImageMemoryRequirements(m_device, offscreen.image, &memReqs);
-                VkMemoryAllocateInfo memAllocInfo{};
-                memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-                memAllocInfo.allocationSize = memReqs.size;
-                memAllocInfo.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physical_device);
-                VK_CHECK_RESULT(vkAllocateMemory(m_device, &memAllocInfo, nullptr, &offscreen.memory));
-                VK_CHECK_RESULT(vkBindImageMemory(m_device, offscreen.image, offscreen.memory, 0));
-
-                // View
-                VkImageViewCreateInfo viewCI{};
-                viewCI.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-                viewCI.viewType = VK_IMAGE_VIEW_TYPE_2D;
-                viewCI.format = format;
-                viewCI.flags = 0;
-                viewCI.subresourceRange = {};
-                viewCI.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                viewCI.subresourceRange.baseMipLevel = 0;
-                viewCI.subresourceRange.levelCount = 1;
-                viewCI.subresourceRange.baseArrayLayer = 0;
-                viewCI.subresourceRange.layerCount = 1;
-                viewCI.image = offscreen.image;
-                VK_CHECK_RESULT(vkCreateImageView(m_device, &viewCI, nullptr, &offscreen.view));
-
-                // Framebuffer
-                VkFramebufferCreateInfo framebufferCI{};
-                framebufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-                framebufferCI.renderPass = renderpass;
-                framebufferCI.attachmentCount = 1;
-                framebufferCI.pAttachments = &offscreen.view;
-                framebufferCI.width = dim;
-                framebufferCI.height = dim;
-                framebufferCI.layers = 1;
-                VK_CHECK_RESULT(vkCreateFramebuffer(m_device, &framebufferCI, nullptr, &offscreen.framebuffer));
-
-                VkCommandBuffer layoutCmd = CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-                VkImageMemoryBarrier imageMemoryBarrier{};
-                imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                imageMemoryBarrier.image = offscreen.image;
-                imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-                imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-                imageMemoryBarrier.srcAccessMask = 0;
-                imageMemoryBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-                imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-                vkCmdPipelineBarrier(layoutCmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-                FlushCommandBuffer(layoutCmd, m_graphics_queue, true);
-            }
-
-            // Descriptors
-            VkDescriptorSetLayout descriptorsetlayout;
-            VkDescriptorSetLayoutBinding setLayoutBinding = { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr };
-            VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
-            descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-            descriptorSetLayoutCI.pBindings = &setLayoutBinding;
-            descriptorSetLayoutCI.bindingCount = 1;
-            VK_CHECK_RESULT(vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutCI, nullptr, &descriptorsetlayout));
-
-            // Descriptor Pool
-            VkDescriptorPoolSize poolSize = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 };
-            VkDescriptorPoolCreateInfo descriptorPoolCI{};
-            descriptorPoolCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-            descriptorPoolCI.poolSizeCount = 1;
-            descriptorPoolCI.pPoolSizes = &poolSize;
-            descriptorPoolCI.maxSets = 2;
-            VkDescriptorPool descriptorpool;
-            VK_CHECK_RESULT(vkCreateDescriptorPool(m_device, &descriptorPoolCI, nullptr, &descriptorpool));
-
-            // Descriptor sets
-            VkDescriptorSet descriptorset;
-            VkDescriptorSetAllocateInfo descriptorSetAllocInfo{};
-            descriptorSetAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            descriptorSetAllocInfo.descriptorPool = descriptorpool;
-            descriptorSetAllocInfo.pSetLayouts = &descriptorsetlayout;
-            descriptorSetAllocInfo.descriptorSetCount = 1;
-            VK_CHECK_RESULT(vkAllocateDescriptorSets(m_device, &descriptorSetAllocInfo, &descriptorset));
-            VkWriteDescriptorSet writeDescriptorSet{};
-            writeDescriptorSet.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            writeDescriptorSet.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            writeDescriptorSet.descriptorCount = 1;
-            writeDescriptorSet.dstSet = descriptorset;
-            writeDescriptorSet.dstBinding = 0;
-            VkDescriptorImageInfo env_image_info = { m_env_texuture.sampler, m_env_texuture.view, m_env_texuture.layout };
-            writeDescriptorSet.pImageInfo = &env_image_info;
-            vkUpdateDescriptorSets(m_device, 1, &writeDescriptorSet, 0, nullptr);
-
-            struct PushBlockIrradiance {
-                glm::mat4 mvp;
-                float deltaPhi = (2.0f * float(M_PI)) / 180.0f;
-                float deltaTheta = (0.5f * float(M_PI)) / 64.0f;
-            } pushBlockIrradiance;
-
-            struct PushBlockPrefilterEnv {
-                glm::mat4 mvp;
-                float roughness;
-                uint32_t numSamples = 16u;
-            } pushBlockPrefilterEnv;
-
-            // Pipeline layout
-            VkPipelineLayout pipelinelayout;
-            VkPushConstantRange pushConstantRange{};
-            pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
-
-            switch (target) {
-            case IRRADIANCE:
-                pushConstantRange.size = sizeof(PushBlockIrradiance);
-                break;
-            case PREFILTEREDENV:
-                pushConstantRange.size = sizeof(PushBlockPrefilterEnv);
-                prefilter_mips = numMips;
-                break;
-            };
-
-            VkPipelineLayoutCreateInfo pipelineLayoutCI{};
-            pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-            pipelineLayoutCI.setLayoutCount = 1;
-            pipelineLayoutCI.pSetLayouts = &descriptorsetlayout;
-            pipelineLayoutCI.pushConstantRangeCount = 1;
-            pipelineLayoutCI.pPushConstantRanges = &pushConstantRange;
-            VK_CHECK_RESULT(vkCreatePipelineLayout(m_device, &pipelineLayoutCI, nullptr, &pipelinelayout));
-
-            // Pipeline
-            VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCI{};
-            inputAssemblyStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-            inputAssemblyStateCI.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-
-            VkPipelineRasterizationStateCreateInfo rasterizationStateCI{};
-            rasterizationStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-            rasterizationStateCI.polygonMode = VK_POLYGON_MODE_FILL;
-            rasterizationStateCI.cullMode = VK_CULL_MODE_NONE;
-            rasterizationStateCI.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-            rasterizationStateCI.lineWidth = 1.0f;
-
-            VkPipelineColorBlendAttachmentState blendAttachmentState{};
-            blendAttachmentState.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-            blendAttachmentState.blendEnable = VK_FALSE;
-
-            VkPipelineColorBlendStateCreateInfo colorBlendStateCI{};
-            colorBlendStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-            colorBlendStateCI.attachmentCount = 1;
-            colorBlendStateCI.pAttachments = &blendAttachmentState;
-
-            VkPipelineDepthStencilStateCreateInfo depthStencilStateCI{};
-            depthStencilStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
-            depthStencilStateCI.depthTestEnable = VK_FALSE;
-            depthStencilStateCI.depthWriteEnable = VK_FALSE;
-            depthStencilStateCI.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
-            depthStencilStateCI.front = depthStencilStateCI.back;
-            depthStencilStateCI.back.compareOp = VK_COMPARE_OP_ALWAYS;
-
-            VkPipelineViewportStateCreateInfo viewportStateCI{};
-            viewportStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-            viewportStateCI.viewportCount = 1;
-            viewportStateCI.scissorCount = 1;
-
-            VkPipelineMultisampleStateCreateInfo multisampleStateCI{};
-            multisampleStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-            multisampleStateCI.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-
-            std::vector<VkDynamicState> dynamicStateEnables = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
-            VkPipelineDynamicStateCreateInfo dynamicStateCI{};
-            dynamicStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-            dynamicStateCI.pDynamicStates = dynamicStateEnables.data();
-            dynamicStateCI.dynamicStateCount = static_cast<uint32_t>(dynamicStateEnables.size());
-
-            // Vertex input state
-            VkVertexInputBindingDescription vertexInputBinding = { 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX };
-            VkVertexInputAttributeDescription vertexInputAttribute = { 0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0 };
-
-            VkPipelineVertexInputStateCreateInfo vertexInputStateCI{};
-            vertexInputStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-            vertexInputStateCI.vertexBindingDescriptionCount = 1;
-            vertexInputStateCI.pVertexBindingDescriptions = &vertexInputBinding;
-            vertexInputStateCI.vertexAttributeDescriptionCount = 1;
-            vertexInputStateCI.pVertexAttributeDescriptions = &vertexInputAttribute;
-
-            std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
-
-            VkGraphicsPipelineCreateInfo pipelineCI{};
-            pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-            pipelineCI.layout = pipelinelayout;
-            pipelineCI.renderPass = renderpass;
-            pipelineCI.pInputAssemblyState = &inputAssemblyStateCI;
-            pipelineCI.pVertexInputState = &vertexInputStateCI;
-            pipelineCI.pRasterizationState = &rasterizationStateCI;
-            pipelineCI.pColorBlendState = &colorBlendStateCI;
-            pipelineCI.pMultisampleState = &multisampleStateCI;
-            pipelineCI.pViewportState = &viewportStateCI;
-            pipelineCI.pDepthStencilState = &depthStencilStateCI;
-            pipelineCI.pDynamicState = &dynamicStateCI;
-            pipelineCI.stageCount = 2;
-            pipelineCI.pStages = shaderStages.data();
-            pipelineCI.renderPass = renderpass;
-
-            auto vert_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/filtercube.vert.spv");
-
-            VkShaderModule vert_shader_module = vkUtilities::CreateShaderModule(vert_shader_code, m_device);
-
-            VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
-            vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-            vert_shader_stage_info.module = vert_shader_module;
-            vert_shader_stage_info.pName = "main";
-
-            shaderStages[0] = vert_shader_stage_info;
-            switch (target) {
-                case IRRADIANCE:
-                {
-                    auto frag_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/irradiancecube.frag.spv");
-                    VkShaderModule frag_shader_module = vkUtilities::CreateShaderModule(frag_shader_code, m_device);
-                    VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
-                    frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-                    frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-                    frag_shader_stage_info.module = frag_shader_module;
-                    frag_shader_stage_info.pName = "main";
-                    shaderStages[1] = frag_shader_stage_info;
-                    break;
-                }
-                case PREFILTEREDENV:
-                {
-                    auto frag_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/prefilterenvmap.frag.spv");
-                    VkShaderModule frag_shader_module = vkUtilities::CreateShaderModule(frag_shader_code, m_device);
-                    VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
-                    frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-                    frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-                    frag_shader_stage_info.module = frag_shader_module;
-                    frag_shader_stage_info.pName = "main";
-                    shaderStages[1] = frag_shader_stage_info;
-                    break;
-                }
-            };
-            VkPipeline pipeline;
-            VK_CHECK_RESULT(vkCreateGraphicsPipelines(m_device, m_pipeline_cache, 1, &pipelineCI, nullptr, &pipeline));
-            for (auto shaderStage : shaderStages) {
-                vkDestroyShaderModule(m_device, shaderStage.module, nullptr);
-            }
-
-            // Render cubemap
-            VkClearValue clearValues[1];
-            clearValues[0].color = { { 0.0f, 0.0f, 0.2f, 0.0f } };
-
-            VkRenderPassBeginInfo renderPassBeginInfo{};
-            renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-            renderPassBeginInfo.renderPass = renderpass;
-            renderPassBeginInfo.framebuffer = offscreen.framebuffer;
-            renderPassBeginInfo.renderArea.extent.width = dim;
-            renderPassBeginInfo.renderArea.extent.height = dim;
-            renderPassBeginInfo.clearValueCount = 1;
-            renderPassBeginInfo.pClearValues = clearValues;
-
-            std::vector<glm::mat4> matrices = {
-                glm::rotate(glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f)), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
-                glm::rotate(glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(0.0f, 1.0f, 0.0f)), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
-                glm::rotate(glm::mat4(1.0f), glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
-                glm::rotate(glm::mat4(1.0f), glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
-                glm::rotate(glm::mat4(1.0f), glm::radians(180.0f), glm::vec3(1.0f, 0.0f, 0.0f)),
-                glm::rotate(glm::mat4(1.0f), glm::radians(180.0f), glm::vec3(0.0f, 0.0f, 1.0f)),
-            };
-
-            VkCommandBuffer cmdBuf = CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, false);
-
-            VkViewport viewport{};
-            viewport.width = (float)dim;
-            viewport.height = (float)dim;
-            viewport.minDepth = 0.0f;
-            viewport.maxDepth = 1.0f;
-
-            VkRect2D scissor{};
-            scissor.extent.width = dim;
-            scissor.extent.height = dim;
-
-            VkImageSubresourceRange subresourceRange{};
-            subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-            subresourceRange.baseMipLevel = 0;
-            subresourceRange.levelCount = numMips;
-            subresourceRange.layerCount = 6;
-
-            // Change image layout for all cubemap faces to transfer destination
-            {
-                VkCommandBufferBeginInfo commandBufferBI{};
-                commandBufferBI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-                VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuf, &commandBufferBI));
-                VkImageMemoryBarrier imageMemoryBarrier{};
-                imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                imageMemoryBarrier.image = cubemap_texture.image;
-                imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-                imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-                imageMemoryBarrier.srcAccessMask = 0;
-                imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-                imageMemoryBarrier.subresourceRange = subresourceRange;
-                vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-                FlushCommandBuffer(cmdBuf, m_graphics_queue, false);
-            }
-
-            for (uint32_t m = 0; m < numMips; m++) {
-                for (uint32_t f = 0; f < 6; f++) {
-                    VkCommandBufferBeginInfo commandBufferBI{};
-                    commandBufferBI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-                    VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuf, &commandBufferBI));
-
-                    viewport.width = static_cast<float>(dim * std::pow(0.5f, m));
-                    viewport.height = static_cast<float>(dim * std::pow(0.5f, m));
-                    vkCmdSetViewport(cmdBuf, 0, 1, &viewport);
-                    vkCmdSetScissor(cmdBuf, 0, 1, &scissor);
-
-                    // Render scene from cube face's point of view
-                    vkCmdBeginRenderPass(cmdBuf, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
-                    // Pass parameters for current pass using a push constant block
-                    switch (target) {
-                    case IRRADIANCE:
-                        pushBlockIrradiance.mvp = glm::perspective((float)(M_PI / 2.0), 1.0f, 0.1f, 512.0f) * matrices[f];
-                        vkCmdPushConstants(cmdBuf, pipelinelayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushBlockIrradiance), &pushBlockIrradiance);
-                        break;
-                    case PREFILTEREDENV:
-                        pushBlockPrefilterEnv.mvp = glm::perspective((float)(M_PI / 2.0), 1.0f, 0.1f, 512.0f) * matrices[f];
-                        pushBlockPrefilterEnv.roughness = (float)m / (float)(numMips - 1);
-                        vkCmdPushConstants(cmdBuf, pipelinelayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushBlockPrefilterEnv), &pushBlockPrefilterEnv);
-                        break;
-                    };
-
-                    vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-                    vkCmdBindDescriptorSets(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelinelayout, 0, 1, &descriptorset, 0, NULL);
-
-                    VkDeviceSize offsets[1] = { 0 };
-
-                    //models.skybox.draw(cmdBuf);
-                    {
-                        VkBuffer vertexBuffers[] = { scene->GetSkybox()->p_model.m_vertices.buffer };
-                        VkDeviceSize offsets[] = { 0 };
-                        vkCmdBindVertexBuffers(cmdBuf, 0, 1, vertexBuffers, offsets);
-                        vkCmdBindIndexBuffer(cmdBuf, scene->GetSkybox()->p_model.m_indices.buffer, 0, VK_INDEX_TYPE_UINT32);
-                        for (auto& node : scene->GetSkybox()->p_model.GetNodes()) {
-                            DrawNodeSkybox(node, cmdBuf);
-                        }
-                    }
-
-                    vkCmdEndRenderPass(cmdBuf);
-
-                    VkImageSubresourceRange subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-                    subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    subresourceRange.baseMipLevel = 0;
-                    subresourceRange.levelCount = numMips;
-                    subresourceRange.layerCount = 6;
-
-                    {
-                        VkImageMemoryBarrier imageMemoryBarrier{};
-                        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                        imageMemoryBarrier.image = offscreen.image;
-                        imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-                        imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-                        imageMemoryBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-                        imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-                        imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-                        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-                    }
-
-                    // Copy region for transfer from framebuffer to cube face
-                    VkImageCopy copyRegion{};
-
-                    copyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    copyRegion.srcSubresource.baseArrayLayer = 0;
-                    copyRegion.srcSubresource.mipLevel = 0;
-                    copyRegion.srcSubresource.layerCount = 1;
-                    copyRegion.srcOffset = { 0, 0, 0 };
-
-                    copyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-                    copyRegion.dstSubresource.baseArrayLayer = f;
-                    copyRegion.dstSubresource.mipLevel = m;
-                    copyRegion.dstSubresource.layerCount = 1;
-                    copyRegion.dstOffset = { 0, 0, 0 };
-
-                    copyRegion.extent.width = static_cast<uint32_t>(viewport.width);
-                    copyRegion.extent.height = static_cast<uint32_t>(viewport.height);
-                    copyRegion.extent.depth = 1;
-
-                    vkCmdCopyImage(
-                        cmdBuf,
-                        offscreen.image,
-                        VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                        cubemap_texture.image,
-                        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                        1,
-                        &copyRegion);
-
-                    {
-                        VkImageMemoryBarrier imageMemoryBarrier{};
-                        imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                        imageMemoryBarrier.image = offscreen.image;
-                        imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-                        imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-                        imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-                        imageMemoryBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-                        imageMemoryBarrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
-                        vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-                    }
+        // Everything drawn from here on needs the scene pipelines
+        m_pipeline_compiler->WaitIdle();
+        m_pipeline_compiler->PrintStats();
+        BuildGpuDraws(scene);
 
-                    FlushCommandBuffer(cmdBuf, m_graphics_queue, false);
-                }
-            }
-
-            {
-                VkCommandBufferBeginInfo commandBufferBI{};
-                commandBufferBI.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-                VK_CHECK_RESULT(vkBeginCommandBuffer(cmdBuf, &commandBufferBI));
-                VkImageMemoryBarrier imageMemoryBarrier{};
-                imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-                imageMemoryBarrier.image = cubemap_texture.image;
-                imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-                imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-                imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-                imageMemoryBarrier.dstAccessMask = VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
-                imageMemoryBarrier.subresourceRange = subresourceRange;
-                vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-                FlushCommandBuffer(cmdBuf, m_graphics_queue, false);
-            }
-
-
-            vkDestroyRenderPass(m_device, renderpass, nullptr);
-            vkDestroyFramebuffer(m_device, offscreen.framebuffer, nullptr);
-            vkFreeMemory(m_device, offscreen.memory, nullptr);
-            vkDestroyImageView(m_device, offscreen.view, nullptr);
-            vkDestroyImage(m_device, offscreen.image, nullptr);
-            vkDestroyDescriptorPool(m_device, descriptorpool, nullptr);
-            vkDestroyDescriptorSetLayout(m_device, descriptorsetlayout, nullptr);
-            vkDestroyPipeline(m_device, pipeline, nullptr);
-            vkDestroyPipelineLayout(m_device, pipelinelayout, nullptr);
-
-            cubemap_texture.descriptor.imageView = cubemap_texture.view;
-            cubemap_texture.descriptor.sampler = cubemap_texture.sampler;
-            cubemap_texture.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-            switch (target) {
-            case IRRADIANCE:
-                m_Irradiance_cubemap = cubemap_texture;
-                break;
-            case PREFILTEREDENV:
-                m_Prefilter_cubemap = cubemap_texture;
-                //shaderValuesParams.prefilteredCubeMipLevels = static_cast<float>(numMips);
-                break;
-            };
-
-            auto tEnd = std::chrono::high_resolution_clock::now();
-            auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-            std::cout << "Generating cube map with " << numMips << " mip levels took " << tDiff << " ms" << std::endl;
-        }
+        auto startup_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - m_startup_start).count();
+        std::cout << "Startup: " << startup_ms << " ms with a " << (m_pipeline_cache->IsWarm() ? "warm" : "cold") << " pipeline cache ("
+            << (m_pipeline_cache->GetLoadedSize() >> 10) << " KB loaded)" << std::endl;
     }
 
-    void GraphicsDevice::GenerateBRDF_LUT() {
-        auto tStart = std::chrono::high_resolution_clock::now();
+    void GraphicsDevice::GenerateBRDF_LUT(RenderGraph& graph) {
+        MemoryAllocator::Tag tag(MemoryCategory::IBL, "brdf lut");
 
         const VkFormat format = VK_FORMAT_R16G16_SFLOAT;
         const int32_t dim = 512;
@@ -1655,15 +959,7 @@ namespace Diffuse {
         imageCI.tiling = VK_IMAGE_TILING_OPTIMAL;
         imageCI.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
         VK_CHECK_RESULT(vkCreateImage(m_device, &imageCI, nullptr, &m_brdf_lut.image));
-        VkMemoryRequirements memReqs;
-        vkGetImageMemoryRequirements(m_device, m_brdf_lut.image, &memReqs);
-        VkMemoryAllocateInfo memAllocInfo{};
-        memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        memAllocInfo.allocationSize = memReqs.size;
-        //memAllocInfo.memoryTypeIndex = vulkanDevice->getMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-        memAllocInfo.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_physical_device);
-        VK_CHECK_RESULT(vkAllocateMemory(m_device, &memAllocInfo, nullptr, &m_brdf_lut.memory));
-        VK_CHECK_RESULT(vkBindImageMemory(m_device, m_brdf_lut.image, m_brdf_lut.memory, 0));
+        m_memory_allocator->BindImage(m_brdf_lut.image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &m_brdf_lut.memory);
 
         // View
         VkImageViewCreateInfo viewCI{};
@@ -1690,7 +986,7 @@ namespace Diffuse {
         samplerCI.maxLod = 1.0f;
         samplerCI.maxAnisotropy = 1.0f;
         samplerCI.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-        VK_CHECK_RESULT(vkCreateSampler(m_device, &samplerCI, nullptr, &m_brdf_lut.sampler));
+        m_brdf_lut.sampler = m_object_cache->GetSampler(samplerCI);
 
         // FB, Att, RP, Pipe, etc.
         VkAttachmentDescription attDesc{};
@@ -1701,8 +997,8 @@ namespace Diffuse {
         attDesc.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         attDesc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         attDesc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-        attDesc.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-        attDesc.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        attDesc.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        attDesc.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
         VkAttachmentReference colorReference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
 
         VkSubpassDescription subpassDescription{};
@@ -1710,23 +1006,6 @@ namespace Diffuse {
         subpassDescription.colorAttachmentCount = 1;
         subpassDescription.pColorAttachments = &colorReference;
 
-        // Use subpass dependencies for layout transitions
-        std::array<VkSubpassDependency, 2> dependencies;
-        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[0].dstSubpass = 0;
-        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[0].srcAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[0].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-        dependencies[1].srcSubpass = 0;
-        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
-        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-        dependencies[1].dstAccessMask = VK_ACCESS_MEMORY_READ_BIT;
-        dependencies[1].dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
-
         // Create the actual renderpass
         VkRenderPassCreateInfo renderPassCI{};
         renderPassCI.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -1734,37 +1013,21 @@ namespace Diffuse {
         renderPassCI.pAttachments = &attDesc;
         renderPassCI.subpassCount = 1;
         renderPassCI.pSubpasses = &subpassDescription;
-        renderPassCI.dependencyCount = 2;
-        renderPassCI.pDependencies = dependencies.data();
-
-        VkRenderPass renderpass;
-        VK_CHECK_RESULT(vkCreateRenderPass(m_device, &renderPassCI, nullptr, &renderpass));
-
-        VkFramebufferCreateInfo framebufferCI{};
-        framebufferCI.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferCI.renderPass = renderpass;
-        framebufferCI.attachmentCount = 1;
-        framebufferCI.pAttachments = &m_brdf_lut.view;
-        framebufferCI.width = dim;
-        framebufferCI.height = dim;
-        framebufferCI.layers = 1;
+        // The render graph transitions the attachment for sampling afterwards
 
-        VkFramebuffer framebuffer;
-        VK_CHECK_RESULT(vkCreateFramebuffer(m_device, &framebufferCI, nullptr, &framebuffer));
+        VkRenderPass renderpass = m_object_cache->GetRenderPass(renderPassCI);
 
         // Desriptors
-        VkDescriptorSetLayout descriptorsetlayout;
         VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCI{};
         descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutCI, nullptr, &descriptorsetlayout));
+        VkDescriptorSetLayout descriptorsetlayout = m_object_cache->GetDescriptorSetLayout(descriptorSetLayoutCI);
 
         // Pipeline layout
-        VkPipelineLayout pipelinelayout;
         VkPipelineLayoutCreateInfo pipelineLayoutCI{};
         pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
         pipelineLayoutCI.setLayoutCount = 1;
         pipelineLayoutCI.pSetLayouts = &descriptorsetlayout;
-        VK_CHECK_RESULT(vkCreatePipelineLayout(m_device, &pipelineLayoutCI, nullptr, &pipelinelayout));
+        VkPipelineLayout pipelinelayout = m_object_cache->GetPipelineLayout(pipelineLayoutCI);
 
         // Pipeline
         VkPipelineInputAssemblyStateCreateInfo inputAssemblyStateCI{};
@@ -1813,8 +1076,6 @@ namespace Diffuse {
         VkPipelineVertexInputStateCreateInfo emptyInputStateCI{};
         emptyInputStateCI.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-        std::array<VkPipelineShaderStageCreateInfo, 2> shaderStages;
-
         VkGraphicsPipelineCreateInfo pipelineCI{};
         pipelineCI.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
         pipelineCI.layout = pipelinelayout;
@@ -1827,54 +1088,17 @@ namespace Diffuse {
         pipelineCI.pViewportState = &viewportStateCI;
         pipelineCI.pDepthStencilState = &depthStencilStateCI;
         pipelineCI.pDynamicState = &dynamicStateCI;
-        pipelineCI.stageCount = 2;
-        pipelineCI.pStages = shaderStages.data();
-
-        auto vert_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/genbrdflut.vert.spv");
-        auto frag_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/genbrdflut.frag.spv");
-
-        VkShaderModule vert_shader_module = vkUtilities::CreateShaderModule(vert_shader_code, m_device);
-        VkShaderModule frag_shader_module = vkUtilities::CreateShaderModule(frag_shader_code, m_device);
-
-        VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
-        vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vert_shader_stage_info.module = vert_shader_module;
-        vert_shader_stage_info.pName = "main";
-
-        VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
-        frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        frag_shader_stage_info.module = frag_shader_module;
-        frag_shader_stage_info.pName = "main";
-
-        // Look-up-table (from BRDF) pipeline		
-        shaderStages = {
-            vert_shader_stage_info,
-            frag_shader_stage_info
-        };
-        VkPipeline pipeline;
-        VK_CHECK_RESULT(vkCreateGraphicsPipelines(m_device, m_pipeline_cache, 1, &pipelineCI, nullptr, &pipeline));
-        for (auto shaderStage : shaderStages) {
-            vkDestroyShaderModule(m_device, shaderStage.module, nullptr);
-        }
+
+        // Look-up-table (from BRDF) pipeline, waited on when the pass is recorded so it compiles while the graph is built
+        PipelineCompiler::Ticket pipeline = m_pipeline_compiler->Compile(pipelineCI, {
+            { VK_SHADER_STAGE_VERTEX_BIT, "../shaders/pbr_ibl/genbrdflut.vert.spv" },
+            { VK_SHADER_STAGE_FRAGMENT_BIT, "../shaders/pbr_ibl/genbrdflut.frag.spv" },
+        });
 
         // Render
         VkClearValue clearValues[1];
         clearValues[0].color = { { 0.0f, 0.0f, 0.0f, 1.0f } };
 
-        VkRenderPassBeginInfo renderPassBeginInfo{};
-        renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        renderPassBeginInfo.renderPass = renderpass;
-        renderPassBeginInfo.renderArea.extent.width = dim;
-        renderPassBeginInfo.renderArea.extent.height = dim;
-        renderPassBeginInfo.clearValueCount = 1;
-        renderPassBeginInfo.pClearValues = clearValues;
-        renderPassBeginInfo.framebuffer = framebuffer;
-
-        VkCommandBuffer cmdBuf = CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-        vkCmdBeginRenderPass(cmdBuf, &renderPassBeginInfo, VK_SUBPASS_CONTENTS_INLINE);
-
         VkViewport viewport{};
         viewport.width = (float)dim;
         viewport.height = (float)dim;
@@ -1885,34 +1109,29 @@ namespace Diffuse {
         scissor.extent.width = dim;
         scissor.extent.height = dim;
 
-        vkCmdSetViewport(cmdBuf, 0, 1, &viewport);
-        vkCmdSetScissor(cmdBuf, 0, 1, &scissor);
-        vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        vkCmdDraw(cmdBuf, 3, 1, 0, 0);
-        vkCmdEndRenderPass(cmdBuf);
-        FlushCommandBuffer(cmdBuf, m_graphics_queue);
-
-        vkQueueWaitIdle(m_graphics_queue);
+        RenderGraph::Resource lut = graph.ImportImage("brdf lut", m_brdf_lut.image, m_brdf_lut.view, format, 1, 1, {});
+        graph.AddPass("brdf lut", [viewport, scissor, pipeline](VkCommandBuffer cmdBuf) {
+            vkCmdSetViewport(cmdBuf, 0, 1, &viewport);
+            vkCmdSetScissor(cmdBuf, 0, 1, &scissor);
+            vkCmdBindPipeline(cmdBuf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.get());
+            vkCmdDraw(cmdBuf, 3, 1, 0, 0);
+        })
+            .Write(lut, RenderGraph::Usage::ColorAttachment, {}, true)
+            .SetRenderPass(renderpass, { (uint32_t)dim, (uint32_t)dim }, { clearValues[0] });
+        graph.Output(lut, RenderGraph::Usage::FragmentSampled);
 
-        vkDestroyPipeline(m_device, pipeline, nullptr);
-        vkDestroyPipelineLayout(m_device, pipelinelayout, nullptr);
-        vkDestroyRenderPass(m_device, renderpass, nullptr);
-        vkDestroyFramebuffer(m_device, framebuffer, nullptr);
-        vkDestroyDescriptorSetLayout(m_device, descriptorsetlayout, nullptr);
+        // Destroyed once the graph was submitted
+        m_deletion_queue->Push([device = m_device, pipeline]() { vkDestroyPipeline(device, pipeline.get(), nullptr); });
 
         m_brdf_lut.descriptor.imageView = m_brdf_lut.view;
         m_brdf_lut.descriptor.sampler = m_brdf_lut.sampler;
         m_brdf_lut.descriptor.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-
-        auto tEnd = std::chrono::high_resolution_clock::now();
-        auto tDiff = std::chrono::duration<double, std::milli>(tEnd - tStart).count();
-        std::cout << "Generating BRDF LUT took " << tDiff << " ms" << std::endl;
     }
 
-    void GraphicsDevice::SetupSkybox(std::shared_ptr<Skybox> skybox) {
+    void GraphicsDevice::CreateSkyboxPipeline() {
         {
             const std::vector<VkDescriptorSetLayoutBinding> descriptorSetLayoutBindings = {
-                { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
+                { 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1, VK_SHADER_STAGE_VERTEX_BIT, nullptr },
                 { 1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr}, // Environment texture
             };
 
@@ -1921,79 +1140,18 @@ namespace Diffuse {
             descriptorSetLayoutCI.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
             descriptorSetLayoutCI.pBindings = descriptorSetLayoutBindings.data();
             descriptorSetLayoutCI.bindingCount = descriptorSetLayoutBindings.size();
-            if (vkCreateDescriptorSetLayout(m_device, &descriptorSetLayoutCI, nullptr, &m_descriptorSetLayouts.skybox) != VK_SUCCESS) {
-                throw std::runtime_error("Failed to create descriptor pool");
-            }
+            m_descriptorSetLayouts.skybox = m_object_cache->GetDescriptorSetLayout(descriptorSetLayoutCI);
 
             // create pipeline layout
             VkPipelineLayoutCreateInfo pipelineLayoutCI{};
             pipelineLayoutCI.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
             pipelineLayoutCI.setLayoutCount = 1;
             pipelineLayoutCI.pSetLayouts = &m_descriptorSetLayouts.skybox;
-            if (vkCreatePipelineLayout(m_device, &pipelineLayoutCI, nullptr, &m_pipeline_layouts.skybox) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create pipeline layout!");
-            }
-
-            VkDescriptorSetAllocateInfo allocInfo{};
-            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-            allocInfo.descriptorPool = m_descriptor_pools.scene;
-            allocInfo.descriptorSetCount = 1;
-            allocInfo.pSetLayouts = &m_descriptorSetLayouts.skybox;
-
-            if (vkAllocateDescriptorSets(m_device, &allocInfo, &m_descriptor_sets.skybox) != VK_SUCCESS) {
-                throw std::runtime_error("failed to allocate descriptor sets!");
-            }
-
-            VkDescriptorBufferInfo buffer_info{};
-            buffer_info.buffer = skybox->p_ubo.uniformBuffers[0];
-            buffer_info.offset = 0;
-            buffer_info.range = sizeof(UBO);
-            VkDescriptorImageInfo image_info = { m_env_texuture.sampler, m_env_texuture.view, m_env_texuture.layout};
-            //VkDescriptorImageInfo image_info = { m_cubemap.sampler, m_cubemap.view, m_cubemap.layout};
-            //VkDescriptorImageInfo image_info = m_Irradiance_cubemap.descriptor;
-            //VkDescriptorImageInfo image_info = m_Prefilter_cubemap.descriptor;
-
-            std::vector<VkWriteDescriptorSet> write_descriptor_sets;
-            write_descriptor_sets.resize(2);
-            write_descriptor_sets[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            write_descriptor_sets[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-            write_descriptor_sets[0].dstSet = m_descriptor_sets.skybox;
-            write_descriptor_sets[0].dstBinding = 0;
-            write_descriptor_sets[0].descriptorCount = 1;
-            write_descriptor_sets[0].pBufferInfo = &buffer_info;
-
-            write_descriptor_sets[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-            write_descriptor_sets[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-            write_descriptor_sets[1].dstSet = m_descriptor_sets.skybox;
-            write_descriptor_sets[1].dstBinding = 1;
-            write_descriptor_sets[1].descriptorCount = 1;
-            write_descriptor_sets[1].pImageInfo = &image_info;
-
-            vkUpdateDescriptorSets(m_device, write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+            m_pipeline_layouts.skybox = m_object_cache->GetPipelineLayout(pipelineLayoutCI);
         }
 
         // create skybox cubemap pipeline
         {
-            auto vert_shader_code = Utils::File::ReadFile("../shaders/skybox/skybox_vert.spv");
-            auto frag_shader_code = Utils::File::ReadFile("../shaders/skybox/skybox_frag.spv");
-
-            VkShaderModule vert_shader_module = vkUtilities::CreateShaderModule(vert_shader_code, m_device);
-            VkShaderModule frag_shader_module = vkUtilities::CreateShaderModule(frag_shader_code, m_device);
-
-            VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
-            vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-            vert_shader_stage_info.module = vert_shader_module;
-            vert_shader_stage_info.pName = "main";
-
-            VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
-            frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-            frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-            frag_shader_stage_info.module = frag_shader_module;
-            frag_shader_stage_info.pName = "main";
-
-            VkPipelineShaderStageCreateInfo shaderStages[] = { vert_shader_stage_info, frag_shader_stage_info };
-
             VkPipelineVertexInputStateCreateInfo vertex_input_info{};
             vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
@@ -2075,8 +1233,6 @@ namespace Diffuse {
 
             VkGraphicsPipelineCreateInfo pipeline_info{};
             pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-            pipeline_info.stageCount = 2;
-            pipeline_info.pStages = shaderStages;
             pipeline_info.pVertexInputState = &vertex_input_info;
             pipeline_info.pInputAssemblyState = &inputAssembly;
             pipeline_info.pViewportState = &viewport_state;
@@ -2090,121 +1246,107 @@ namespace Diffuse {
             pipeline_info.subpass = 0;
             pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
             pipeline_info.pNext = nullptr;
-            
 
-            if (vkCreateGraphicsPipelines(m_device, VK_NULL_HANDLE, 1, &pipeline_info, nullptr, &m_pipelines.skybox) != VK_SUCCESS) {
-                LOG_ERROR(false, "Failed to create graphics pipeline!");
-            }
-
-            vkDestroyShaderModule(m_device, frag_shader_module, nullptr);
-            vkDestroyShaderModule(m_device, vert_shader_module, nullptr);
+            m_pipeline_compiler->Compile(pipeline_info, {
+                { VK_SHADER_STAGE_VERTEX_BIT, "../shaders/skybox/skybox_vert.spv" },
+                { VK_SHADER_STAGE_FRAGMENT_BIT, "../shaders/skybox/skybox_frag.spv" },
+            }, &m_pipelines.skybox);
         }
     }
 
-    void GraphicsDevice::CreateVertexBuffer(VkBuffer& vertex_buffer, VkDeviceMemory& vertex_buffer_memory, uint32_t buffer_size, const Vertex* vertices) {
-        VkDeviceSize bufferSize = buffer_size;
-
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        vkUtilities::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, m_physical_device, m_device);
-
-        void* data;
-        vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, vertices, (size_t)bufferSize);
-        vkUnmapMemory(m_device, stagingBufferMemory);
-
-        vkUtilities::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer, vertex_buffer_memory, m_physical_device, m_device);
-        vkUtilities::CopyBuffer(stagingBuffer, vertex_buffer, bufferSize, m_command_pool, m_device, m_graphics_queue);
+    void GraphicsDevice::SetupSkybox(std::shared_ptr<Skybox> skybox) {
+        // The environment cubemap is written when a bake is acquired
+        {
+            VkDescriptorSetLayout layouts[] = { m_descriptorSetLayouts.skybox, m_descriptorSetLayouts.skybox };
+            VkDescriptorSet sets[2];
+            VkDescriptorSetAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+            allocInfo.descriptorPool = m_descriptor_pools.scene;
+            allocInfo.descriptorSetCount = 2;
+            allocInfo.pSetLayouts = layouts;
 
-        vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-        vkFreeMemory(m_device, stagingBufferMemory, nullptr);
-    }
-    void GraphicsDevice::CreateIndexBuffer(VkBuffer& index_buffer, VkDeviceMemory& index_buffer_memory, uint32_t buffer_size, const uint32_t* indices) {
-        //m_indices_size = indices.size();
-        VkDeviceSize bufferSize = buffer_size;
+            if (vkAllocateDescriptorSets(m_device, &allocInfo, sets) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate descriptor sets!");
+            }
+            m_descriptor_sets.skybox = sets[0];
+            m_descriptor_sets.skybox_spare = sets[1];
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        vkUtilities::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, m_physical_device, m_device);
+            VkDescriptorBufferInfo buffer_info = m_uniform_ring->GetDescriptor(sizeof(UBO));
 
-        void* data;
-        vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-        memcpy(data, indices, (size_t)bufferSize);
-        vkUnmapMemory(m_device, stagingBufferMemory);
+            std::vector<VkWriteDescriptorSet> write_descriptor_sets;
+            write_descriptor_sets.resize(2);
+            for (uint32_t i = 0; i < 2; i++) {
+                write_descriptor_sets[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                write_descriptor_sets[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+                write_descriptor_sets[i].dstSet = sets[i];
+                write_descriptor_sets[i].dstBinding = 0;
+                write_descriptor_sets[i].descriptorCount = 1;
+                write_descriptor_sets[i].pBufferInfo = &buffer_info;
+            }
 
-        vkUtilities::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, index_buffer, index_buffer_memory, m_physical_device, m_device);
+            vkUpdateDescriptorSets(m_device, write_descriptor_sets.size(), write_descriptor_sets.data(), 0, nullptr);
+        }
 
-        vkUtilities::CopyBuffer(stagingBuffer, index_buffer, bufferSize, m_command_pool, m_device, m_graphics_queue);
+    }
 
-        vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-        vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+    void GraphicsDevice::LoadEnvironment(const std::string& path) {
+        m_environment_path = path;
+        m_environment_baker->Bake(path);
     }
 
-    void GraphicsDevice::CreateUniformBuffer(const std::shared_ptr<Scene> scene) {
-        VkDeviceSize buffer_size = sizeof(UBO);
-        scene->GetSkybox()->p_ubo.uniformBuffers.resize(m_render_ahead);
-        scene->GetSkybox()->p_ubo.uniformBuffersMemory.resize(m_render_ahead);
-        scene->GetSkybox()->p_ubo.uniformBuffersMapped.resize(m_render_ahead);
-        for (int i = 0; i < scene->GetSkybox()->p_ubo.uniformBuffers.size(); i++) {
-            vkUtilities::CreateBuffer(buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, scene->GetSkybox()->p_ubo.uniformBuffers[i],
-                scene->GetSkybox()->p_ubo.uniformBuffersMemory[i], m_physical_device, m_device);
+    void GraphicsDevice::AcquireEnvironment(VkCommandBuffer command_buffer) {
+        // The spare sets were bound by the frames before the last switch, which are done once every frame slot has come round
+        if (m_environment.environment.image != VK_NULL_HANDLE && m_frame_number < m_environment_frame + m_render_ahead)
+            return;
+        EnvironmentBaker::Environment environment;
+        if (!m_environment_baker->Acquire(command_buffer, environment))
+            return;
 
-            vkMapMemory(m_device, scene->GetSkybox()->p_ubo.uniformBuffersMemory[i], 0, buffer_size, 0, &scene->GetSkybox()->p_ubo.uniformBuffersMapped[i]);
+        std::vector<VkWriteDescriptorSet> descriptorWrites(3);
+        for (auto& write : descriptorWrites) {
+            write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            write.descriptorCount = 1;
         }
-
-        for (auto& object : scene->GetSceneObjects()) {
-            VkDeviceSize buffer_size = sizeof(UBO);
-            object->p_ubo.uniformBuffers.resize(m_render_ahead);
-            object->p_ubo.uniformBuffersMemory.resize(m_render_ahead);
-            object->p_ubo.uniformBuffersMapped.resize(m_render_ahead);
-            for (int i = 0; i < object->p_ubo.uniformBuffers.size(); i++) {
-                vkUtilities::CreateBuffer(buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, object->p_ubo.uniformBuffers[i],
-                    object->p_ubo.uniformBuffersMemory[i], m_physical_device, m_device);
-
-                vkMapMemory(m_device, object->p_ubo.uniformBuffersMemory[i], 0, buffer_size, 0, &object->p_ubo.uniformBuffersMapped[i]);
-            }
-
-            buffer_size = sizeof(UBOShaderValues);
-            object->p_shader_values_ubo.uniformBuffers.resize(m_render_ahead);
-            object->p_shader_values_ubo.uniformBuffersMemory.resize(m_render_ahead);
-            object->p_shader_values_ubo.uniformBuffersMapped.resize(m_render_ahead);
-            for (int i = 0; i < object->p_shader_values_ubo.uniformBuffers.size(); i++) {
-                vkUtilities::CreateBuffer(buffer_size, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                    VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, object->p_shader_values_ubo.uniformBuffers[i],
-                    object->p_shader_values_ubo.uniformBuffersMemory[i], m_physical_device, m_device);
-
-                vkMapMemory(m_device, object->p_shader_values_ubo.uniformBuffersMemory[i], 0, buffer_size, 0, &object->p_shader_values_ubo.uniformBuffersMapped[i]);
-            }
+        descriptorWrites[0].dstSet = m_descriptor_sets.ibl_spare;
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].pImageInfo = &environment.irradiance.descriptor;
+        descriptorWrites[1].dstSet = m_descriptor_sets.ibl_spare;
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].pImageInfo = &environment.prefiltered.descriptor;
+        descriptorWrites[2].dstSet = m_descriptor_sets.skybox_spare;
+        descriptorWrites[2].dstBinding = 1;
+        descriptorWrites[2].pImageInfo = &environment.environment.descriptor;
+        vkUpdateDescriptorSets(m_device, descriptorWrites.size(), descriptorWrites.data(), 0, nullptr);
+        std::swap(m_descriptor_sets.ibl, m_descriptor_sets.ibl_spare);
+        std::swap(m_descriptor_sets.skybox, m_descriptor_sets.skybox_spare);
+
+        // The frames in flight still sample the old maps
+        if (m_environment.environment.image != VK_NULL_HANDLE) {
+            m_deletion_queue->Push([baker = m_environment_baker.get(), old = m_environment]() mutable { baker->Destroy(old); });
         }
+        m_environment = environment;
+        prefilter_mips = m_environment.prefiltered.mip_levels;
+        m_environment_generation++;
+        m_environment_frame = m_frame_number;
+        std::cout << "Environment: " << m_environment.path << std::endl;
     }
 
     void GraphicsDevice::DeleteUniformBuffers(const std::shared_ptr<Scene> scene) {
 
     }
 
-    void GraphicsDevice::CreateGraphicsPipeline() {
-        // Create Graphics Pipeline
-        auto vert_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/pbribl_vert.spv");
-        auto frag_shader_code = Utils::File::ReadFile("../shaders/pbr_ibl/pbribl_frag.spv");
-
-        VkShaderModule vert_shader_module = vkUtilities::CreateShaderModule(vert_shader_code, m_device);
-        VkShaderModule frag_shader_module = vkUtilities::CreateShaderModule(frag_shader_code, m_device);
-
-        VkPipelineShaderStageCreateInfo vert_shader_stage_info{};
-        vert_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        vert_shader_stage_info.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vert_shader_stage_info.module = vert_shader_module;
-        vert_shader_stage_info.pName = "main";
-
-        VkPipelineShaderStageCreateInfo frag_shader_stage_info{};
-        frag_shader_stage_info.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-        frag_shader_stage_info.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-        frag_shader_stage_info.module = frag_shader_module;
-        frag_shader_stage_info.pName = "main";
-
-        VkPipelineShaderStageCreateInfo shaderStages[] = { vert_shader_stage_info, frag_shader_stage_info };
+    void GraphicsDevice::CreateGraphicsPipeline(uint32_t features) {
+        // Create Graphics Pipeline. The pipelines are compiled on the pipeline compiler's threads, every Compile takes a copy
+        // of the states so they are changed right away for the next variant
+        // Variants only set the fragment shader's specialization constants MATERIAL_SPECIALIZED and MATERIAL_FEATURES
+        const bool specialized = features != MaterialFeatures::GENERIC;
+        PipelineVariant* variant = specialized ? &m_pipeline_variants[features] : nullptr;
+        const std::vector<PipelineCompiler::ShaderStage> shaders = {
+            { VK_SHADER_STAGE_VERTEX_BIT, "../shaders/pbr_ibl/pbribl_vert.spv" },
+            { VK_SHADER_STAGE_FRAGMENT_BIT, m_bindless_textures ? "../shaders/pbr_ibl/pbribl_bindless_frag.spv" : "../shaders/pbr_ibl/pbribl_frag.spv",
+                specialized ? std::vector<uint32_t>{ VK_TRUE, features } : std::vector<uint32_t>{} },
+        };
 
         VkPipelineVertexInputStateCreateInfo vertex_input_info{};
         vertex_input_info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
@@ -2274,8 +1416,6 @@ namespace Diffuse {
 
         VkGraphicsPipelineCreateInfo pipeline_info{};
         pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-        pipeline_info.stageCount = 2;
-        pipeline_info.pStages = shaderStages;
         pipeline_info.pVertexInputState = &vertex_input_info;
         pipeline_info.pInputAssemblyState = &inputAssembly;
         pipeline_info.pViewportState = &viewport_state;
@@ -2289,16 +1429,20 @@ namespace Diffuse {
         pipeline_info.subpass = 0;
         pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
 
-        if (vkCreateGraphicsPipelines(m_device, m_pipeline_cache, 1, &pipeline_info, nullptr, &m_pipelines.pbr) != VK_SUCCESS) {
-            LOG_ERROR(false, "Failed to create graphics pipeline!");
+        // After the pre-pass the depth is final, only the visible surface of each pixel passes
+        if (m_depth_prepass) {
+            depthStencil.depthWriteEnable = VK_FALSE;
+            depthStencil.depthCompareOp = VK_COMPARE_OP_EQUAL;
         }
+        std::vector<PipelineCompiler::Ticket> tickets;
+        tickets.push_back(m_pipeline_compiler->Compile(pipeline_info, shaders, specialized ? &variant->pbr : &m_pipelines.pbr));
 
         // Double sided
         rasterizer.cullMode = VK_CULL_MODE_NONE;
-        if (vkCreateGraphicsPipelines(m_device, m_pipeline_cache, 1, &pipeline_info, nullptr, &m_pipelines.double_sided) != VK_SUCCESS) {
-            LOG_ERROR(false, "Failed to create graphics pipeline!");
-        }
+        tickets.push_back(m_pipeline_compiler->Compile(pipeline_info, shaders, specialized ? &variant->double_sided : &m_pipelines.double_sided));
         // Alpha blending
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
         rasterizer.cullMode = VK_CULL_MODE_NONE;
         color_blend_attachment.blendEnable = VK_TRUE;
         color_blend_attachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
@@ -2308,16 +1452,99 @@ namespace Diffuse {
         color_blend_attachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
         color_blend_attachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
         color_blend_attachment.alphaBlendOp = VK_BLEND_OP_ADD;
-        if (vkCreateGraphicsPipelines(m_device, m_pipeline_cache, 1, &pipeline_info, nullptr, &m_pipelines.alpha_blending) != VK_SUCCESS) {
-            LOG_ERROR(false, "Failed to create graphics pipeline!");
+        tickets.push_back(m_pipeline_compiler->Compile(pipeline_info, shaders, specialized ? &variant->alpha_blending : &m_pipelines.alpha_blending));
+        if (specialized) {
+            variant->pending = std::move(tickets);
+        }
+
+        // Depth pre-pass, shared by all variants
+        if (m_depth_prepass && !specialized) {
+            color_blend_attachment = {};
+            color_blend_attachment.colorWriteMask = 0;
+
+            // Opaque draws only read the position from the interleaved vertices and have no fragment shader
+            const std::vector<PipelineCompiler::ShaderStage> depth_shaders = {
+                { VK_SHADER_STAGE_VERTEX_BIT, "../shaders/pbr_ibl/depth_vert.spv" },
+            };
+            vertex_input_info.vertexAttributeDescriptionCount = 1;
+            vertex_input_info.pVertexAttributeDescriptions = vertexInputAttributes.data();
+            rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+            m_pipeline_compiler->Compile(pipeline_info, depth_shaders, &m_pipelines.depth_prepass);
+            rasterizer.cullMode = VK_CULL_MODE_NONE;
+            m_pipeline_compiler->Compile(pipeline_info, depth_shaders, &m_pipelines.depth_prepass_double_sided);
+
+            // Masked draws also need the texture coordinates for the alpha test
+            const std::vector<PipelineCompiler::ShaderStage> mask_shaders = {
+                { VK_SHADER_STAGE_VERTEX_BIT, "../shaders/pbr_ibl/depth_mask_vert.spv" },
+                { VK_SHADER_STAGE_FRAGMENT_BIT, m_bindless_textures ? "../shaders/pbr_ibl/depth_mask_bindless_frag.spv" : "../shaders/pbr_ibl/depth_mask_frag.spv" },
+            };
+            std::vector<VkVertexInputAttributeDescription> mask_attributes = { vertexInputAttributes[0], vertexInputAttributes[2], vertexInputAttributes[3] };
+            vertex_input_info.vertexAttributeDescriptionCount = static_cast<uint32_t>(mask_attributes.size());
+            vertex_input_info.pVertexAttributeDescriptions = mask_attributes.data();
+            rasterizer.cullMode = VK_CULL_MODE_BACK_BIT;
+            m_pipeline_compiler->Compile(pipeline_info, mask_shaders, &m_pipelines.depth_prepass_mask);
+            rasterizer.cullMode = VK_CULL_MODE_NONE;
+            m_pipeline_compiler->Compile(pipeline_info, mask_shaders, &m_pipelines.depth_prepass_mask_double_sided);
+        }
+    }
+
+    void GraphicsDevice::SetupMaterialVariants(const std::shared_ptr<Scene>& scene) {
+        if (!m_material_variants)
+            return;
+        std::set<uint32_t> variants;
+        uint32_t material_count = 0;
+        uint64_t primitive_count = 0;
+        uint64_t generic_fetches = 0, variant_fetches = 0;
+        uint64_t generic_branches = 0;
+        for (auto& scene_object : scene->GetSceneObjects()) {
+            Model& model = scene_object->p_model;
+            for (size_t i = 0; i < model.GetMaterials().size(); i++) {
+                Material& material = model.GetMaterial(i);
+                // Missing textures were replaced by m_white_texture, the variants skip them
+                material.shaderFeatures = MaterialFeatures::Get(material, m_white_texture);
+                variants.insert(material.shaderFeatures);
+                material_count++;
+            }
+
+            // Savings per fragment, averaged over the primitives drawn with each material
+            std::vector<Node*> nodes = model.GetNodes();
+            while (!nodes.empty()) {
+                Node* node = nodes.back();
+                nodes.pop_back();
+                nodes.insert(nodes.end(), node->children.begin(), node->children.end());
+                if (!node->mesh)
+                    continue;
+                for (Primitive* primitive : node->mesh->primitives) {
+                    const Material& material = model.GetMaterial(primitive->material_index > -1 ? primitive->material_index : 0);
+                    MaterialFeatures::Cost generic = MaterialFeatures::Estimate(MaterialFeatures::Get(material, nullptr), false);
+                    MaterialFeatures::Cost variant = MaterialFeatures::Estimate(material.shaderFeatures, true);
+                    generic_fetches += generic.texture_fetches;
+                    generic_branches += generic.branches;
+                    variant_fetches += variant.texture_fetches;
+                    primitive_count++;
+                }
+            }
         }
 
-        vkDestroyShaderModule(m_device, frag_shader_module, nullptr);
-        vkDestroyShaderModule(m_device, vert_shader_module, nullptr);
+        double primitives = static_cast<double>(std::max<uint64_t>(primitive_count, 1));
+        std::cout << "Material variants: " << variants.size() << " for " << material_count << " materials, per fragment "
+            << generic_fetches / primitives << " -> " << variant_fetches / primitives << " texture fetches and "
+            << generic_branches / primitives << " -> 0 material branches (average over " << primitive_count << " primitives)" << std::endl;
     }
 
     void GraphicsDevice::Draw(std::shared_ptr<Scene> scene, std::shared_ptr<EditorCamera> camera, float dt) {
+        auto wait_start = std::chrono::high_resolution_clock::now();
         vkWaitForFences(m_device, 1, &m_wait_fences[m_current_frame_index], VK_TRUE, UINT64_MAX);
+        m_frame_timer->BeginFrame(m_current_frame_index, std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - wait_start).count());
+        // Everything retired while this slot last recorded is unused now
+        m_deletion_queue->BeginFrame(m_current_frame_index);
+        m_upload_queue->BeginFrame(m_current_frame_index);
+        if (m_texture_streamer) {
+            m_texture_streamer->BeginFrame(m_current_frame_index);
+        }
+        if (m_gpu_culler) {
+            m_gpu_culler->BeginFrame(m_current_frame_index);
+        }
 
         if (m_window->IsWindowResized()) {
             RecreateSwapchain();
@@ -2338,13 +1565,28 @@ namespace Diffuse {
             LOG_ERROR(false, "Failed to acquire swap chain image!");
         }
 
+        // The fence above guarantees the GPU is done with this frame's part of the ring
+        m_uniform_ring->BeginFrame(m_current_frame_index);
         {
             UBO ubo{};
             ubo.model = glm::mat4(1.0f);
             ubo.view = camera->GetViewMatrix();
             ubo.proj = camera->GetProjection();
 
-            memcpy(scene->GetSkybox()->p_ubo.uniformBuffersMapped[m_current_frame_index], &ubo, sizeof(ubo));
+            scene->GetSkybox()->p_ubo_offset = m_uniform_ring->Push(ubo);
+        }
+
+        {
+            UBOShaderValues ubo{};
+            ubo.lightDir = glm::vec4(0.0f, 1.0, 1.0, 0.0);
+            ubo.exposure = 4.0f;
+            ubo.gamma = 2.0f;
+            ubo.prefilteredCubeMipLevels = prefilter_mips;
+            ubo.scaleIBLAmbient = 0.5f;
+            ubo.debugViewInputs = 0.0f;
+            ubo.debugViewEquation = 0.0f;
+
+            m_shader_values_offset = m_uniform_ring->Push(ubo);
         }
 
         // Updating uniform buffers
@@ -2360,41 +1602,63 @@ namespace Diffuse {
                 ubo.proj = camera->GetProjection();
                 //ubo.cam_pos = camera->GetPosition();
 
-                memcpy(object->p_ubo.uniformBuffersMapped[m_current_frame_index], &ubo, sizeof(ubo));
-            }
+                object->p_ubo_offset = m_uniform_ring->Push(ubo);
+                object->p_world = ubo.model;
 
-            {
-                UBOShaderValues ubo{};
-                ubo.lightDir = glm::vec4(0.0f, 1.0, 1.0, 0.0);
-                ubo.exposure = 4.0f;
-                ubo.gamma = 2.0f;
-                ubo.prefilteredCubeMipLevels = prefilter_mips;
-                ubo.scaleIBLAmbient = 0.5f;
-                ubo.debugViewInputs = 0.0f;
-                ubo.debugViewEquation = 0.0f;
+                if (m_texture_streamer) {
+                    m_texture_streamer->Request(*object, ubo.model, *camera, static_cast<float>(m_swapchain->GetExtentHeight()));
+                }
+            }
+        }
 
-                memcpy(object->p_shader_values_ubo.uniformBuffersMapped[m_current_frame_index], &ubo, sizeof(ubo));
+        // World boxes follow the matrices just written, the scene's hierarchy is refit where they moved
+        scene->UpdateBounds();
+        if (m_gpu_culler) {
+            for (uint32_t i = 0; i < scene->GetSceneObjects().size(); i++) {
+                const auto& object = scene->GetSceneObjects()[i];
+                m_gpu_culler->SetInstance(i, object->p_world, object->p_model.GetBounds(), object->p_render);
             }
         }
 
         vkResetFences(m_device, 1, &m_wait_fences[m_current_frame_index]);
 
+        auto record_start = std::chrono::high_resolution_clock::now();
         vkResetCommandBuffer(m_command_buffers[m_current_frame_index], /*VkCommandBufferResetFlagBits*/ 0);
         RecordCommandBuffer(scene, camera, m_command_buffers[m_current_frame_index], imageIndex);
+        m_frame_timer->AddRecordTime(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - record_start).count());
 
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = { m_render_complete_semaphores[m_current_frame_index] };
-        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-        submitInfo.waitSemaphoreCount = 1;
+        VkSemaphore waitSemaphores[] = { m_render_complete_semaphores[m_current_frame_index], VK_NULL_HANDLE, VK_NULL_HANDLE };
+        VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0 };
+        uint64_t waitValues[] = { 0, 0, 0 };
+        uint32_t waitCount = 1;
+
+        // This frame's uploads run on the transfer queue, textures are acquired once its timeline value is reached
+        if (m_upload_queue->Submit(waitSemaphores[waitCount], waitValues[waitCount], waitStages[waitCount])) {
+            waitCount++;
+        }
+        // An environment baked on the compute queue and acquired by this frame
+        if (m_environment_baker->GetFrameWait(waitSemaphores[waitCount], waitValues[waitCount], waitStages[waitCount])) {
+            waitCount++;
+        }
+        submitInfo.waitSemaphoreCount = waitCount;
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
 
+        VkTimelineSemaphoreSubmitInfo timelineInfo{ VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO };
+        if (waitCount > 1) {
+            timelineInfo.waitSemaphoreValueCount = waitCount;
+            timelineInfo.pWaitSemaphoreValues = waitValues;
+            submitInfo.pNext = &timelineInfo;
+        }
+
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &m_command_buffers[m_current_frame_index];
 
-        VkSemaphore signalSemaphores[] = { m_present_complete_semaphores[m_current_frame_index] };
+        // Indexed by image, the presentation engine may still hold the semaphore of a frame slot's previous image
+        VkSemaphore signalSemaphores[] = { m_present_complete_semaphores[imageIndex] };
         submitInfo.signalSemaphoreCount = 1;
         submitInfo.pSignalSemaphores = signalSemaphores;
 
@@ -2421,12 +1685,19 @@ namespace Diffuse {
         if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_window->IsWindowResized()) {
             m_window->WindowResized(false);
             //m_framebuffer_resized = false;
-            CleanUpSwapchain();
+            // Waits for the frames in flight before the swapchain images and framebuffers are replaced
+            RecreateSwapchain();
         }
         else if (result != VK_SUCCESS) {
             LOG_ERROR(false, "failed to present swap chain image!");
         }
         m_current_frame_index = (m_current_frame_index + 1) % m_render_ahead;
+
+        // The budget query goes to the driver, every 60 frames is enough to catch growth
+        m_frame_number++;
+        if (m_memory_budget_warning && m_frame_number % 60 == 0) {
+            m_memory_allocator->CheckBudget(m_memory_budget_limit);
+        }
     }
 
     void GraphicsDevice::RecordCommandBuffer(std::shared_ptr<Scene> scene, std::shared_ptr<EditorCamera> camera, VkCommandBuffer command_buffer, uint32_t image_index) {
@@ -2435,6 +1706,14 @@ namespace Diffuse {
         if (vkBeginCommandBuffer(command_buffer, &beginInfo) != VK_SUCCESS) {
             throw std::runtime_error("failed to begin recording command buffer!");
         }
+        m_frame_timer->WriteBegin(command_buffer);
+
+        // Texture mip uploads and evictions for this frame
+        if (m_texture_streamer) {
+            m_texture_streamer->Update(command_buffer);
+        }
+        // A finished environment bake replaces the IBL maps and the skybox from this frame on
+        AcquireEnvironment(command_buffer);
 
         // Render offscreen framebuffer
         // only once
@@ -2452,8 +1731,213 @@ namespace Diffuse {
         renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
         renderPassInfo.pClearValues = clearValues.data();
 
-        vkCmdBeginRenderPass(command_buffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+        // Subtrees of the scene hierarchy outside the view frustum are rejected whole, the primitives of the
+        // visible objects are culled one by one
+        const glm::mat4 view = camera->GetViewMatrix();
+        const glm::mat4 view_projection = camera->GetViewProjection();
+        glm::vec4 planes[6];
+        FrustumCuller::ExtractPlanes(view_projection, planes);
+        m_visible_object_ids.clear();
+        m_cull_stats = {};
+        m_cull_stats.bvh_nodes = scene->GetBVH().QueryFrustum(planes, m_visible_object_ids);
+        // Scene order keeps the draw candidates and the visibility hash independent of the tree layout
+        std::sort(m_visible_object_ids.begin(), m_visible_object_ids.end());
+        m_object_visibility_hash = Utils::Hash::Murmur3_128(m_visible_object_ids.data(), m_visible_object_ids.size() * sizeof(uint32_t)).low;
+        m_visible_objects.clear();
+        for (uint32_t id : m_visible_object_ids) {
+            if (scene->GetSceneObjects()[id]->p_render)
+                m_visible_objects.push_back(scene->GetSceneObjects()[id]);
+        }
+        m_cull_stats.objects = scene->GetSceneObjects().size();
+        m_cull_stats.objects_culled = m_cull_stats.objects - m_visible_objects.size();
+
+        // With GPU culling only the blended primitives are culled and sorted here, the rest is culled by a compute pass
+        // that has to run before the render pass begins. With occlusion culling that is the early phase, the late phase
+        // runs between the early and the late render pass
+        const GpuCuller::Phase gpu_phase = m_depth_pyramid ? GpuCuller::PHASE_LATE : GpuCuller::PHASE_ALL;
+        m_draw_candidates.clear();
+        m_culler->Clear();
+        if (m_gpu_culler) {
+            for (uint32_t id : m_visible_object_ids) {
+                const auto& object = scene->GetSceneObjects()[id];
+                if (!object->p_render)
+                    continue;
+                for (Primitive* primitive : m_blend_primitives[id]) {
+                    GatherPrimitive(object, primitive, view);
+                }
+            }
+        }
+        else {
+            for (auto& object : m_visible_objects) {
+                for (auto& node : object->p_model.GetNodes()) {
+                    GatherNode(object, node, view);
+                }
+            }
+        }
+        m_culler->Cull(view_projection);
+        m_cull_stats.primitives = m_culler->GetCount();
+        m_cull_stats.primitives_culled = m_culler->GetCount() - m_culler->GetVisibleCount();
+        m_cull_totals.bvh_nodes += m_cull_stats.bvh_nodes;
+        m_cull_totals.objects += m_cull_stats.objects;
+        m_cull_totals.objects_culled += m_cull_stats.objects_culled;
+        m_cull_totals.primitives += m_cull_stats.primitives;
+        m_cull_totals.primitives_culled += m_cull_stats.primitives_culled;
+        m_cull_frames++;
+
+        // The visible draws of all objects are sorted together, so state only changes where it differs between neighbours
+        m_render_queue->Begin();
+        for (uint32_t i = 0; i < m_draw_candidates.size(); i++) {
+            if (m_culler->IsVisible(i))
+                m_render_queue->Push(m_draw_candidates[i].pass, m_draw_candidates[i].depth, m_draw_candidates[i].item);
+        }
+        m_render_queue->Sort();
+
+        // Only the contents of the uniform ring change from frame to frame, so the scene is replayed from this slot's
+        // secondary command buffers for the framebuffer and recorded again only when something baked into them changed
+        StaticCommands& cache = m_static_commands[m_current_frame_index * m_framebuffers.size() + image_index];
+        BuildStaticSignature(scene, m_static_signature);
+        if (!m_enable_static_commands || !cache.valid || cache.signature != m_static_signature) {
+            // The sorted draws are split into contiguous chunks recorded in parallel, chunk i always records into
+            // a command buffer of the slot's pool i, so no pool is used by two threads at once
+            const uint32_t draw_count = m_render_queue->GetDrawCount();
+            const uint32_t chunk_count = std::clamp((draw_count + s_min_draws_per_chunk - 1) / s_min_draws_per_chunk, 1u, m_worker_pool->GetWorkerCount());
+            std::vector<RenderQueue::Stats> chunk_stats(chunk_count);
+            std::atomic<bool> failed = false;
+            // The render passes are compatible, so every secondary buffer inherits m_render_pass
+            VkCommandBufferInheritanceInfo inheritance{};
+            inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+            inheritance.renderPass = m_render_pass;
+            inheritance.subpass = 0;
+            inheritance.framebuffer = m_framebuffers[image_index];
+
+            VkCommandBufferBeginInfo secondary_info{};
+            secondary_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            secondary_info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+            secondary_info.pInheritanceInfo = &inheritance;
+            // The skybox and the early phase's buckets, recorded before the first chunk's pool is handed to a worker
+            RenderQueue::Stats early_stats;
+            if (m_depth_pyramid) {
+                if (vkBeginCommandBuffer(cache.early, &secondary_info) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to record scene command buffers!");
+                }
+                if (m_depth_prepass) {
+                    early_stats = RecordDepthPrepass(scene, cache.early, 0, 0, true, GpuCuller::PHASE_EARLY);
+                }
+                early_stats += RecordScene(scene, cache.early, 0, 0, true, GpuCuller::PHASE_EARLY);
+                if (vkEndCommandBuffer(cache.early) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to record scene command buffers!");
+                }
+            }
+            m_worker_pool->ParallelFor(chunk_count, [&](uint32_t chunk, uint32_t worker) {
+                uint32_t first = static_cast<uint32_t>(uint64_t(draw_count) * chunk / chunk_count);
+                uint32_t last = static_cast<uint32_t>(uint64_t(draw_count) * (chunk + 1) / chunk_count);
+                if (m_depth_prepass) {
+                    VkCommandBuffer depth_secondary = cache.depth_command_buffers[chunk];
+                    if (vkBeginCommandBuffer(depth_secondary, &secondary_info) != VK_SUCCESS) {
+                        failed = true;
+                        return;
+                    }
+                    chunk_stats[chunk] = RecordDepthPrepass(scene, depth_secondary, first, last - first, chunk == 0, gpu_phase);
+                    if (vkEndCommandBuffer(depth_secondary) != VK_SUCCESS) {
+                        failed = true;
+                    }
+                }
+                VkCommandBuffer secondary = cache.command_buffers[chunk];
+                if (vkBeginCommandBuffer(secondary, &secondary_info) != VK_SUCCESS) {
+                    failed = true;
+                    return;
+                }
+                chunk_stats[chunk] += RecordScene(scene, secondary, first, last - first, chunk == 0, gpu_phase);
+                if (vkEndCommandBuffer(secondary) != VK_SUCCESS) {
+                    failed = true;
+                }
+            });
+            if (failed) {
+                throw std::runtime_error("failed to record scene command buffers!");
+            }
+
+            RenderQueue::Stats stats = early_stats;
+            for (const auto& chunk : chunk_stats) {
+                stats += chunk;
+            }
+            m_render_queue->AddFrameStats(stats);
+            cache.chunk_count = chunk_count;
+            cache.signature = m_static_signature;
+            cache.valid = true;
+            m_static_records++;
+        }
+        m_static_frames++;
+
+        // The frame's passes, the graph places the barriers between the compute passes and the render passes. The render
+        // passes keep their subpass dependencies for the attachments
+        using Usage = RenderGraph::Usage;
+        RenderGraph& graph = *m_frame_graph;
+        graph.Reset();
+        RenderGraph::Resource color = graph.ImportImage("swapchain image", m_swapchain->GetSwapchainImage(image_index), VK_NULL_HANDLE, m_swapchain->GetFormat(), 1, 1,
+            { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0 });
+        RenderGraph::Resource depth = graph.ImportImage("depth", m_depth_image, m_depth_image_view, m_depth_format, 1, 1,
+            { VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT });
+        // Only this frame slot's last frame used them, its fence was waited on
+        RenderGraph::Resource commands = graph.ImportBuffer("indirect commands", m_gpu_culler ? m_gpu_culler->GetIndirectBuffer() : VK_NULL_HANDLE, {});
+        RenderGraph::Resource counts = graph.ImportBuffer("draw counts", m_gpu_culler ? m_gpu_culler->GetCountBuffer() : VK_NULL_HANDLE, {});
+
+        if (m_gpu_culler) {
+            graph.AddPass("cull", [this, view_projection](VkCommandBuffer cmd) {
+                m_gpu_culler->Cull(cmd, view_projection, m_depth_pyramid ? GpuCuller::PHASE_EARLY : GpuCuller::PHASE_ALL);
+            })
+                .Write(commands, Usage::ComputeWrite)
+                .Write(counts, Usage::ComputeWrite)
+                .SideEffect();
+        }
+        if (m_depth_pyramid) {
+            // Last frame's visible draws lay down the depth the rest is tested against, the late pass draws what they missed
+            RenderGraph::Resource pyramid = graph.ImportImage("depth pyramid", m_depth_pyramid->GetImage(), m_depth_pyramid->GetView(), VK_FORMAT_R32_SFLOAT,
+                m_depth_pyramid->GetLevelCount(), 1, { VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0 });
+            graph.AddPass("early scene", [this, &renderPassInfo, &cache](VkCommandBuffer cmd) {
+                renderPassInfo.renderPass = m_early_render_pass;
+                vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+                vkCmdExecuteCommands(cmd, 1, &cache.early);
+                vkCmdEndRenderPass(cmd);
+            })
+                .Attachment(color, Usage::ColorAttachment, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL)
+                .Attachment(depth, Usage::DepthAttachment, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+                    VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT)
+                .Read(commands, Usage::IndirectRead)
+                .Read(counts, Usage::IndirectRead);
+            graph.AddPass("depth pyramid", [this](VkCommandBuffer cmd) { m_depth_pyramid->Build(cmd); })
+                .Read(depth, Usage::DepthRead)
+                .Write(pyramid, Usage::ComputeWrite, {}, true);
+            graph.AddPass("late cull", [this, view_projection](VkCommandBuffer cmd) { m_gpu_culler->Cull(cmd, view_projection, GpuCuller::PHASE_LATE); })
+                .Read(pyramid, Usage::ComputeRead)
+                .Write(commands, Usage::ComputeWrite)
+                .Write(counts, Usage::ComputeWrite)
+                .SideEffect();
+        }
+        graph.AddPass("scene", [this, &renderPassInfo, &cache](VkCommandBuffer cmd) {
+            renderPassInfo.renderPass = m_depth_pyramid ? m_late_render_pass : m_render_pass;
+            vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+            if (m_depth_prepass) {
+                vkCmdExecuteCommands(cmd, cache.chunk_count, cache.depth_command_buffers.data());
+            }
+            vkCmdExecuteCommands(cmd, cache.chunk_count, cache.command_buffers.data());
+            vkCmdEndRenderPass(cmd);
+        })
+            .Attachment(color, Usage::ColorAttachment, m_depth_pyramid ? VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR)
+            .Attachment(depth, Usage::DepthAttachment, m_depth_pyramid ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED,
+                VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL)
+            .Read(commands, Usage::IndirectRead)
+            .Read(counts, Usage::IndirectRead);
+        graph.Output(color, Usage::Present);
+        graph.Execute(command_buffer);
+
+        m_frame_timer->WriteEnd(command_buffer);
 
+        if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+    }
+
+    void GraphicsDevice::BeginSceneCommands(VkCommandBuffer command_buffer) {
         VkViewport viewport{};
         viewport.x = 0.0f;
         viewport.y = 0.0f;
@@ -2468,98 +1952,277 @@ namespace Diffuse {
         scissor.extent = m_swapchain->GetExtent();
         vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 
-        if (scene->GetSkybox()->p_render) {
-            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layouts.skybox, 0, 1, &m_descriptor_sets.skybox, 0, nullptr);
+        // Every model's geometry lives in the pool's two buffers, bound once per command buffer
+        m_geometry_pool->Bind(command_buffer);
+    }
+
+    RenderQueue::Stats GraphicsDevice::RecordScene(std::shared_ptr<Scene> scene, VkCommandBuffer command_buffer, uint32_t first_draw, uint32_t draw_count, bool first_chunk,
+        GpuCuller::Phase gpu_phase) {
+        BeginSceneCommands(command_buffer);
+
+        if (first_chunk && gpu_phase != GpuCuller::PHASE_LATE && scene->GetSkybox()->p_render) {
+            vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layouts.skybox, 0, 1, &m_descriptor_sets.skybox, 1, &scene->GetSkybox()->p_ubo_offset);
             vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelines.skybox);
-            VkBuffer vertexBuffers[] = { scene->GetSkybox()->p_model.m_vertices.buffer };
-            VkDeviceSize offsets[] = { 0 };
-            vkCmdBindVertexBuffers(command_buffer, 0, 1, vertexBuffers, offsets);
-            vkCmdBindIndexBuffer(command_buffer, scene->GetSkybox()->p_model.m_indices.buffer, 0, VK_INDEX_TYPE_UINT32);
             //models.skybox.draw(currentCB);
             for (auto& node : scene->GetSkybox()->p_model.GetNodes()) {
-                DrawNodeSkybox(node, command_buffer);
+                DrawNodeSkybox(scene->GetSkybox()->p_model, node, command_buffer);
             }
         }
 
-        //vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout, 0, 1, &m_descriptor_sets.scene[m_current_frame_index], 0, nullptr);
+        // Opaque and masked buckets come before the blended draws of the render queue
+        VkDescriptorSet texture_set = m_bindless_textures ? m_bindless_textures->GetDescriptorSet(m_current_frame_index) : VK_NULL_HANDLE;
+        RenderQueue::Stats gpu_stats;
+        if (first_chunk && m_gpu_culler) {
+            gpu_stats = m_gpu_culler->Record(command_buffer, m_pipeline_layouts.scene, m_descriptor_sets.ibl, texture_set, m_shader_values_offset, *scene, gpu_phase);
+        }
+
+        RenderQueue::Stats stats = m_render_queue->Record(command_buffer, m_pipeline_layouts.scene, m_descriptor_sets.ibl, texture_set, m_shader_values_offset, first_draw, draw_count);
+        stats += gpu_stats;
+        return stats;
+    }
+
+    RenderQueue::Stats GraphicsDevice::RecordDepthPrepass(std::shared_ptr<Scene> scene, VkCommandBuffer command_buffer, uint32_t first_draw, uint32_t draw_count, bool first_chunk,
+        GpuCuller::Phase gpu_phase) {
+        BeginSceneCommands(command_buffer);
+        // Same state and draws as RecordScene with the depth pipelines, blended draws are left out
+        VkDescriptorSet texture_set = m_bindless_textures ? m_bindless_textures->GetDescriptorSet(m_current_frame_index) : VK_NULL_HANDLE;
+        RenderQueue::Stats stats;
+        if (first_chunk && m_gpu_culler) {
+            stats = m_gpu_culler->Record(command_buffer, m_pipeline_layouts.scene, m_descriptor_sets.ibl, texture_set, m_shader_values_offset, *scene, gpu_phase, true);
+        }
+        stats += m_render_queue->Record(command_buffer, m_pipeline_layouts.scene, m_descriptor_sets.ibl, texture_set, m_shader_values_offset, first_draw, draw_count, true);
+        return stats;
+    }
+
+    void GraphicsDevice::BuildStaticSignature(const std::shared_ptr<Scene>& scene, std::vector<uint64_t>& signature) const {
+        signature.clear();
+        signature.push_back((uint64_t)scene.get());
+        // A grown geometry pool has new buffers
+        signature.push_back((uint64_t)m_geometry_pool->GetVertexBuffer());
+        signature.push_back((uint64_t)m_geometry_pool->GetIndexBuffer());
+        // Dynamic offsets into the uniform ring are recorded, the data behind them is not
+        signature.push_back(m_shader_values_offset);
+        signature.push_back(scene->GetSkybox()->p_render ? scene->GetSkybox()->p_ubo_offset : UINT64_MAX);
         for (auto& object : scene->GetSceneObjects()) {
-            if (!object->p_render)
-                continue;
-            VkBuffer vertexBuffers[] = { object->p_model.m_vertices.buffer };
-            VkDeviceSize offsets[] = { 0 };
-            vkCmdBindVertexBuffers(command_buffer, 0, 1, vertexBuffers, offsets);
-            vkCmdBindIndexBuffer(command_buffer, object->p_model.m_indices.buffer, 0, VK_INDEX_TYPE_UINT32);
+            signature.push_back(object->p_render ? object->p_ubo_offset : UINT64_MAX);
+        }
+        // Rewriting a bound descriptor set invalidates the command buffer
+        signature.push_back(m_texture_streamer ? m_texture_streamer->GetDescriptorVersion(m_current_frame_index) : 0);
+        // The skybox and IBL sets are switched with the environment
+        signature.push_back(m_environment_generation);
+        // Materials switch from the generic pipelines to their variants once those are compiled
+        signature.push_back(m_variant_generation);
+        // The culled draws change with the camera
+        signature.push_back(m_object_visibility_hash);
+        signature.push_back(m_culler->GetVisibilityHash());
+        // Blended draws must stay back to front as the camera moves, opaque ones only lose some early depth rejection
+        signature.push_back(m_render_queue->GetOrderHash(RenderQueue::PASS_BLEND));
+    }
 
-            for (auto& node : object->p_model.GetNodes()) {
-                DrawNode(object, node, command_buffer, Material::ALPHAMODE_OPAQUE);
+    void GraphicsDevice::CreateStaticCommandBuffers() {
+        FreeStaticCommandBuffers();
+
+        // Every chunk of a frame slot allocates from its own pool, one command buffer per framebuffer
+        const uint32_t workers = m_worker_pool->GetWorkerCount();
+        m_static_commands.resize(m_render_ahead * m_framebuffers.size());
+        for (uint32_t frame = 0; frame < m_render_ahead; frame++) {
+            for (uint32_t chunk = 0; chunk < workers; chunk++) {
+                // The second half records the chunk's depth pre-pass
+                std::vector<VkCommandBuffer> command_buffers(m_framebuffers.size() * (m_depth_prepass ? 2 : 1));
+                VkCommandBufferAllocateInfo alloc_info{};
+                alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                alloc_info.commandPool = m_recording_pools[frame * workers + chunk];
+                alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                alloc_info.commandBufferCount = (uint32_t)command_buffers.size();
+                if (vkAllocateCommandBuffers(m_device, &alloc_info, command_buffers.data()) != VK_SUCCESS) {
+                    LOG_ERROR(false, "Failed to allocate scene command buffers!");
+                }
+                for (size_t image = 0; image < m_framebuffers.size(); image++) {
+                    StaticCommands& cache = m_static_commands[frame * m_framebuffers.size() + image];
+                    cache.frame_index = frame;
+                    cache.command_buffers.push_back(command_buffers[image]);
+                    if (m_depth_prepass) {
+                        cache.depth_command_buffers.push_back(command_buffers[m_framebuffers.size() + image]);
+                    }
+                }
+            }
+            if (m_depth_pyramid) {
+                for (size_t image = 0; image < m_framebuffers.size(); image++) {
+                    VkCommandBufferAllocateInfo alloc_info{};
+                    alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+                    alloc_info.commandPool = m_recording_pools[frame * workers];
+                    alloc_info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+                    alloc_info.commandBufferCount = 1;
+                    if (vkAllocateCommandBuffers(m_device, &alloc_info, &m_static_commands[frame * m_framebuffers.size() + image].early) != VK_SUCCESS) {
+                        LOG_ERROR(false, "Failed to allocate scene command buffers!");
+                    }
+                }
             }
+        }
+    }
 
-            for (auto& node : object->p_model.GetNodes()) {
-                DrawNode(object, node, command_buffer, Material::ALPHAMODE_MASK);
+    void GraphicsDevice::FreeStaticCommandBuffers() {
+        const uint32_t workers = m_worker_pool->GetWorkerCount();
+        for (auto& cache : m_static_commands) {
+            for (uint32_t chunk = 0; chunk < cache.command_buffers.size(); chunk++) {
+                vkFreeCommandBuffers(m_device, m_recording_pools[cache.frame_index * workers + chunk], 1, &cache.command_buffers[chunk]);
+            }
+            for (uint32_t chunk = 0; chunk < cache.depth_command_buffers.size(); chunk++) {
+                vkFreeCommandBuffers(m_device, m_recording_pools[cache.frame_index * workers + chunk], 1, &cache.depth_command_buffers[chunk]);
             }
+            if (cache.early != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(m_device, m_recording_pools[cache.frame_index * workers], 1, &cache.early);
+            }
+        }
+        m_static_commands.clear();
+    }
 
-            for (auto& node : object->p_model.GetNodes()) {
-                DrawNode(object, node, command_buffer, Material::ALPHAMODE_BLEND);
+    void GraphicsDevice::GatherNode(const std::shared_ptr<SceneObject>& object, Node* node, const glm::mat4& view) {
+        if (node->mesh) {
+            for (Primitive* primitive : node->mesh->primitives) {
+                GatherPrimitive(object, primitive, view);
             }
         }
+        for (auto& child : node->children) {
+            GatherNode(object, child, view);
+        }
+    }
 
-        vkCmdEndRenderPass(command_buffer);
+    void GraphicsDevice::GatherPrimitive(const std::shared_ptr<SceneObject>& object, Primitive* primitive, const glm::mat4& view) {
+        const GeometryAllocation& geometry = object->p_model.GetGeometry();
+        uint32_t index = primitive->material_index > -1 ? primitive->material_index : 0;
+        const Material& material = object->p_model.GetMaterial(index);
+
+        DrawItem item;
+        RenderQueue::Pass pass = RenderQueue::PASS_OPAQUE;
+        item.pipeline = SelectPipeline(material, pass);
+        item.depth_pipeline = SelectDepthPipeline(material);
+        item.material_set = material.descriptorSets[m_current_frame_index];
+        item.object_set = object->p_mat_descritpor_set;
+        item.ubo_offset = object->p_ubo_offset;
+        item.material_index = primitive->material_index;
+        item.index_count = primitive->index_count;
+        item.first_index = geometry.first_index + primitive->first_index;
+        item.vertex_offset = geometry.vertex_offset;
+
+        BoundingBox bounds = primitive->bb.Transform(object->p_world);
+        float depth = bounds.valid ? -(view * glm::vec4(bounds.Center(), 1.0f)).z : 0.0f;
+        m_draw_candidates.push_back({ item, pass, depth });
+        m_culler->Add(bounds);
+    }
 
-        if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
-            throw std::runtime_error("failed to record command buffer!");
+    VkPipeline GraphicsDevice::SelectPipeline(const Material& material, RenderQueue::Pass& pass) {
+        const PipelineVariant* variant = material.shaderFeatures != MaterialFeatures::GENERIC ? GetPipelineVariant(material.shaderFeatures) : nullptr;
+        if (material.alphaMode == Material::ALPHAMODE_BLEND) {
+            pass = RenderQueue::PASS_BLEND;
+            return variant ? variant->alpha_blending : m_pipelines.alpha_blending;
         }
+        pass = material.alphaMode == Material::ALPHAMODE_MASK ? RenderQueue::PASS_MASK : RenderQueue::PASS_OPAQUE;
+        if (material.doubleSided)
+            return variant ? variant->double_sided : m_pipelines.double_sided;
+        return variant ? variant->pbr : m_pipelines.pbr;
     }
 
-    void GraphicsDevice::DrawNode(const std::shared_ptr<SceneObject> object, Node* node, VkCommandBuffer commandBuffer, Material::AlphaMode alpha_mode) {
-        if (node->mesh) {
-            for (Primitive* primitive : node->mesh->primitives) {
-                {
-                    if (alpha_mode == Material::ALPHAMODE_BLEND) {
-                        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelines.alpha_blending);
-                    }
-                    else if (object->p_model.GetMaterial(primitive->material_index).doubleSided) {
-                        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelines.double_sided);
-                    }
-                    else {
-                        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipelines.pbr);
-                    }
-                }
-                uint32_t index = primitive->material_index > -1 ? primitive->material_index : 0;
-    			const std::vector<VkDescriptorSet> descriptorsets = {
-                    object->p_model.GetMaterial(index).descriptorSet,
-					m_descriptor_sets.ibl,
-                    object->p_mat_descritpor_set
-				};
-                vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layouts.scene, 0, static_cast<uint32_t>(descriptorsets.size()), descriptorsets.data(), 0, NULL);
-                vkCmdPushConstants(commandBuffer, m_pipeline_layouts.scene, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &primitive->material_index);
+    const GraphicsDevice::PipelineVariant* GraphicsDevice::GetPipelineVariant(uint32_t features) {
+        auto it = m_pipeline_variants.find(features);
+        if (it == m_pipeline_variants.end()) {
+            CreateGraphicsPipeline(features);
+            it = m_pipeline_variants.find(features);
+        }
+        PipelineVariant& variant = it->second;
+        if (!variant.pending.empty()) {
+            for (const PipelineCompiler::Ticket& ticket : variant.pending) {
+                if (ticket.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+                    return nullptr;
+            }
+            // Rethrows a compile error
+            for (const PipelineCompiler::Ticket& ticket : variant.pending) {
+                ticket.get();
+            }
+            variant.pending.clear();
+            m_variant_generation++;
+        }
+        return &variant;
+    }
+
+    VkPipeline GraphicsDevice::SelectDepthPipeline(const Material& material) const {
+        if (!m_depth_prepass || material.alphaMode == Material::ALPHAMODE_BLEND)
+            return VK_NULL_HANDLE;
+        if (material.alphaMode == Material::ALPHAMODE_MASK)
+            return material.doubleSided ? m_pipelines.depth_prepass_mask_double_sided : m_pipelines.depth_prepass_mask;
+        return material.doubleSided ? m_pipelines.depth_prepass_double_sided : m_pipelines.depth_prepass;
+    }
 
-                //vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layouts.scene, 0, 1, 
-                //    &m_models[0]->GetMaterial(index).descriptorSet, 0, NULL);
-                //vkCmdDraw(commandBuffer, primitive->vertex_count, 1, 0, 0);
-                vkCmdDrawIndexed(commandBuffer, primitive->index_count, 1, primitive->first_index, 0, 0);
+    void GraphicsDevice::BuildGpuDraws(const std::shared_ptr<Scene>& scene) {
+        if (!m_gpu_culler)
+            return;
+        const auto& objects = scene->GetSceneObjects();
+        // The draws are built once, so the variants they use have to be compiled first
+        for (const auto& object : objects) {
+            for (const Material& material : object->p_model.GetMaterials()) {
+                if (material.shaderFeatures != MaterialFeatures::GENERIC)
+                    GetPipelineVariant(material.shaderFeatures);
             }
         }
-        for (auto& child : node->children) {
-            DrawNode(object, child, commandBuffer, alpha_mode);
+        m_pipeline_compiler->WaitIdle();
+        m_gpu_culler->Clear(static_cast<uint32_t>(objects.size()));
+        m_blend_primitives.assign(objects.size(), {});
+        for (uint32_t i = 0; i < objects.size(); i++) {
+            const Model& model = objects[i]->p_model;
+            const GeometryAllocation& geometry = model.GetGeometry();
+            std::vector<Node*> nodes = model.GetNodes();
+            while (!nodes.empty()) {
+                Node* node = nodes.back();
+                nodes.pop_back();
+                nodes.insert(nodes.end(), node->children.begin(), node->children.end());
+                if (!node->mesh)
+                    continue;
+                for (Primitive* primitive : node->mesh->primitives) {
+                    const Material& material = model.GetMaterial(primitive->material_index > -1 ? primitive->material_index : 0);
+                    RenderQueue::Pass pass = RenderQueue::PASS_OPAQUE;
+                    VkPipeline pipeline = SelectPipeline(material, pass);
+                    if (pass == RenderQueue::PASS_BLEND) {
+                        m_blend_primitives[i].push_back(primitive);
+                        continue;
+                    }
+                    m_gpu_culler->AddDraw(i, pipeline, SelectDepthPipeline(material), &material, primitive->material_index, pass, primitive->bb,
+                        primitive->index_count, geometry.first_index + primitive->first_index, geometry.vertex_offset);
+                }
+            }
         }
+        m_gpu_culler->Build();
     }
 
-    void GraphicsDevice::DrawNodeSkybox(Node* node, VkCommandBuffer commandBuffer) {
+    void GraphicsDevice::DrawNodeSkybox(const Model& model, Node* node, VkCommandBuffer commandBuffer) {
         if (node->mesh) {
+            const GeometryAllocation& geometry = model.GetGeometry();
             for (Primitive* primitive : node->mesh->primitives) {
-                uint32_t index = primitive->material_index > -1 ? primitive->material_index : 0;
-                vkCmdDrawIndexed(commandBuffer, primitive->index_count, 1, primitive->first_index, 0, 0);
+                vkCmdDrawIndexed(commandBuffer, primitive->index_count, 1, geometry.first_index + primitive->first_index, geometry.vertex_offset, 0);
             }
         }
         for (auto& child : node->children) {
-            DrawNodeSkybox(child, commandBuffer);
+            DrawNodeSkybox(model, child, commandBuffer);
+        }
+    }
+
+    void GraphicsDevice::CreatePresentSemaphores() {
+        // The image count can change with the swapchain, only called while the device is idle
+        for (VkSemaphore semaphore : m_present_complete_semaphores) {
+            vkDestroySemaphore(m_device, semaphore, nullptr);
+        }
+        m_present_complete_semaphores.resize(m_swapchain->GetSwapchainImages().size());
+        VkSemaphoreCreateInfo semaphore_info{};
+        semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        for (auto& semaphore : m_present_complete_semaphores) {
+            if (vkCreateSemaphore(m_device, &semaphore_info, nullptr, &semaphore) != VK_SUCCESS) {
+                LOG_ERROR(false, "Failed to create present semaphore!");
+            }
         }
     }
 
     void GraphicsDevice::CleanUpSwapchain() {
         vkDestroyImageView(m_device, m_depth_image_view, nullptr);
-        vkDestroyImage(m_device, m_depth_image, nullptr);
-        vkFreeMemory(m_device, m_depth_image_memory, nullptr);
+        vkUtilities::DestroyImage(m_device, m_depth_image);
         for (auto framebuffer : m_framebuffers) {
             vkDestroyFramebuffer(m_device, framebuffer, nullptr);
         }
@@ -2569,109 +2232,97 @@ namespace Diffuse {
     void GraphicsDevice::CleanUp(const Config& config) {
         glfwWaitEvents();
         vkDeviceWaitIdle(m_device);
+        if (!m_memory_report_path.empty()) {
+            WriteMemoryReport();
+        }
+        m_frame_timer->PrintStats();
+        m_render_queue->PrintStats();
+        if (m_gpu_culler) {
+            m_gpu_culler->PrintStats();
+        }
+        if (m_cull_frames > 0) {
+            std::cout << "Frustum culling (" << (FrustumCuller::HasAVX2() ? "AVX2" : "SSE") << "): per frame " << m_cull_totals.objects_culled / m_cull_frames << " of "
+                << m_cull_totals.objects / m_cull_frames << " objects and " << m_cull_totals.primitives_culled / m_cull_frames << " of "
+                << m_cull_totals.primitives / m_cull_frames << " primitives culled, " << m_cull_totals.bvh_nodes / m_cull_frames << " hierarchy nodes visited" << std::endl;
+        }
+        if (m_static_frames > 0) {
+            std::cout << "Static command buffers: recorded " << m_static_records << " times in " << m_static_frames << " frames" << std::endl;
+        }
+        m_frame_timer->CleanUp();
         CleanUpSwapchain();
-        for (size_t i = 0; i < m_render_ahead; i++) {
-            vkDestroyBuffer(m_device, m_active_scene->GetSkybox()->p_ubo.uniformBuffers[i], nullptr);
-            vkFreeMemory(m_device, m_active_scene->GetSkybox()->p_ubo.uniformBuffersMemory[i], nullptr);
+        // Resources retired by the last frames, the device is idle
+        m_deletion_queue->Flush();
+        m_frame_graph.reset();
+        m_environment_baker->Destroy(m_environment);
+        m_environment_baker->CleanUp();
+        if (m_texture_streamer) {
+            m_texture_streamer->CleanUp();
+        }
+        m_upload_queue->CleanUp();
+        m_uniform_ring->PrintStats();
+        m_uniform_ring->CleanUp();
+        if (m_gpu_culler) {
+            m_gpu_culler->CleanUp();
+        }
+        if (m_depth_pyramid) {
+            m_depth_pyramid->CleanUp();
+        }
+        if (m_bindless_textures) {
+            m_bindless_textures->CleanUp();
         }
         for (int index = 0; index < m_active_scene->GetSceneObjects().size(); index++) {
-            //for (size_t i = 0; i < m_active_scene->GetSceneObjects()[index]->p_ubo.uniformBuffers.size(); i++) {
-            for (size_t i = 0; i < m_render_ahead; i++) {
-                vkDestroyBuffer(m_device, m_active_scene->GetSceneObjects()[index]->p_ubo.uniformBuffers[i], nullptr);
-                vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_ubo.uniformBuffersMemory[i], nullptr);
-
-                vkDestroyBuffer(m_device, m_active_scene->GetSceneObjects()[index]->p_shader_values_ubo.uniformBuffers[i], nullptr);
-                vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_shader_values_ubo.uniformBuffersMemory[i], nullptr);
-            }
-            vkDestroyBuffer(m_device, m_active_scene->GetSceneObjects()[index]->p_shader_material_buffer.buffer, nullptr);
-            vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_shader_material_buffer.memory, nullptr);
-
-            // delete vertices
-            vkDestroyBuffer(m_device, m_active_scene->GetSceneObjects()[index]->p_model.m_vertices.buffer, nullptr);
-            vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_model.m_vertices.memory, nullptr);
-            // delete indices
-            vkDestroyBuffer(m_device, m_active_scene->GetSceneObjects()[index]->p_model.m_indices.buffer, nullptr);
-            vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_model.m_indices.memory, nullptr);
-
-            for (int mat = 0; mat < m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials().size(); mat++) {
-                if (m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].baseColorTexture != nullptr) {
-                    vkDestroyImageView(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].baseColorTexture->GetView(), nullptr);
-                    vkDestroyImage(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].baseColorTexture->GetImage(), nullptr);
-                    vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].baseColorTexture->GetMemory(), nullptr);
-                }
-                if (m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].metallicRoughnessTexture != nullptr) {
-                    vkDestroyImageView(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].metallicRoughnessTexture->GetView(), nullptr);
-                    vkDestroyImage(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].metallicRoughnessTexture->GetImage(), nullptr);
-                    vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].metallicRoughnessTexture->GetMemory(), nullptr);
-                }
-                if (m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].normalTexture != nullptr) {
-                    vkDestroyImageView(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].normalTexture->GetView(), nullptr);
-                    vkDestroyImage(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].normalTexture->GetImage(), nullptr);
-                    vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].normalTexture->GetMemory(), nullptr);
-                }
-                if (m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].occlusionTexture != nullptr) {
-                    vkDestroyImageView(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].occlusionTexture->GetView(), nullptr);
-                    vkDestroyImage(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].occlusionTexture->GetImage(), nullptr);
-                    vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].occlusionTexture->GetMemory(), nullptr);
-                }
-                if (m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].emissiveTexture != nullptr) {
-                    vkDestroyImageView(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].emissiveTexture->GetView(), nullptr);
-                    vkDestroyImage(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].emissiveTexture->GetImage(), nullptr);
-                    vkFreeMemory(m_device, m_active_scene->GetSceneObjects()[index]->p_model.GetMaterials()[mat].emissiveTexture->GetMemory(), nullptr);
-                }
+            vkUtilities::DestroyBuffer(m_device, m_active_scene->GetSceneObjects()[index]->p_shader_material_buffer.buffer);
+
+            m_geometry_pool->Free(m_active_scene->GetSceneObjects()[index]->p_model.GetGeometry());
+
+            for (auto texture : m_active_scene->GetSceneObjects()[index]->p_model.GetTextures()) {
+                m_texture_registry->Release(texture);
             }
         }
-        vkDestroySampler(m_device, computeSampler, nullptr);
-        // m_env_texuture
-        vkDestroyImageView(m_device, m_env_texuture.view, nullptr);
-        vkDestroyImage(m_device, m_env_texuture.image, nullptr);
-        vkFreeMemory(m_device, m_env_texuture.memory, nullptr);
-        vkDestroySampler(m_device, m_env_texuture.sampler, nullptr);
-        // m_cubemap
-        vkDestroyImageView(m_device, m_cubemap.view, nullptr);
-        vkDestroyImage(m_device, m_cubemap.image, nullptr);
-        vkFreeMemory(m_device, m_cubemap.memory, nullptr);
-        vkDestroySampler(m_device, m_cubemap.sampler, nullptr);
+        m_geometry_pool->Free(m_active_scene->GetSkybox()->p_model.GetGeometry());
+        m_geometry_pool->PrintStats();
+        m_geometry_pool->CleanUp();
+        m_texture_registry->CleanUp();
+        m_texture_packer->CleanUp();
+        // m_white_texture stands in for every missing material texture, destroy it once
+        vkDestroyImageView(m_device, m_white_texture->GetView(), nullptr);
+        vkUtilities::DestroyImage(m_device, m_white_texture->GetImage());
         // m_brdf_lut
         vkDestroyImageView(m_device, m_brdf_lut.view, nullptr);
-        vkDestroyImage(m_device, m_brdf_lut.image, nullptr);
-        vkFreeMemory(m_device, m_brdf_lut.memory, nullptr);
-        vkDestroySampler(m_device, m_brdf_lut.sampler, nullptr);
-        // m_Irradiance_cubemap
-        vkDestroyImageView(m_device, m_Irradiance_cubemap.view, nullptr);
-        vkDestroyImage(m_device, m_Irradiance_cubemap.image, nullptr);
-        vkFreeMemory(m_device, m_Irradiance_cubemap.memory, nullptr);
-        vkDestroySampler(m_device, m_Irradiance_cubemap.sampler, nullptr);
-        // m_Prefilter_cubemap
-        vkDestroyImageView(m_device, m_Prefilter_cubemap.view, nullptr);
-        vkDestroyImage(m_device, m_Prefilter_cubemap.image, nullptr);
-        vkFreeMemory(m_device, m_Prefilter_cubemap.memory, nullptr);
-        vkDestroySampler(m_device, m_Prefilter_cubemap.sampler, nullptr);
+        vkUtilities::DestroyImage(m_device, m_brdf_lut.image);
         //
         //vkDestroyImageView(m_device, m_depth_image_view, nullptr);
         //vkDestroyImage(m_device, m_depth_image, nullptr);
         //vkFreeMemory(m_device, m_depth_image_memory, nullptr);
         vkDestroyDescriptorPool(m_device, m_descriptor_pools.scene, nullptr);
-        // destroy descriptor sets layouts
-        vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.model, nullptr);
-        vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.skybox, nullptr);
-        //vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.material, nullptr);
-        //vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.node, nullptr);
-        vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.ibl, nullptr);
-        vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayouts.materialBuffer, nullptr);
-        //
-        vkDestroyPipelineLayout(m_device, m_pipeline_layouts.scene, nullptr);
-        vkDestroyPipelineLayout(m_device, m_pipeline_layouts.compute, nullptr);
-        vkDestroyPipelineLayout(m_device, m_pipeline_layouts.skybox, nullptr);
-        vkDestroyRenderPass(m_device, m_render_pass, nullptr);
+        m_pipeline_compiler.reset();
+        for (auto& [features, variant] : m_pipeline_variants) {
+            vkDestroyPipeline(m_device, variant.pbr, nullptr);
+            vkDestroyPipeline(m_device, variant.alpha_blending, nullptr);
+            vkDestroyPipeline(m_device, variant.double_sided, nullptr);
+        }
+        m_pipeline_cache->Save();
+        m_pipeline_cache->CleanUp();
+        // samplers, descriptor set layouts, pipeline layouts and render passes
+        m_object_cache->PrintStats();
+        m_object_cache->CleanUp();
         for (size_t i = 0; i < m_render_ahead; i++) {
             vkDestroySemaphore(m_device, m_render_complete_semaphores[i], nullptr);
-            vkDestroySemaphore(m_device, m_present_complete_semaphores[i], nullptr);
             vkDestroyFence(m_device, m_wait_fences[i], nullptr);
         }
+        for (VkSemaphore semaphore : m_present_complete_semaphores) {
+            vkDestroySemaphore(m_device, semaphore, nullptr);
+        }
         
+        FreeStaticCommandBuffers();
+        for (VkCommandPool pool : m_recording_pools) {
+            vkDestroyCommandPool(m_device, pool, nullptr);
+        }
+        m_worker_pool.reset();
         vkFreeCommandBuffers(m_device, m_command_pool, m_command_buffers.size(), m_command_buffers.data());
         vkDestroyCommandPool(m_device, m_command_pool, nullptr);
+        m_memory_allocator->PrintStats();
+        m_memory_allocator->CleanUp();
         vkDestroyDevice(m_device, nullptr);
         if (config.enable_validation_layers)
             vkUtilities::DestroyDebugUtilsMessengerEXT(m_instance, m_debug_messenger, nullptr);
@@ -2681,6 +2332,13 @@ namespace Diffuse {
         glfwTerminate();
     }
 
+    bool GraphicsDevice::WriteMemoryReport(const std::string& path) const {
+        const std::string& report_path = path.empty() ? m_memory_report_path : path;
+        if (report_path.empty())
+            return false;
+        return m_memory_allocator->WriteReport(report_path);
+    }
+
     void GraphicsDevice::RecreateSwapchain() {
         int width = 0, height = 0;
         glfwGetFramebufferSize(m_window->window(), &width, &height);
@@ -2694,11 +2352,22 @@ namespace Diffuse {
         // Create swap chain
         m_swapchain = std::make_unique<Swapchain>(this);
         m_swapchain->Initialize();
+        CreatePresentSemaphores();
 
         // === Create Depth Resource ===
         VkFormat depthFormat = vkUtilities::FindDepthFormat(m_physical_device);
-        vkUtilities::CreateImage(m_swapchain->GetExtentWidth(), m_swapchain->GetExtentHeight(), m_device, m_physical_device, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depth_image, m_depth_image_memory, 1, 1);
+        m_depth_format = depthFormat;
+        {
+            MemoryAllocator::Tag tag(MemoryCategory::Attachment, "depth buffer");
+            VkImageUsageFlags depth_usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | (m_depth_pyramid ? VK_IMAGE_USAGE_SAMPLED_BIT : 0);
+            vkUtilities::CreateImage(m_swapchain->GetExtentWidth(), m_swapchain->GetExtentHeight(), m_device, m_physical_device, depthFormat, VK_IMAGE_TILING_OPTIMAL, depth_usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_depth_image, m_depth_image_memory, 1, 1);
+        }
         m_depth_image_view = vkUtilities::CreateImageView(m_depth_image, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT, m_device, 1, 0, 1);
+        if (m_depth_pyramid) {
+            m_depth_pyramid->Resize(m_depth_image_view, m_swapchain->GetExtentWidth(), m_swapchain->GetExtentHeight());
+            m_gpu_culler->SetDepthPyramid(m_depth_pyramid->GetView(), m_depth_pyramid->GetSampler(), m_depth_pyramid->GetWidth(), m_depth_pyramid->GetHeight(),
+                m_depth_pyramid->GetLevelCount());
+        }
 
         // === Create Framebuffers ===
         {
@@ -2724,5 +2393,8 @@ namespace Diffuse {
                 }
             }
         }
+
+        // Recorded against the old framebuffers
+        CreateStaticCommandBuffers();
     }
 }
\ No newline at end of file
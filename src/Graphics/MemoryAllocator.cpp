@@ -0,0 +1,672 @@
+#include "MemoryAllocator.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+
+namespace Diffuse {
+	namespace {
+		VkDeviceSize AlignUp(VkDeviceSize value, VkDeviceSize alignment) {
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+		std::mutex s_registry_mutex;
+		std::unordered_map<VkDevice, MemoryAllocator*> s_allocators;
+
+		const std::string s_no_asset;
+
+		std::string JsonString(const std::string& value) {
+			std::string result = "\"";
+			for (char c : value) {
+				if (c == '"' || c == '\\')
+					result += '\\';
+				if (static_cast<unsigned char>(c) < 0x20)
+					c = ' ';
+				result += c;
+			}
+			return result + "\"";
+		}
+
+		std::string CsvString(const std::string& value) {
+			std::string result = "\"";
+			for (char c : value) {
+				if (c == '"')
+					result += '"';
+				result += c;
+			}
+			return result + "\"";
+		}
+	}
+
+	const char* MemoryCategoryName(MemoryCategory category) {
+		switch (category) {
+		case MemoryCategory::Geometry: return "geometry";
+		case MemoryCategory::Texture: return "texture";
+		case MemoryCategory::IBL: return "ibl";
+		case MemoryCategory::Uniform: return "uniform";
+		case MemoryCategory::Staging: return "staging";
+		case MemoryCategory::Attachment: return "attachment";
+		default: return "other";
+		}
+	}
+
+	thread_local const MemoryAllocator::Tag* MemoryAllocator::Tag::s_current = nullptr;
+
+	MemoryAllocator::Tag::Tag(MemoryCategory category, const std::string& asset)
+		:m_category(category), m_asset(asset.empty() ? Asset() : asset), m_previous(s_current) {
+		s_current = this;
+	}
+
+	MemoryAllocator::Tag::~Tag() {
+		s_current = m_previous;
+	}
+
+	MemoryCategory MemoryAllocator::Tag::Category() {
+		return s_current ? s_current->m_category : MemoryCategory::Other;
+	}
+
+	const std::string& MemoryAllocator::Tag::Asset() {
+		return s_current ? s_current->m_asset : s_no_asset;
+	}
+
+	MemoryAllocator::MemoryAllocator(VkDevice device, VkPhysicalDevice physical_device, VkDeviceSize block_size, bool memory_budget)
+		:m_device(device), m_physical_device(physical_device), m_memory_budget(memory_budget), m_block_size(AlignUp(block_size, s_min_chunk)) {
+		vkGetPhysicalDeviceMemoryProperties(physical_device, &m_memory_properties);
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(physical_device, &properties);
+		m_non_coherent_atom_size = properties.limits.nonCoherentAtomSize;
+		m_max_allocation_count = properties.limits.maxMemoryAllocationCount;
+		m_dedicated_threshold = m_block_size / 2;
+		m_assets.push_back(s_no_asset);
+		m_asset_ids[s_no_asset] = 0;
+
+		std::lock_guard<std::mutex> lock(s_registry_mutex);
+		s_allocators[device] = this;
+	}
+
+	MemoryAllocator::~MemoryAllocator() {
+		CleanUp();
+		std::lock_guard<std::mutex> lock(s_registry_mutex);
+		s_allocators.erase(m_device);
+	}
+
+	MemoryAllocator* MemoryAllocator::Get(VkDevice device) {
+		std::lock_guard<std::mutex> lock(s_registry_mutex);
+		auto it = s_allocators.find(device);
+		if (it == s_allocators.end()) {
+			throw std::runtime_error("no memory allocator for device!");
+		}
+		return it->second;
+	}
+
+	void MemoryAllocator::BindBuffer(VkBuffer buffer, VkMemoryPropertyFlags properties, VkDeviceMemory* memory) {
+		VkMemoryRequirements requirements;
+		vkGetBufferMemoryRequirements(m_device, buffer, &requirements);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Allocation allocation = Allocate(requirements, properties, Kind::Linear);
+		if (vkBindBufferMemory(m_device, buffer, allocation.memory, allocation.offset) != VK_SUCCESS) {
+			throw std::runtime_error("failed to bind buffer memory!");
+		}
+		Track(KeyOf(buffer), allocation);
+		if (memory)
+			*memory = allocation.memory;
+	}
+
+	void MemoryAllocator::BindImage(VkImage image, VkMemoryPropertyFlags properties, VkDeviceMemory* memory) {
+		VkMemoryRequirements requirements;
+		vkGetImageMemoryRequirements(m_device, image, &requirements);
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Every image in this renderer uses optimal tiling
+		Allocation allocation = Allocate(requirements, properties, Kind::Optimal);
+		if (vkBindImageMemory(m_device, image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+			throw std::runtime_error("failed to bind image memory!");
+		}
+		Track(KeyOf(image), allocation);
+		if (memory)
+			*memory = allocation.memory;
+	}
+
+	void MemoryAllocator::BindAliased(const std::vector<VkImage>& images, VkMemoryPropertyFlags properties) {
+		if (images.empty())
+			return;
+		VkMemoryRequirements requirements{};
+		requirements.memoryTypeBits = ~0u;
+		for (VkImage image : images) {
+			VkMemoryRequirements image_requirements;
+			vkGetImageMemoryRequirements(m_device, image, &image_requirements);
+			requirements.size = std::max(requirements.size, image_requirements.size);
+			requirements.alignment = std::max(requirements.alignment, image_requirements.alignment);
+			requirements.memoryTypeBits &= image_requirements.memoryTypeBits;
+		}
+		if (requirements.memoryTypeBits == 0) {
+			throw std::runtime_error("aliased images have no memory type in common!");
+		}
+
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Allocation allocation = Allocate(requirements, properties, Kind::Optimal);
+		allocation.alias_group = ++m_alias_groups;
+		m_alias_refs[allocation.alias_group] = static_cast<uint32_t>(images.size());
+		for (VkImage image : images) {
+			if (vkBindImageMemory(m_device, image, allocation.memory, allocation.offset) != VK_SUCCESS) {
+				throw std::runtime_error("failed to bind image memory!");
+			}
+			Track(KeyOf(image), allocation);
+			// The reports count the memory once
+			allocation.size = 0;
+		}
+	}
+
+	void MemoryAllocator::Track(const HandleKey& key, Allocation& allocation) {
+		allocation.category = Tag::Category();
+		const std::string& asset = Tag::Asset();
+		auto it = m_asset_ids.find(asset);
+		if (it == m_asset_ids.end()) {
+			it = m_asset_ids.emplace(asset, static_cast<uint32_t>(m_assets.size())).first;
+			m_assets.push_back(asset);
+		}
+		allocation.asset = it->second;
+		m_allocations[key] = allocation;
+	}
+
+	void MemoryAllocator::Free(VkBuffer buffer) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Release(KeyOf(buffer));
+	}
+
+	void MemoryAllocator::Free(VkImage image) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Release(KeyOf(image));
+	}
+
+	void* MemoryAllocator::GetMapped(VkBuffer buffer) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_allocations.find(KeyOf(buffer));
+		return it != m_allocations.end() ? it->second.mapped : nullptr;
+	}
+
+	VkResult MemoryAllocator::Flush(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) const {
+		return FlushOrInvalidate(buffer, offset, size, true);
+	}
+
+	VkResult MemoryAllocator::Invalidate(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size) const {
+		return FlushOrInvalidate(buffer, offset, size, false);
+	}
+
+	VkResult MemoryAllocator::FlushOrInvalidate(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size, bool flush) const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_allocations.find(KeyOf(buffer));
+		if (it == m_allocations.end())
+			return VK_ERROR_MEMORY_MAP_FAILED;
+		const Allocation& allocation = it->second;
+		if (allocation.coherent)
+			return VK_SUCCESS;
+
+		// The range is relative to the buffer, widen it to whole atoms of the shared memory object
+		VkDeviceSize end = size == VK_WHOLE_SIZE ? allocation.size : std::min(allocation.size, offset + size);
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = allocation.memory;
+		range.offset = (allocation.offset + offset) / m_non_coherent_atom_size * m_non_coherent_atom_size;
+		range.size = AlignUp(allocation.offset + end, m_non_coherent_atom_size) - range.offset;
+		VkDeviceSize memory_size = allocation.block ? allocation.block->size : allocation.size;
+		if (range.offset + range.size > memory_size)
+			range.size = VK_WHOLE_SIZE;
+		return flush ? vkFlushMappedMemoryRanges(m_device, 1, &range) : vkInvalidateMappedMemoryRanges(m_device, 1, &range);
+	}
+
+	uint32_t MemoryAllocator::FindMemoryType(uint32_t type_bits, VkMemoryPropertyFlags properties) const {
+		for (uint32_t i = 0; i < m_memory_properties.memoryTypeCount; i++) {
+			if ((type_bits & (1u << i)) && (m_memory_properties.memoryTypes[i].propertyFlags & properties) == properties) {
+				return i;
+			}
+		}
+		throw std::runtime_error("failed to find suitable memory type!");
+	}
+
+	MemoryAllocator::Allocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, Kind kind) {
+		uint32_t memory_type = FindMemoryType(requirements.memoryTypeBits, properties);
+		VkMemoryPropertyFlags type_flags = m_memory_properties.memoryTypes[memory_type].propertyFlags;
+
+		Allocation allocation;
+		allocation.memory_type = memory_type;
+		allocation.coherent = (type_flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+
+		// Large resources would mostly waste a shared block, they get their own memory object
+		if (requirements.size >= m_dedicated_threshold) {
+			VkMemoryAllocateInfo alloc_info{};
+			alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+			alloc_info.allocationSize = requirements.size;
+			alloc_info.memoryTypeIndex = memory_type;
+			if (vkAllocateMemory(m_device, &alloc_info, nullptr, &allocation.memory) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate dedicated memory!");
+			}
+			m_device_allocations++;
+			allocation.size = requirements.size;
+			if (type_flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+				if (vkMapMemory(m_device, allocation.memory, 0, VK_WHOLE_SIZE, 0, (void**)&allocation.mapped) != VK_SUCCESS) {
+					throw std::runtime_error("failed to map memory!");
+				}
+			}
+			return allocation;
+		}
+
+		for (auto& block : m_blocks) {
+			if (block->memory_type == memory_type && block->kind == kind && AllocateFromBlock(block.get(), requirements.size, requirements.alignment, allocation)) {
+				return allocation;
+			}
+		}
+		Block* block = CreateBlock(memory_type, kind, m_block_size);
+		if (!AllocateFromBlock(block, requirements.size, requirements.alignment, allocation)) {
+			throw std::runtime_error("failed to sub-allocate memory!");
+		}
+		return allocation;
+	}
+
+	MemoryAllocator::Block* MemoryAllocator::CreateBlock(uint32_t memory_type, Kind kind, VkDeviceSize size) {
+		if (m_device_allocations + 1 > m_max_allocation_count) {
+			std::cout << "Memory allocator: exceeding maxMemoryAllocationCount (" << m_max_allocation_count << ")" << std::endl;
+		}
+
+		auto block = std::make_unique<Block>();
+		block->size = size;
+		block->memory_type = memory_type;
+		block->kind = kind;
+
+		VkMemoryAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+		alloc_info.allocationSize = size;
+		alloc_info.memoryTypeIndex = memory_type;
+		if (vkAllocateMemory(m_device, &alloc_info, nullptr, &block->memory) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate memory block!");
+		}
+		m_device_allocations++;
+		if (m_memory_properties.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+			if (vkMapMemory(m_device, block->memory, 0, VK_WHOLE_SIZE, 0, (void**)&block->mapped) != VK_SUCCESS) {
+				throw std::runtime_error("failed to map memory!");
+			}
+		}
+
+		block->first = new Chunk{ 0, size };
+		InsertFree(block.get(), block->first);
+		m_blocks.push_back(std::move(block));
+		return m_blocks.back().get();
+	}
+
+	void MemoryAllocator::DestroyBlock(Block* block) {
+		for (Chunk* chunk = block->first; chunk;) {
+			Chunk* next = chunk->next_phys;
+			delete chunk;
+			chunk = next;
+		}
+		vkFreeMemory(m_device, block->memory, nullptr);
+		m_device_allocations--;
+		m_blocks.erase(std::find_if(m_blocks.begin(), m_blocks.end(), [&](const auto& b) { return b.get() == block; }));
+	}
+
+	void MemoryAllocator::Mapping(VkDeviceSize size, uint32_t& fl, uint32_t& sl) {
+		fl = 63 - std::countl_zero(static_cast<uint64_t>(size));
+		sl = static_cast<uint32_t>(size >> (fl - s_sl_bits)) & (s_sl_count - 1);
+	}
+
+	void MemoryAllocator::InsertFree(Block* block, Chunk* chunk) {
+		uint32_t fl, sl;
+		Mapping(chunk->size, fl, sl);
+		chunk->free = true;
+		chunk->prev_free = nullptr;
+		chunk->next_free = block->heads[fl][sl];
+		if (chunk->next_free)
+			chunk->next_free->prev_free = chunk;
+		block->heads[fl][sl] = chunk;
+		block->fl_bitmap |= 1ull << fl;
+		block->sl_bitmap[fl] |= 1u << sl;
+	}
+
+	void MemoryAllocator::RemoveFree(Block* block, Chunk* chunk) {
+		uint32_t fl, sl;
+		Mapping(chunk->size, fl, sl);
+		if (chunk->prev_free)
+			chunk->prev_free->next_free = chunk->next_free;
+		if (chunk->next_free)
+			chunk->next_free->prev_free = chunk->prev_free;
+		if (block->heads[fl][sl] == chunk) {
+			block->heads[fl][sl] = chunk->next_free;
+			if (block->heads[fl][sl] == nullptr) {
+				block->sl_bitmap[fl] &= ~(1u << sl);
+				if (block->sl_bitmap[fl] == 0)
+					block->fl_bitmap &= ~(1ull << fl);
+			}
+		}
+		chunk->prev_free = chunk->next_free = nullptr;
+		chunk->free = false;
+	}
+
+	MemoryAllocator::Chunk* MemoryAllocator::FindFree(Block* block, VkDeviceSize size) {
+		// Round up to the next list so any chunk found is large enough (good fit instead of first fit)
+		uint32_t fl, sl;
+		Mapping(size, fl, sl);
+		size += (1ull << (fl - s_sl_bits)) - 1;
+		Mapping(size, fl, sl);
+		if (fl >= s_fl_count)
+			return nullptr;
+
+		uint32_t sl_map = block->sl_bitmap[fl] & (~0u << sl);
+		if (sl_map == 0) {
+			uint64_t fl_map = fl + 1 < s_fl_count ? block->fl_bitmap & (~0ull << (fl + 1)) : 0;
+			if (fl_map == 0)
+				return nullptr;
+			fl = std::countr_zero(fl_map);
+			sl_map = block->sl_bitmap[fl];
+		}
+		sl = std::countr_zero(sl_map);
+		return block->heads[fl][sl];
+	}
+
+	bool MemoryAllocator::AllocateFromBlock(Block* block, VkDeviceSize size, VkDeviceSize alignment, Allocation& allocation) {
+		// Offsets and sizes are kept at multiples of s_min_chunk, smaller alignments hold automatically
+		VkDeviceSize request = AlignUp(std::max(size, s_min_chunk), s_min_chunk);
+		VkDeviceSize search = alignment > s_min_chunk ? request + alignment - s_min_chunk : request;
+		Chunk* chunk = FindFree(block, search);
+		if (chunk == nullptr)
+			return false;
+		RemoveFree(block, chunk);
+
+		VkDeviceSize aligned = alignment > s_min_chunk ? AlignUp(chunk->offset, alignment) : chunk->offset;
+		if (aligned > chunk->offset) {
+			// The front padding stays behind as a free chunk
+			Chunk* rest = new Chunk{ aligned, chunk->size - (aligned - chunk->offset) };
+			rest->prev_phys = chunk;
+			rest->next_phys = chunk->next_phys;
+			if (rest->next_phys)
+				rest->next_phys->prev_phys = rest;
+			chunk->next_phys = rest;
+			chunk->size = aligned - chunk->offset;
+			InsertFree(block, chunk);
+			chunk = rest;
+		}
+		if (chunk->size > request) {
+			Chunk* tail = new Chunk{ chunk->offset + request, chunk->size - request };
+			tail->prev_phys = chunk;
+			tail->next_phys = chunk->next_phys;
+			if (tail->next_phys)
+				tail->next_phys->prev_phys = tail;
+			chunk->next_phys = tail;
+			chunk->size = request;
+			InsertFree(block, tail);
+		}
+		chunk->free = false;
+
+		block->allocations++;
+		allocation.block = block;
+		allocation.chunk = chunk;
+		allocation.memory = block->memory;
+		allocation.offset = chunk->offset;
+		allocation.size = size;
+		allocation.mapped = block->mapped ? block->mapped + chunk->offset : nullptr;
+		return true;
+	}
+
+	void MemoryAllocator::FreeChunk(Block* block, Chunk* chunk) {
+		Chunk* next = chunk->next_phys;
+		if (next && next->free) {
+			RemoveFree(block, next);
+			chunk->size += next->size;
+			chunk->next_phys = next->next_phys;
+			if (chunk->next_phys)
+				chunk->next_phys->prev_phys = chunk;
+			delete next;
+		}
+		Chunk* prev = chunk->prev_phys;
+		if (prev && prev->free) {
+			RemoveFree(block, prev);
+			prev->size += chunk->size;
+			prev->next_phys = chunk->next_phys;
+			if (prev->next_phys)
+				prev->next_phys->prev_phys = prev;
+			delete chunk;
+			chunk = prev;
+		}
+		InsertFree(block, chunk);
+	}
+
+	void MemoryAllocator::Release(const HandleKey& key) {
+		auto it = m_allocations.find(key);
+		if (it == m_allocations.end())
+			return;
+		Allocation allocation = it->second;
+		m_allocations.erase(it);
+
+		if (allocation.alias_group) {
+			auto refs = m_alias_refs.find(allocation.alias_group);
+			if (--refs->second > 0) {
+				// Another image of the group takes over the size
+				for (auto& [other_handle, other] : m_allocations) {
+					if (allocation.size && other.alias_group == allocation.alias_group) {
+						other.size = allocation.size;
+						break;
+					}
+				}
+				return;
+			}
+			m_alias_refs.erase(refs);
+		}
+
+		if (allocation.block == nullptr) {
+			vkFreeMemory(m_device, allocation.memory, nullptr);
+			m_device_allocations--;
+			return;
+		}
+
+		Block* block = allocation.block;
+		FreeChunk(block, allocation.chunk);
+		block->allocations--;
+		// Keep one empty block per memory type and kind around so load spikes don't allocate and free blocks repeatedly
+		if (block->allocations == 0) {
+			bool other_empty = std::any_of(m_blocks.begin(), m_blocks.end(), [&](const auto& b) {
+				return b.get() != block && b->memory_type == block->memory_type && b->kind == block->kind && b->allocations == 0;
+			});
+			if (other_empty)
+				DestroyBlock(block);
+		}
+	}
+
+	std::vector<MemoryAllocator::HeapBudget> MemoryAllocator::QueryBudget() const {
+		std::vector<HeapBudget> heaps(m_memory_properties.memoryHeapCount);
+		for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; i++) {
+			heaps[i].device_local = (m_memory_properties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) != 0;
+			heaps[i].size = m_memory_properties.memoryHeaps[i].size;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& block : m_blocks) {
+				heaps[m_memory_properties.memoryTypes[block->memory_type].heapIndex].allocated += block->size;
+			}
+			for (auto& [handle, allocation] : m_allocations) {
+				if (allocation.block == nullptr)
+					heaps[m_memory_properties.memoryTypes[allocation.memory_type].heapIndex].allocated += allocation.size;
+			}
+		}
+
+		if (m_memory_budget) {
+			VkPhysicalDeviceMemoryBudgetPropertiesEXT budget{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT };
+			VkPhysicalDeviceMemoryProperties2 properties{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2 };
+			properties.pNext = &budget;
+			vkGetPhysicalDeviceMemoryProperties2(m_physical_device, &properties);
+			for (uint32_t i = 0; i < m_memory_properties.memoryHeapCount; i++) {
+				heaps[i].budget = budget.heapBudget[i];
+				heaps[i].usage = budget.heapUsage[i];
+			}
+		}
+		else {
+			// Same estimate as common allocators use when the driver can't tell
+			for (HeapBudget& heap : heaps) {
+				heap.budget = heap.size / 10 * 8;
+				heap.usage = heap.allocated;
+			}
+		}
+		return heaps;
+	}
+
+	bool MemoryAllocator::CheckBudget(VkDeviceSize device_local_limit) {
+		std::vector<HeapBudget> heaps = QueryBudget();
+		bool over = false;
+		for (const HeapBudget& heap : heaps) {
+			VkDeviceSize budget = heap.device_local && device_local_limit > 0 ? std::min(heap.budget, device_local_limit) : heap.budget;
+			over |= heap.usage > budget;
+		}
+		if (over && !m_over_budget) {
+			std::cout << "Memory allocator: over budget" << (m_memory_budget ? "" : " (estimated)") << std::endl;
+			for (uint32_t i = 0; i < heaps.size(); i++) {
+				std::cout << "  heap " << i << (heaps[i].device_local ? " (device local): " : ": ") << (heaps[i].usage >> 20) << " / "
+					<< (heaps[i].budget >> 20) << " MB, " << (heaps[i].allocated >> 20) << " MB allocated by the renderer" << std::endl;
+			}
+		}
+		m_over_budget = over;
+		return over;
+	}
+
+	bool MemoryAllocator::WriteReport(const std::string& path) const {
+		struct Usage {
+			uint32_t allocations = 0;
+			VkDeviceSize bytes = 0;
+		};
+		std::vector<HeapBudget> heaps = QueryBudget();
+		std::array<Usage, static_cast<size_t>(MemoryCategory::Count)> categories{};
+		std::map<std::pair<std::string, MemoryCategory>, Usage> assets;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& [handle, allocation] : m_allocations) {
+				Usage& category = categories[static_cast<size_t>(allocation.category)];
+				category.allocations++;
+				category.bytes += allocation.size;
+				Usage& asset = assets[{ m_assets[allocation.asset], allocation.category }];
+				asset.allocations++;
+				asset.bytes += allocation.size;
+			}
+		}
+		// Largest owners first
+		std::vector<std::pair<std::pair<std::string, MemoryCategory>, Usage>> sorted(assets.begin(), assets.end());
+		std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second.bytes > b.second.bytes; });
+
+		std::ofstream file(path);
+		if (!file) {
+			std::cout << "Memory allocator: failed to write report " << path << std::endl;
+			return false;
+		}
+		if (path.ends_with(".csv")) {
+			file << "section,name,category,allocations,bytes,budget,usage\n";
+			for (uint32_t i = 0; i < heaps.size(); i++) {
+				file << "heap," << i << "," << (heaps[i].device_local ? "device_local" : "host") << ",," << heaps[i].allocated << ","
+					<< heaps[i].budget << "," << heaps[i].usage << "\n";
+			}
+			for (size_t i = 0; i < categories.size(); i++) {
+				file << "category,," << MemoryCategoryName(static_cast<MemoryCategory>(i)) << "," << categories[i].allocations << "," << categories[i].bytes << ",,\n";
+			}
+			for (auto& [key, usage] : sorted) {
+				file << "asset," << CsvString(key.first) << "," << MemoryCategoryName(key.second) << "," << usage.allocations << "," << usage.bytes << ",,\n";
+			}
+		}
+		else {
+			file << "{\n  \"budget_source\": \"" << (m_memory_budget ? "VK_EXT_memory_budget" : "estimate") << "\",\n  \"heaps\": [";
+			for (uint32_t i = 0; i < heaps.size(); i++) {
+				file << (i ? "," : "") << "\n    { \"index\": " << i << ", \"device_local\": " << (heaps[i].device_local ? "true" : "false")
+					<< ", \"size\": " << heaps[i].size << ", \"budget\": " << heaps[i].budget << ", \"usage\": " << heaps[i].usage
+					<< ", \"allocated\": " << heaps[i].allocated << " }";
+			}
+			file << "\n  ],\n  \"categories\": [";
+			for (size_t i = 0; i < categories.size(); i++) {
+				file << (i ? "," : "") << "\n    { \"category\": \"" << MemoryCategoryName(static_cast<MemoryCategory>(i)) << "\", \"allocations\": "
+					<< categories[i].allocations << ", \"bytes\": " << categories[i].bytes << " }";
+			}
+			file << "\n  ],\n  \"assets\": [";
+			for (size_t i = 0; i < sorted.size(); i++) {
+				file << (i ? "," : "") << "\n    { \"asset\": " << JsonString(sorted[i].first.first) << ", \"category\": \"" << MemoryCategoryName(sorted[i].first.second)
+					<< "\", \"allocations\": " << sorted[i].second.allocations << ", \"bytes\": " << sorted[i].second.bytes << " }";
+			}
+			file << "\n  ]\n}\n";
+		}
+		std::cout << "Memory allocator: report written to " << path << std::endl;
+		return true;
+	}
+
+	MemoryAllocator::Stats MemoryAllocator::GetStats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Stats stats;
+		VkDeviceSize free_bytes = 0;
+		for (auto& block : m_blocks) {
+			stats.blocks++;
+			stats.block_bytes += block->size;
+			bool hole = false;
+			for (Chunk* chunk = block->first; chunk; chunk = chunk->next_phys) {
+				if (chunk->free) {
+					hole = true;
+					stats.free_ranges++;
+					free_bytes += chunk->size;
+					stats.largest_free_range = std::max(stats.largest_free_range, chunk->size);
+				}
+				else if (hole) {
+					stats.movable_allocations++;
+				}
+			}
+		}
+		for (auto& [handle, allocation] : m_allocations) {
+			stats.allocations++;
+			if (allocation.block) {
+				stats.used_bytes += allocation.size;
+			}
+			else {
+				stats.dedicated++;
+				stats.dedicated_bytes += allocation.size;
+			}
+		}
+		stats.fragmentation = free_bytes > 0 ? 1.0f - static_cast<float>(stats.largest_free_range) / static_cast<float>(free_bytes) : 0.0f;
+		return stats;
+	}
+
+	void MemoryAllocator::PrintStats() const {
+		Stats stats = GetStats();
+		std::cout << "Memory allocator: " << stats.allocations << " allocations in " << stats.blocks << " blocks ("
+			<< (stats.used_bytes >> 20) << " / " << (stats.block_bytes >> 20) << " MB used), "
+			<< stats.dedicated << " dedicated (" << (stats.dedicated_bytes >> 20) << " MB), "
+			<< m_device_allocations << " device allocations" << std::endl;
+		std::cout << "  " << stats.free_ranges << " free ranges, largest " << (stats.largest_free_range >> 10) << " KB, fragmentation "
+			<< static_cast<int>(stats.fragmentation * 100.0f) << "%, " << stats.movable_allocations << " allocations movable by compaction" << std::endl;
+
+		std::array<VkDeviceSize, static_cast<size_t>(MemoryCategory::Count)> categories{};
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			for (auto& [handle, allocation] : m_allocations) {
+				categories[static_cast<size_t>(allocation.category)] += allocation.size;
+			}
+		}
+		std::cout << " ";
+		for (size_t i = 0; i < categories.size(); i++) {
+			std::cout << " " << MemoryCategoryName(static_cast<MemoryCategory>(i)) << " " << (categories[i] >> 20) << " MB";
+		}
+		std::cout << std::endl;
+	}
+
+	void MemoryAllocator::CleanUp() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_allocations.empty()) {
+			std::cout << "Memory allocator: " << m_allocations.size() << " allocations leaked" << std::endl;
+		}
+		for (auto& [handle, allocation] : m_allocations) {
+			// Aliased memory is freed with the first image of its group found
+			if (allocation.alias_group && m_alias_refs.erase(allocation.alias_group) == 0)
+				continue;
+			if (allocation.block == nullptr)
+				vkFreeMemory(m_device, allocation.memory, nullptr);
+		}
+		m_allocations.clear();
+		m_alias_refs.clear();
+		while (!m_blocks.empty()) {
+			DestroyBlock(m_blocks.back().get());
+		}
+		m_device_allocations = 0;
+	}
+}
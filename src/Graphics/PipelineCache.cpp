@@ -0,0 +1,123 @@
+#include "PipelineCache.hpp"
+
+#include "Hash.hpp"
+
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	namespace {
+		constexpr uint32_t s_magic = 0x43505044;    // "DPPC"
+		constexpr uint32_t s_version = 1;
+	}
+
+	PipelineCache::PipelineCache(VkDevice device, VkPhysicalDevice physical_device, const std::string& path)
+		:m_device(device), m_path(path) {
+		vkGetPhysicalDeviceProperties(physical_device, &m_properties);
+
+		std::vector<char> data = m_path.empty() ? std::vector<char>() : Load();
+		VkPipelineCacheCreateInfo create_info{ VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO };
+		create_info.initialDataSize = data.size();
+		create_info.pInitialData = data.empty() ? nullptr : data.data();
+		if (vkCreatePipelineCache(m_device, &create_info, nullptr, &m_cache) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create pipeline cache");
+		}
+		m_loaded_size = data.size();
+	}
+
+	PipelineCache::FileHeader PipelineCache::MakeHeader() const {
+		FileHeader header{};
+		header.magic = s_magic;
+		header.version = s_version;
+		header.vendor_id = m_properties.vendorID;
+		header.device_id = m_properties.deviceID;
+		header.driver_version = m_properties.driverVersion;
+		std::memcpy(header.uuid, m_properties.pipelineCacheUUID, VK_UUID_SIZE);
+		return header;
+	}
+
+	std::vector<char> PipelineCache::Load() const {
+		std::ifstream file(m_path, std::ios::ate | std::ios::binary);
+		if (!file.is_open()) {
+			std::cout << "Pipeline cache: no " << m_path << ", starting cold" << std::endl;
+			return {};
+		}
+		size_t file_size = static_cast<size_t>(file.tellg());
+		file.seekg(0);
+
+		FileHeader header{};
+		FileHeader expected = MakeHeader();
+		if (file_size < sizeof(FileHeader) || !file.read(reinterpret_cast<char*>(&header), sizeof(FileHeader)) ||
+			header.magic != expected.magic || header.version != expected.version || header.data_size != file_size - sizeof(FileHeader)) {
+			std::cout << "Pipeline cache: " << m_path << " is not a valid cache, starting cold" << std::endl;
+			return {};
+		}
+		if (header.vendor_id != expected.vendor_id || header.device_id != expected.device_id || header.driver_version != expected.driver_version ||
+			std::memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) != 0) {
+			std::cout << "Pipeline cache: " << m_path << " was written for another device or driver, starting cold" << std::endl;
+			return {};
+		}
+
+		std::vector<char> data(header.data_size);
+		Utils::Hash128 hash{};
+		if (file.read(data.data(), data.size())) {
+			hash = Utils::Hash::Murmur3_128(data.data(), data.size());
+		}
+		// The driver checks its own header as well, but a damaged cache is better caught here
+		VkPipelineCacheHeaderVersionOne vulkan_header{};
+		if (data.size() >= sizeof(vulkan_header)) {
+			std::memcpy(&vulkan_header, data.data(), sizeof(vulkan_header));
+		}
+		if (hash.low != header.data_hash_low || hash.high != header.data_hash_high ||
+			vulkan_header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || vulkan_header.vendorID != expected.vendor_id ||
+			vulkan_header.deviceID != expected.device_id || std::memcmp(vulkan_header.pipelineCacheUUID, expected.uuid, VK_UUID_SIZE) != 0) {
+			std::cout << "Pipeline cache: " << m_path << " is damaged, starting cold" << std::endl;
+			return {};
+		}
+		return data;
+	}
+
+	bool PipelineCache::Save() const {
+		if (m_path.empty())
+			return false;
+		size_t size = 0;
+		if (vkGetPipelineCacheData(m_device, m_cache, &size, nullptr) != VK_SUCCESS)
+			return false;
+		std::vector<char> data(size);
+		if (vkGetPipelineCacheData(m_device, m_cache, &size, data.data()) != VK_SUCCESS)
+			return false;
+		data.resize(size);
+
+		FileHeader header = MakeHeader();
+		header.data_size = data.size();
+		Utils::Hash128 hash = Utils::Hash::Murmur3_128(data.data(), data.size());
+		header.data_hash_low = hash.low;
+		header.data_hash_high = hash.high;
+
+		const std::string temporary_path = m_path + ".tmp";
+		{
+			std::ofstream file(temporary_path, std::ios::binary | std::ios::trunc);
+			if (!file || !file.write(reinterpret_cast<const char*>(&header), sizeof(header)) || !file.write(data.data(), data.size())) {
+				std::cout << "Pipeline cache: failed to write " << temporary_path << std::endl;
+				return false;
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary_path, m_path, error);
+		if (error) {
+			std::cout << "Pipeline cache: failed to replace " << m_path << ": " << error.message() << std::endl;
+			std::filesystem::remove(temporary_path, error);
+			return false;
+		}
+		std::cout << "Pipeline cache: saved " << (data.size() >> 10) << " KB to " << m_path << std::endl;
+		return true;
+	}
+
+	void PipelineCache::CleanUp() {
+		vkDestroyPipelineCache(m_device, m_cache, nullptr);
+		m_cache = VK_NULL_HANDLE;
+	}
+}
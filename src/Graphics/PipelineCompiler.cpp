@@ -0,0 +1,245 @@
+#include "PipelineCompiler.hpp"
+
+#include "ReadFile.hpp"
+#include "VulkanUtilities.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	// Owns copies of everything a VkGraphicsPipelineCreateInfo points to
+	struct PipelineCompiler::GraphicsJob {
+		VkGraphicsPipelineCreateInfo info{};
+		std::vector<ShaderStage> shaders;
+
+		VkPipelineVertexInputStateCreateInfo vertex_input{};
+		std::vector<VkVertexInputBindingDescription> vertex_bindings;
+		std::vector<VkVertexInputAttributeDescription> vertex_attributes;
+		VkPipelineInputAssemblyStateCreateInfo input_assembly{};
+		VkPipelineTessellationStateCreateInfo tessellation{};
+		VkPipelineViewportStateCreateInfo viewport{};
+		std::vector<VkViewport> viewports;
+		std::vector<VkRect2D> scissors;
+		VkPipelineRasterizationStateCreateInfo rasterization{};
+		VkPipelineMultisampleStateCreateInfo multisample{};
+		std::vector<VkSampleMask> sample_mask;
+		VkPipelineDepthStencilStateCreateInfo depth_stencil{};
+		VkPipelineColorBlendStateCreateInfo color_blend{};
+		std::vector<VkPipelineColorBlendAttachmentState> blend_attachments;
+		VkPipelineDynamicStateCreateInfo dynamic{};
+		std::vector<VkDynamicState> dynamic_states;
+	};
+
+	namespace {
+		template<typename T>
+		const T* CopyState(const T* source, T& destination) {
+			if (source == nullptr)
+				return nullptr;
+			destination = *source;
+			destination.pNext = nullptr;
+			return &destination;
+		}
+
+		// 32 bit constants with consecutive ids, the entries and info have to outlive the pipeline creation
+		const VkSpecializationInfo* Specialize(const std::vector<uint32_t>& constants, std::vector<VkSpecializationMapEntry>& entries, VkSpecializationInfo& info) {
+			if (constants.empty())
+				return nullptr;
+			entries.resize(constants.size());
+			for (uint32_t i = 0; i < constants.size(); i++) {
+				entries[i] = { i, i * static_cast<uint32_t>(sizeof(uint32_t)), sizeof(uint32_t) };
+			}
+			info.mapEntryCount = static_cast<uint32_t>(entries.size());
+			info.pMapEntries = entries.data();
+			info.dataSize = constants.size() * sizeof(uint32_t);
+			info.pData = constants.data();
+			return &info;
+		}
+
+		template<typename T>
+		const T* CopyArray(const T* source, uint32_t count, std::vector<T>& destination) {
+			if (source == nullptr || count == 0)
+				return nullptr;
+			destination.assign(source, source + count);
+			return destination.data();
+		}
+	}
+
+	PipelineCompiler::PipelineCompiler(VkDevice device, VkPipelineCache cache, uint32_t thread_count)
+		:m_device(device), m_cache(cache) {
+		for (uint32_t i = 0; i < thread_count; i++) {
+			m_threads.emplace_back(&PipelineCompiler::Run, this);
+		}
+	}
+
+	PipelineCompiler::~PipelineCompiler() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (auto& thread : m_threads) {
+			thread.join();
+		}
+	}
+
+	PipelineCompiler::Ticket PipelineCompiler::Compile(const VkGraphicsPipelineCreateInfo& create_info, const std::vector<ShaderStage>& shaders, VkPipeline* target) {
+		auto job = std::make_shared<GraphicsJob>();
+		job->info = create_info;
+		job->info.pNext = nullptr;
+		job->info.stageCount = 0;
+		job->info.pStages = nullptr;
+		job->shaders = shaders;
+
+		job->info.pVertexInputState = CopyState(create_info.pVertexInputState, job->vertex_input);
+		if (create_info.pVertexInputState) {
+			job->vertex_input.pVertexBindingDescriptions = CopyArray(create_info.pVertexInputState->pVertexBindingDescriptions,
+				create_info.pVertexInputState->vertexBindingDescriptionCount, job->vertex_bindings);
+			job->vertex_input.pVertexAttributeDescriptions = CopyArray(create_info.pVertexInputState->pVertexAttributeDescriptions,
+				create_info.pVertexInputState->vertexAttributeDescriptionCount, job->vertex_attributes);
+		}
+		job->info.pInputAssemblyState = CopyState(create_info.pInputAssemblyState, job->input_assembly);
+		job->info.pTessellationState = CopyState(create_info.pTessellationState, job->tessellation);
+		job->info.pViewportState = CopyState(create_info.pViewportState, job->viewport);
+		if (create_info.pViewportState) {
+			job->viewport.pViewports = CopyArray(create_info.pViewportState->pViewports, create_info.pViewportState->viewportCount, job->viewports);
+			job->viewport.pScissors = CopyArray(create_info.pViewportState->pScissors, create_info.pViewportState->scissorCount, job->scissors);
+		}
+		job->info.pRasterizationState = CopyState(create_info.pRasterizationState, job->rasterization);
+		job->info.pMultisampleState = CopyState(create_info.pMultisampleState, job->multisample);
+		if (create_info.pMultisampleState) {
+			job->multisample.pSampleMask = CopyArray(create_info.pMultisampleState->pSampleMask,
+				(static_cast<uint32_t>(create_info.pMultisampleState->rasterizationSamples) + 31) / 32, job->sample_mask);
+		}
+		job->info.pDepthStencilState = CopyState(create_info.pDepthStencilState, job->depth_stencil);
+		job->info.pColorBlendState = CopyState(create_info.pColorBlendState, job->color_blend);
+		if (create_info.pColorBlendState) {
+			job->color_blend.pAttachments = CopyArray(create_info.pColorBlendState->pAttachments, create_info.pColorBlendState->attachmentCount, job->blend_attachments);
+		}
+		job->info.pDynamicState = CopyState(create_info.pDynamicState, job->dynamic);
+		if (create_info.pDynamicState) {
+			job->dynamic.pDynamicStates = CopyArray(create_info.pDynamicState->pDynamicStates, create_info.pDynamicState->dynamicStateCount, job->dynamic_states);
+		}
+
+		return Submit([this, job]() { return CompileGraphics(*job); }, target);
+	}
+
+	PipelineCompiler::Ticket PipelineCompiler::Compile(const VkComputePipelineCreateInfo& create_info, const ShaderStage& shader, VkPipeline* target) {
+		VkComputePipelineCreateInfo info = create_info;
+		info.pNext = nullptr;
+		return Submit([this, info, shader]() mutable {
+			std::vector<VkSpecializationMapEntry> entries;
+			VkSpecializationInfo specialization{};
+			info.stage = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, shader.stage, CreateModule(shader.path), "main",
+				Specialize(shader.constants, entries, specialization) };
+			VkPipeline pipeline = VK_NULL_HANDLE;
+			VkResult result = vkCreateComputePipelines(m_device, m_cache, 1, &info, nullptr, &pipeline);
+			vkDestroyShaderModule(m_device, info.stage.module, nullptr);
+			if (result != VK_SUCCESS) {
+				throw std::runtime_error("Failed to create compute pipeline from " + shader.path);
+			}
+			return pipeline;
+		}, target);
+	}
+
+	PipelineCompiler::Ticket PipelineCompiler::Submit(std::function<VkPipeline()> compile, VkPipeline* target) {
+		auto task = std::make_shared<std::packaged_task<VkPipeline()>>([this, compile = std::move(compile), target]() {
+			auto start = std::chrono::high_resolution_clock::now();
+			VkPipeline pipeline = compile();
+			if (target) {
+				*target = pipeline;
+			}
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_compiled++;
+			m_compile_ms += ms;
+			return pipeline;
+		});
+		Ticket ticket = task->get_future().share();
+
+		if (m_threads.empty()) {
+			(*task)();
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_pending.push_back(ticket);
+			return ticket;
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_queue.emplace_back([task]() { (*task)(); });
+			m_pending.push_back(ticket);
+		}
+		m_wake.notify_one();
+		return ticket;
+	}
+
+	void PipelineCompiler::WaitIdle() {
+		std::vector<Ticket> pending;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			pending.swap(m_pending);
+		}
+		for (Ticket& ticket : pending) {
+			ticket.get();
+		}
+	}
+
+	std::shared_ptr<const std::vector<char>> PipelineCompiler::ReadSpirv(const std::string& path) {
+		{
+			std::lock_guard<std::mutex> lock(m_spirv_mutex);
+			auto it = m_spirv.find(path);
+			if (it != m_spirv.end())
+				return it->second;
+		}
+		auto code = std::make_shared<const std::vector<char>>(Utils::File::ReadFile(path));
+		std::lock_guard<std::mutex> lock(m_spirv_mutex);
+		return m_spirv.emplace(path, code).first->second;
+	}
+
+	VkShaderModule PipelineCompiler::CreateModule(const std::string& path) {
+		return vkUtilities::CreateShaderModule(*ReadSpirv(path), m_device);
+	}
+
+	VkPipeline PipelineCompiler::CompileGraphics(const GraphicsJob& job) {
+		std::vector<VkPipelineShaderStageCreateInfo> stages(job.shaders.size());
+		std::vector<std::vector<VkSpecializationMapEntry>> entries(job.shaders.size());
+		std::vector<VkSpecializationInfo> specializations(job.shaders.size());
+		for (size_t i = 0; i < job.shaders.size(); i++) {
+			stages[i] = { VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO, nullptr, 0, job.shaders[i].stage, CreateModule(job.shaders[i].path), "main",
+				Specialize(job.shaders[i].constants, entries[i], specializations[i]) };
+		}
+		VkGraphicsPipelineCreateInfo info = job.info;
+		info.stageCount = static_cast<uint32_t>(stages.size());
+		info.pStages = stages.data();
+
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		VkResult result = vkCreateGraphicsPipelines(m_device, m_cache, 1, &info, nullptr, &pipeline);
+		for (auto& stage : stages) {
+			vkDestroyShaderModule(m_device, stage.module, nullptr);
+		}
+		if (result != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create graphics pipeline from " + job.shaders.front().path);
+		}
+		return pipeline;
+	}
+
+	void PipelineCompiler::Run() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [this]() { return m_stop || !m_queue.empty(); });
+				if (m_queue.empty())
+					return;
+				task = std::move(m_queue.front());
+				m_queue.pop_front();
+			}
+			task();
+		}
+	}
+
+	void PipelineCompiler::PrintStats() const {
+		std::cout << "Pipeline compiler: " << m_compiled << " pipelines on " << std::max<size_t>(m_threads.size(), 1) << " threads, "
+			<< m_compile_ms << " ms of compilation" << std::endl;
+	}
+}
@@ -0,0 +1,555 @@
+#include "RenderGraph.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	namespace {
+		constexpr VkAccessFlags s_write_access = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+			VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+		VkImageAspectFlags GetAspect(VkFormat format) {
+			switch (format) {
+			case VK_FORMAT_D16_UNORM:
+			case VK_FORMAT_X8_D24_UNORM_PACK32:
+			case VK_FORMAT_D32_SFLOAT:
+				return VK_IMAGE_ASPECT_DEPTH_BIT;
+			case VK_FORMAT_S8_UINT:
+				return VK_IMAGE_ASPECT_STENCIL_BIT;
+			case VK_FORMAT_D16_UNORM_S8_UINT:
+			case VK_FORMAT_D24_UNORM_S8_UINT:
+			case VK_FORMAT_D32_SFLOAT_S8_UINT:
+				return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+			default:
+				return VK_IMAGE_ASPECT_COLOR_BIT;
+			}
+		}
+	}
+
+	RenderGraph::Pass& RenderGraph::Pass::Read(Resource resource, Usage usage, const Range& range) {
+		m_accesses.push_back({ resource, usage, range, false, false, false, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 });
+		return *this;
+	}
+
+	RenderGraph::Pass& RenderGraph::Pass::Write(Resource resource, Usage usage, const Range& range, bool discard) {
+		m_accesses.push_back({ resource, usage, range, true, discard, false, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_UNDEFINED, 0, 0 });
+		return *this;
+	}
+
+	RenderGraph::Pass& RenderGraph::Pass::Attachment(Resource resource, Usage usage, VkImageLayout initial_layout, VkImageLayout final_layout,
+		VkPipelineStageFlags visible_stages, VkAccessFlags visible_access) {
+		m_accesses.push_back({ resource, usage, {}, true, initial_layout == VK_IMAGE_LAYOUT_UNDEFINED, true, initial_layout, final_layout, visible_stages, visible_access });
+		return *this;
+	}
+
+	RenderGraph::Pass& RenderGraph::Pass::SetRenderPass(VkRenderPass render_pass, VkExtent2D extent, const std::vector<VkClearValue>& clear_values) {
+		m_render_pass = render_pass;
+		m_extent = extent;
+		m_clear_values = clear_values;
+		return *this;
+	}
+
+	RenderGraph::RenderGraph(GraphicsDevice* device)
+		:m_device(device) {}
+
+	RenderGraph::~RenderGraph() {
+		Reset();
+	}
+
+	RenderGraph::Resource RenderGraph::ImportImage(const std::string& name, VkImage image, VkImageView view, VkFormat format, uint32_t mip_levels, uint32_t layers,
+		const State& state) {
+		ResourceData resource;
+		resource.name = name;
+		resource.image = image;
+		resource.view = view;
+		resource.aspect = GetAspect(format);
+		resource.mip_levels = mip_levels;
+		resource.layers = layers;
+		SubresourceState initial;
+		initial.layout = state.layout;
+		if (state.access) {
+			initial.write_stages = state.stages;
+			initial.write_access = state.access;
+		}
+		else {
+			initial.read_stages = state.stages;
+			initial.visible_stages = ~0u;
+			initial.visible_access = ~0u;
+		}
+		resource.states.assign(mip_levels * layers, initial);
+		m_resources.push_back(std::move(resource));
+		return static_cast<Resource>(m_resources.size() - 1);
+	}
+
+	RenderGraph::Resource RenderGraph::ImportBuffer(const std::string& name, VkBuffer buffer, const State& state) {
+		ResourceData resource;
+		resource.name = name;
+		resource.buffer = buffer;
+		SubresourceState initial;
+		if (state.access) {
+			initial.write_stages = state.stages;
+			initial.write_access = state.access;
+		}
+		else {
+			initial.read_stages = state.stages;
+			initial.visible_stages = ~0u;
+			initial.visible_access = ~0u;
+		}
+		resource.states.assign(1, initial);
+		m_resources.push_back(std::move(resource));
+		return static_cast<Resource>(m_resources.size() - 1);
+	}
+
+	RenderGraph::Resource RenderGraph::CreateImage(const std::string& name, const VkImageCreateInfo& create_info, VkImageViewType view_type) {
+		ResourceData resource;
+		resource.name = name;
+		resource.transient = true;
+		resource.create_info = create_info;
+		resource.create_info.pNext = nullptr;
+		resource.create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		resource.view_type = view_type;
+		resource.aspect = GetAspect(create_info.format);
+		resource.mip_levels = create_info.mipLevels;
+		resource.layers = create_info.arrayLayers;
+		resource.states.assign(resource.mip_levels * resource.layers, {});
+		m_resources.push_back(std::move(resource));
+		return static_cast<Resource>(m_resources.size() - 1);
+	}
+
+	void RenderGraph::Output(Resource resource, Usage usage) {
+		m_resources[resource].output = true;
+		m_resources[resource].output_usage = usage;
+	}
+
+	RenderGraph::Pass& RenderGraph::AddPass(const std::string& name, std::function<void(VkCommandBuffer)> execute) {
+		m_passes.emplace_back();
+		Pass& pass = m_passes.back();
+		pass.m_name = name;
+		pass.m_execute = std::move(execute);
+		m_compiled = false;
+		return pass;
+	}
+
+	RenderGraph::UsageInfo RenderGraph::GetUsageInfo(Usage usage) {
+		switch (usage) {
+		case Usage::ColorAttachment:
+			return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+				VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, true };
+		case Usage::DepthAttachment:
+			return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+				VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, true };
+		case Usage::DepthRead:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL, false };
+		case Usage::FragmentSampled:
+			return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+		case Usage::ComputeSampled:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, false };
+		case Usage::ComputeRead:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, false };
+		case Usage::ComputeWrite:
+			return { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, true };
+		case Usage::TransferSrc:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, false };
+		case Usage::TransferDst:
+			return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, true };
+		case Usage::IndirectRead:
+			return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false };
+		case Usage::Present:
+			return { VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false };
+		}
+		throw std::runtime_error("unknown render graph usage!");
+	}
+
+	void RenderGraph::Compile() {
+		if (m_compiled)
+			return;
+		m_stats = {};
+		m_stats.passes = static_cast<uint32_t>(m_passes.size());
+		CullPasses();
+		AllocateTransients();
+
+		m_barriers.assign(m_passes.size(), {});
+		m_pass_framebuffers.assign(m_passes.size(), VK_NULL_HANDLE);
+		for (uint32_t i = 0; i < m_passes.size(); i++) {
+			if (!m_live[i])
+				continue;
+			const Pass& pass = m_passes[i];
+			Barriers& barriers = m_barriers[i];
+			for (const auto& access : pass.m_accesses) {
+				ResourceData& resource = m_resources[access.resource];
+				if (resource.alias_pending) {
+					// The first use of the memory waits for the last uses of the image that had it before
+					SubresourceState previous;
+					for (const auto& state : m_resources[resource.alias_previous].states) {
+						previous.write_stages |= state.write_stages | state.read_stages;
+						previous.write_access |= state.write_access;
+					}
+					resource.states.assign(resource.states.size(), previous);
+					resource.alias_pending = false;
+				}
+				const UsageInfo usage = GetUsageInfo(access.usage);
+				if (access.attachment) {
+					if (access.initial_layout == VK_IMAGE_LAYOUT_UNDEFINED)
+						continue;
+					bool other_layout = std::any_of(resource.states.begin(), resource.states.end(), [&](const SubresourceState& state) {
+						return state.layout != access.initial_layout;
+					});
+					if (other_layout) {
+						AddBarriers(barriers, resource, access.range, usage.stages, usage.access, access.initial_layout, usage.write, false);
+					}
+					continue;
+				}
+				AddBarriers(barriers, resource, access.range, usage.stages, usage.access, usage.layout, access.write, access.discard);
+			}
+			// Render passes the pass begins itself leave their attachments in the final layout
+			for (const auto& access : pass.m_accesses) {
+				if (!access.attachment)
+					continue;
+				const UsageInfo usage = GetUsageInfo(access.usage);
+				for (auto& state : m_resources[access.resource].states) {
+					state.layout = access.final_layout;
+					state.write_stages = usage.stages;
+					state.write_access = usage.access & s_write_access;
+					state.read_stages = 0;
+					state.visible_stages = access.visible_stages;
+					state.visible_access = access.visible_access;
+				}
+			}
+			if (pass.m_render_pass) {
+				m_pass_framebuffers[i] = GetFramebuffer(pass);
+			}
+		}
+
+		m_output_barriers = {};
+		for (auto& resource : m_resources) {
+			if (!resource.output)
+				continue;
+			const UsageInfo usage = GetUsageInfo(resource.output_usage);
+			AddBarriers(m_output_barriers, resource, {}, usage.stages, usage.access, usage.layout, false, false);
+		}
+
+		auto count = [this](const Barriers& barriers) {
+			if (barriers.images.empty() && barriers.buffers.empty())
+				return;
+			m_stats.barriers++;
+			m_stats.image_barriers += static_cast<uint32_t>(barriers.images.size());
+			m_stats.buffer_barriers += static_cast<uint32_t>(barriers.buffers.size());
+		};
+		for (const auto& barriers : m_barriers) {
+			count(barriers);
+		}
+		count(m_output_barriers);
+		m_compiled = true;
+	}
+
+	void RenderGraph::CullPasses() {
+		// Backwards from the outputs, a pass is kept when a later kept pass or the caller needs something it writes
+		m_live.assign(m_passes.size(), false);
+		std::vector<bool> needed(m_resources.size(), false);
+		for (uint32_t r = 0; r < m_resources.size(); r++) {
+			needed[r] = m_resources[r].output;
+		}
+		for (uint32_t i = static_cast<uint32_t>(m_passes.size()); i-- > 0;) {
+			const Pass& pass = m_passes[i];
+			bool live = pass.m_side_effect;
+			for (const auto& access : pass.m_accesses) {
+				live = live || (access.write && needed[access.resource]);
+			}
+			if (!live) {
+				m_stats.culled_passes++;
+				continue;
+			}
+			m_live[i] = true;
+			// Writes that keep part of the previous contents depend on the passes before them as much as reads
+			for (const auto& access : pass.m_accesses) {
+				if (!access.write || !access.discard)
+					needed[access.resource] = true;
+			}
+		}
+	}
+
+	void RenderGraph::AllocateTransients() {
+		VkDevice device = m_device->Device();
+		std::vector<Resource> transients;
+		for (uint32_t i = 0; i < m_passes.size(); i++) {
+			if (!m_live[i])
+				continue;
+			for (const auto& access : m_passes[i].m_accesses) {
+				ResourceData& resource = m_resources[access.resource];
+				if (!resource.transient)
+					continue;
+				if (resource.first_pass == ~0u) {
+					resource.first_pass = i;
+					transients.push_back(access.resource);
+				}
+				resource.last_pass = i;
+			}
+		}
+		if (transients.empty())
+			return;
+
+		// Images are placed in order of their first use, each in the slot that grows least among those whose last image
+		// is done before it starts and which share a memory type with it
+		struct Slot {
+			std::vector<VkImage> images;
+			VkMemoryRequirements requirements;
+			uint32_t last_pass;
+			Resource last;
+		};
+		std::vector<Slot> slots;
+		for (Resource r : transients) {
+			ResourceData& resource = m_resources[r];
+			if (vkCreateImage(device, &resource.create_info, nullptr, &resource.image) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create transient image!");
+			}
+			VkMemoryRequirements requirements;
+			vkGetImageMemoryRequirements(device, resource.image, &requirements);
+			m_stats.transient_bytes += requirements.size;
+
+			Slot* best = nullptr;
+			for (auto& slot : slots) {
+				if (slot.last_pass >= resource.first_pass || !(slot.requirements.memoryTypeBits & requirements.memoryTypeBits))
+					continue;
+				VkDeviceSize growth = requirements.size > slot.requirements.size ? requirements.size - slot.requirements.size : 0;
+				VkDeviceSize best_growth = best && requirements.size > best->requirements.size ? requirements.size - best->requirements.size : 0;
+				if (!best || growth < best_growth)
+					best = &slot;
+			}
+			if (!best) {
+				slots.push_back({ {}, requirements, resource.last_pass, r });
+				slots.back().images.push_back(resource.image);
+				continue;
+			}
+			resource.alias_previous = best->last;
+			resource.alias_pending = true;
+			best->images.push_back(resource.image);
+			best->requirements.size = std::max(best->requirements.size, requirements.size);
+			best->requirements.alignment = std::max(best->requirements.alignment, requirements.alignment);
+			best->requirements.memoryTypeBits &= requirements.memoryTypeBits;
+			best->last_pass = resource.last_pass;
+			best->last = r;
+		}
+
+		MemoryAllocator::Tag tag(MemoryCategory::Attachment, "render graph");
+		for (const auto& slot : slots) {
+			m_device->GetMemoryAllocator()->BindAliased(slot.images, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+			m_stats.allocated_bytes += slot.requirements.size;
+		}
+		m_stats.transient_images = static_cast<uint32_t>(transients.size());
+		m_stats.transient_allocations = static_cast<uint32_t>(slots.size());
+
+		for (Resource r : transients) {
+			ResourceData& resource = m_resources[r];
+			VkImageViewCreateInfo view_info{ VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
+			view_info.image = resource.image;
+			view_info.viewType = resource.view_type;
+			view_info.format = resource.create_info.format;
+			view_info.subresourceRange = { resource.aspect, 0, resource.mip_levels, 0, resource.layers };
+			if (vkCreateImageView(device, &view_info, nullptr, &resource.view) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create transient image view!");
+			}
+		}
+	}
+
+	void RenderGraph::AddBarriers(Barriers& barriers, ResourceData& resource, const Range& range, VkPipelineStageFlags stages, VkAccessFlags access,
+		VkImageLayout layout, bool write, bool discard) {
+		if (resource.image == VK_NULL_HANDLE && resource.buffer == VK_NULL_HANDLE)
+			return;
+
+		const bool image = resource.image != VK_NULL_HANDLE;
+		const uint32_t mip_end = range.mip_count == VK_REMAINING_MIP_LEVELS ? resource.mip_levels : range.base_mip + range.mip_count;
+		const uint32_t layer_end = range.layer_count == VK_REMAINING_ARRAY_LAYERS ? resource.layers : range.base_layer + range.layer_count;
+		if (!image) {
+			layout = VK_IMAGE_LAYOUT_UNDEFINED;
+		}
+
+		for (uint32_t mip = image ? range.base_mip : 0; mip < (image ? mip_end : 1); mip++) {
+			for (uint32_t layer = image ? range.base_layer : 0; layer < (image ? layer_end : 1); layer++) {
+				SubresourceState& state = resource.states[layer * resource.mip_levels + mip];
+				const bool transition = state.layout != layout;
+				VkPipelineStageFlags src_stages;
+				bool needed;
+				if (write) {
+					// Waits for the reads since the last write as well, they must not see this one
+					src_stages = state.write_stages | state.read_stages;
+					needed = transition || src_stages != 0;
+				}
+				else {
+					bool visible = (state.visible_stages & stages) == stages && (state.visible_access & access) == access;
+					src_stages = state.write_stages | (transition ? state.read_stages : 0);
+					needed = transition || (state.write_stages != 0 && !visible);
+				}
+				// Presentation waits on a semaphore, only a layout change needs recording
+				if (stages == VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT && !transition)
+					needed = false;
+
+				if (needed) {
+					barriers.src_stages |= src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+					barriers.dst_stages |= stages;
+					if (image) {
+						VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+						barrier.srcAccessMask = state.write_access;
+						barrier.dstAccessMask = access;
+						barrier.oldLayout = discard ? VK_IMAGE_LAYOUT_UNDEFINED : state.layout;
+						barrier.newLayout = layout;
+						barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+						barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+						barrier.image = resource.image;
+						barrier.subresourceRange = { resource.aspect, mip, 1, layer, 1 };
+						// Neighbouring layers of a mip, then neighbouring mips over the same layers, share one barrier
+						VkImageMemoryBarrier* last = barriers.images.empty() ? nullptr : &barriers.images.back();
+						if (last && last->image == barrier.image && last->oldLayout == barrier.oldLayout && last->newLayout == barrier.newLayout &&
+							last->srcAccessMask == barrier.srcAccessMask && last->dstAccessMask == barrier.dstAccessMask &&
+							last->subresourceRange.baseMipLevel == mip && last->subresourceRange.levelCount == 1 &&
+							last->subresourceRange.baseArrayLayer + last->subresourceRange.layerCount == layer) {
+							last->subresourceRange.layerCount++;
+						}
+						else {
+							barriers.images.push_back(barrier);
+						}
+					}
+					else {
+						VkBufferMemoryBarrier barrier{ VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER };
+						barrier.srcAccessMask = state.write_access;
+						barrier.dstAccessMask = access;
+						barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+						barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+						barrier.buffer = resource.buffer;
+						barrier.offset = 0;
+						barrier.size = VK_WHOLE_SIZE;
+						barriers.buffers.push_back(barrier);
+					}
+				}
+
+				if (write || transition) {
+					// A layout transition orders the reads after it like a write
+					state.layout = layout;
+					state.write_stages = stages;
+					state.write_access = write ? (access & s_write_access) : 0;
+					state.read_stages = write ? 0 : stages;
+					state.visible_stages = write ? 0 : stages;
+					state.visible_access = write ? 0 : access;
+				}
+				else {
+					if (needed) {
+						state.visible_stages |= stages;
+						state.visible_access |= access;
+					}
+					state.read_stages |= stages;
+				}
+			}
+		}
+
+		// Whole layer ranges of consecutive mips
+		while (barriers.images.size() >= 2) {
+			VkImageMemoryBarrier& previous = barriers.images[barriers.images.size() - 2];
+			const VkImageMemoryBarrier& last = barriers.images.back();
+			if (previous.image != last.image || previous.oldLayout != last.oldLayout || previous.newLayout != last.newLayout ||
+				previous.srcAccessMask != last.srcAccessMask || previous.dstAccessMask != last.dstAccessMask ||
+				previous.subresourceRange.baseArrayLayer != last.subresourceRange.baseArrayLayer ||
+				previous.subresourceRange.layerCount != last.subresourceRange.layerCount ||
+				previous.subresourceRange.baseMipLevel + previous.subresourceRange.levelCount != last.subresourceRange.baseMipLevel)
+				break;
+			previous.subresourceRange.levelCount += last.subresourceRange.levelCount;
+			barriers.images.pop_back();
+		}
+	}
+
+	VkFramebuffer RenderGraph::GetFramebuffer(const Pass& pass) {
+		std::vector<VkImageView> views;
+		for (const auto& access : pass.m_accesses) {
+			if (access.usage == Usage::ColorAttachment || access.usage == Usage::DepthAttachment)
+				views.push_back(m_resources[access.resource].view);
+		}
+		for (const auto& framebuffer : m_framebuffers) {
+			if (framebuffer.render_pass == pass.m_render_pass && framebuffer.views == views &&
+				framebuffer.extent.width == pass.m_extent.width && framebuffer.extent.height == pass.m_extent.height)
+				return framebuffer.framebuffer;
+		}
+
+		VkFramebufferCreateInfo framebuffer_info{ VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
+		framebuffer_info.renderPass = pass.m_render_pass;
+		framebuffer_info.attachmentCount = static_cast<uint32_t>(views.size());
+		framebuffer_info.pAttachments = views.data();
+		framebuffer_info.width = pass.m_extent.width;
+		framebuffer_info.height = pass.m_extent.height;
+		framebuffer_info.layers = 1;
+		VkFramebuffer framebuffer;
+		if (vkCreateFramebuffer(m_device->Device(), &framebuffer_info, nullptr, &framebuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create render graph framebuffer!");
+		}
+		m_framebuffers.push_back({ pass.m_render_pass, views, pass.m_extent, framebuffer });
+		return framebuffer;
+	}
+
+	void RenderGraph::RecordBarriers(VkCommandBuffer command_buffer, const Barriers& barriers) {
+		if (barriers.images.empty() && barriers.buffers.empty())
+			return;
+		vkCmdPipelineBarrier(command_buffer, barriers.src_stages, barriers.dst_stages, 0, 0, nullptr,
+			static_cast<uint32_t>(barriers.buffers.size()), barriers.buffers.data(), static_cast<uint32_t>(barriers.images.size()), barriers.images.data());
+	}
+
+	void RenderGraph::Execute(VkCommandBuffer command_buffer) {
+		Compile();
+		for (uint32_t i = 0; i < m_passes.size(); i++) {
+			if (!m_live[i])
+				continue;
+			const Pass& pass = m_passes[i];
+			RecordBarriers(command_buffer, m_barriers[i]);
+			if (pass.m_render_pass) {
+				VkRenderPassBeginInfo begin_info{ VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO };
+				begin_info.renderPass = pass.m_render_pass;
+				begin_info.framebuffer = m_pass_framebuffers[i];
+				begin_info.renderArea.extent = pass.m_extent;
+				begin_info.clearValueCount = static_cast<uint32_t>(pass.m_clear_values.size());
+				begin_info.pClearValues = pass.m_clear_values.data();
+				vkCmdBeginRenderPass(command_buffer, &begin_info, VK_SUBPASS_CONTENTS_INLINE);
+			}
+			pass.m_execute(command_buffer);
+			if (pass.m_render_pass) {
+				vkCmdEndRenderPass(command_buffer);
+			}
+		}
+		RecordBarriers(command_buffer, m_output_barriers);
+	}
+
+	void RenderGraph::Submit(VkQueue queue) {
+		VkCommandBuffer command_buffer = m_device->CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+		Execute(command_buffer);
+		m_device->FlushCommandBuffer(command_buffer, queue, true);
+	}
+
+	void RenderGraph::Reset() {
+		VkDevice device = m_device->Device();
+		for (const auto& framebuffer : m_framebuffers) {
+			vkDestroyFramebuffer(device, framebuffer.framebuffer, nullptr);
+		}
+		for (const auto& resource : m_resources) {
+			if (!resource.transient)
+				continue;
+			vkDestroyImageView(device, resource.view, nullptr);
+			vkUtilities::DestroyImage(device, resource.image);
+		}
+		m_framebuffers.clear();
+		m_resources.clear();
+		m_passes.clear();
+		m_live.clear();
+		m_barriers.clear();
+		m_output_barriers = {};
+		m_pass_framebuffers.clear();
+		m_compiled = false;
+	}
+
+	void RenderGraph::PrintStats(const std::string& label) const {
+		std::cout << "Render graph " << label << ": " << m_stats.passes - m_stats.culled_passes << " of " << m_stats.passes << " passes, "
+			<< m_stats.barriers << " barriers with " << m_stats.image_barriers << " image and " << m_stats.buffer_barriers << " buffer barriers";
+		if (m_stats.transient_images) {
+			std::cout << ", " << m_stats.transient_images << " transient images in " << m_stats.transient_allocations << " allocations ("
+				<< m_stats.allocated_bytes / (1024.0 * 1024.0) << " MB, " << m_stats.transient_bytes / (1024.0 * 1024.0) << " MB unaliased)";
+		}
+		std::cout << std::endl;
+	}
+}
@@ -0,0 +1,51 @@
+#include "UniformRing.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	UniformRing::UniformRing(GraphicsDevice* device, uint32_t frame_count, VkDeviceSize frame_size)
+		:m_device(device), m_frame_count(frame_count) {
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(device->PhysicalDevice(), &properties);
+		m_alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, 16);
+		m_frame_size = (frame_size + m_alignment - 1) / m_alignment * m_alignment;
+
+		VkDeviceMemory memory;
+		MemoryAllocator::Tag tag(MemoryCategory::Uniform, "uniform ring");
+		vkUtilities::CreateBuffer(m_frame_size * m_frame_count, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			m_buffer, memory, device->PhysicalDevice(), device->Device());
+		m_mapped = (unsigned char*)vkUtilities::MapBuffer(device->Device(), m_buffer);
+	}
+
+	void UniformRing::BeginFrame(uint32_t frame) {
+		m_frame_start = (frame % m_frame_count) * m_frame_size;
+		m_head = 0;
+	}
+
+	uint32_t UniformRing::Push(const void* data, VkDeviceSize size) {
+		VkDeviceSize offset = m_head;
+		if (offset + size > m_frame_size) {
+			throw std::runtime_error("uniform ring frame region is full!");
+		}
+		memcpy(m_mapped + m_frame_start + offset, data, (size_t)size);
+		m_head = (offset + size + m_alignment - 1) / m_alignment * m_alignment;
+		m_peak = std::max(m_peak, m_head);
+		return static_cast<uint32_t>(m_frame_start + offset);
+	}
+
+	void UniformRing::PrintStats() const {
+		std::cout << "Uniform ring: " << m_frame_count << " x " << m_frame_size / 1024 << " KB, peak "
+			<< m_peak / 1024.0f << " KB per frame" << std::endl;
+	}
+
+	void UniformRing::CleanUp() {
+		vkUtilities::DestroyBuffer(m_device->Device(), m_buffer);
+		m_buffer = VK_NULL_HANDLE;
+		m_mapped = nullptr;
+	}
+}
@@ -0,0 +1,159 @@
+#include "UploadQueue.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	UploadQueue::UploadQueue(GraphicsDevice* device, uint32_t frames_in_flight, VkQueue transfer_queue, uint32_t transfer_family, uint32_t graphics_family)
+		:m_device(device), m_queue(transfer_queue), m_transfer_family(transfer_family), m_graphics_family(graphics_family) {
+		if (!IsAsync()) {
+			std::cout << "Uploads: no separate transfer queue, recording on the graphics queue" << std::endl;
+			return;
+		}
+
+		VkCommandPoolCreateInfo pool_info{};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+		pool_info.queueFamilyIndex = m_transfer_family;
+		if (vkCreateCommandPool(device->Device(), &pool_info, nullptr, &m_command_pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create transfer command pool!");
+		}
+
+		m_command_buffers.resize(frames_in_flight);
+		VkCommandBufferAllocateInfo alloc_info{};
+		alloc_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		alloc_info.commandPool = m_command_pool;
+		alloc_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		alloc_info.commandBufferCount = frames_in_flight;
+		if (vkAllocateCommandBuffers(device->Device(), &alloc_info, m_command_buffers.data()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate transfer command buffers!");
+		}
+		m_frame_values.resize(frames_in_flight, 0);
+
+		VkSemaphoreTypeCreateInfo type_info{};
+		type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		type_info.initialValue = 0;
+		VkSemaphoreCreateInfo semaphore_info{};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_info.pNext = &type_info;
+		if (vkCreateSemaphore(device->Device(), &semaphore_info, nullptr, &m_timeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload timeline semaphore!");
+		}
+		std::cout << "Uploads: transfer queue family " << m_transfer_family << std::endl;
+	}
+
+	void UploadQueue::BeginFrame(uint32_t frame_index) {
+		m_frame_index = frame_index;
+		m_recording = false;
+		m_dst_stages = 0;
+		if (!IsAsync() || m_frame_values[frame_index] == 0)
+			return;
+
+		// The graphics submission of this slot waited on its batch, so this returns immediately in practice
+		VkSemaphoreWaitInfo wait_info{};
+		wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &m_timeline;
+		wait_info.pValues = &m_frame_values[frame_index];
+		vkWaitSemaphores(m_device->Device(), &wait_info, UINT64_MAX);
+	}
+
+	VkCommandBuffer UploadQueue::Begin(VkCommandBuffer graphics_command_buffer) {
+		if (!IsAsync())
+			return graphics_command_buffer;
+
+		VkCommandBuffer command_buffer = m_command_buffers[m_frame_index];
+		if (!m_recording) {
+			vkResetCommandBuffer(command_buffer, 0);
+			VkCommandBufferBeginInfo begin_info{};
+			begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+			begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+			if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+				throw std::runtime_error("failed to begin transfer command buffer!");
+			}
+			m_recording = true;
+		}
+		return command_buffer;
+	}
+
+	void UploadQueue::HandOver(VkCommandBuffer graphics_command_buffer, VkImage image, const VkImageSubresourceRange& range, VkImageLayout old_layout,
+		VkImageLayout new_layout, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access) {
+		VkImageMemoryBarrier barrier{};
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = old_layout;
+		barrier.newLayout = new_layout;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = dst_access;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = image;
+		barrier.subresourceRange = range;
+
+		if (!IsAsync()) {
+			vkCmdPipelineBarrier(graphics_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+			return;
+		}
+
+		// Release on the transfer queue, the destination access is ignored there
+		barrier.srcQueueFamilyIndex = m_transfer_family;
+		barrier.dstQueueFamilyIndex = m_graphics_family;
+		barrier.dstAccessMask = 0;
+		vkCmdPipelineBarrier(Begin(graphics_command_buffer), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		// Matching acquire on the graphics queue, ordered after the transfer batch by the semaphore wait at dst_stage
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = dst_access;
+		vkCmdPipelineBarrier(graphics_command_buffer, dst_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		m_dst_stages |= dst_stage;
+		m_stats.handovers++;
+	}
+
+	bool UploadQueue::Submit(VkSemaphore& semaphore, uint64_t& value, VkPipelineStageFlags& dst_stage) {
+		if (!IsAsync() || !m_recording)
+			return false;
+
+		VkCommandBuffer command_buffer = m_command_buffers[m_frame_index];
+		if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record transfer command buffer!");
+		}
+		m_recording = false;
+
+		m_value++;
+		VkTimelineSemaphoreSubmitInfo timeline_info{};
+		timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+		timeline_info.signalSemaphoreValueCount = 1;
+		timeline_info.pSignalSemaphoreValues = &m_value;
+
+		VkSubmitInfo submit_info{};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.pNext = &timeline_info;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &command_buffer;
+		submit_info.signalSemaphoreCount = 1;
+		submit_info.pSignalSemaphores = &m_timeline;
+		if (vkQueueSubmit(m_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+			throw std::runtime_error("failed to submit transfer command buffer!");
+		}
+
+		m_frame_values[m_frame_index] = m_value;
+		m_stats.batches++;
+		semaphore = m_timeline;
+		value = m_value;
+		dst_stage = m_dst_stages ? m_dst_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+		return true;
+	}
+
+	void UploadQueue::CleanUp() {
+		if (!IsAsync())
+			return;
+		std::cout << "Uploads: " << m_stats.batches << " transfer batches, " << m_stats.handovers << " images handed to graphics" << std::endl;
+		vkDestroySemaphore(m_device->Device(), m_timeline, nullptr);
+		vkDestroyCommandPool(m_device->Device(), m_command_pool, nullptr);
+		m_timeline = VK_NULL_HANDLE;
+		m_command_pool = VK_NULL_HANDLE;
+	}
+}
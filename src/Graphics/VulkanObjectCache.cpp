@@ -0,0 +1,247 @@
+#include "VulkanObjectCache.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+
+namespace Diffuse {
+	namespace {
+		// Builds the lookup key field by field so padding bytes in the create infos never leak into it
+		struct KeyWriter {
+			std::string key;
+
+			template<typename T>
+			void Write(const T& value) {
+				key.append(reinterpret_cast<const char*>(&value), sizeof(T));
+			}
+		};
+
+		void WriteAttachmentReferences(KeyWriter& writer, uint32_t count, const VkAttachmentReference* references) {
+			writer.Write(references ? count : 0u);
+			for (uint32_t i = 0; references && i < count; i++) {
+				writer.Write(references[i].attachment);
+				writer.Write(references[i].layout);
+			}
+		}
+
+		void PrintCounter(const char* name, size_t unique, const VulkanObjectCache::Counter& counter) {
+			uint32_t requests = counter.hits + counter.misses;
+			float hit_rate = requests > 0 ? 100.0f * counter.hits / requests : 0.0f;
+			std::cout << "  " << std::left << std::setw(24) << name << std::right
+				<< unique << " unique, " << requests << " requests, "
+				<< std::fixed << std::setprecision(1) << hit_rate << "% hit rate" << std::endl;
+		}
+	}
+
+	VulkanObjectCache::VulkanObjectCache(VkDevice device) : m_device(device) {}
+
+	template<typename Handle, typename CreateFn>
+	Handle VulkanObjectCache::Get(Table<Handle>& table, const std::string& key, bool cacheable, CreateFn create) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (cacheable) {
+			auto it = table.objects.find(key);
+			if (it != table.objects.end()) {
+				table.counter.hits++;
+				return it->second;
+			}
+		}
+
+		table.counter.misses++;
+		Handle handle = create();
+		if (cacheable) {
+			table.objects.emplace(key, handle);
+		}
+		else {
+			table.uncached.push_back(handle);
+		}
+		return handle;
+	}
+
+	VkSampler VulkanObjectCache::GetSampler(const VkSamplerCreateInfo& create_info) {
+		KeyWriter writer;
+		writer.Write(create_info.flags);
+		writer.Write(create_info.magFilter);
+		writer.Write(create_info.minFilter);
+		writer.Write(create_info.mipmapMode);
+		writer.Write(create_info.addressModeU);
+		writer.Write(create_info.addressModeV);
+		writer.Write(create_info.addressModeW);
+		writer.Write(create_info.mipLodBias);
+		writer.Write(create_info.anisotropyEnable);
+		writer.Write(create_info.maxAnisotropy);
+		writer.Write(create_info.compareEnable);
+		writer.Write(create_info.compareOp);
+		writer.Write(create_info.minLod);
+		writer.Write(create_info.maxLod);
+		writer.Write(create_info.borderColor);
+		writer.Write(create_info.unnormalizedCoordinates);
+
+		return Get(m_samplers, writer.key, create_info.pNext == nullptr, [&]() {
+			VkSampler sampler;
+			if (vkCreateSampler(m_device, &create_info, nullptr, &sampler) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create sampler!");
+			}
+			return sampler;
+		});
+	}
+
+	VkDescriptorSetLayout VulkanObjectCache::GetDescriptorSetLayout(const VkDescriptorSetLayoutCreateInfo& create_info) {
+		// Binding flags are the only extension understood here
+		bool cacheable = true;
+		const VkDescriptorBindingFlags* binding_flags = nullptr;
+		for (auto next = static_cast<const VkBaseInStructure*>(create_info.pNext); next; next = next->pNext) {
+			if (next->sType == VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO) {
+				auto flags_info = reinterpret_cast<const VkDescriptorSetLayoutBindingFlagsCreateInfo*>(next);
+				if (flags_info->bindingCount > 0) {
+					binding_flags = flags_info->pBindingFlags;
+				}
+			}
+			else {
+				cacheable = false;
+			}
+		}
+
+		// Binding order doesn't matter to Vulkan, so key the bindings sorted by index
+		std::vector<uint32_t> order(create_info.bindingCount);
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+			return create_info.pBindings[a].binding < create_info.pBindings[b].binding;
+		});
+
+		KeyWriter writer;
+		writer.Write(create_info.flags);
+		writer.Write(create_info.bindingCount);
+		for (uint32_t i : order) {
+			const VkDescriptorSetLayoutBinding& binding = create_info.pBindings[i];
+			writer.Write(binding.binding);
+			writer.Write(binding.descriptorType);
+			writer.Write(binding.descriptorCount);
+			writer.Write(binding.stageFlags);
+			writer.Write(binding_flags ? binding_flags[i] : 0u);
+			bool immutable = binding.pImmutableSamplers != nullptr;
+			writer.Write(immutable);
+			for (uint32_t s = 0; immutable && s < binding.descriptorCount; s++) {
+				writer.Write(binding.pImmutableSamplers[s]);
+			}
+		}
+
+		return Get(m_descriptor_set_layouts, writer.key, cacheable, [&]() {
+			VkDescriptorSetLayout layout;
+			if (vkCreateDescriptorSetLayout(m_device, &create_info, nullptr, &layout) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create descriptor set layout!");
+			}
+			return layout;
+		});
+	}
+
+	VkPipelineLayout VulkanObjectCache::GetPipelineLayout(const VkPipelineLayoutCreateInfo& create_info) {
+		KeyWriter writer;
+		writer.Write(create_info.flags);
+		writer.Write(create_info.setLayoutCount);
+		for (uint32_t i = 0; i < create_info.setLayoutCount; i++) {
+			writer.Write(create_info.pSetLayouts[i]);
+		}
+		writer.Write(create_info.pushConstantRangeCount);
+		for (uint32_t i = 0; i < create_info.pushConstantRangeCount; i++) {
+			writer.Write(create_info.pPushConstantRanges[i].stageFlags);
+			writer.Write(create_info.pPushConstantRanges[i].offset);
+			writer.Write(create_info.pPushConstantRanges[i].size);
+		}
+
+		return Get(m_pipeline_layouts, writer.key, create_info.pNext == nullptr, [&]() {
+			VkPipelineLayout layout;
+			if (vkCreatePipelineLayout(m_device, &create_info, nullptr, &layout) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create pipeline layout!");
+			}
+			return layout;
+		});
+	}
+
+	VkRenderPass VulkanObjectCache::GetRenderPass(const VkRenderPassCreateInfo& create_info) {
+		KeyWriter writer;
+		writer.Write(create_info.flags);
+		writer.Write(create_info.attachmentCount);
+		for (uint32_t i = 0; i < create_info.attachmentCount; i++) {
+			const VkAttachmentDescription& attachment = create_info.pAttachments[i];
+			writer.Write(attachment.flags);
+			writer.Write(attachment.format);
+			writer.Write(attachment.samples);
+			writer.Write(attachment.loadOp);
+			writer.Write(attachment.storeOp);
+			writer.Write(attachment.stencilLoadOp);
+			writer.Write(attachment.stencilStoreOp);
+			writer.Write(attachment.initialLayout);
+			writer.Write(attachment.finalLayout);
+		}
+		writer.Write(create_info.subpassCount);
+		for (uint32_t i = 0; i < create_info.subpassCount; i++) {
+			const VkSubpassDescription& subpass = create_info.pSubpasses[i];
+			writer.Write(subpass.flags);
+			writer.Write(subpass.pipelineBindPoint);
+			WriteAttachmentReferences(writer, subpass.inputAttachmentCount, subpass.pInputAttachments);
+			WriteAttachmentReferences(writer, subpass.colorAttachmentCount, subpass.pColorAttachments);
+			WriteAttachmentReferences(writer, subpass.colorAttachmentCount, subpass.pResolveAttachments);
+			WriteAttachmentReferences(writer, 1, subpass.pDepthStencilAttachment);
+			writer.Write(subpass.preserveAttachmentCount);
+			for (uint32_t p = 0; p < subpass.preserveAttachmentCount; p++) {
+				writer.Write(subpass.pPreserveAttachments[p]);
+			}
+		}
+		writer.Write(create_info.dependencyCount);
+		for (uint32_t i = 0; i < create_info.dependencyCount; i++) {
+			const VkSubpassDependency& dependency = create_info.pDependencies[i];
+			writer.Write(dependency.srcSubpass);
+			writer.Write(dependency.dstSubpass);
+			writer.Write(dependency.srcStageMask);
+			writer.Write(dependency.dstStageMask);
+			writer.Write(dependency.srcAccessMask);
+			writer.Write(dependency.dstAccessMask);
+			writer.Write(dependency.dependencyFlags);
+		}
+
+		return Get(m_render_passes, writer.key, create_info.pNext == nullptr, [&]() {
+			VkRenderPass render_pass;
+			if (vkCreateRenderPass(m_device, &create_info, nullptr, &render_pass) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create render pass!");
+			}
+			return render_pass;
+		});
+	}
+
+	void VulkanObjectCache::PrintStats() const {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		std::cout << "Vulkan object cache:" << std::endl;
+		PrintCounter("Samplers", m_samplers.objects.size() + m_samplers.uncached.size(), m_samplers.counter);
+		PrintCounter("Descriptor set layouts", m_descriptor_set_layouts.objects.size() + m_descriptor_set_layouts.uncached.size(), m_descriptor_set_layouts.counter);
+		PrintCounter("Pipeline layouts", m_pipeline_layouts.objects.size() + m_pipeline_layouts.uncached.size(), m_pipeline_layouts.counter);
+		PrintCounter("Render passes", m_render_passes.objects.size() + m_render_passes.uncached.size(), m_render_passes.counter);
+	}
+
+	void VulkanObjectCache::CleanUp() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		// Pipeline layouts reference set layouts, destroy them first
+		for (auto& [key, layout] : m_pipeline_layouts.objects)
+			vkDestroyPipelineLayout(m_device, layout, nullptr);
+		for (auto layout : m_pipeline_layouts.uncached)
+			vkDestroyPipelineLayout(m_device, layout, nullptr);
+		for (auto& [key, layout] : m_descriptor_set_layouts.objects)
+			vkDestroyDescriptorSetLayout(m_device, layout, nullptr);
+		for (auto layout : m_descriptor_set_layouts.uncached)
+			vkDestroyDescriptorSetLayout(m_device, layout, nullptr);
+		for (auto& [key, render_pass] : m_render_passes.objects)
+			vkDestroyRenderPass(m_device, render_pass, nullptr);
+		for (auto render_pass : m_render_passes.uncached)
+			vkDestroyRenderPass(m_device, render_pass, nullptr);
+		for (auto& [key, sampler] : m_samplers.objects)
+			vkDestroySampler(m_device, sampler, nullptr);
+		for (auto sampler : m_samplers.uncached)
+			vkDestroySampler(m_device, sampler, nullptr);
+
+		m_pipeline_layouts = {};
+		m_descriptor_set_layouts = {};
+		m_render_passes = {};
+		m_samplers = {};
+	}
+}
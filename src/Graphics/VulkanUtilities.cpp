@@ -171,19 +171,26 @@ namespace Diffuse {
 
 		int i = 0;
 		for (const auto& queueFamily : queueFamilies) {
-			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+			if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily.has_value()) {
 				indices.graphicsFamily = i;
 			}
 
 			VkBool32 presentSupport = false;
 			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);	
 
-			if (presentSupport) {
+			if (presentSupport && !indices.presentFamily.has_value()) {
 				indices.presentFamily = i;
 			}
 
-			if (indices.isComplete()) {
-				break;
+			if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+				bool dedicated = !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT);
+				if (!indices.transferFamily.has_value() || (dedicated && (queueFamilies[indices.transferFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT))) {
+					indices.transferFamily = i;
+				}
+			}
+
+			if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.computeFamily.has_value()) {
+				indices.computeFamily = i;
 			}
 
 			i++;
@@ -416,19 +423,31 @@ namespace Diffuse {
 			throw std::runtime_error("failed to create buffer!");
 		}
 
-		VkMemoryRequirements memRequirements;
-		vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+		// Transfer source only buffers are staging memory, whatever the enclosing tag says
+		MemoryAllocator::Tag tag(usage == VK_BUFFER_USAGE_TRANSFER_SRC_BIT ? MemoryCategory::Staging : MemoryAllocator::Tag::Category());
+		MemoryAllocator::Get(device)->BindBuffer(buffer, properties, &bufferMemory);
+	}
 
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = vkUtilities::FindMemoryType(memRequirements.memoryTypeBits, properties, physical_device);
+	void vkUtilities::DestroyBuffer(VkDevice device, VkBuffer buffer) {
+		if (buffer == VK_NULL_HANDLE)
+			return;
+		MemoryAllocator::Get(device)->Free(buffer);
+		vkDestroyBuffer(device, buffer, nullptr);
+	}
 
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate buffer memory!");
-		}
+	void vkUtilities::DestroyImage(VkDevice device, VkImage image) {
+		if (image == VK_NULL_HANDLE)
+			return;
+		MemoryAllocator::Get(device)->Free(image);
+		vkDestroyImage(device, image, nullptr);
+	}
 
-		vkBindBufferMemory(device, buffer, bufferMemory, 0);
+	void* vkUtilities::MapBuffer(VkDevice device, VkBuffer buffer) {
+		void* mapped = MemoryAllocator::Get(device)->GetMapped(buffer);
+		if (mapped == nullptr) {
+			throw std::runtime_error("failed to map memory!");
+		}
+		return mapped;
 	}
 
 	void vkUtilities::CreateVertexBuffer(const std::vector<Vertex>& vertices, VkDevice device, VkBuffer vertex_buffer, VkDeviceMemory vertex_buffer_memory, 
@@ -439,17 +458,13 @@ namespace Diffuse {
 		VkDeviceMemory stagingBufferMemory;
 		vkUtilities::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory, physical_device, device);
 
-		void* data;
-		vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-		memcpy(data, vertices.data(), (size_t)bufferSize);
-		vkUnmapMemory(device, stagingBufferMemory);
+		memcpy(vkUtilities::MapBuffer(device, stagingBuffer), vertices.data(), (size_t)bufferSize);
 
 		vkUtilities::CreateBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertex_buffer, vertex_buffer_memory, physical_device, device);
 
 		vkUtilities::CopyBuffer(stagingBuffer, vertex_buffer, bufferSize, command_pool, device, graphics_queue);
 
-		vkDestroyBuffer(device, stagingBuffer, nullptr);
-		vkFreeMemory(device, stagingBufferMemory, nullptr);
+		vkUtilities::DestroyBuffer(device, stagingBuffer);
 	}
 
 	//void vkUtilities::UpdateUniformBuffers(Camera* camera, uint32_t current_image, VkExtent2D swap_chain_extent, std::vector<void*> uniform_buffers_mapped)
@@ -526,19 +541,7 @@ namespace Diffuse {
 			throw std::runtime_error("failed to create image!");
 		}
 
-		VkMemoryRequirements memRequirements;
-		vkGetImageMemoryRequirements(device, image, &memRequirements);
-
-		VkMemoryAllocateInfo allocInfo{};
-		allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		allocInfo.allocationSize = memRequirements.size;
-		allocInfo.memoryTypeIndex = FindMemoryType(memRequirements.memoryTypeBits, properties, physical_device);
-
-		if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-			throw std::runtime_error("failed to allocate image memory!");
-		}
-
-		vkBindImageMemory(device, image, imageMemory, 0);
+		MemoryAllocator::Get(device)->BindImage(image, properties, &imageMemory);
 	}
 
 	VkCommandBuffer vkUtilities::BeginSingleTimeCommands(VkCommandPool command_pool, VkDevice device) {
@@ -707,47 +710,20 @@ namespace Diffuse {
 			throw std::runtime_error("Failed to create descriptor pool");
 		}
 
-		// Create the memory backing up the buffer handle
-		VkMemoryRequirements memReqs;
-		VkMemoryAllocateInfo memAlloc = MemoryAllocateInfo();
-		vkGetBufferMemoryRequirements(device, *buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		// Find a memory type index that fits the properties of the buffer
-		memAlloc.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags, physical_device);
-		// If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
-		VkMemoryAllocateFlagsInfoKHR allocFlagsInfo{};
-		if (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-			allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
-			allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-			memAlloc.pNext = &allocFlagsInfo;
-		}
-		if (vkAllocateMemory(device, &memAlloc, nullptr, memory) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create descriptor pool");
-		}
+		// Sub-allocated and persistently mapped when host visible
+		MemoryAllocator* allocator = MemoryAllocator::Get(device);
+		MemoryAllocator::Tag tag(usageFlags == VK_BUFFER_USAGE_TRANSFER_SRC_BIT ? MemoryCategory::Staging : MemoryAllocator::Tag::Category());
+		allocator->BindBuffer(*buffer, memoryPropertyFlags, memory);
 
-		// If a pointer to the buffer data has been passed, map the buffer and copy over the data
+		// If a pointer to the buffer data has been passed, copy it over
 		if (data != nullptr)
 		{
-			void* mapped;
-			if (vkMapMemory(device, *memory, 0, size, 0, &mapped) != VK_SUCCESS) {
-				throw std::runtime_error("Failed to create descriptor pool");
-			}
-			memcpy(mapped, data, size);
+			memcpy(vkUtilities::MapBuffer(device, *buffer), data, size);
 			// If host coherency hasn't been requested, do a manual flush to make writes visible
 			if ((memoryPropertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) == 0)
 			{
-				VkMappedMemoryRange mappedRange = MappedMemoryRange();
-				mappedRange.memory = *memory;
-				mappedRange.offset = 0;
-				mappedRange.size = size;
-				vkFlushMappedMemoryRanges(device, 1, &mappedRange);
+				allocator->Flush(*buffer, 0, size);
 			}
-			vkUnmapMemory(device, *memory);
-		}
-
-		// Attach the memory to the buffer object
-		if (vkBindBufferMemory(device, *buffer, *memory, 0) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to create descriptor pool");
 		}
 
 		return VK_SUCCESS;
@@ -763,30 +739,18 @@ namespace Diffuse {
 
 		}
 
-		// Create the memory backing up the buffer handle
+		// Sub-allocated and bound by the device's allocator
 		VkMemoryRequirements memReqs;
-		VkMemoryAllocateInfo memAlloc = MemoryAllocateInfo();
 		vkGetBufferMemoryRequirements(device, buffer->buffer, &memReqs);
-		memAlloc.allocationSize = memReqs.size;
-		// Find a memory type index that fits the properties of the buffer
-		memAlloc.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, memoryPropertyFlags, physical_device);
-		// If the buffer has VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT set we also need to enable the appropriate flag during allocation
-		VkMemoryAllocateFlagsInfoKHR allocFlagsInfo{};
-		if (usageFlags & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) {
-			allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO_KHR;
-			allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT_KHR;
-			memAlloc.pNext = &allocFlagsInfo;
-		}
-		if (vkAllocateMemory(device, &memAlloc, nullptr, &buffer->memory) != VK_SUCCESS) {
-
-		}
+		MemoryAllocator::Tag tag(usageFlags == VK_BUFFER_USAGE_TRANSFER_SRC_BIT ? MemoryCategory::Staging : MemoryAllocator::Tag::Category());
+		MemoryAllocator::Get(device)->BindBuffer(buffer->buffer, memoryPropertyFlags, &buffer->memory);
 
 		buffer->alignment = memReqs.alignment;
 		buffer->size = size;
 		buffer->usageFlags = usageFlags;
 		buffer->memoryPropertyFlags = memoryPropertyFlags;
 
-		// If a pointer to the buffer data has been passed, map the buffer and copy over the data
+		// If a pointer to the buffer data has been passed, copy it over
 		if (data != nullptr)
 		{
 			if (buffer->Map() != VK_SUCCESS) {
@@ -802,7 +766,6 @@ namespace Diffuse {
 		// Initialize a default descriptor that covers the whole buffer size
 		buffer->SetupDescriptor();
 
-		// Attach the memory to the buffer object
-		return buffer->Bind();
+		return VK_SUCCESS;
 	}
 }
\ No newline at end of file
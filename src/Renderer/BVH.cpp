@@ -0,0 +1,418 @@
+#include "BVH.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cfloat>
+#include <cmath>
+
+namespace Diffuse {
+	namespace {
+		constexpr uint32_t s_bin_count = 16;
+		constexpr uint32_t s_max_leaf_size = 8;
+		constexpr uint32_t s_max_depth = 64;
+		constexpr uint32_t s_invalid = UINT32_MAX;
+
+		float HalfArea(const glm::vec3& min, const glm::vec3& max) {
+			glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+			return d.x * d.y + d.y * d.z + d.z * d.x;
+		}
+
+		float HalfArea(const BoundingBox& box) {
+			return box.valid ? HalfArea(box.min, box.max) : 0.0f;
+		}
+
+		bool Overlaps(const glm::vec3& min_a, const glm::vec3& max_a, const glm::vec3& min_b, const glm::vec3& max_b) {
+			return min_a.x <= max_b.x && max_a.x >= min_b.x && min_a.y <= max_b.y && max_a.y >= min_b.y && min_a.z <= max_b.z && max_a.z >= min_b.z;
+		}
+
+		// Slab test, returns the entry distance or a negative value when the ray misses within max_distance
+		float IntersectRay(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin, const glm::vec3& inv_direction, float max_distance) {
+			glm::vec3 t0 = (min - origin) * inv_direction;
+			glm::vec3 t1 = (max - origin) * inv_direction;
+			glm::vec3 t_near = glm::min(t0, t1);
+			glm::vec3 t_far = glm::max(t0, t1);
+			float enter = std::max(std::max(t_near.x, t_near.y), std::max(t_near.z, 0.0f));
+			float exit = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, max_distance));
+			return enter <= exit ? enter : -1.0f;
+		}
+	}
+
+	uint32_t BVH::Add(const BoundingBox& box) {
+		m_boxes.push_back(box);
+		m_is_dirty.push_back(0);
+		m_needs_build = true;
+		return static_cast<uint32_t>(m_boxes.size() - 1);
+	}
+
+	void BVH::Clear() {
+		m_boxes.clear();
+		m_centers.clear();
+		m_order.clear();
+		m_nodes.clear();
+		m_right.clear();
+		m_parent.clear();
+		m_item_leaf.clear();
+		m_dirty.clear();
+		m_is_dirty.clear();
+		m_needs_build = false;
+		m_cost = 0.0f;
+		m_built_cost = 0.0f;
+	}
+
+	void BVH::Update(uint32_t id, const BoundingBox& box) {
+		BoundingBox& current = m_boxes[id];
+		if (current.valid == box.valid && current.min == box.min && current.max == box.max)
+			return;
+		current = box;
+		if (!m_is_dirty[id]) {
+			m_is_dirty[id] = 1;
+			m_dirty.push_back(id);
+		}
+	}
+
+	void BVH::Refit() {
+		if (m_needs_build) {
+			Build();
+			return;
+		}
+		for (uint32_t id : m_dirty) {
+			m_is_dirty[id] = 0;
+			// Ancestors only change while the child's bounds do
+			for (uint32_t node = m_item_leaf[id]; node != s_invalid; node = m_parent[node]) {
+				Node before = m_nodes[node];
+				m_cost -= NodeCost(node);
+				ComputeBounds(node);
+				m_cost += NodeCost(node);
+				if (before.min == m_nodes[node].min && before.max == m_nodes[node].max)
+					break;
+			}
+		}
+		m_dirty.clear();
+
+		if (m_cost > 2.0f * m_built_cost) {
+			Build();
+		}
+	}
+
+	void BVH::Build() {
+		m_needs_build = false;
+		for (uint32_t id : m_dirty) {
+			m_is_dirty[id] = 0;
+		}
+		m_dirty.clear();
+		m_nodes.clear();
+		m_right.clear();
+		m_parent.clear();
+
+		const uint32_t count = static_cast<uint32_t>(m_boxes.size());
+		m_order.resize(count);
+		m_centers.resize(count);
+		m_item_leaf.assign(count, s_invalid);
+		for (uint32_t i = 0; i < count; i++) {
+			m_order[i] = i;
+			// Items without geometry sit at the origin, they are never drawn anyway
+			m_centers[i] = m_boxes[i].valid ? m_boxes[i].Center() : glm::vec3(0.0f);
+		}
+		m_cost = 0.0f;
+		m_built_cost = 0.0f;
+		m_builds++;
+		if (count == 0)
+			return;
+
+		m_nodes.reserve(2 * count);
+		m_right.reserve(2 * count);
+		m_parent.reserve(2 * count);
+		m_nodes.push_back({ glm::vec3(0.0f), 0, glm::vec3(0.0f), count });
+		m_right.push_back(0);
+		m_parent.push_back(s_invalid);
+		Subdivide(0, 0);
+		m_built_cost = m_cost;
+	}
+
+	void BVH::Subdivide(uint32_t node, uint32_t depth) {
+		ComputeBounds(node);
+		const uint32_t first = m_nodes[node].first;
+		const uint32_t count = m_nodes[node].count;
+
+		auto make_leaf = [&]() {
+			for (uint32_t i = first; i < first + count; i++) {
+				m_item_leaf[m_order[i]] = node;
+			}
+			m_cost += NodeCost(node);
+		};
+		if (count <= 2 || depth >= s_max_depth) {
+			make_leaf();
+			return;
+		}
+
+		glm::vec3 centroid_min(FLT_MAX), centroid_max(-FLT_MAX);
+		for (uint32_t i = first; i < first + count; i++) {
+			centroid_min = glm::min(centroid_min, m_centers[m_order[i]]);
+			centroid_max = glm::max(centroid_max, m_centers[m_order[i]]);
+		}
+
+		// Bin the centroids along every axis and take the cheapest split plane
+		float best_cost = FLT_MAX;
+		int best_axis = -1;
+		uint32_t best_split = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float extent = centroid_max[axis] - centroid_min[axis];
+			if (extent <= 0.0f)
+				continue;
+			struct Bin {
+				BoundingBox box;
+				uint32_t count = 0;
+			};
+			std::array<Bin, s_bin_count> bins;
+			float scale = s_bin_count / extent;
+			for (uint32_t i = first; i < first + count; i++) {
+				uint32_t item = m_order[i];
+				uint32_t bin = std::min(static_cast<uint32_t>((m_centers[item][axis] - centroid_min[axis]) * scale), s_bin_count - 1);
+				bins[bin].count++;
+				if (m_boxes[item].valid) {
+					bins[bin].box.Expand(m_boxes[item].min);
+					bins[bin].box.Expand(m_boxes[item].max);
+				}
+			}
+
+			std::array<float, s_bin_count - 1> left_area, right_area;
+			std::array<uint32_t, s_bin_count - 1> left_count, right_count;
+			BoundingBox left_box, right_box;
+			uint32_t left_sum = 0, right_sum = 0;
+			for (uint32_t i = 0; i < s_bin_count - 1; i++) {
+				left_sum += bins[i].count;
+				left_count[i] = left_sum;
+				if (bins[i].box.valid) {
+					left_box.Expand(bins[i].box.min);
+					left_box.Expand(bins[i].box.max);
+				}
+				left_area[i] = HalfArea(left_box);
+
+				uint32_t r = s_bin_count - 1 - i;
+				right_sum += bins[r].count;
+				right_count[r - 1] = right_sum;
+				if (bins[r].box.valid) {
+					right_box.Expand(bins[r].box.min);
+					right_box.Expand(bins[r].box.max);
+				}
+				right_area[r - 1] = HalfArea(right_box);
+			}
+			for (uint32_t i = 0; i < s_bin_count - 1; i++) {
+				if (left_count[i] == 0 || right_count[i] == 0)
+					continue;
+				float cost = left_count[i] * left_area[i] + right_count[i] * right_area[i];
+				if (cost < best_cost) {
+					best_cost = cost;
+					best_axis = axis;
+					best_split = i + 1;
+				}
+			}
+		}
+
+		// Splitting has to beat testing every item of a leaf, unless the leaf would get too large
+		const float leaf_cost = count * HalfArea(m_nodes[node].min, m_nodes[node].max);
+		uint32_t middle = 0;
+		if (best_axis >= 0 && (best_cost + HalfArea(m_nodes[node].min, m_nodes[node].max) < leaf_cost || count > s_max_leaf_size)) {
+			const float scale = s_bin_count / (centroid_max[best_axis] - centroid_min[best_axis]);
+			auto split = std::partition(m_order.begin() + first, m_order.begin() + first + count, [&](uint32_t item) {
+				uint32_t bin = std::min(static_cast<uint32_t>((m_centers[item][best_axis] - centroid_min[best_axis]) * scale), s_bin_count - 1);
+				return bin < best_split;
+			});
+			middle = static_cast<uint32_t>(split - m_order.begin()) - first;
+		}
+		else if (count > s_max_leaf_size) {
+			// All centroids coincide, halve the range
+			middle = count / 2;
+		}
+		if (middle == 0 || middle == count) {
+			make_leaf();
+			return;
+		}
+
+		m_cost += HalfArea(m_nodes[node].min, m_nodes[node].max);
+		uint32_t left = static_cast<uint32_t>(m_nodes.size());
+		m_nodes.push_back({ glm::vec3(0.0f), first, glm::vec3(0.0f), middle });
+		m_right.push_back(0);
+		m_parent.push_back(node);
+		Subdivide(left, depth + 1);
+
+		uint32_t right = static_cast<uint32_t>(m_nodes.size());
+		m_nodes.push_back({ glm::vec3(0.0f), first + middle, glm::vec3(0.0f), count - middle });
+		m_right.push_back(0);
+		m_parent.push_back(node);
+		m_right[node] = right;
+		Subdivide(right, depth + 1);
+	}
+
+	void BVH::ComputeBounds(uint32_t node) {
+		Node& n = m_nodes[node];
+		BoundingBox box;
+		if (IsLeaf(node)) {
+			for (uint32_t i = n.first; i < n.first + n.count; i++) {
+				const BoundingBox& item = m_boxes[m_order[i]];
+				if (item.valid) {
+					box.Expand(item.min);
+					box.Expand(item.max);
+				}
+			}
+		}
+		else {
+			const Node& left = m_nodes[node + 1];
+			const Node& right = m_nodes[m_right[node]];
+			box.Expand(left.min);
+			box.Expand(left.max);
+			box.Expand(right.min);
+			box.Expand(right.max);
+		}
+		// Nodes of items without geometry collapse to the origin
+		n.min = box.valid ? box.min : glm::vec3(0.0f);
+		n.max = box.valid ? box.max : glm::vec3(0.0f);
+	}
+
+	float BVH::NodeCost(uint32_t node) const {
+		const Node& n = m_nodes[node];
+		return HalfArea(n.min, n.max) * (IsLeaf(node) ? static_cast<float>(n.count) : 1.0f);
+	}
+
+	uint32_t BVH::QueryFrustum(const glm::vec4* planes, std::vector<uint32_t>& items) const {
+		if (m_nodes.empty())
+			return 0;
+
+		// Planes a node lies entirely inside of are not tested again below it
+		struct Entry {
+			uint32_t node;
+			uint32_t planes;
+		};
+		Entry stack[s_max_depth * 2 + 2];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = { 0, 0x3f };
+		uint32_t visited = 0;
+
+		while (stack_size > 0) {
+			Entry entry = stack[--stack_size];
+			const Node& node = m_nodes[entry.node];
+			visited++;
+
+			glm::vec3 center = (node.min + node.max) * 0.5f;
+			glm::vec3 extent = (node.max - node.min) * 0.5f;
+			bool outside = false;
+			uint32_t mask = entry.planes;
+			for (uint32_t p = 0; p < 6 && !outside; p++) {
+				if (!(mask & (1u << p)))
+					continue;
+				float distance = glm::dot(glm::vec3(planes[p]), center) + planes[p].w;
+				float radius = glm::dot(glm::abs(glm::vec3(planes[p])), extent);
+				if (distance + radius < 0.0f)
+					outside = true;
+				else if (distance - radius >= 0.0f)
+					mask &= ~(1u << p);
+			}
+			if (outside)
+				continue;
+
+			if (mask == 0) {
+				items.insert(items.end(), m_order.begin() + node.first, m_order.begin() + node.first + node.count);
+			}
+			else if (IsLeaf(entry.node)) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					const BoundingBox& box = m_boxes[m_order[i]];
+					if (!box.valid)
+						continue;
+					glm::vec3 item_center = box.Center();
+					glm::vec3 item_extent = box.Extent();
+					bool inside = true;
+					for (uint32_t p = 0; p < 6 && inside; p++) {
+						if (mask & (1u << p))
+							inside = glm::dot(glm::vec3(planes[p]), item_center) + planes[p].w + glm::dot(glm::abs(glm::vec3(planes[p])), item_extent) >= 0.0f;
+					}
+					if (inside)
+						items.push_back(m_order[i]);
+				}
+			}
+			else {
+				stack[stack_size++] = { m_right[entry.node], mask };
+				stack[stack_size++] = { entry.node + 1, mask };
+			}
+		}
+		return visited;
+	}
+
+	void BVH::QueryBox(const BoundingBox& box, std::vector<uint32_t>& items) const {
+		if (m_nodes.empty() || !box.valid)
+			return;
+
+		uint32_t stack[s_max_depth * 2 + 2];
+		uint32_t stack_size = 0;
+		stack[stack_size++] = 0;
+		while (stack_size > 0) {
+			uint32_t index = stack[--stack_size];
+			const Node& node = m_nodes[index];
+			if (!Overlaps(node.min, node.max, box.min, box.max))
+				continue;
+			if (IsLeaf(index)) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					const BoundingBox& item = m_boxes[m_order[i]];
+					if (item.valid && Overlaps(item.min, item.max, box.min, box.max))
+						items.push_back(m_order[i]);
+				}
+			}
+			else {
+				stack[stack_size++] = m_right[index];
+				stack[stack_size++] = index + 1;
+			}
+		}
+	}
+
+	bool BVH::Raycast(const glm::vec3& origin, const glm::vec3& direction, float max_distance, uint32_t& item, float& distance) const {
+		if (m_nodes.empty())
+			return false;
+
+		const glm::vec3 inv_direction = 1.0f / direction;
+		float closest = max_distance;
+		bool hit = false;
+
+		// Nearer children are visited first, so farther subtrees are mostly pruned by the closest hit so far
+		uint32_t stack[s_max_depth * 2 + 2];
+		uint32_t stack_size = 0;
+		if (IntersectRay(m_nodes[0].min, m_nodes[0].max, origin, inv_direction, closest) >= 0.0f)
+			stack[stack_size++] = 0;
+		while (stack_size > 0) {
+			uint32_t index = stack[--stack_size];
+			const Node& node = m_nodes[index];
+			if (IntersectRay(node.min, node.max, origin, inv_direction, closest) < 0.0f)
+				continue;
+			if (IsLeaf(index)) {
+				for (uint32_t i = node.first; i < node.first + node.count; i++) {
+					const BoundingBox& box = m_boxes[m_order[i]];
+					if (!box.valid)
+						continue;
+					float t = IntersectRay(box.min, box.max, origin, inv_direction, closest);
+					if (t >= 0.0f && t <= closest) {
+						closest = t;
+						item = m_order[i];
+						hit = true;
+					}
+				}
+			}
+			else {
+				uint32_t left = index + 1;
+				uint32_t right = m_right[index];
+				float t_left = IntersectRay(m_nodes[left].min, m_nodes[left].max, origin, inv_direction, closest);
+				float t_right = IntersectRay(m_nodes[right].min, m_nodes[right].max, origin, inv_direction, closest);
+				if (t_left >= 0.0f && t_right >= 0.0f) {
+					stack[stack_size++] = t_left < t_right ? right : left;
+					stack[stack_size++] = t_left < t_right ? left : right;
+				}
+				else if (t_left >= 0.0f) {
+					stack[stack_size++] = left;
+				}
+				else if (t_right >= 0.0f) {
+					stack[stack_size++] = right;
+				}
+			}
+		}
+		if (hit)
+			distance = closest;
+		return hit;
+	}
+}
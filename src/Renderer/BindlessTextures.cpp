@@ -0,0 +1,88 @@
+#include "BindlessTextures.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	BindlessTextures::BindlessTextures(GraphicsDevice* device, uint32_t frame_count, uint32_t capacity)
+		:m_device(device), m_capacity(capacity) {
+		VkDescriptorSetLayoutBinding binding{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, capacity, VK_SHADER_STAGE_FRAGMENT_BIT, nullptr };
+		const VkDescriptorBindingFlags binding_flags = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+			VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT;
+		VkDescriptorSetLayoutBindingFlagsCreateInfo binding_flags_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO };
+		binding_flags_info.bindingCount = 1;
+		binding_flags_info.pBindingFlags = &binding_flags;
+		VkDescriptorSetLayoutCreateInfo set_layout_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+		set_layout_info.pNext = &binding_flags_info;
+		set_layout_info.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+		set_layout_info.bindingCount = 1;
+		set_layout_info.pBindings = &binding;
+		m_set_layout = device->GetObjectCache()->GetDescriptorSetLayout(set_layout_info);
+
+		VkDescriptorPoolSize pool_size{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, capacity * frame_count };
+		VkDescriptorPoolCreateInfo pool_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+		pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+		pool_info.maxSets = frame_count;
+		pool_info.poolSizeCount = 1;
+		pool_info.pPoolSizes = &pool_size;
+		if (vkCreateDescriptorPool(device->Device(), &pool_info, nullptr, &m_descriptor_pool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create bindless texture descriptor pool");
+		}
+
+		std::vector<VkDescriptorSetLayout> layouts(frame_count, m_set_layout);
+		std::vector<uint32_t> counts(frame_count, capacity);
+		VkDescriptorSetVariableDescriptorCountAllocateInfo count_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO };
+		count_info.descriptorSetCount = frame_count;
+		count_info.pDescriptorCounts = counts.data();
+		VkDescriptorSetAllocateInfo alloc_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		alloc_info.pNext = &count_info;
+		alloc_info.descriptorPool = m_descriptor_pool;
+		alloc_info.descriptorSetCount = frame_count;
+		alloc_info.pSetLayouts = layouts.data();
+		m_descriptor_sets.resize(frame_count);
+		if (vkAllocateDescriptorSets(device->Device(), &alloc_info, m_descriptor_sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate bindless texture descriptor sets");
+		}
+	}
+
+	uint32_t BindlessTextures::Add(Texture2D* texture) {
+		auto it = m_indices.find(texture);
+		if (it != m_indices.end())
+			return it->second;
+		if (m_textures.size() == m_capacity) {
+			throw std::runtime_error("Bindless texture array is full");
+		}
+
+		const uint32_t index = static_cast<uint32_t>(m_textures.size());
+		m_textures.push_back(texture);
+		m_indices[texture] = index;
+
+		// No submitted draw reads the new element yet, so every copy can be written now
+		std::vector<VkWriteDescriptorSet> writes(m_descriptor_sets.size());
+		for (uint32_t frame = 0; frame < m_descriptor_sets.size(); frame++) {
+			writes[frame] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			writes[frame].dstSet = m_descriptor_sets[frame];
+			writes[frame].dstBinding = 0;
+			writes[frame].dstArrayElement = index;
+			writes[frame].descriptorCount = 1;
+			writes[frame].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[frame].pImageInfo = &texture->m_descriptor;
+			if (TextureStreamer* streamer = m_device->GetTextureStreamer()) {
+				streamer->RegisterDescriptor(texture, m_descriptor_sets[frame], 0, frame, index, true);
+			}
+		}
+		vkUpdateDescriptorSets(m_device->Device(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+		return index;
+	}
+
+	void BindlessTextures::CleanUp() {
+		std::cout << "Bindless textures: " << m_textures.size() << " of " << m_capacity << " elements" << std::endl;
+		vkDestroyDescriptorPool(m_device->Device(), m_descriptor_pool, nullptr);
+		m_descriptor_pool = VK_NULL_HANDLE;
+		m_descriptor_sets.clear();
+		m_textures.clear();
+		m_indices.clear();
+	}
+}
@@ -0,0 +1,185 @@
+#include "DepthPyramid.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace Diffuse {
+	namespace {
+		constexpr uint32_t s_group_size = 8;     // local_size_x and local_size_y of depth_reduce.comp
+		constexpr uint32_t s_max_levels = 16;    // Enough for a 32768 texel wide depth buffer
+
+		struct ReducePushConstants {
+			int32_t input_width, input_height;
+			int32_t output_width, output_height;
+		};
+
+		uint32_t PreviousPowerOfTwo(uint32_t value) {
+			uint32_t result = 1;
+			while (result * 2 <= value) {
+				result *= 2;
+			}
+			return result;
+		}
+	}
+
+	DepthPyramid::DepthPyramid(GraphicsDevice* device)
+		:m_device(device) {
+		std::vector<VkDescriptorSetLayoutBinding> bindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		};
+		VkDescriptorSetLayoutCreateInfo set_layout_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+		set_layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+		set_layout_info.pBindings = bindings.data();
+		m_set_layout = device->GetObjectCache()->GetDescriptorSetLayout(set_layout_info);
+
+		VkPushConstantRange push_constant_range{ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ReducePushConstants) };
+		VkPipelineLayoutCreateInfo pipeline_layout_info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &m_set_layout;
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+		m_pipeline_layout = device->GetObjectCache()->GetPipelineLayout(pipeline_layout_info);
+
+		VkComputePipelineCreateInfo pipeline_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+		pipeline_info.layout = m_pipeline_layout;
+		device->GetPipelineCompiler()->Compile(pipeline_info, { VK_SHADER_STAGE_COMPUTE_BIT, "../shaders/culling/depth_reduce_comp.spv" }, &m_pipeline);
+
+		// Levels are read with texelFetch, the sampler only has to exist
+		VkSamplerCreateInfo sampler_info{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+		sampler_info.magFilter = VK_FILTER_NEAREST;
+		sampler_info.minFilter = VK_FILTER_NEAREST;
+		sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+		sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.maxLod = static_cast<float>(s_max_levels);
+		m_sampler = device->GetObjectCache()->GetSampler(sampler_info);
+
+		VkDescriptorPoolSize pool_sizes[] = {
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, s_max_levels },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, s_max_levels },
+		};
+		VkDescriptorPoolCreateInfo pool_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+		pool_info.maxSets = s_max_levels;
+		pool_info.poolSizeCount = 2;
+		pool_info.pPoolSizes = pool_sizes;
+		if (vkCreateDescriptorPool(device->Device(), &pool_info, nullptr, &m_descriptor_pool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create depth pyramid descriptor pool");
+		}
+	}
+
+	void DepthPyramid::Resize(VkImageView depth_view, uint32_t width, uint32_t height) {
+		DestroyImage();
+		VkDevice device = m_device->Device();
+		m_depth_width = width;
+		m_depth_height = height;
+		m_width = PreviousPowerOfTwo(width);
+		m_height = PreviousPowerOfTwo(height);
+		uint32_t level_count = 1;
+		while ((std::max(m_width, m_height) >> level_count) > 0) {
+			level_count++;
+		}
+		level_count = std::min(level_count, s_max_levels);
+
+		{
+			MemoryAllocator::Tag tag(MemoryCategory::Attachment, "depth pyramid");
+			vkUtilities::CreateImage(m_width, m_height, device, m_device->PhysicalDevice(), VK_FORMAT_R32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+				VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_image, m_memory, 1, level_count);
+		}
+		m_view = vkUtilities::CreateImageView(m_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, device, 1, 0, level_count);
+
+		vkResetDescriptorPool(device, m_descriptor_pool, 0);
+		std::vector<VkDescriptorSetLayout> set_layouts(level_count, m_set_layout);
+		std::vector<VkDescriptorSet> sets(level_count);
+		VkDescriptorSetAllocateInfo allocate_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		allocate_info.descriptorPool = m_descriptor_pool;
+		allocate_info.descriptorSetCount = level_count;
+		allocate_info.pSetLayouts = set_layouts.data();
+		if (vkAllocateDescriptorSets(device, &allocate_info, sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate depth pyramid descriptor sets");
+		}
+
+		m_levels.resize(level_count);
+		for (uint32_t i = 0; i < level_count; i++) {
+			Level& level = m_levels[i];
+			level.view = vkUtilities::CreateImageView(m_image, VK_FORMAT_R32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, device, 1, i, 1);
+			level.descriptor_set = sets[i];
+			level.width = std::max(m_width >> i, 1u);
+			level.height = std::max(m_height >> i, 1u);
+
+			VkDescriptorImageInfo input = i == 0 ? VkDescriptorImageInfo{ m_sampler, depth_view, VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL }
+				: VkDescriptorImageInfo{ m_sampler, m_levels[i - 1].view, VK_IMAGE_LAYOUT_GENERAL };
+			VkDescriptorImageInfo output{ VK_NULL_HANDLE, level.view, VK_IMAGE_LAYOUT_GENERAL };
+			VkWriteDescriptorSet writes[2] = { { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET }, { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET } };
+			writes[0].dstSet = level.descriptor_set;
+			writes[0].dstBinding = 0;
+			writes[0].descriptorCount = 1;
+			writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[0].pImageInfo = &input;
+			writes[1].dstSet = level.descriptor_set;
+			writes[1].dstBinding = 1;
+			writes[1].descriptorCount = 1;
+			writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[1].pImageInfo = &output;
+			vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+		}
+	}
+
+	void DepthPyramid::Build(VkCommandBuffer command_buffer) {
+		if (m_levels.empty())
+			return;
+
+		VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.image = m_image;
+
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+		uint32_t input_width = m_depth_width, input_height = m_depth_height;
+		for (uint32_t i = 0; i < m_levels.size(); i++) {
+			const Level& level = m_levels[i];
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout, 0, 1, &level.descriptor_set, 0, nullptr);
+			ReducePushConstants push_constants{ (int32_t)input_width, (int32_t)input_height, (int32_t)level.width, (int32_t)level.height };
+			vkCmdPushConstants(command_buffer, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+			vkCmdDispatch(command_buffer, (level.width + s_group_size - 1) / s_group_size, (level.height + s_group_size - 1) / s_group_size, 1);
+
+			input_width = level.width;
+			input_height = level.height;
+			if (i + 1 == m_levels.size())
+				break;
+
+			// The next level reads this one
+			barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, i, 1, 0, 1 };
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+	}
+
+	void DepthPyramid::CleanUp() {
+		DestroyImage();
+		vkDestroyPipeline(m_device->Device(), m_pipeline, nullptr);
+		vkDestroyDescriptorPool(m_device->Device(), m_descriptor_pool, nullptr);
+		m_pipeline = VK_NULL_HANDLE;
+		m_descriptor_pool = VK_NULL_HANDLE;
+	}
+
+	void DepthPyramid::DestroyImage() {
+		VkDevice device = m_device->Device();
+		for (Level& level : m_levels) {
+			vkDestroyImageView(device, level.view, nullptr);
+		}
+		m_levels.clear();
+		if (m_view != VK_NULL_HANDLE) {
+			vkDestroyImageView(device, m_view, nullptr);
+			vkUtilities::DestroyImage(device, m_image);
+			m_view = VK_NULL_HANDLE;
+			m_image = VK_NULL_HANDLE;
+		}
+	}
+}
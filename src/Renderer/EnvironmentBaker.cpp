@@ -0,0 +1,490 @@
+#include "EnvironmentBaker.hpp"
+
+#include "GraphicsDevice.hpp"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	namespace {
+		constexpr uint32_t s_equirect_group_size = 32;    // local_size_x and local_size_y of equirect2cube_cs.comp
+		constexpr uint32_t s_filter_group_size = 8;       // Of irradiance_cube.comp and prefilter_cube.comp
+		constexpr uint32_t s_irradiance_size = 32;
+		constexpr uint32_t s_prefilter_samples = 16;
+		constexpr float s_pi = 3.14159265358979f;
+
+		// Both fill the push constant range of the shared pipeline layout
+		struct IrradiancePushConstants {
+			float delta_phi;
+			float delta_theta;
+		};
+		struct PrefilterPushConstants {
+			float roughness;
+			uint32_t samples;
+		};
+
+		uint32_t MipCount(uint32_t size) {
+			return static_cast<uint32_t>(std::floor(std::log2(size))) + 1;
+		}
+	}
+
+	EnvironmentBaker::EnvironmentBaker(GraphicsDevice* device, VkQueue compute_queue, uint32_t compute_family, VkQueue graphics_queue, uint32_t graphics_family, uint32_t size)
+		:m_device(device), m_queue(compute_queue), m_compute_family(compute_family), m_graphics_queue(graphics_queue), m_graphics_family(graphics_family), m_size(size) {
+		std::vector<VkDescriptorSetLayoutBinding> bindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		};
+		VkDescriptorSetLayoutCreateInfo set_layout_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+		set_layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+		set_layout_info.pBindings = bindings.data();
+		m_set_layout = device->GetObjectCache()->GetDescriptorSetLayout(set_layout_info);
+
+		VkPushConstantRange push_constant_range{ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(IrradiancePushConstants) };
+		VkPipelineLayoutCreateInfo pipeline_layout_info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &m_set_layout;
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+		m_pipeline_layout = device->GetObjectCache()->GetPipelineLayout(pipeline_layout_info);
+
+		VkComputePipelineCreateInfo pipeline_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+		pipeline_info.layout = m_pipeline_layout;
+		m_tickets.push_back(device->GetPipelineCompiler()->Compile(pipeline_info, { VK_SHADER_STAGE_COMPUTE_BIT, "../shaders/pbr_ibl/equirect_to_cube_cs.spv" }, &m_equirect_pipeline));
+		m_tickets.push_back(device->GetPipelineCompiler()->Compile(pipeline_info, { VK_SHADER_STAGE_COMPUTE_BIT, "../shaders/pbr_ibl/irradiance_cube_comp.spv" }, &m_irradiance_pipeline));
+		m_tickets.push_back(device->GetPipelineCompiler()->Compile(pipeline_info, { VK_SHADER_STAGE_COMPUTE_BIT, "../shaders/pbr_ibl/prefilter_cube_comp.spv" }, &m_prefilter_pipeline));
+
+		// Linear, non-anisotropic sampler, wrap address mode
+		VkSamplerCreateInfo sampler_info{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+		sampler_info.minFilter = VK_FILTER_LINEAR;
+		sampler_info.magFilter = VK_FILTER_LINEAR;
+		sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK;
+		m_sampler = device->GetObjectCache()->GetSampler(sampler_info);
+
+		// Bakes are recorded on the family they are submitted to
+		VkCommandPoolCreateInfo pool_info{};
+		pool_info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+		pool_info.queueFamilyIndex = IsAsync() ? m_compute_family : m_graphics_family;
+		if (vkCreateCommandPool(device->Device(), &pool_info, nullptr, &m_command_pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create environment command pool!");
+		}
+
+		if (!IsAsync()) {
+			std::cout << "Environment bakes: no separate compute queue, baking on the graphics queue" << std::endl;
+			return;
+		}
+
+		VkSemaphoreTypeCreateInfo type_info{};
+		type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+		type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+		type_info.initialValue = 0;
+		VkSemaphoreCreateInfo semaphore_info{};
+		semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+		semaphore_info.pNext = &type_info;
+		if (vkCreateSemaphore(device->Device(), &semaphore_info, nullptr, &m_timeline) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create environment timeline semaphore!");
+		}
+		std::cout << "Environment bakes: compute queue family " << m_compute_family << std::endl;
+	}
+
+	void EnvironmentBaker::Bake(const std::string& path) {
+		auto start = std::chrono::high_resolution_clock::now();
+		VkDevice device = m_device->Device();
+		for (auto& ticket : m_tickets) {
+			ticket.get();
+		}
+		m_tickets.clear();
+
+		int width, height, channels;
+		float* pixels = stbi_loadf(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+		if (!pixels) {
+			throw std::runtime_error("failed to load environment " + path + "!");
+		}
+		VkDeviceSize image_size = static_cast<VkDeviceSize>(width) * height * 4 * sizeof(float);
+
+		Job job;
+		job.environment.path = path;
+		{
+			MemoryAllocator::Tag tag(MemoryCategory::Staging, path);
+			vkUtilities::CreateBuffer(image_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				job.staging_buffer, job.staging_memory, m_device->PhysicalDevice(), device);
+		}
+		std::memcpy(vkUtilities::MapBuffer(device, job.staging_buffer), pixels, image_size);
+		stbi_image_free(pixels);
+
+		{
+			MemoryAllocator::Tag tag(MemoryCategory::IBL, path);
+			vkUtilities::CreateImage(width, height, device, m_device->PhysicalDevice(), VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+				VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, job.equirect, job.equirect_memory, 1, 1);
+			job.equirect_view = vkUtilities::CreateImageView(job.equirect, VK_FORMAT_R32G32B32A32_SFLOAT, VK_IMAGE_ASPECT_COLOR_BIT, device, 1, 0, 1);
+			// The formats match the storage images of the shaders writing them
+			CreateCubemap(job.environment.environment, VK_FORMAT_R16G16B16A16_SFLOAT, m_size, 1);
+			CreateCubemap(job.environment.irradiance, VK_FORMAT_R32G32B32A32_SFLOAT, s_irradiance_size, MipCount(s_irradiance_size));
+			CreateCubemap(job.environment.prefiltered, VK_FORMAT_R16G16B16A16_SFLOAT, m_size, MipCount(m_size));
+		}
+
+		// One set per dispatch, the conversion writes the environment map and every mip level of the filtered maps is
+		// written by a dispatch sampling it
+		const Cubemap& environment = job.environment.environment;
+		const uint32_t set_count = 1 + job.environment.irradiance.mip_levels + job.environment.prefiltered.mip_levels;
+		VkDescriptorPoolSize pool_sizes[] = {
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, set_count },
+			{ VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, set_count },
+		};
+		VkDescriptorPoolCreateInfo pool_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+		pool_info.maxSets = set_count;
+		pool_info.poolSizeCount = 2;
+		pool_info.pPoolSizes = pool_sizes;
+		if (vkCreateDescriptorPool(device, &pool_info, nullptr, &job.descriptor_pool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create environment descriptor pool!");
+		}
+		std::vector<VkDescriptorSetLayout> set_layouts(set_count, m_set_layout);
+		std::vector<VkDescriptorSet> sets(set_count);
+		VkDescriptorSetAllocateInfo allocate_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		allocate_info.descriptorPool = job.descriptor_pool;
+		allocate_info.descriptorSetCount = set_count;
+		allocate_info.pSetLayouts = set_layouts.data();
+		if (vkAllocateDescriptorSets(device, &allocate_info, sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate environment descriptor sets!");
+		}
+
+		auto write_set = [device](VkDescriptorSet set, const VkDescriptorImageInfo& input, VkImageView output_view) {
+			VkDescriptorImageInfo output{ VK_NULL_HANDLE, output_view, VK_IMAGE_LAYOUT_GENERAL };
+			VkWriteDescriptorSet writes[2] = { { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET }, { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET } };
+			writes[0].dstSet = set;
+			writes[0].dstBinding = 0;
+			writes[0].descriptorCount = 1;
+			writes[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			writes[0].pImageInfo = &input;
+			writes[1].dstSet = set;
+			writes[1].dstBinding = 1;
+			writes[1].descriptorCount = 1;
+			writes[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+			writes[1].pImageInfo = &output;
+			vkUpdateDescriptorSets(device, 2, writes, 0, nullptr);
+		};
+		write_set(sets[0], { m_sampler, job.equirect_view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL }, environment.view);
+		// The environment map is sampled in the general layout it was written in
+		const VkDescriptorImageInfo environment_input{ m_sampler, environment.view, VK_IMAGE_LAYOUT_GENERAL };
+		uint32_t set_index = 1;
+		for (const Cubemap* cubemap : { &job.environment.irradiance, &job.environment.prefiltered }) {
+			for (uint32_t level = 0; level < cubemap->mip_levels; level++) {
+				VkFormat format = cubemap == &job.environment.irradiance ? VK_FORMAT_R32G32B32A32_SFLOAT : VK_FORMAT_R16G16B16A16_SFLOAT;
+				job.level_views.push_back(vkUtilities::CreateImageView(cubemap->image, format, VK_IMAGE_ASPECT_COLOR_BIT, device, 6, level, 1));
+				write_set(sets[set_index++], environment_input, job.level_views.back());
+			}
+		}
+
+		VkCommandBufferAllocateInfo command_buffer_info{};
+		command_buffer_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		command_buffer_info.commandPool = m_command_pool;
+		command_buffer_info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		command_buffer_info.commandBufferCount = 1;
+		if (vkAllocateCommandBuffers(device, &command_buffer_info, &job.command_buffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate environment command buffer!");
+		}
+		VkCommandBuffer command_buffer = job.command_buffer;
+		VkCommandBufferBeginInfo begin_info{};
+		begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		if (vkBeginCommandBuffer(command_buffer, &begin_info) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin environment command buffer!");
+		}
+
+		VkImageMemoryBarrier barrier{ VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+
+		// Staging buffer to the equirectangular image
+		barrier.image = job.equirect;
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		VkBufferImageCopy copy_region{};
+		copy_region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 };
+		copy_region.imageExtent = { static_cast<uint32_t>(width), static_cast<uint32_t>(height), 1 };
+		vkCmdCopyBufferToImage(command_buffer, job.staging_buffer, job.equirect, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy_region);
+
+		// The equirectangular image becomes readable and every cubemap writable, their previous contents are discarded
+		VkImageMemoryBarrier barriers[4] = { barrier, barrier, barrier, barrier };
+		barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barriers[0].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barriers[0].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		const Cubemap* cubemaps[3] = { &job.environment.environment, &job.environment.irradiance, &job.environment.prefiltered };
+		for (uint32_t i = 0; i < 3; i++) {
+			barriers[i + 1].image = cubemaps[i]->image;
+			barriers[i + 1].srcAccessMask = 0;
+			barriers[i + 1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barriers[i + 1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barriers[i + 1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		}
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 4, barriers);
+
+		// Equirectangular to cubemap
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_equirect_pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout, 0, 1, &sets[0], 0, nullptr);
+		vkCmdDispatch(command_buffer, m_size / s_equirect_group_size, m_size / s_equirect_group_size, 6);
+
+		barrier.image = environment.image;
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+		vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		// Both filtered maps read the environment map only, their dispatches need no barriers between them
+		set_index = 1;
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_irradiance_pipeline);
+		IrradiancePushConstants irradiance_constants{ (2.0f * s_pi) / 180.0f, (0.5f * s_pi) / 64.0f };
+		vkCmdPushConstants(command_buffer, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(IrradiancePushConstants), &irradiance_constants);
+		for (uint32_t level = 0; level < job.environment.irradiance.mip_levels; level++) {
+			uint32_t level_size = std::max(s_irradiance_size >> level, 1u);
+			uint32_t groups = (level_size + s_filter_group_size - 1) / s_filter_group_size;
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout, 0, 1, &sets[set_index++], 0, nullptr);
+			vkCmdDispatch(command_buffer, groups, groups, 6);
+		}
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_prefilter_pipeline);
+		for (uint32_t level = 0; level < job.environment.prefiltered.mip_levels; level++) {
+			uint32_t level_size = std::max(m_size >> level, 1u);
+			uint32_t groups = (level_size + s_filter_group_size - 1) / s_filter_group_size;
+			PrefilterPushConstants prefilter_constants{ static_cast<float>(level) / static_cast<float>(job.environment.prefiltered.mip_levels - 1), s_prefilter_samples };
+			vkCmdPushConstants(command_buffer, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(PrefilterPushConstants), &prefilter_constants);
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout, 0, 1, &sets[set_index++], 0, nullptr);
+			vkCmdDispatch(command_buffer, groups, groups, 6);
+		}
+
+		RecordHandOver(command_buffer, job.environment, false);
+		if (vkEndCommandBuffer(command_buffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to record environment command buffer!");
+		}
+
+		VkSubmitInfo submit_info{};
+		submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+		submit_info.commandBufferCount = 1;
+		submit_info.pCommandBuffers = &command_buffer;
+		if (IsAsync()) {
+			job.value = ++m_value;
+			VkTimelineSemaphoreSubmitInfo timeline_info{};
+			timeline_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+			timeline_info.signalSemaphoreValueCount = 1;
+			timeline_info.pSignalSemaphoreValues = &job.value;
+			submit_info.pNext = &timeline_info;
+			submit_info.signalSemaphoreCount = 1;
+			submit_info.pSignalSemaphores = &m_timeline;
+			if (vkQueueSubmit(m_queue, 1, &submit_info, VK_NULL_HANDLE) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit environment command buffer!");
+			}
+		}
+		else {
+			VkFenceCreateInfo fence_info{};
+			fence_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+			if (vkCreateFence(device, &fence_info, nullptr, &job.fence) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create environment fence!");
+			}
+			if (vkQueueSubmit(m_graphics_queue, 1, &submit_info, job.fence) != VK_SUCCESS) {
+				throw std::runtime_error("failed to submit environment command buffer!");
+			}
+		}
+
+		m_jobs.push_back(std::move(job));
+		m_stats.bakes++;
+		m_stats.load_ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	}
+
+	void EnvironmentBaker::Wait() const {
+		if (m_jobs.empty())
+			return;
+
+		const Job& job = m_jobs.back();
+		if (!IsAsync()) {
+			vkWaitForFences(m_device->Device(), 1, &job.fence, VK_TRUE, UINT64_MAX);
+			return;
+		}
+		VkSemaphoreWaitInfo wait_info{};
+		wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+		wait_info.semaphoreCount = 1;
+		wait_info.pSemaphores = &m_timeline;
+		wait_info.pValues = &job.value;
+		vkWaitSemaphores(m_device->Device(), &wait_info, UINT64_MAX);
+	}
+
+	bool EnvironmentBaker::Acquire(VkCommandBuffer graphics_command_buffer, Environment& environment) {
+		if (m_jobs.empty())
+			return false;
+
+		// The queue finishes bakes in submission order, once the last one is done every replaced one is as well
+		const bool finished = IsFinished(m_jobs.back());
+		size_t replaced = 0;
+		while (replaced < m_jobs.size() - 1 && (finished || IsFinished(m_jobs[replaced]))) {
+			ReleaseJob(m_jobs[replaced]);
+			Destroy(m_jobs[replaced].environment);
+			m_stats.discarded++;
+			replaced++;
+		}
+		m_jobs.erase(m_jobs.begin(), m_jobs.begin() + replaced);
+		if (!finished)
+			return false;
+
+		Job& job = m_jobs.back();
+		if (IsAsync()) {
+			RecordHandOver(graphics_command_buffer, job.environment, true);
+			m_wait_value = job.value;
+		}
+		environment = job.environment;
+		ReleaseJob(job);
+		m_jobs.clear();
+		return true;
+	}
+
+	bool EnvironmentBaker::GetFrameWait(VkSemaphore& semaphore, uint64_t& value, VkPipelineStageFlags& dst_stage) {
+		if (m_wait_value == 0)
+			return false;
+
+		semaphore = m_timeline;
+		value = m_wait_value;
+		dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		m_wait_value = 0;
+		return true;
+	}
+
+	void EnvironmentBaker::Destroy(Environment& environment) {
+		for (Cubemap* cubemap : { &environment.environment, &environment.irradiance, &environment.prefiltered }) {
+			if (cubemap->image == VK_NULL_HANDLE)
+				continue;
+			vkDestroyImageView(m_device->Device(), cubemap->view, nullptr);
+			vkUtilities::DestroyImage(m_device->Device(), cubemap->image);
+			*cubemap = {};
+		}
+	}
+
+	bool EnvironmentBaker::IsFinished(const Job& job) const {
+		if (!IsAsync())
+			return vkGetFenceStatus(m_device->Device(), job.fence) == VK_SUCCESS;
+
+		uint64_t value = 0;
+		vkGetSemaphoreCounterValue(m_device->Device(), m_timeline, &value);
+		return value >= job.value;
+	}
+
+	void EnvironmentBaker::CreateCubemap(Cubemap& cubemap, VkFormat format, uint32_t size, uint32_t mip_levels) {
+		VkDevice device = m_device->Device();
+		cubemap.mip_levels = mip_levels;
+		vkUtilities::CreateImage(size, size, device, m_device->PhysicalDevice(), format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cubemap.image, cubemap.memory, 6, mip_levels);
+		cubemap.view = vkUtilities::CreateImageView(cubemap.image, format, VK_IMAGE_ASPECT_COLOR_BIT, device, 6, 0, mip_levels);
+
+		VkSamplerCreateInfo sampler_info{ VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO };
+		sampler_info.magFilter = VK_FILTER_LINEAR;
+		sampler_info.minFilter = VK_FILTER_LINEAR;
+		sampler_info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		sampler_info.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+		sampler_info.maxAnisotropy = 1.0f;
+		sampler_info.minLod = 0.0f;
+		sampler_info.maxLod = static_cast<float>(mip_levels);
+		sampler_info.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		cubemap.sampler = m_device->GetObjectCache()->GetSampler(sampler_info);
+
+		cubemap.descriptor = { cubemap.sampler, cubemap.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL };
+	}
+
+	void EnvironmentBaker::ReleaseJob(Job& job) {
+		VkDevice device = m_device->Device();
+		vkFreeCommandBuffers(device, m_command_pool, 1, &job.command_buffer);
+		if (job.fence != VK_NULL_HANDLE) {
+			vkDestroyFence(device, job.fence, nullptr);
+		}
+		vkUtilities::DestroyBuffer(device, job.staging_buffer);
+		vkDestroyImageView(device, job.equirect_view, nullptr);
+		vkUtilities::DestroyImage(device, job.equirect);
+		for (VkImageView view : job.level_views) {
+			vkDestroyImageView(device, view, nullptr);
+		}
+		vkDestroyDescriptorPool(device, job.descriptor_pool, nullptr);
+		job.command_buffer = VK_NULL_HANDLE;
+		job.fence = VK_NULL_HANDLE;
+		job.staging_buffer = VK_NULL_HANDLE;
+		job.equirect = VK_NULL_HANDLE;
+		job.equirect_view = VK_NULL_HANDLE;
+		job.level_views.clear();
+		job.descriptor_pool = VK_NULL_HANDLE;
+	}
+
+	void EnvironmentBaker::RecordHandOver(VkCommandBuffer command_buffer, const Environment& environment, bool acquire) {
+		VkImageMemoryBarrier barriers[3];
+		const Cubemap* cubemaps[3] = { &environment.environment, &environment.irradiance, &environment.prefiltered };
+		for (uint32_t i = 0; i < 3; i++) {
+			barriers[i] = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER };
+			barriers[i].oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+			barriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barriers[i].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+			barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barriers[i].image = cubemaps[i]->image;
+			barriers[i].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS };
+		}
+
+		// On the graphics queue the frames submitted after the bake are ordered by this barrier alone
+		if (!IsAsync()) {
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 3, barriers);
+			return;
+		}
+
+		// Release on the compute queue, the destination access is ignored there. The acquire repeats the layout
+		// transition and is ordered after the bake by the frame's semaphore wait at the fragment shader
+		for (VkImageMemoryBarrier& barrier : barriers) {
+			barrier.srcQueueFamilyIndex = m_compute_family;
+			barrier.dstQueueFamilyIndex = m_graphics_family;
+			if (acquire) {
+				barrier.srcAccessMask = 0;
+			}
+			else {
+				barrier.dstAccessMask = 0;
+			}
+		}
+		if (acquire) {
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 3, barriers);
+		}
+		else {
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 3, barriers);
+		}
+	}
+
+	void EnvironmentBaker::CleanUp() {
+		for (auto& ticket : m_tickets) {
+			ticket.get();
+		}
+		m_tickets.clear();
+		// The device is idle
+		for (Job& job : m_jobs) {
+			ReleaseJob(job);
+			Destroy(job.environment);
+		}
+		m_jobs.clear();
+		std::cout << "Environment bakes: " << m_stats.bakes << " on the " << (IsAsync() ? "compute" : "graphics") << " queue, " << m_stats.discarded
+			<< " replaced before they were used, the last took " << m_stats.load_ms << " ms to load and record" << std::endl;
+
+		VkDevice device = m_device->Device();
+		vkDestroyPipeline(device, m_equirect_pipeline, nullptr);
+		vkDestroyPipeline(device, m_irradiance_pipeline, nullptr);
+		vkDestroyPipeline(device, m_prefilter_pipeline, nullptr);
+		vkDestroySemaphore(device, m_timeline, nullptr);
+		vkDestroyCommandPool(device, m_command_pool, nullptr);
+		m_equirect_pipeline = VK_NULL_HANDLE;
+		m_irradiance_pipeline = VK_NULL_HANDLE;
+		m_prefilter_pipeline = VK_NULL_HANDLE;
+		m_timeline = VK_NULL_HANDLE;
+		m_command_pool = VK_NULL_HANDLE;
+	}
+}
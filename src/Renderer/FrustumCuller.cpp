@@ -0,0 +1,189 @@
+#include "FrustumCuller.hpp"
+
+#include "Hash.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(_M_IX86) || defined(__i386__)
+#define DIFFUSE_CULL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define DIFFUSE_TARGET_AVX2
+#else
+#define DIFFUSE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace Diffuse {
+	namespace {
+		constexpr uint32_t s_block_size = 2048;    // Boxes per parallel job, a multiple of 8
+		constexpr float s_unbounded_extent = 1e30f;
+
+#if defined(DIFFUSE_CULL_X86)
+		// The box is outside a plane when even its corner furthest along the plane normal is behind it
+		DIFFUSE_TARGET_AVX2 void CullAVX2(const glm::vec4* planes, const float* cx, const float* cy, const float* cz,
+			const float* ex, const float* ey, const float* ez, uint8_t* visible, uint32_t first, uint32_t last) {
+			const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+			const __m256 zero = _mm256_setzero_ps();
+			for (uint32_t i = first; i < last; i += 8) {
+				__m256 center_x = _mm256_loadu_ps(cx + i), center_y = _mm256_loadu_ps(cy + i), center_z = _mm256_loadu_ps(cz + i);
+				__m256 extent_x = _mm256_loadu_ps(ex + i), extent_y = _mm256_loadu_ps(ey + i), extent_z = _mm256_loadu_ps(ez + i);
+				__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+				for (uint32_t p = 0; p < 6; p++) {
+					__m256 nx = _mm256_set1_ps(planes[p].x), ny = _mm256_set1_ps(planes[p].y), nz = _mm256_set1_ps(planes[p].z);
+					__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(center_x, nx), _mm256_mul_ps(center_y, ny)),
+						_mm256_add_ps(_mm256_mul_ps(center_z, nz), _mm256_set1_ps(planes[p].w)));
+					__m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(extent_x, _mm256_andnot_ps(sign_mask, nx)), _mm256_mul_ps(extent_y, _mm256_andnot_ps(sign_mask, ny))),
+						_mm256_mul_ps(extent_z, _mm256_andnot_ps(sign_mask, nz)));
+					inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), zero, _CMP_GE_OQ));
+				}
+				int mask = _mm256_movemask_ps(inside);
+				for (uint32_t lane = 0; lane < 8; lane++) {
+					visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+				}
+			}
+		}
+
+		void CullSSE(const glm::vec4* planes, const float* cx, const float* cy, const float* cz,
+			const float* ex, const float* ey, const float* ez, uint8_t* visible, uint32_t first, uint32_t last) {
+			const __m128 sign_mask = _mm_set1_ps(-0.0f);
+			const __m128 zero = _mm_setzero_ps();
+			for (uint32_t i = first; i < last; i += 4) {
+				__m128 center_x = _mm_loadu_ps(cx + i), center_y = _mm_loadu_ps(cy + i), center_z = _mm_loadu_ps(cz + i);
+				__m128 extent_x = _mm_loadu_ps(ex + i), extent_y = _mm_loadu_ps(ey + i), extent_z = _mm_loadu_ps(ez + i);
+				__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+				for (uint32_t p = 0; p < 6; p++) {
+					__m128 nx = _mm_set1_ps(planes[p].x), ny = _mm_set1_ps(planes[p].y), nz = _mm_set1_ps(planes[p].z);
+					__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(center_x, nx), _mm_mul_ps(center_y, ny)),
+						_mm_add_ps(_mm_mul_ps(center_z, nz), _mm_set1_ps(planes[p].w)));
+					__m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(extent_x, _mm_andnot_ps(sign_mask, nx)), _mm_mul_ps(extent_y, _mm_andnot_ps(sign_mask, ny))),
+						_mm_mul_ps(extent_z, _mm_andnot_ps(sign_mask, nz)));
+					inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), zero));
+				}
+				int mask = _mm_movemask_ps(inside);
+				for (uint32_t lane = 0; lane < 4; lane++) {
+					visible[i + lane] = static_cast<uint8_t>((mask >> lane) & 1);
+				}
+			}
+		}
+#else
+		void CullScalar(const glm::vec4* planes, const float* cx, const float* cy, const float* cz,
+			const float* ex, const float* ey, const float* ez, uint8_t* visible, uint32_t first, uint32_t last) {
+			for (uint32_t i = first; i < last; i++) {
+				bool inside = true;
+				for (uint32_t p = 0; p < 6 && inside; p++) {
+					float distance = cx[i] * planes[p].x + cy[i] * planes[p].y + cz[i] * planes[p].z + planes[p].w;
+					float radius = ex[i] * std::abs(planes[p].x) + ey[i] * std::abs(planes[p].y) + ez[i] * std::abs(planes[p].z);
+					inside = distance + radius >= 0.0f;
+				}
+				visible[i] = inside ? 1 : 0;
+			}
+		}
+#endif
+	}
+
+	FrustumCuller::FrustumCuller(Utils::WorkerPool* workers)
+		:m_workers(workers), m_avx2(HasAVX2()) {}
+
+	bool FrustumCuller::HasAVX2() {
+#if defined(DIFFUSE_CULL_X86) && defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		// The OS has to save the AVX registers too
+		bool os_avx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		return os_avx && (info[1] & (1 << 5));
+#elif defined(DIFFUSE_CULL_X86)
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+
+	void FrustumCuller::Clear() {
+		m_count = 0;
+		m_visible_count = 0;
+		m_center_x.clear();
+		m_center_y.clear();
+		m_center_z.clear();
+		m_extent_x.clear();
+		m_extent_y.clear();
+		m_extent_z.clear();
+	}
+
+	uint32_t FrustumCuller::Add(const BoundingBox& box) {
+		if (box.valid) {
+			glm::vec3 center = box.Center();
+			glm::vec3 extent = box.Extent();
+			m_center_x.push_back(center.x);
+			m_center_y.push_back(center.y);
+			m_center_z.push_back(center.z);
+			m_extent_x.push_back(extent.x);
+			m_extent_y.push_back(extent.y);
+			m_extent_z.push_back(extent.z);
+		}
+		else {
+			m_center_x.push_back(0.0f);
+			m_center_y.push_back(0.0f);
+			m_center_z.push_back(0.0f);
+			m_extent_x.push_back(s_unbounded_extent);
+			m_extent_y.push_back(s_unbounded_extent);
+			m_extent_z.push_back(s_unbounded_extent);
+		}
+		return m_count++;
+	}
+
+	void FrustumCuller::ExtractPlanes(const glm::mat4& view_projection, glm::vec4* planes) {
+		// Rows of the matrix combine into the planes, normals point inside
+		const glm::mat4 m = glm::transpose(view_projection);
+		planes[0] = m[3] + m[0];    // left
+		planes[1] = m[3] - m[0];    // right
+		planes[2] = m[3] + m[1];    // bottom
+		planes[3] = m[3] - m[1];    // top
+		planes[4] = m[2];           // near
+		planes[5] = m[3] - m[2];    // far
+	}
+
+	void FrustumCuller::Cull(const glm::mat4& view_projection) {
+		glm::vec4 planes[6];
+		ExtractPlanes(view_projection, planes);
+
+		const uint32_t padded = (m_count + 7) & ~7u;
+		for (auto* array : { &m_center_x, &m_center_y, &m_center_z, &m_extent_x, &m_extent_y, &m_extent_z }) {
+			array->resize(padded, 0.0f);
+		}
+		m_visible.resize(padded);
+
+		const uint32_t blocks = (padded + s_block_size - 1) / s_block_size;
+		m_workers->ParallelFor(blocks, [&](uint32_t block, uint32_t) {
+			CullBlock(planes, block * s_block_size, std::min(padded, (block + 1) * s_block_size));
+		});
+
+		m_visible_count = 0;
+		for (uint32_t i = 0; i < m_count; i++) {
+			m_visible_count += m_visible[i];
+		}
+	}
+
+	void FrustumCuller::CullBlock(const glm::vec4* planes, uint32_t first, uint32_t last) {
+#if defined(DIFFUSE_CULL_X86)
+		if (m_avx2) {
+			CullAVX2(planes, m_center_x.data(), m_center_y.data(), m_center_z.data(), m_extent_x.data(), m_extent_y.data(), m_extent_z.data(), m_visible.data(), first, last);
+		}
+		else {
+			CullSSE(planes, m_center_x.data(), m_center_y.data(), m_center_z.data(), m_extent_x.data(), m_extent_y.data(), m_extent_z.data(), m_visible.data(), first, last);
+		}
+#else
+		CullScalar(planes, m_center_x.data(), m_center_y.data(), m_center_z.data(), m_extent_x.data(), m_extent_y.data(), m_extent_z.data(), m_visible.data(), first, last);
+#endif
+	}
+
+	uint64_t FrustumCuller::GetVisibilityHash() const {
+		return Utils::Hash::Murmur3_128(m_visible.data(), m_count, m_count).low;
+	}
+}
@@ -0,0 +1,421 @@
+#include "GpuCuller.hpp"
+
+#include "GraphicsDevice.hpp"
+#include "FrustumCuller.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace Diffuse {
+	namespace {
+		constexpr uint32_t s_group_size = 64;    // local_size_x of draw_cull.comp
+
+		struct CullPushConstants {
+			uint32_t record_count;
+			uint32_t compact;
+			uint32_t phase;
+			uint32_t command_offset;
+			uint32_t count_offset;
+			uint32_t stats_offset;
+		};
+
+		void GlobalBarrier(VkCommandBuffer command_buffer, VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access) {
+			VkMemoryBarrier barrier{ VK_STRUCTURE_TYPE_MEMORY_BARRIER };
+			barrier.srcAccessMask = src_access;
+			barrier.dstAccessMask = dst_access;
+			vkCmdPipelineBarrier(command_buffer, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+		}
+	}
+
+	GpuCuller::GpuCuller(GraphicsDevice* device, uint32_t frame_count, bool draw_indirect_count, bool occlusion)
+		:m_device(device), m_draw_indirect_count(draw_indirect_count), m_occlusion(occlusion), m_frames(frame_count) {
+		std::vector<VkDescriptorSetLayoutBinding> bindings = {
+			{ 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+			{ 4, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr },
+		};
+		if (occlusion) {
+			bindings.push_back({ 5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr });
+			bindings.push_back({ 6, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT, nullptr });
+		}
+		VkDescriptorSetLayoutCreateInfo set_layout_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO };
+		set_layout_info.bindingCount = static_cast<uint32_t>(bindings.size());
+		set_layout_info.pBindings = bindings.data();
+		m_set_layout = device->GetObjectCache()->GetDescriptorSetLayout(set_layout_info);
+
+		VkPushConstantRange push_constant_range{ VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullPushConstants) };
+		VkPipelineLayoutCreateInfo pipeline_layout_info{ VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO };
+		pipeline_layout_info.setLayoutCount = 1;
+		pipeline_layout_info.pSetLayouts = &m_set_layout;
+		pipeline_layout_info.pushConstantRangeCount = 1;
+		pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+		m_pipeline_layout = device->GetObjectCache()->GetPipelineLayout(pipeline_layout_info);
+
+		// The occlusion variant is draw_cull.comp built with OCCLUSION_CULLING
+		// Compiled in the background, the device waits for it before the first frame
+		VkComputePipelineCreateInfo pipeline_info{ VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO };
+		pipeline_info.layout = m_pipeline_layout;
+		device->GetPipelineCompiler()->Compile(pipeline_info,
+			{ VK_SHADER_STAGE_COMPUTE_BIT, occlusion ? "../shaders/culling/draw_cull_occlusion_comp.spv" : "../shaders/culling/draw_cull_comp.spv" }, &m_pipeline);
+
+		VkDescriptorPoolSize pool_sizes[] = {
+			{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 5 * frame_count },
+			{ VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, frame_count },
+			{ VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, frame_count },
+		};
+		VkDescriptorPoolCreateInfo pool_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO };
+		pool_info.maxSets = frame_count;
+		pool_info.poolSizeCount = 3;
+		pool_info.pPoolSizes = pool_sizes;
+		if (vkCreateDescriptorPool(device->Device(), &pool_info, nullptr, &m_descriptor_pool) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to create draw culling descriptor pool");
+		}
+		std::vector<VkDescriptorSetLayout> set_layouts(frame_count, m_set_layout);
+		std::vector<VkDescriptorSet> sets(frame_count);
+		VkDescriptorSetAllocateInfo allocate_info{ VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO };
+		allocate_info.descriptorPool = m_descriptor_pool;
+		allocate_info.descriptorSetCount = frame_count;
+		allocate_info.pSetLayouts = set_layouts.data();
+		if (vkAllocateDescriptorSets(device->Device(), &allocate_info, sets.data()) != VK_SUCCESS) {
+			throw std::runtime_error("Failed to allocate draw culling descriptor sets");
+		}
+		for (uint32_t i = 0; i < frame_count; i++) {
+			m_frames[i].descriptor_set = sets[i];
+		}
+	}
+
+	void GpuCuller::Clear(uint32_t instance_count) {
+		DestroyBuffers();
+		m_records.clear();
+		m_buckets.clear();
+		m_bucket_lookup.clear();
+		m_instance_count = instance_count;
+		m_stats = {};
+	}
+
+	void GpuCuller::AddDraw(uint32_t instance, VkPipeline pipeline, VkPipeline depth_pipeline, const Material* material, int32_t material_index, RenderQueue::Pass pass,
+		const BoundingBox& local_bounds, uint32_t index_count, uint32_t first_index, int32_t vertex_offset) {
+		BucketKey key{ pass, pipeline, material, instance, material_index };
+		auto it = m_bucket_lookup.find(key);
+		if (it == m_bucket_lookup.end()) {
+			it = m_bucket_lookup.emplace(key, static_cast<uint32_t>(m_buckets.size())).first;
+			m_buckets.push_back({ pipeline, depth_pipeline, material, instance, material_index, pass, 0, 0 });
+		}
+		m_buckets[it->second].command_count++;
+
+		DrawRecord record{};
+		record.box_min = glm::vec4(local_bounds.valid ? local_bounds.min : glm::vec3(0.0f), local_bounds.valid ? 1.0f : 0.0f);
+		record.box_max = glm::vec4(local_bounds.valid ? local_bounds.max : glm::vec3(0.0f), 0.0f);
+		record.index_count = index_count;
+		record.first_index = first_index;
+		record.vertex_offset = vertex_offset;
+		record.instance = instance;
+		record.bucket = it->second;
+		m_records.push_back(record);
+	}
+
+	void GpuCuller::Build() {
+		// The lookup iterates in key order, pass first and then pipeline and material, so neighbouring buckets mostly share state
+		std::vector<uint32_t> remap(m_buckets.size());
+		std::vector<Bucket> sorted;
+		sorted.reserve(m_buckets.size());
+		for (const auto& [key, index] : m_bucket_lookup) {
+			remap[index] = static_cast<uint32_t>(sorted.size());
+			sorted.push_back(m_buckets[index]);
+		}
+		m_buckets.swap(sorted);
+		uint32_t first_command = 0;
+		for (Bucket& bucket : m_buckets) {
+			bucket.first_command = first_command;
+			first_command += bucket.command_count;
+		}
+
+		// Records of a bucket become contiguous, so without compaction a record's command slot is its own index
+		for (DrawRecord& record : m_records) {
+			record.bucket = remap[record.bucket];
+		}
+		std::stable_sort(m_records.begin(), m_records.end(), [](const DrawRecord& a, const DrawRecord& b) { return a.bucket < b.bucket; });
+		for (uint32_t i = 0; i < m_records.size(); i++) {
+			m_records[i].bucket_first = m_buckets[m_records[i].bucket].first_command;
+			m_records[i].slot = i;
+		}
+		m_stats.records = static_cast<uint32_t>(m_records.size());
+		m_stats.buckets = static_cast<uint32_t>(m_buckets.size());
+		if (m_records.empty())
+			return;
+
+		VkDevice device = m_device->Device();
+		MemoryAllocator::Tag tag(MemoryCategory::Geometry, "gpu culling");
+		{
+			// Read by every cull dispatch, so the records go to device local memory through one staging copy
+			VkDeviceSize size = m_records.size() * sizeof(DrawRecord);
+			VkBuffer staging;
+			VkDeviceMemory memory;
+			vkUtilities::CreateBuffer(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				staging, memory, m_device->PhysicalDevice(), device);
+			memcpy(vkUtilities::MapBuffer(device, staging), m_records.data(), (size_t)size);
+			vkUtilities::CreateBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				m_record_buffer, memory, m_device->PhysicalDevice(), device);
+			VkCommandBuffer copy_cmd = m_device->CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
+			VkBufferCopy region{ 0, 0, size };
+			vkCmdCopyBuffer(copy_cmd, staging, m_record_buffer, 1, &region);
+			if (m_occlusion) {
+				// Nothing was visible before the first frame, its early phase draws nothing
+				vkUtilities::CreateBuffer(m_records.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_visibility_buffer, memory, m_device->PhysicalDevice(), device);
+				vkCmdFillBuffer(copy_cmd, m_visibility_buffer, 0, VK_WHOLE_SIZE, 0);
+			}
+			m_device->FlushCommandBuffer(copy_cmd, m_device->Queue(), true);
+			vkUtilities::DestroyBuffer(device, staging);
+		}
+
+		const VkDeviceSize instance_bytes = std::max(m_instance_count, 1u) * sizeof(Instance);
+		// With occlusion culling the late phase has its own commands and counts after the early ones
+		const uint32_t phases = m_occlusion ? 2 : 1;
+		const VkDeviceSize command_bytes = phases * m_records.size() * sizeof(VkDrawIndexedIndirectCommand);
+		const VkDeviceSize count_bytes = (phases * m_buckets.size() + (m_occlusion ? 2 : 0)) * sizeof(uint32_t);
+		for (Frame& frame : m_frames) {
+			VkDeviceMemory memory;
+			vkUtilities::CreateBuffer(instance_bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				frame.instances, memory, m_device->PhysicalDevice(), device);
+			frame.mapped_instances = (Instance*)vkUtilities::MapBuffer(device, frame.instances);
+			memset(frame.mapped_instances, 0, (size_t)instance_bytes);
+			vkUtilities::CreateBuffer(command_bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				frame.commands, memory, m_device->PhysicalDevice(), device);
+			vkUtilities::CreateBuffer(count_bytes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+				VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frame.counts, memory, m_device->PhysicalDevice(), device);
+			vkUtilities::CreateBuffer(count_bytes, VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				frame.readback, memory, m_device->PhysicalDevice(), device);
+			frame.mapped_readback = (const uint32_t*)vkUtilities::MapBuffer(device, frame.readback);
+			vkUtilities::CreateBuffer(sizeof(View), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				frame.view, memory, m_device->PhysicalDevice(), device);
+			frame.mapped_view = (View*)vkUtilities::MapBuffer(device, frame.view);
+			frame.pending = false;
+
+			VkDescriptorBufferInfo buffer_infos[] = {
+				{ frame.instances, 0, VK_WHOLE_SIZE },
+				{ m_record_buffer, 0, VK_WHOLE_SIZE },
+				{ frame.commands, 0, VK_WHOLE_SIZE },
+				{ frame.counts, 0, VK_WHOLE_SIZE },
+				{ frame.view, 0, VK_WHOLE_SIZE },
+				{ m_visibility_buffer, 0, VK_WHOLE_SIZE },
+			};
+			const uint32_t write_count = m_occlusion ? 6 : 5;
+			VkWriteDescriptorSet writes[6];
+			for (uint32_t binding = 0; binding < write_count; binding++) {
+				writes[binding] = { VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+				writes[binding].dstSet = frame.descriptor_set;
+				writes[binding].dstBinding = binding;
+				writes[binding].descriptorCount = 1;
+				writes[binding].descriptorType = binding == 4 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				writes[binding].pBufferInfo = &buffer_infos[binding];
+			}
+			vkUpdateDescriptorSets(device, write_count, writes, 0, nullptr);
+		}
+	}
+
+	void GpuCuller::BeginFrame(uint32_t frame_index) {
+		m_frame_index = frame_index;
+		Frame& frame = m_frames[frame_index];
+		if (!frame.pending)
+			return;
+		m_stats.visible = 0;
+		const uint32_t count_total = (m_occlusion ? 2 : 1) * GetBucketCount();
+		for (uint32_t i = 0; i < count_total; i++) {
+			m_stats.visible += frame.mapped_readback[i];
+		}
+		m_total_visible += m_stats.visible;
+		if (m_occlusion) {
+			m_stats.occluded = frame.mapped_readback[GetStatsOffset()];
+			m_stats.occluded_triangles = frame.mapped_readback[GetStatsOffset() + 1];
+			m_total_occluded += m_stats.occluded;
+			m_total_occluded_triangles += m_stats.occluded_triangles;
+		}
+		m_counted_frames++;
+		frame.pending = false;
+	}
+
+	void GpuCuller::SetInstance(uint32_t instance, const glm::mat4& world, const BoundingBox& local_bounds, bool render) {
+		Instance* instances = m_frames[m_frame_index].mapped_instances;
+		if (!instances)
+			return;
+		instances[instance].world = world;
+		instances[instance].box_min = glm::vec4(local_bounds.valid ? local_bounds.min : glm::vec3(0.0f), render ? 1.0f : 0.0f);
+		instances[instance].box_max = glm::vec4(local_bounds.valid ? local_bounds.max : glm::vec3(0.0f), local_bounds.valid ? 1.0f : 0.0f);
+	}
+
+	void GpuCuller::SetDepthPyramid(VkImageView view, VkSampler sampler, uint32_t width, uint32_t height, uint32_t levels) {
+		if (!m_occlusion)
+			return;
+		m_pyramid = { sampler, view, VK_IMAGE_LAYOUT_GENERAL };
+		m_pyramid_size = glm::vec2(static_cast<float>(width), static_cast<float>(height));
+		m_pyramid_levels = levels;
+		for (Frame& frame : m_frames) {
+			VkWriteDescriptorSet write{ VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET };
+			write.dstSet = frame.descriptor_set;
+			write.dstBinding = 6;
+			write.descriptorCount = 1;
+			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+			write.pImageInfo = &m_pyramid;
+			vkUpdateDescriptorSets(m_device->Device(), 1, &write, 0, nullptr);
+		}
+	}
+
+	void GpuCuller::Cull(VkCommandBuffer command_buffer, const glm::mat4& view_projection, Phase phase) {
+		if (m_records.empty())
+			return;
+		Frame& frame = m_frames[m_frame_index];
+
+		if (phase != PHASE_LATE) {
+			frame.mapped_view->view_projection = view_projection;
+			FrustumCuller::ExtractPlanes(view_projection, frame.mapped_view->planes);
+			frame.mapped_view->pyramid_size = m_pyramid_size;
+			frame.mapped_view->pyramid_levels = m_pyramid_levels;
+			// Both phases' counts start at zero, the previous frame's late phase wrote the visibility read now
+			vkCmdFillBuffer(command_buffer, frame.counts, 0, VK_WHOLE_SIZE, 0);
+			GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		}
+		else {
+			// The early phase read the visibility the late phase overwrites
+			GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT);
+		}
+
+		CullPushConstants push_constants{};
+		push_constants.record_count = static_cast<uint32_t>(m_records.size());
+		push_constants.compact = m_draw_indirect_count ? 1 : 0;
+		push_constants.phase = phase;
+		push_constants.command_offset = phase == PHASE_LATE ? push_constants.record_count : 0;
+		push_constants.count_offset = GetCountOffset(phase);
+		push_constants.stats_offset = GetStatsOffset();
+		vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline);
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_pipeline_layout, 0, 1, &frame.descriptor_set, 0, nullptr);
+		vkCmdPushConstants(command_buffer, m_pipeline_layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(push_constants), &push_constants);
+		vkCmdDispatch(command_buffer, (push_constants.record_count + s_group_size - 1) / s_group_size, 1, 1);
+
+		// The frame graph orders the indirect reads of the commands and counts after the pass
+		if (phase == PHASE_EARLY)
+			return;
+
+		// The counts are copied back for the stats
+		GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+		VkBufferCopy region{ 0, 0, ((m_occlusion ? 2 : 1) * m_buckets.size() + (m_occlusion ? 2 : 0)) * sizeof(uint32_t) };
+		vkCmdCopyBuffer(command_buffer, frame.counts, frame.readback, 1, &region);
+		GlobalBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_HOST_BIT, VK_ACCESS_HOST_READ_BIT);
+		frame.pending = true;
+	}
+
+	RenderQueue::Stats GpuCuller::Record(VkCommandBuffer command_buffer, VkPipelineLayout layout, VkDescriptorSet ibl_set, VkDescriptorSet texture_set, uint32_t shader_values_offset,
+		const Scene& scene, Phase phase, bool depth_prepass) const {
+		RenderQueue::Stats stats;
+		if (m_buckets.empty())
+			return stats;
+		const Frame& frame = m_frames[m_frame_index];
+		const uint32_t stride = sizeof(VkDrawIndexedIndirectCommand);
+		const VkDeviceSize command_offset = phase == PHASE_LATE ? m_records.size() * stride : 0;
+		const uint32_t count_offset = GetCountOffset(phase);
+
+		vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &ibl_set, 0, nullptr);
+		stats.descriptor_binds++;
+		if (texture_set != VK_NULL_HANDLE) {
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 3, 1, &texture_set, 0, nullptr);
+			stats.descriptor_binds++;
+		}
+
+		VkPipeline bound_pipeline = VK_NULL_HANDLE;
+		VkDescriptorSet bound_material = VK_NULL_HANDLE;
+		VkDescriptorSet bound_object = VK_NULL_HANDLE;
+		uint32_t bound_ubo_offset = 0;
+		int32_t pushed_material_index = 0;
+		bool pushed = false;
+		for (uint32_t i = 0; i < m_buckets.size(); i++) {
+			const Bucket& bucket = m_buckets[i];
+			VkPipeline pipeline = depth_prepass ? bucket.depth_pipeline : bucket.pipeline;
+			if (pipeline == VK_NULL_HANDLE)
+				continue;
+			const SceneObject& object = *scene.GetSceneObjects()[bucket.instance];
+			VkDescriptorSet material_set = bucket.material->descriptorSets[m_frame_index];
+			if (pipeline != bound_pipeline) {
+				vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				bound_pipeline = pipeline;
+				stats.pipeline_binds++;
+			}
+			if (material_set != bound_material || object.p_ubo_offset != bound_ubo_offset) {
+				const uint32_t dynamic_offsets[] = { object.p_ubo_offset, shader_values_offset };
+				vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &material_set, 2, dynamic_offsets);
+				bound_material = material_set;
+				bound_ubo_offset = object.p_ubo_offset;
+				stats.descriptor_binds++;
+			}
+			if (object.p_mat_descritpor_set != bound_object) {
+				vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &object.p_mat_descritpor_set, 0, nullptr);
+				bound_object = object.p_mat_descritpor_set;
+				stats.descriptor_binds++;
+			}
+			if (!pushed || bucket.material_index != pushed_material_index) {
+				vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(int32_t), &bucket.material_index);
+				pushed_material_index = bucket.material_index;
+				pushed = true;
+				stats.push_constants++;
+			}
+			if (m_draw_indirect_count) {
+				vkCmdDrawIndexedIndirectCount(command_buffer, frame.commands, command_offset + bucket.first_command * stride, frame.counts, (count_offset + i) * sizeof(uint32_t),
+					bucket.command_count, stride);
+			}
+			else {
+				vkCmdDrawIndexedIndirect(command_buffer, frame.commands, command_offset + bucket.first_command * stride, bucket.command_count, stride);
+			}
+			stats.indirect_draws++;
+		}
+		return stats;
+	}
+
+	void GpuCuller::PrintStats() const {
+		std::cout << "GPU culling (" << (m_draw_indirect_count ? "draw count" : "zero instance count") << "): " << m_stats.records << " draw records in "
+			<< m_stats.buckets << " buckets";
+		if (m_counted_frames > 0) {
+			std::cout << ", per frame " << m_total_visible / m_counted_frames << " visible";
+			if (m_occlusion) {
+				std::cout << ", " << m_total_occluded / m_counted_frames << " occluded with " << m_total_occluded_triangles / m_counted_frames << " triangles";
+			}
+		}
+		std::cout << std::endl;
+	}
+
+	void GpuCuller::CleanUp() {
+		DestroyBuffers();
+		vkDestroyPipeline(m_device->Device(), m_pipeline, nullptr);
+		vkDestroyDescriptorPool(m_device->Device(), m_descriptor_pool, nullptr);
+		m_pipeline = VK_NULL_HANDLE;
+		m_descriptor_pool = VK_NULL_HANDLE;
+	}
+
+	void GpuCuller::DestroyBuffers() {
+		VkDevice device = m_device->Device();
+		for (Frame& frame : m_frames) {
+			for (VkBuffer* buffer : { &frame.instances, &frame.commands, &frame.counts, &frame.readback, &frame.view }) {
+				if (*buffer != VK_NULL_HANDLE) {
+					vkUtilities::DestroyBuffer(device, *buffer);
+					*buffer = VK_NULL_HANDLE;
+				}
+			}
+			frame.mapped_instances = nullptr;
+			frame.mapped_readback = nullptr;
+			frame.mapped_view = nullptr;
+			frame.pending = false;
+		}
+		if (m_visibility_buffer != VK_NULL_HANDLE) {
+			vkUtilities::DestroyBuffer(device, m_visibility_buffer);
+			m_visibility_buffer = VK_NULL_HANDLE;
+		}
+		if (m_record_buffer != VK_NULL_HANDLE) {
+			vkUtilities::DestroyBuffer(device, m_record_buffer);
+			m_record_buffer = VK_NULL_HANDLE;
+		}
+	}
+}
@@ -0,0 +1,60 @@
+#include "MaterialFeatures.hpp"
+
+namespace Diffuse {
+	uint32_t MaterialFeatures::Get(const Material& material, const Texture2D* fallback) {
+		auto present = [fallback](const Texture2D* texture) { return texture != nullptr && texture != fallback; };
+
+		uint32_t features = 0;
+		if (material.alphaMode == Material::ALPHAMODE_MASK)
+			features |= ALPHA_MASK;
+		// The shader samples the base color and metallic roughness bindings in both workflows, the specular glossiness
+		// extension textures only decide whether they are used
+		if (material.pbrWorkflows.specularGlossiness) {
+			features |= SPECULAR_GLOSSINESS;
+			if (material.extension.diffuseTexture != nullptr && present(material.baseColorTexture))
+				features |= BASE_COLOR_TEXTURE;
+			if (material.extension.specularGlossinessTexture != nullptr && present(material.metallicRoughnessTexture))
+				features |= PHYSICAL_DESCRIPTOR_TEXTURE;
+		}
+		else {
+			if (present(material.baseColorTexture))
+				features |= BASE_COLOR_TEXTURE;
+			if (present(material.metallicRoughnessTexture)) {
+				features |= PHYSICAL_DESCRIPTOR_TEXTURE;
+				if (material.occlusionInMetallicRoughness)
+					features |= PACKED_OCCLUSION;
+			}
+		}
+		if (present(material.normalTexture))
+			features |= NORMAL_TEXTURE;
+		if (!(features & PACKED_OCCLUSION) && present(material.occlusionTexture))
+			features |= OCCLUSION_TEXTURE;
+		if (present(material.emissiveTexture))
+			features |= EMISSIVE_TEXTURE;
+		return features;
+	}
+
+	MaterialFeatures::Cost MaterialFeatures::Estimate(uint32_t features, bool specialized) {
+		// Follows main() of pbr.frag, the generic pipeline tests base color, physical descriptor, alpha mask, workflow, normal,
+		// packed occlusion and emissive for every fragment and the occlusion texture when it is not packed
+		Cost cost;
+		cost.branches = (features & PACKED_OCCLUSION) ? 7 : 8;
+		if ((features & ALPHA_MASK) && (features & BASE_COLOR_TEXTURE))
+			cost.texture_fetches++;
+		if (features & SPECULAR_GLOSSINESS) {
+			// Diffuse and specular are read whether the textures are present or not
+			cost.texture_fetches += ((features & PHYSICAL_DESCRIPTOR_TEXTURE) ? 1 : 0) + 2;
+		}
+		else {
+			cost.texture_fetches += ((features & PHYSICAL_DESCRIPTOR_TEXTURE) ? 1 : 0) + ((features & BASE_COLOR_TEXTURE) ? 1 : 0);
+		}
+		cost.texture_fetches += (features & NORMAL_TEXTURE) ? 1 : 0;
+		cost.texture_fetches += (features & OCCLUSION_TEXTURE) ? 1 : 0;
+		cost.texture_fetches += (features & EMISSIVE_TEXTURE) ? 1 : 0;
+
+		if (specialized) {
+			cost.branches = 0;
+		}
+		return cost;
+	}
+}
@@ -1,8 +1,83 @@
 #include "Model.hpp"
 
 #include "GraphicsDevice.hpp"
+#include "Hash.hpp"
 
 namespace Diffuse {
+	namespace {
+		// Keeps packed texture hashes apart from hashes of encoded images
+		constexpr uint64_t s_orm_hash_seed = 0x4f524d;
+
+		struct ImageLoadContext {
+			TextureRegistry* registry;
+			std::vector<Utils::Hash128> hashes;
+			std::vector<bool> decoded;
+		};
+
+		// Hashes the encoded image bytes and only decodes images the registry hasn't seen yet
+		bool LoadImageDataHashed(tinygltf::Image* image, const int image_idx, std::string* err, std::string* warn,
+			int req_width, int req_height, const unsigned char* bytes, int size, void* user_data) {
+			ImageLoadContext* context = static_cast<ImageLoadContext*>(user_data);
+			if (context->hashes.size() <= static_cast<size_t>(image_idx)) {
+				context->hashes.resize(image_idx + 1);
+				context->decoded.resize(image_idx + 1, false);
+			}
+			Utils::Hash128 hash = Utils::Hash::Murmur3_128(bytes, size);
+			context->hashes[image_idx] = hash;
+
+			bool known = context->registry->Contains(hash);
+			for (int i = 0; i < image_idx && !known; i++) {
+				known = context->decoded[i] && context->hashes[i] == hash;
+			}
+			if (known) {
+				context->registry->CountSkippedDecode();
+				return true;
+			}
+			context->decoded[image_idx] = true;
+			return tinygltf::LoadImageData(image, image_idx, err, warn, req_width, req_height, bytes, size, nullptr);
+		}
+
+		// Occlusion goes into red, roughness and metallic stay in green and blue as glTF stores them
+		tinygltf::Image PackOcclusionRoughnessMetallic(const tinygltf::Image& occlusion, const tinygltf::Image& metallic_roughness) {
+			tinygltf::Image packed;
+			packed.width = metallic_roughness.width;
+			packed.height = metallic_roughness.height;
+			packed.component = 4;
+			packed.bits = 8;
+			packed.pixel_type = TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE;
+			packed.image.resize(static_cast<size_t>(packed.width) * packed.height * 4);
+			for (size_t i = 0; i < static_cast<size_t>(packed.width) * packed.height; i++) {
+				packed.image[i * 4 + 0] = occlusion.image[i * occlusion.component];
+				packed.image[i * 4 + 1] = metallic_roughness.image[i * metallic_roughness.component + 1];
+				packed.image[i * 4 + 2] = metallic_roughness.image[i * metallic_roughness.component + 2];
+				packed.image[i * 4 + 3] = 255;
+			}
+			return packed;
+		}
+
+		// Counts every texture reference of a material, including the ones inside extensions
+		void CountTextureUses(const tinygltf::Material& mat, std::vector<uint32_t>& uses) {
+			auto count = [&](int index) {
+				if (index >= 0 && static_cast<size_t>(index) < uses.size())
+					uses[index]++;
+			};
+			for (auto& [name, value] : mat.values) {
+				count(value.TextureIndex());
+			}
+			for (auto& [name, value] : mat.additionalValues) {
+				count(value.TextureIndex());
+			}
+			for (auto& [name, extension] : mat.extensions) {
+				for (auto& key : extension.Keys()) {
+					const tinygltf::Value& value = extension.Get(key);
+					if (value.IsObject() && value.Has("index")) {
+						count(value.Get("index").Get<int>());
+					}
+				}
+			}
+		}
+	}
+
 	Model::~Model() {
 		for (auto node : m_nodes) {
 			delete node;
@@ -10,11 +85,18 @@ namespace Diffuse {
 	}
 
 	void Model::Load(const std::string& path, GraphicsDevice* device) {
+		m_path = path;
+		// Everything allocated while loading is reported under this file
+		MemoryAllocator::Tag tag(MemoryCategory::Other, path);
 		tinygltf::TinyGLTF loader;
 		tinygltf::Model model;
 		std::string error;
 		std::string warning;
 
+		TextureRegistry* registry = device->GetTextureRegistry();
+		ImageLoadContext image_context{ registry };
+		loader.SetImageLoader(LoadImageDataHashed, &image_context);
+
 		bool binary = false;
 		size_t extpos = path.rfind('.', path.length());
 		if (extpos != std::string::npos) {
@@ -41,8 +123,9 @@ namespace Diffuse {
 				texture_sampler.address_modeW = texture_sampler.address_modeV;
 				m_texture_samplers.push_back(texture_sampler);
 			}
-			for (tinygltf::Texture& tex : model.textures) {
-				tinygltf::Image image = model.images[tex.source];
+			image_context.hashes.resize(model.images.size());
+			image_context.decoded.resize(model.images.size(), false);
+			auto get_sampler = [&](const tinygltf::Texture& tex) {
 				TextureSampler texture_sampler{};
 				if (tex.sampler == -1) 
 				{
@@ -56,12 +139,86 @@ namespace Diffuse {
 				else {
 					texture_sampler = m_texture_samplers[tex.sampler];
 				}
-				Texture2D* texture;
-				texture = new Texture2D(image, texture_sampler, device->Queue(), device);
+				return texture_sampler;
+			};
+			// Duplicates within this file were not decoded, pixels come from the first decoded copy, -1 if there is none
+			auto get_decoded_source = [&](int source) {
+				for (size_t i = 0; i < model.images.size() && !image_context.decoded[source]; i++) {
+					if (image_context.decoded[i] && image_context.hashes[i] == image_context.hashes[source])
+						source = static_cast<int>(i);
+				}
+				return image_context.decoded[source] ? source : -1;
+			};
+
+			// Occlusion and metallic roughness read with the same UV set and sampler are packed into one ORM texture
+			std::vector<uint32_t> texture_uses(model.textures.size(), 0);
+			std::vector<uint32_t> packed_uses(model.textures.size(), 0);
+			m_orm_textures.assign(model.materials.size(), nullptr);
+			for (size_t i = 0; i < model.materials.size(); i++) {
+				tinygltf::Material& mat = model.materials[i];
+				CountTextureUses(mat, texture_uses);
+				if (mat.values.find("metallicRoughnessTexture") == mat.values.end() || mat.additionalValues.find("occlusionTexture") == mat.additionalValues.end())
+					continue;
+				const tinygltf::Parameter& mr_param = mat.values["metallicRoughnessTexture"];
+				const tinygltf::Parameter& occlusion_param = mat.additionalValues["occlusionTexture"];
+				int mr_index = mr_param.TextureIndex();
+				int occlusion_index = occlusion_param.TextureIndex();
+				if (mr_index == occlusion_index || mr_param.TextureTexCoord() != occlusion_param.TextureTexCoord())
+					continue;
+				const tinygltf::Texture& mr_tex = model.textures[mr_index];
+				const tinygltf::Texture& occlusion_tex = model.textures[occlusion_index];
+				if (mr_tex.sampler != occlusion_tex.sampler)
+					continue;
+
+				const Utils::Hash128 sources[2] = { image_context.hashes[occlusion_tex.source], image_context.hashes[mr_tex.source] };
+				const Utils::Hash128 content = Utils::Hash::Murmur3_128(sources, sizeof(sources), s_orm_hash_seed);
+				TextureSampler texture_sampler = get_sampler(mr_tex);
+				Texture2D* texture = registry->Acquire(content, texture_sampler);
+				if (texture == nullptr) {
+					int occlusion_source = get_decoded_source(occlusion_tex.source);
+					int mr_source = get_decoded_source(mr_tex.source);
+					if (occlusion_source < 0 || mr_source < 0)
+						continue;
+					const tinygltf::Image& occlusion = model.images[occlusion_source];
+					const tinygltf::Image& mr = model.images[mr_source];
+					if (occlusion.width != mr.width || occlusion.height != mr.height || occlusion.bits != 8 || mr.bits != 8 || mr.component < 3)
+						continue;
+					texture = registry->Insert(content, texture_sampler, new Texture2D(PackOcclusionRoughnessMetallic(occlusion, mr), texture_sampler, device->Queue(), device));
+				}
+				m_orm_textures[i] = texture;
+				packed_uses[mr_index]++;
+				packed_uses[occlusion_index]++;
+			}
+
+			// Indexed like model.textures, maps only referenced through packed ORM textures stay nullptr
+			std::vector<Texture2D*> textures(model.textures.size(), nullptr);
+			for (size_t t = 0; t < model.textures.size(); t++) {
+				tinygltf::Texture& tex = model.textures[t];
+				// Only referenced through packed ORM textures, the separate maps never reach the GPU
+				if (texture_uses[t] > 0 && texture_uses[t] == packed_uses[t])
+					continue;
+				const Utils::Hash128& content = image_context.hashes[tex.source];
+				TextureSampler texture_sampler = get_sampler(tex);
+				Texture2D* texture = registry->Acquire(content, texture_sampler);
+				if (texture == nullptr) {
+					int source = get_decoded_source(tex.source);
+					texture = registry->Insert(content, texture_sampler, new Texture2D(model.images[source], texture_sampler, device->Queue(), device));
+				}
+				textures[t] = texture;
 				m_textures.push_back(texture);
 			}
+			// The packed textures hold one reference each as well
+			for (auto texture : m_orm_textures) {
+				if (texture)
+					m_textures.push_back(texture);
+			}
+			// After Setup nothing else packs the pending textures of this model
+			TexturePacker* packer = device->GetTexturePacker();
+			if (packer && packer->HasPacked()) {
+				packer->Pack(device->Queue());
+			}
 			//Load Materials
-			LoadMaterials(model);
+			LoadMaterials(model, textures);
 
 			const tinygltf::Scene& scene = model.scenes[model.defaultScene > -1 ? model.defaultScene : 0];
 			for (auto& node_index : scene.nodes) {
@@ -77,33 +234,21 @@ namespace Diffuse {
 			}
 		}
 
-		size_t vertexBufferSize = vertex_count * sizeof(Vertex);
-		size_t indexBufferSize = index_count * sizeof(uint32_t);
-		assert(vertexBufferSize > 0);
-
-		struct StagingBuffer {
-			VkBuffer buffer;
-			VkDeviceMemory memory;
-		} vertex_staging, index_staging;
-
-		// Vertex buffer
-		device->CreateVertexBuffer(m_vertices.buffer, m_vertices.memory, vertexBufferSize, m_vertex_buffer);
-		// Index buffer
-		if (indexBufferSize > 0) {
-			device->CreateIndexBuffer(m_indices.buffer, m_indices.memory, indexBufferSize, m_index_buffer);
-		}
+		assert(vertex_count > 0);
+		// Indices stay relative to this model, draws add the allocation's vertex offset
+		m_geometry = device->GetGeometryPool()->Allocate(m_vertex_buffer, vertex_count, m_index_buffer, index_count);
 	}
 
-	void Model::LoadMaterials(tinygltf::Model model) {
+	void Model::LoadMaterials(tinygltf::Model& model, const std::vector<Texture2D*>& textures) {
 		for (tinygltf::Material& mat : model.materials) {
 			Material material{};
 			material.doubleSided = mat.doubleSided;
 			if (mat.values.find("baseColorTexture") != mat.values.end()) {
-				material.baseColorTexture = m_textures[mat.values["baseColorTexture"].TextureIndex()];
+				material.baseColorTexture = textures[mat.values["baseColorTexture"].TextureIndex()];
 				material.texCoordSets.baseColor = mat.values["baseColorTexture"].TextureTexCoord();
 			}
 			if (mat.values.find("metallicRoughnessTexture") != mat.values.end()) {
-				material.metallicRoughnessTexture = m_textures[mat.values["metallicRoughnessTexture"].TextureIndex()];
+				material.metallicRoughnessTexture = textures[mat.values["metallicRoughnessTexture"].TextureIndex()];
 				material.texCoordSets.metallicRoughness = mat.values["metallicRoughnessTexture"].TextureTexCoord();
 			}
 			if (mat.values.find("roughnessFactor") != mat.values.end()) {
@@ -116,17 +261,24 @@ namespace Diffuse {
 				material.baseColorFactor = glm::make_vec4(mat.values["baseColorFactor"].ColorFactor().data());
 			}
 			if (mat.additionalValues.find("normalTexture") != mat.additionalValues.end()) {
-				material.normalTexture = m_textures[mat.additionalValues["normalTexture"].TextureIndex()];
+				material.normalTexture = textures[mat.additionalValues["normalTexture"].TextureIndex()];
 				material.texCoordSets.normal = mat.additionalValues["normalTexture"].TextureTexCoord();
 			}
 			if (mat.additionalValues.find("emissiveTexture") != mat.additionalValues.end()) {
-				material.emissiveTexture = m_textures[mat.additionalValues["emissiveTexture"].TextureIndex()];
+				material.emissiveTexture = textures[mat.additionalValues["emissiveTexture"].TextureIndex()];
 				material.texCoordSets.emissive = mat.additionalValues["emissiveTexture"].TextureTexCoord();
 			}
 			if (mat.additionalValues.find("occlusionTexture") != mat.additionalValues.end()) {
-				material.occlusionTexture = m_textures[mat.additionalValues["occlusionTexture"].TextureIndex()];
+				material.occlusionTexture = textures[mat.additionalValues["occlusionTexture"].TextureIndex()];
 				material.texCoordSets.occlusion = mat.additionalValues["occlusionTexture"].TextureTexCoord();
 			}
+			if (Texture2D* orm = m_ortextures[m_materials.size()]) {
+				material.occlusionTexture = orm;
+				material.metallicRoughnessTexture = orm;
+			}
+			// Also true for glTF files that already share one texture between both slots
+			material.occlusionInMetallicRoughness = material.occlusionTexture != nullptr && material.occlusionTexture == material.metallicRoughnessTexture &&
+				material.texCoordSets.occlusion == material.texCoordSets.metallicRoughness;
 			if (mat.additionalValues.find("alphaMode") != mat.additionalValues.end()) {
 				tinygltf::Parameter param = mat.additionalValues["alphaMode"];
 				if (param.string_value == "BLEND") {
@@ -150,14 +302,14 @@ namespace Diffuse {
 				auto ext = mat.extensions.find("KHR_materials_pbrSpecularGlossiness");
 				if (ext->second.Has("specularGlossinessTexture")) {
 					auto index = ext->second.Get("specularGlossinessTexture").Get("index");
-					material.extension.specularGlossinessTexture = m_textures[index.Get<int>()];
+					material.extension.specularGlossinessTexture = textures[index.Get<int>()];
 					auto texCoordSet = ext->second.Get("specularGlossinessTexture").Get("texCoord");
 					material.texCoordSets.specularGlossiness = texCoordSet.Get<int>();
 					material.pbrWorkflows.specularGlossiness = true;
 				}
 				if (ext->second.Has("diffuseTexture")) {
 					auto index = ext->second.Get("diffuseTexture").Get("index");
-					material.extension.diffuseTexture = m_textures[index.Get<int>()];
+					material.extension.diffuseTexture = textures[index.Get<int>()];
 				}
 				if (ext->second.Has("diffuseFactor")) {
 					auto factor = ext->second.Get("diffuseFactor");
@@ -359,6 +511,30 @@ namespace Diffuse {
 				}
 				uint32_t mat_index = primitive.material > -1 ? primitive.material : -1;
 				Primitive* new_primitive = new Primitive(index_start, index_count, vertex_count, mat_index);
+				// Bounds and texel density
+				{
+					for (uint32_t v = vertex_start; v < vertex_start + vertex_count; v++) {
+						new_primitive->bb.Expand(m_vertex_buffer[v].pos);
+					}
+					if (new_primitive->bb.valid) {
+						m_bounds.Expand(new_primitive->bb.min);
+						m_bounds.Expand(new_primitive->bb.max);
+					}
+					double world_area = 0.0;
+					double uv_area[2] = { 0.0, 0.0 };
+					for (uint32_t i = index_start; i + 2 < index_start + index_count; i += 3) {
+						const Vertex& v0 = m_vertex_buffer[m_index_buffer[i]];
+						const Vertex& v1 = m_vertex_buffer[m_index_buffer[i + 1]];
+						const Vertex& v2 = m_vertex_buffer[m_index_buffer[i + 2]];
+						world_area += glm::length(glm::cross(v1.pos - v0.pos, v2.pos - v0.pos));
+						uv_area[0] += std::abs((v1.uv0.x - v0.uv0.x) * (v2.uv0.y - v0.uv0.y) - (v2.uv0.x - v0.uv0.x) * (v1.uv0.y - v0.uv0.y));
+						uv_area[1] += std::abs((v1.uv1.x - v0.uv1.x) * (v2.uv1.y - v0.uv1.y) - (v2.uv1.x - v0.uv1.x) * (v1.uv1.y - v0.uv1.y));
+					}
+					if (world_area > 0.0) {
+						new_primitive->uv_density[0] = static_cast<float>(std::sqrt(uv_area[0] / world_area));
+						new_primitive->uv_density[1] = static_cast<float>(std::sqrt(uv_area[1] / world_area));
+					}
+				}
 				new_mesh->primitives.push_back(new_primitive);
 			}
 			new_node->mesh = new_mesh;
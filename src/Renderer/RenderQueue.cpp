@@ -0,0 +1,174 @@
+#include "RenderQueue.hpp"
+
+#include "Hash.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <iostream>
+
+namespace Diffuse {
+	namespace {
+		constexpr uint32_t s_pipeline_bits = 8;
+		constexpr uint32_t s_material_bits = 22;
+
+		// Non negative floats keep their order when their bits are compared as integers
+		uint32_t DepthBits(float depth) {
+			depth = std::max(depth, 0.0f);
+			uint32_t bits;
+			std::memcpy(&bits, &depth, sizeof(bits));
+			return bits;
+		}
+	}
+
+	void RenderQueue::Begin() {
+		m_items.clear();
+		m_sorted.clear();
+		m_frame_stats = {};
+	}
+
+	void RenderQueue::Push(Pass pass, float view_depth, const DrawItem& item) {
+		uint64_t pipeline = PipelineId(item.pipeline);
+		uint64_t material = MaterialId(item.material_set);
+		uint64_t depth = DepthBits(view_depth);
+		uint64_t key = static_cast<uint64_t>(pass) << 62;
+		if (pass == PASS_BLEND) {
+			key |= (~depth & 0xffffffffull) << (s_pipeline_bits + s_material_bits) | pipeline << s_material_bits | material;
+		}
+		else {
+			key |= pipeline << (32 + s_material_bits) | material << 32 | depth;
+		}
+		m_sorted.push_back({ key, static_cast<uint32_t>(m_items.size()) });
+		m_items.push_back(item);
+	}
+
+	void RenderQueue::Sort() {
+		// LSD radix sort over the eight key bytes, bytes every key shares are skipped
+		const size_t count = m_sorted.size();
+		std::array<std::array<uint32_t, 256>, 8> histograms{};
+		for (const SortEntry& entry : m_sorted) {
+			for (uint32_t byte = 0; byte < 8; byte++) {
+				histograms[byte][(entry.key >> (byte * 8)) & 0xff]++;
+			}
+		}
+
+		m_scratch.resize(count);
+		for (uint32_t byte = 0; byte < 8; byte++) {
+			auto& histogram = histograms[byte];
+			if (std::find(histogram.begin(), histogram.end(), count) != histogram.end())
+				continue;
+			uint32_t offset = 0;
+			for (uint32_t& bucket : histogram) {
+				uint32_t size = bucket;
+				bucket = offset;
+				offset += size;
+			}
+			for (const SortEntry& entry : m_sorted) {
+				m_scratch[histogram[(entry.key >> (byte * 8)) & 0xff]++] = entry;
+			}
+			m_sorted.swap(m_scratch);
+		}
+	}
+
+	uint64_t RenderQueue::GetOrderHash(Pass pass) const {
+		std::vector<uint32_t> order;
+		for (const SortEntry& entry : m_sorted) {
+			if ((entry.key >> 62) == pass)
+				order.push_back(entry.item);
+		}
+		return Utils::Hash::Murmur3_128(order.data(), order.size() * sizeof(uint32_t), pass).low;
+	}
+
+	RenderQueue::Stats RenderQueue::Record(VkCommandBuffer command_buffer, VkPipelineLayout layout, VkDescriptorSet ibl_set, VkDescriptorSet texture_set, uint32_t shader_values_offset,
+		uint32_t first, uint32_t count, bool depth_prepass) const {
+		Stats stats;
+		VkPipeline bound_pipeline = VK_NULL_HANDLE;
+		VkDescriptorSet bound_material = VK_NULL_HANDLE;
+		VkDescriptorSet bound_object = VK_NULL_HANDLE;
+		uint32_t bound_ubo_offset = 0;
+		int32_t pushed_material_index = 0;
+		bool pushed = false;
+
+		const uint32_t last = std::min(first + count, static_cast<uint32_t>(m_sorted.size()));
+		if (first < last) {
+			vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 1, 1, &ibl_set, 0, nullptr);
+			stats.descriptor_binds++;
+			if (texture_set != VK_NULL_HANDLE) {
+				vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 3, 1, &texture_set, 0, nullptr);
+				stats.descriptor_binds++;
+			}
+		}
+
+		for (uint32_t i = first; i < last; i++) {
+			const DrawItem& item = m_items[m_sorted[i].item];
+			VkPipeline pipeline = depth_prepass ? item.depth_pipeline : item.pipeline;
+			if (pipeline == VK_NULL_HANDLE)
+				continue;
+			// All pipelines share the scene layout, so switching pipelines keeps the bound sets
+			if (pipeline != bound_pipeline) {
+				vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+				bound_pipeline = pipeline;
+				stats.pipeline_binds++;
+			}
+			if (item.material_set != bound_material || item.ubo_offset != bound_ubo_offset) {
+				const uint32_t dynamic_offsets[] = { item.ubo_offset, shader_values_offset };
+				vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 0, 1, &item.material_set, 2, dynamic_offsets);
+				bound_material = item.material_set;
+				bound_ubo_offset = item.ubo_offset;
+				stats.descriptor_binds++;
+			}
+			if (item.object_set != bound_object) {
+				vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, 2, 1, &item.object_set, 0, nullptr);
+				bound_object = item.object_set;
+				stats.descriptor_binds++;
+			}
+			if (!pushed || item.material_index != pushed_material_index) {
+				vkCmdPushConstants(command_buffer, layout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(int32_t), &item.material_index);
+				pushed_material_index = item.material_index;
+				pushed = true;
+				stats.push_constants++;
+			}
+			vkCmdDrawIndexed(command_buffer, item.index_count, 1, item.first_index, item.vertex_offset, 0);
+			stats.draws++;
+		}
+
+		return stats;
+	}
+
+	void RenderQueue::AddFrameStats(const Stats& stats) {
+		m_frame_stats = stats;
+		m_total_stats.draws += stats.draws;
+		m_total_stats.indirect_draws += stats.indirect_draws;
+		m_total_stats.pipeline_binds += stats.pipeline_binds;
+		m_total_stats.descriptor_binds += stats.descriptor_binds;
+		m_total_stats.push_constants += stats.push_constants;
+		m_frames++;
+	}
+
+	void RenderQueue::PrintStats() const {
+		if (m_frames == 0)
+			return;
+		std::cout << "Render queue: per frame " << m_total_stats.draws / m_frames << " draws, " << m_total_stats.indirect_draws / m_frames << " indirect draws, "
+			<< m_total_stats.pipeline_binds / m_frames << " pipeline binds, "
+			<< m_total_stats.descriptor_binds / m_frames << " descriptor set binds, " << m_total_stats.push_constants / m_frames << " push constants" << std::endl;
+	}
+
+	uint32_t RenderQueue::PipelineId(VkPipeline pipeline) {
+		auto it = std::find(m_pipelines.begin(), m_pipelines.end(), pipeline);
+		if (it == m_pipelines.end()) {
+			m_pipelines.push_back(pipeline);
+			it = m_pipelines.end() - 1;
+		}
+		// Past 256 pipelines ids repeat, draws still come out grouped by the rest of the key
+		return static_cast<uint32_t>(it - m_pipelines.begin()) & ((1u << s_pipeline_bits) - 1);
+	}
+
+	uint32_t RenderQueue::MaterialId(VkDescriptorSet material_set) {
+		auto it = m_materials.find(material_set);
+		if (it != m_materials.end())
+			return it->second;
+		uint32_t id = static_cast<uint32_t>(m_materials.size()) & ((1u << s_material_bits) - 1);
+		m_materials.emplace(material_set, id);
+		return id;
+	}
+}
@@ -1,5 +1,11 @@
 #include "Scene.hpp"
 
 namespace Diffuse {
-
-}
\ No newline at end of file
+	void Scene::UpdateBounds() {
+		for (uint32_t i = 0; i < m_scene_objects.size(); i++) {
+			const auto& object = m_scene_objects[i];
+			m_bvh.Update(i, object->p_model.GetBounds().Transform(object->p_world));
+		}
+		m_bvh.Refit();
+	}
+}
@@ -1,13 +1,36 @@
 #include "Texture2D.hpp"
 
 #include "GraphicsDevice.hpp"
+#include "TexturePacker.hpp"
+#include "TextureStreamer.hpp"
 #include "VulkanUtilities.hpp"
 
 #include "stb_image.h"
 
 namespace Diffuse {
+	static VkSampler GetTextureSampler(GraphicsDevice* graphics_device, const TextureSampler& sampler) {
+		VkSamplerCreateInfo samplerInfo{};
+		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+		samplerInfo.magFilter = sampler.mag_filter;
+		samplerInfo.minFilter = sampler.min_filter;
+		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+		samplerInfo.addressModeU = sampler.address_modeU;
+		samplerInfo.addressModeV = sampler.address_modeV;
+		samplerInfo.addressModeW = sampler.address_modeW;
+		samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
+		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
+		// The image view bounds the mip range, leaving the LOD unclamped lets textures with different mip counts share a sampler
+		samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+		samplerInfo.maxAnisotropy = 8.0f;
+		samplerInfo.anisotropyEnable = VK_TRUE;
+		return graphics_device->GetObjectCache()->GetSampler(samplerInfo);
+	}
+
 	Texture2D::Texture2D(tinygltf::Image image, TextureSampler sampler, VkQueue copy_queue, GraphicsDevice* graphics_device) {
 		m_graphics_device = graphics_device;
+		m_asset = MemoryAllocator::Tag::Asset();
+		if (!image.uri.empty())
+			m_asset += "#" + image.uri;
 
 		unsigned char* buffer = nullptr;
 		bool delete_buffer = false;
@@ -31,81 +54,63 @@ namespace Diffuse {
 			buffer_size = image.image.size();
 		}
 
-		VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
-
-		VkFormatProperties formatProperties;
-
+		m_format = VK_FORMAT_R8G8B8A8_UNORM;
 		m_width = image.width;
 		m_height = image.height;
 		m_mip_levels = static_cast<uint32_t>(floor(log2(std::max(m_width, m_height))) + 1.0);
 
-		vkGetPhysicalDeviceFormatProperties(m_graphics_device->PhysicalDevice(), format, &formatProperties);
-		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_SRC_BIT);
-		assert(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_BLIT_DST_BIT);
+		// The mip chain is built on the CPU so that any level can be (re)uploaded on its own when streaming
+		BuildMipChain(buffer);
+		if (delete_buffer)
+			delete[] buffer;
 
-		VkMemoryAllocateInfo memAllocInfo{};
-		memAllocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		VkMemoryRequirements memReqs{};
+		// Small textures stay on the CPU until the packer places them into a shared atlas page
+		TexturePacker* packer = m_graphics_device->GetTexturePacker();
+		if (packer && packer->IsCandidate(*this, sampler)) {
+			m_sampler_desc = sampler;
+			m_pack_pending = true;
+			packer->Add(this);
+			return;
+		}
+		Upload(copy_queue, sampler, true);
+	}
 
-		VkBuffer stagingBuffer;
-		VkDeviceMemory stagingMemory;
+	Texture2D::Texture2D(const unsigned char* rgba, uint32_t width, uint32_t height, uint32_t mip_levels, TextureSampler sampler, VkQueue copy_queue, GraphicsDevice* graphics_device) {
+		m_graphics_device = graphics_device;
+		m_asset = MemoryAllocator::Tag::Asset();
+		m_format = VK_FORMAT_R8G8B8A8_UNORM;
+		m_width = width;
+		m_height = height;
+		m_mip_levels = mip_levels;
+		BuildMipChain(rgba);
+		Upload(copy_queue, sampler, false);
+	}
 
-		VkBufferCreateInfo bufferCreateInfo{};
-		bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-		bufferCreateInfo.size = buffer_size;
-		bufferCreateInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
-		bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		if (vkCreateBuffer(m_graphics_device->Device(), &bufferCreateInfo, nullptr, &stagingBuffer)) {
-			throw std::runtime_error("failed to create buffer!");
-		}
-		vkGetBufferMemoryRequirements(m_graphics_device->Device(), stagingBuffer, &memReqs);
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_graphics_device->PhysicalDevice());
-		if (vkAllocateMemory(m_graphics_device->Device(), &memAllocInfo, nullptr, &stagingMemory)) {
-			throw std::runtime_error("failed to load texture image!");
-		}
-		if (vkBindBufferMemory(m_graphics_device->Device(), stagingBuffer, stagingMemory, 0)) {
-			throw std::runtime_error("failed to load texture image!");
-		}
+	void Texture2D::Upload(VkQueue copy_queue, const TextureSampler& sampler, bool allow_streaming) {
+		TextureStreamer* streamer = allow_streaming ? m_graphics_device->GetTextureStreamer() : nullptr;
+		m_streamed = streamer != nullptr;
+		m_resident_mip = m_streamed ? streamer->InitialResidentMip(*this) : 0;
+		m_requested_mip = m_resident_mip;
 
-		uint8_t* data;
-		if (vkMapMemory(m_graphics_device->Device(), stagingMemory, 0, memReqs.size, 0, (void**)&data)) {
-			throw std::runtime_error("failed to map memory!");
-		}
-		memcpy(data, buffer, buffer_size);
-		vkUnmapMemory(m_graphics_device->Device(), stagingMemory);
+		MemoryAllocator::Tag tag(MemoryCategory::Texture, m_asset);
+		CreateMipImage(m_resident_mip, m_texture_image, m_texture_image_memory, m_texture_image_view, m_resident_size);
 
-		VkImageCreateInfo image_create_info{};
-		image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
-		image_create_info.imageType = VK_IMAGE_TYPE_2D;
-		image_create_info.format = format;
-		image_create_info.mipLevels = m_mip_levels;
-		image_create_info.arrayLayers = 1;
-		image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
-		image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
-		image_create_info.usage = VK_IMAGE_USAGE_SAMPLED_BIT;
-		image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-		image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-		image_create_info.extent = { m_width, m_height, 1 };
-		image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
-		if (vkCreateImage(m_graphics_device->Device(), &image_create_info, nullptr, &m_texture_image)) {
-			throw std::runtime_error("failed to create image!");
-		}
-		vkGetImageMemoryRequirements(m_graphics_device->Device(), m_texture_image, &memReqs);
-		memAllocInfo.allocationSize = memReqs.size;
-		memAllocInfo.memoryTypeIndex = vkUtilities::FindMemoryType(memReqs.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_graphics_device->PhysicalDevice());
-		if (vkAllocateMemory(m_graphics_device->Device(), &memAllocInfo, nullptr, &m_texture_image_memory)) {
-			throw std::runtime_error("failed to allocate memory!");
-		}
-		if (vkBindImageMemory(m_graphics_device->Device(), m_texture_image, m_texture_image_memory, 0)) {
-			throw std::runtime_error("failed to find memory!");
-		}
+		// Upload the resident mips
+		VkDeviceSize upload_offset = m_mips[m_resident_mip].offset;
+		VkDeviceSize upload_size = m_mip_data.size() - upload_offset;
+
+		VkBuffer stagingBuffer;
+		VkDeviceMemory stagingMemory;
+		vkUtilities::CreateBuffer(upload_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffer, stagingMemory, m_graphics_device->PhysicalDevice(), m_graphics_device->Device());
+
+		memcpy(vkUtilities::MapBuffer(m_graphics_device->Device(), stagingBuffer), m_mip_data.data() + upload_offset, upload_size);
 
 		VkCommandBuffer copy_cmd = m_graphics_device->CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
 
 		VkImageSubresourceRange subresource_range = {};
 		subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		subresource_range.levelCount = 1;
+		subresource_range.levelCount = m_mip_levels - m_resident_mip;
 		subresource_range.layerCount = 1;
 
 		{
@@ -117,147 +122,126 @@ namespace Diffuse {
 			image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 			image_memory_barrier.image = m_texture_image;
 			image_memory_barrier.subresourceRange = subresource_range;
-			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
+			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
 		}
 
-		VkBufferImageCopy buffer_copy_region = {};
-		buffer_copy_region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		buffer_copy_region.imageSubresource.mipLevel = 0;
-		buffer_copy_region.imageSubresource.baseArrayLayer = 0;
-		buffer_copy_region.imageSubresource.layerCount = 1;
-		buffer_copy_region.imageExtent.width = m_width;
-		buffer_copy_region.imageExtent.height = m_height;
-		buffer_copy_region.imageExtent.depth = 1;
-
-		vkCmdCopyBufferToImage(copy_cmd, stagingBuffer, m_texture_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &buffer_copy_region);
+		std::vector<VkBufferImageCopy> regions;
+		for (uint32_t i = m_resident_mip; i < m_mip_levels; i++) {
+			VkBufferImageCopy region = {};
+			region.bufferOffset = m_mips[i].offset - upload_offset;
+			region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+			region.imageSubresource.mipLevel = i - m_resident_mip;
+			region.imageSubresource.baseArrayLayer = 0;
+			region.imageSubresource.layerCount = 1;
+			region.imageExtent = { m_mips[i].width, m_mips[i].height, 1 };
+			regions.push_back(region);
+		}
+		vkCmdCopyBufferToImage(copy_cmd, stagingBuffer, m_texture_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
 
+		m_imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 		{
 			VkImageMemoryBarrier image_memory_barrier{};
 			image_memory_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 			image_memory_barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-			image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			image_memory_barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 			image_memory_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			image_memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			image_memory_barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 			image_memory_barrier.image = m_texture_image;
 			image_memory_barrier.subresourceRange = subresource_range;
-			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
+			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &image_memory_barrier);
 		}
 
-		// TODO: implement this
-		//device->flushCommandBuffer(copyCmd, copyQueue, true);
 		m_graphics_device->FlushCommandBuffer(copy_cmd, copy_queue, true);
 
-		vkFreeMemory(m_graphics_device->Device(), stagingMemory, nullptr);
-		vkDestroyBuffer(m_graphics_device->Device(), stagingBuffer, nullptr);
+		vkUtilities::DestroyBuffer(m_graphics_device->Device(), stagingBuffer);
 
-		// Generate the mip chain (glTF uses jpg and png, so we need to create this manually)
-		VkCommandBuffer blit_cmd = m_graphics_device->CreateCommandBuffer(VK_COMMAND_BUFFER_LEVEL_PRIMARY, true);
-		for (uint32_t i = 1; i < m_mip_levels; i++) {
-			VkImageBlit imageBlit{};
-
-			imageBlit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlit.srcSubresource.layerCount = 1;
-			imageBlit.srcSubresource.mipLevel = i - 1;
-			imageBlit.srcOffsets[1].x = int32_t(m_width >> (i - 1));
-			imageBlit.srcOffsets[1].y = int32_t(m_height >> (i - 1));
-			imageBlit.srcOffsets[1].z = 1;
-
-			imageBlit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			imageBlit.dstSubresource.layerCount = 1;
-			imageBlit.dstSubresource.mipLevel = i;
-			imageBlit.dstOffsets[1].x = int32_t(m_width >> i);
-			imageBlit.dstOffsets[1].y = int32_t(m_height >> i);
-			imageBlit.dstOffsets[1].z = 1;
-
-			VkImageSubresourceRange mipSubRange = {};
-			mipSubRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-			mipSubRange.baseMipLevel = i;
-			mipSubRange.levelCount = 1;
-			mipSubRange.layerCount = 1;
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = 0;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.image = m_texture_image;
-				imageMemoryBarrier.subresourceRange = mipSubRange;
-				vkCmdPipelineBarrier(blit_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
+		m_texture_sampler = GetTextureSampler(m_graphics_device, sampler);
 
-			vkCmdBlitImage(blit_cmd, m_texture_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, m_texture_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &imageBlit, VK_FILTER_LINEAR);
-
-			{
-				VkImageMemoryBarrier imageMemoryBarrier{};
-				imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-				imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-				imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-				imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-				imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-				imageMemoryBarrier.image = m_texture_image;
-				imageMemoryBarrier.subresourceRange = mipSubRange;
-				vkCmdPipelineBarrier(blit_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
-			}
-		}
+		m_descriptor.sampler = m_texture_sampler;
+		m_descriptor.imageView = m_texture_image_view;
+		m_descriptor.imageLayout = m_imageLayout;
 
-		subresource_range.levelCount = m_mip_levels;
-		m_imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		if (m_streamed) {
+			streamer->Register(this);
+		}
+		else {
+			// Everything is resident, the CPU copy is no longer needed
+			m_mip_data.clear();
+			m_mip_data.shrink_to_fit();
+		}
+	}
 
-		{
-			VkImageMemoryBarrier imageMemoryBarrier{};
-			imageMemoryBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-			imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-			imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			imageMemoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			imageMemoryBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-			imageMemoryBarrier.image = m_texture_image;
-			imageMemoryBarrier.subresourceRange = subresource_range;
-			vkCmdPipelineBarrier(blit_cmd, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 0, nullptr, 1, &imageMemoryBarrier);
+	void Texture2D::BuildMipChain(const unsigned char* rgba) {
+		m_mips.resize(m_mip_levels);
+		VkDeviceSize total_size = 0;
+		for (uint32_t i = 0; i < m_mip_levels; i++) {
+			m_mips[i].width = std::max(1u, m_width >> i);
+			m_mips[i].height = std::max(1u, m_height >> i);
+			m_mips[i].offset = total_size;
+			m_mips[i].size = static_cast<VkDeviceSize>(m_mips[i].width) * m_mips[i].height * 4;
+			total_size += m_mips[i].size;
 		}
+		m_mip_data.resize(total_size);
+		memcpy(m_mip_data.data(), rgba, m_mips[0].size);
 
-		m_graphics_device->FlushCommandBuffer(blit_cmd, copy_queue, true);
+		// 2x2 box filter, edge texels are clamped for odd sizes
+		for (uint32_t i = 1; i < m_mip_levels; i++) {
+			const MipLevel& src_level = m_mips[i - 1];
+			const MipLevel& dst_level = m_mips[i];
+			const unsigned char* src = m_mip_data.data() + src_level.offset;
+			unsigned char* dst = m_mip_data.data() + dst_level.offset;
+			for (uint32_t y = 0; y < dst_level.height; y++) {
+				uint32_t y0 = std::min(y * 2, src_level.height - 1);
+				uint32_t y1 = std::min(y * 2 + 1, src_level.height - 1);
+				for (uint32_t x = 0; x < dst_level.width; x++) {
+					uint32_t x0 = std::min(x * 2, src_level.width - 1);
+					uint32_t x1 = std::min(x * 2 + 1, src_level.width - 1);
+					for (uint32_t c = 0; c < 4; c++) {
+						uint32_t sum = src[(y0 * src_level.width + x0) * 4 + c] + src[(y0 * src_level.width + x1) * 4 + c] +
+							src[(y1 * src_level.width + x0) * 4 + c] + src[(y1 * src_level.width + x1) * 4 + c];
+						dst[(y * dst_level.width + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+					}
+				}
+			}
+		}
+	}
 
-		VkSamplerCreateInfo samplerInfo{};
-		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-		samplerInfo.magFilter = sampler.mag_filter;
-		samplerInfo.minFilter = sampler.min_filter;
-		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-		samplerInfo.addressModeU = sampler.address_modeU;
-		samplerInfo.addressModeV = sampler.address_modeV;
-		samplerInfo.addressModeW = sampler.address_modeW;
-		samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
-		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-		samplerInfo.maxAnisotropy = 1.0;
-		samplerInfo.anisotropyEnable = VK_FALSE;
-		samplerInfo.maxLod = (float)m_mip_levels;
-		samplerInfo.maxAnisotropy = 8.0f;
-		samplerInfo.anisotropyEnable = VK_TRUE;
-		if (vkCreateSampler(m_graphics_device->Device(), &samplerInfo, nullptr, &m_texture_sampler)) {
-			throw std::runtime_error("failed to create sampler!");
+	void Texture2D::CreateMipImage(uint32_t base_mip, VkImage& image, VkDeviceMemory& memory, VkImageView& view, VkDeviceSize& size) const {
+		// Streaming rebuilds happen outside of any load, the texture remembers its owner
+		MemoryAllocator::Tag tag(MemoryCategory::Texture, m_asset);
+		VkImageCreateInfo image_create_info{};
+		image_create_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		image_create_info.imageType = VK_IMAGE_TYPE_2D;
+		image_create_info.format = m_format;
+		image_create_info.mipLevels = m_mip_levels - base_mip;
+		image_create_info.arrayLayers = 1;
+		image_create_info.samples = VK_SAMPLE_COUNT_1_BIT;
+		image_create_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+		image_create_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		image_create_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		image_create_info.extent = { m_mips[base_mip].width, m_mips[base_mip].height, 1 };
+		image_create_info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+		if (vkCreateImage(m_graphics_device->Device(), &image_create_info, nullptr, &image)) {
+			throw std::runtime_error("failed to create image!");
 		}
 
+		VkMemoryRequirements memReqs{};
+		vkGetImageMemoryRequirements(m_graphics_device->Device(), image, &memReqs);
+		m_graphics_device->GetMemoryAllocator()->BindImage(image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &memory);
+		size = memReqs.size;
+
 		VkImageViewCreateInfo viewInfo{};
 		viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-		viewInfo.image = m_texture_image;
+		viewInfo.image = image;
 		viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-		viewInfo.format = format;
+		viewInfo.format = m_format;
 		viewInfo.components = { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B, VK_COMPONENT_SWIZZLE_A };
 		viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
 		viewInfo.subresourceRange.layerCount = 1;
-		viewInfo.subresourceRange.levelCount = m_mip_levels;
-		if (vkCreateImageView(m_graphics_device->Device(), &viewInfo, nullptr, &m_texture_image_view)) {
+		viewInfo.subresourceRange.levelCount = m_mip_levels - base_mip;
+		if (vkCreateImageView(m_graphics_device->Device(), &viewInfo, nullptr, &view)) {
 			throw std::runtime_error("failed to create image view!");
 		}
-
-		m_descriptor.sampler = m_texture_sampler;
-		m_descriptor.imageView = m_texture_image_view;
-		m_descriptor.imageLayout = m_imageLayout;
-
-		if (delete_buffer)
-			delete[] buffer;
-
 	}
 
 	Texture2D::Texture2D(const std::string& path, VkFormat format, TextureSampler sampler, VkImageUsageFlags additionalUsage, GraphicsDevice* graphics_device, bool null_texture) {
@@ -323,18 +307,7 @@ namespace Diffuse {
 			throw std::runtime_error("Failed to create image");
 		}
 
-		VkMemoryRequirements memoryRequirements;
-		vkGetImageMemoryRequirements(m_graphics_device->Device(), m_texture_image, &memoryRequirements);
-
-		VkMemoryAllocateInfo allocateInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-		allocateInfo.allocationSize = memoryRequirements.size;
-		allocateInfo.memoryTypeIndex = vkUtilities::FindMemoryType(memoryRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_graphics_device->PhysicalDevice());
-		if (vkAllocateMemory(m_graphics_device->Device(), &allocateInfo, nullptr, &m_texture_image_memory)) {
-			throw std::runtime_error("Failed to allocate device memory for image");
-		}
-		if (vkBindImageMemory(m_graphics_device->Device(), m_texture_image, m_texture_image_memory, 0) != VK_SUCCESS) {
-			throw std::runtime_error("Failed to bind device memory to image");
-		}
+		m_graphics_device->GetMemoryAllocator()->BindImage(m_texture_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &m_texture_image_memory);
 
 		//texture.view = createTextureView(texture, format, VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS);
 		VkImageViewCreateInfo viewCreateInfo = { VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
@@ -357,21 +330,8 @@ namespace Diffuse {
 			staging_memory, m_graphics_device->PhysicalDevice(), m_graphics_device->Device());
 
 		// copy data to staging buffer
-		const VkMappedMemoryRange flushRange = {
-			VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-			nullptr,
-			staging_memory,
-			0,
-			VK_WHOLE_SIZE
-		};
-
-		void* mappedMemory;
-		if (vkMapMemory(m_graphics_device->Device(), staging_memory, 0, VK_WHOLE_SIZE, 0, &mappedMemory)) {
-			throw std::runtime_error("Failed to map device memory to host address space");
-		}
-		std::memcpy(mappedMemory, m_pixels, imageSize);
-		vkFlushMappedMemoryRanges(m_graphics_device->Device(), 1, &flushRange);
-		vkUnmapMemory(m_graphics_device->Device(), staging_memory);
+		std::memcpy(vkUtilities::MapBuffer(m_graphics_device->Device(), staging_buffer), m_pixels, imageSize);
+		m_graphics_device->GetMemoryAllocator()->Flush(staging_buffer, 0, VK_WHOLE_SIZE);
 
 		VkCommandBuffer copy_cmd = vkUtilities::BeginSingleTimeCommands(m_graphics_device->CommandPool(), m_graphics_device->Device());
 		{
@@ -390,7 +350,7 @@ namespace Diffuse {
 			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 
 			uint32_t size = 1;
-			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, 0, 0, nullptr, 0, nullptr, size, &barrier);
+			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, size, &barrier);
 		}
 
 		VkBufferImageCopy copyRegion = {};
@@ -407,7 +367,7 @@ namespace Diffuse {
 			VkImageMemoryBarrier barrier{};
 			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
 			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-			barrier.dstAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
 			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
 			barrier.newLayout = final_layout;
 			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -419,29 +379,13 @@ namespace Diffuse {
 			barrier.subresourceRange.layerCount = VK_REMAINING_ARRAY_LAYERS;
 
 			uint32_t size = 1;
-			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, size, &barrier);
+			// Sampled by the environment map conversion as well as by fragment shaders
+			vkCmdPipelineBarrier(copy_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, size, &barrier);
 		}
 
 		vkUtilities::EndSingleTimeCommands(copy_cmd, m_graphics_device->Device(), m_graphics_device->Queue(), m_graphics_device->CommandPool());
 
-		VkSamplerCreateInfo samplerInfo{};
-		samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-		samplerInfo.magFilter = sampler.mag_filter;
-		samplerInfo.minFilter = sampler.min_filter;
-		samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
-		samplerInfo.addressModeU = sampler.address_modeU;
-		samplerInfo.addressModeV = sampler.address_modeV;
-		samplerInfo.addressModeW = sampler.address_modeW;
-		samplerInfo.compareOp = VK_COMPARE_OP_NEVER;
-		samplerInfo.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_WHITE;
-		samplerInfo.maxAnisotropy = 1.0;
-		samplerInfo.anisotropyEnable = VK_FALSE;
-		samplerInfo.maxLod = (float)m_mip_levels;
-		samplerInfo.maxAnisotropy = 8.0f;
-		samplerInfo.anisotropyEnable = VK_TRUE;
-		if (vkCreateSampler(m_graphics_device->Device(), &samplerInfo, nullptr, &m_texture_sampler)) {
-			throw std::runtime_error("failed to create sampler!");
-		}
+		m_texture_sampler = GetTextureSampler(m_graphics_device, sampler);
 
 		m_imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
@@ -449,15 +393,44 @@ namespace Diffuse {
 		m_descriptor.imageView = m_texture_image_view;
 		m_descriptor.imageLayout = m_imageLayout;
 
-		if (staging_buffer != VK_NULL_HANDLE)
-			vkDestroyBuffer(m_graphics_device->Device(), staging_buffer, nullptr);
-		if (staging_memory != VK_NULL_HANDLE)
-			vkFreeMemory(m_graphics_device->Device(), staging_memory, nullptr);
+		vkUtilities::DestroyBuffer(m_graphics_device->Device(), staging_buffer);
 
 		// if level > 1
 		// GenerateMipmaps()
 	}
 
+	Texture2D::Texture2D(Texture2D* owner, TextureSampler sampler) {
+		m_graphics_device = owner->m_graphics_device;
+		m_width = owner->m_width;
+		m_height = owner->m_height;
+		m_mip_levels = owner->m_mip_levels;
+		m_layers = owner->m_layers;
+		m_format = owner->m_format;
+		m_mips = owner->m_mips;
+		m_streamed = owner->m_streamed;
+		m_alias_of = owner;
+		owner->m_aliases.push_back(this);
+
+		m_texture_sampler = GetTextureSampler(m_graphics_device, sampler);
+		// The packer syncs the aliases of a pending owner once it has an image
+		if (!owner->m_pack_pending)
+			SyncWithOwner();
+	}
+
+	void Texture2D::SyncWithOwner() {
+		m_texture_image = m_alias_of->m_texture_image;
+		m_texture_image_view = m_alias_of->m_texture_image_view;
+		m_texture_image_memory = m_alias_of->m_texture_image_memory;
+		m_imageLayout = m_alias_of->m_imageLayout;
+		m_resident_mip = m_alias_of->m_resident_mip;
+		// Aliases of a packed texture sample its atlas tile through the page sampler
+		if (m_alias_of->IsAtlased()) {
+			m_atlas_rect = m_alias_of->m_atlas_rect;
+			m_texture_sampler = m_alias_of->m_texture_sampler;
+		}
+		UpdateDescriptor();
+	}
+
 	void Texture2D::UpdateDescriptor() {
 		m_descriptor.sampler = m_texture_sampler;
 		m_descriptor.imageView = m_texture_image_view;
@@ -589,20 +562,7 @@ namespace Diffuse {
 				throw std::runtime_error("failed to create image!");
 			}
 
-			VkMemoryRequirements memRequirements;
-			vkGetImageMemoryRequirements(m_graphics_device->Device(), m_texture_image, &memRequirements);
-
-			VkMemoryAllocateInfo allocInfo{};
-			allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-			allocInfo.allocationSize = memRequirements.size;
-			allocInfo.memoryTypeIndex =
-				vkUtilities::FindMemoryType(memRequirements.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_graphics_device->PhysicalDevice());
-
-			if (vkAllocateMemory(m_graphics_device->Device(), &allocInfo, nullptr, &m_texture_image_memory) != VK_SUCCESS) {
-				throw std::runtime_error("failed to allocate image memory!");
-			}
-
-			vkBindImageMemory(m_graphics_device->Device(), m_texture_image, m_texture_image_memory, 0);
+			m_graphics_device->GetMemoryAllocator()->BindImage(m_texture_image, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &m_texture_image_memory);
 		}
 
 		// Create Texture Image View
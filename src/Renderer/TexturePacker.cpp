@@ -0,0 +1,158 @@
+#include "TexturePacker.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace Diffuse {
+	TexturePacker::TexturePacker(GraphicsDevice* device, uint32_t max_extent, uint32_t page_extent)
+		:m_device(device), m_max_extent(max_extent), m_page_extent(page_extent) {}
+
+	bool TexturePacker::IsCandidate(const Texture2D& texture, const TextureSampler& sampler) const {
+		if (m_max_extent == 0 || texture.m_format != VK_FORMAT_R8G8B8A8_UNORM)
+			return false;
+		if (texture.m_width > m_max_extent || texture.m_height > m_max_extent || TileExtent(m_max_extent) > m_page_extent)
+			return false;
+		if (texture.m_mip_levels > s_page_mips)
+			return false;
+		// Only repeat addressing is emulated in the shader
+		return sampler.address_modeU == VK_SAMPLER_ADDRESS_MODE_REPEAT && sampler.address_modeV == VK_SAMPLER_ADDRESS_MODE_REPEAT;
+	}
+
+	void TexturePacker::Add(Texture2D* texture) {
+		m_pending.push_back(texture);
+	}
+
+	uint32_t TexturePacker::TileExtent(uint32_t extent) {
+		return (extent + 2 * s_border + s_border - 1) / s_border * s_border;
+	}
+
+	void TexturePacker::Pack(VkQueue copy_queue) {
+		std::vector<Texture2D*> pending;
+		pending.swap(m_pending);
+		m_stats = Stats{};
+		m_has_packed = true;
+		for (auto texture : pending) {
+			texture->m_pack_pending = false;
+		}
+
+		// Textures already shared with another sampler keep their own image, the alias would inherit the repeat emulation
+		std::vector<Texture2D*> candidates;
+		for (auto texture : pending) {
+			if (texture->m_aliases.empty()) {
+				candidates.push_back(texture);
+			}
+			else {
+				UploadStandalone(texture, copy_queue);
+			}
+		}
+
+		std::stable_sort(candidates.begin(), candidates.end(), [](const Texture2D* a, const Texture2D* b) {
+			return a->m_height != b->m_height ? a->m_height > b->m_height : a->m_width > b->m_width;
+		});
+
+		// Shelf packing, tallest first so every shelf is filled with tiles of similar height
+		std::vector<Placement> placements;
+		uint32_t cursor_x = 0, shelf_y = 0, shelf_height = 0;
+		for (auto texture : candidates) {
+			uint32_t tile_width = TileExtent(texture->m_width);
+			uint32_t tile_height = TileExtent(texture->m_height);
+			if (cursor_x + tile_width > m_page_extent) {
+				shelf_y += shelf_height;
+				cursor_x = 0;
+				shelf_height = 0;
+			}
+			if (shelf_y + tile_height > m_page_extent) {
+				BuildPage(placements, shelf_y, copy_queue);
+				placements.clear();
+				cursor_x = shelf_y = shelf_height = 0;
+			}
+			placements.push_back({ texture, cursor_x, shelf_y });
+			cursor_x += tile_width;
+			shelf_height = std::max(shelf_height, tile_height);
+		}
+		if (!placements.empty()) {
+			BuildPage(placements, shelf_y + shelf_height, copy_queue);
+		}
+
+		if (!pending.empty()) {
+			std::cout << "Texture packer: " << m_stats.packed << " textures packed into " << m_stats.pages << " pages ("
+				<< (m_stats.page_bytes >> 10) << " KB), " << m_stats.standalone << " uploaded standalone" << std::endl;
+		}
+	}
+
+	void TexturePacker::UploadStandalone(Texture2D* texture, VkQueue copy_queue) {
+		texture->Upload(copy_queue, texture->m_sampler_desc, true);
+		for (auto alias : texture->m_aliases) {
+			alias->m_streamed = texture->m_streamed;
+			alias->SyncWithOwner();
+		}
+		m_stats.standalone++;
+	}
+
+	void TexturePacker::BuildPage(const std::vector<Placement>& placements, uint32_t height, VkQueue copy_queue) {
+		// A page with a single tile only adds borders
+		if (placements.size() == 1) {
+			UploadStandalone(placements.front().texture, copy_queue);
+			return;
+		}
+
+		uint32_t width = 0;
+		for (auto& placement : placements) {
+			width = std::max(width, placement.x + TileExtent(placement.texture->m_width));
+		}
+
+		// Copy each texture into its tile, the border wraps around so filtering and the page mips see repeated texels
+		std::vector<unsigned char> pixels(static_cast<size_t>(width) * height * 4, 0);
+		for (auto& placement : placements) {
+			const Texture2D* texture = placement.texture;
+			const unsigned char* src = texture->m_mip_data.data();
+			uint32_t tile_width = TileExtent(texture->m_width);
+			uint32_t tile_height = TileExtent(texture->m_height);
+			for (uint32_t y = 0; y < tile_height; y++) {
+				uint32_t src_y = (y + texture->m_height * s_border - s_border) % texture->m_height;
+				unsigned char* dst = pixels.data() + (static_cast<size_t>(placement.y + y) * width + placement.x) * 4;
+				for (uint32_t x = 0; x < tile_width; x++) {
+					uint32_t src_x = (x + texture->m_width * s_border - s_border) % texture->m_width;
+					memcpy(dst + x * 4, src + (static_cast<size_t>(src_y) * texture->m_width + src_x) * 4, 4);
+				}
+			}
+		}
+
+		uint32_t mip_levels = std::min(s_page_mips, static_cast<uint32_t>(std::floor(std::log2(std::min(width, height)))) + 1);
+		TextureSampler sampler{ VK_FILTER_LINEAR, VK_FILTER_LINEAR, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE };
+		MemoryAllocator::Tag tag(MemoryCategory::Texture, "texture atlas page " + std::to_string(m_pages.size()));
+		Texture2D* page = new Texture2D(pixels.data(), width, height, mip_levels, sampler, copy_queue, m_device);
+		m_pages.push_back(page);
+		m_stats.pages++;
+		m_stats.page_bytes += page->m_resident_size;
+
+		for (auto& placement : placements) {
+			Texture2D* texture = placement.texture;
+			texture->m_atlas_rect = glm::vec4(
+				static_cast<float>(texture->m_width) / width, static_cast<float>(texture->m_height) / height,
+				static_cast<float>(placement.x + s_border) / width, static_cast<float>(placement.y + s_border) / height);
+			texture->m_alias_of = page;
+			page->m_aliases.push_back(texture);
+			texture->m_texture_sampler = page->m_texture_sampler;
+			texture->SyncWithOwner();
+			texture->m_mip_data.clear();
+			texture->m_mip_data.shrink_to_fit();
+			m_stats.packed++;
+		}
+	}
+
+	void TexturePacker::CleanUp() {
+		// Packed textures are owned by the texture registry and must have been released already
+		for (auto page : m_pages) {
+			vkDestroyImageView(m_device->Device(), page->GetView(), nullptr);
+			vkUtilities::DestroyImage(m_device->Device(), page->GetImage());
+			delete page;
+		}
+		m_pages.clear();
+		m_pending.clear();
+	}
+}
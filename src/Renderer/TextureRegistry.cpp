@@ -0,0 +1,148 @@
+#include "TextureRegistry.hpp"
+
+#include "GraphicsDevice.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace Diffuse {
+	namespace {
+		bool SameSampler(const TextureSampler& a, const TextureSampler& b) {
+			return a.mag_filter == b.mag_filter && a.min_filter == b.min_filter &&
+				a.address_modeU == b.address_modeU && a.address_modeV == b.address_modeV && a.address_modeW == b.address_modeW;
+		}
+	}
+
+	TextureRegistry::TextureRegistry(GraphicsDevice* device, bool deduplicate)
+		:m_device(device), m_deduplicate(deduplicate) {}
+
+	bool TextureRegistry::Contains(const Utils::Hash128& content) const {
+		return m_deduplicate && m_entries.find(content) != m_entries.end();
+	}
+
+	Texture2D* TextureRegistry::Acquire(const Utils::Hash128& content, const TextureSampler& sampler) {
+		if (!m_deduplicate)
+			return nullptr;
+		auto it = m_entries.find(content);
+		if (it == m_entries.end())
+			return nullptr;
+
+		Entry& entry = it->second;
+		Texture2D* owner = entry.textures.front().second;
+		m_stats.references++;
+		m_stats.duplicates++;
+		m_stats.saved_bytes += TextureBytes(*owner);
+
+		for (auto& [entry_sampler, texture] : entry.textures) {
+			if (SameSampler(entry_sampler, sampler)) {
+				m_references[texture]++;
+				return texture;
+			}
+		}
+
+		// Same image with a different sampler, share the image and keep the owner alive while the alias exists
+		Texture2D* alias = new Texture2D(owner, sampler);
+		m_references[owner]++;
+		entry.textures.push_back({ sampler, alias });
+		m_contents[alias] = content;
+		m_references[alias] = 1;
+		return alias;
+	}
+
+	Texture2D* TextureRegistry::Insert(const Utils::Hash128& content, const TextureSampler& sampler, Texture2D* texture) {
+		m_stats.references++;
+		m_references[texture] = 1;
+		if (m_deduplicate) {
+			Entry& entry = m_entries[content];
+			entry.content = content;
+			entry.textures.push_back({ sampler, texture });
+			m_contents[texture] = content;
+		}
+		return texture;
+	}
+
+	void TextureRegistry::Release(Texture2D* texture) {
+		auto it = m_references.find(texture);
+		if (it == m_references.end())
+			return;
+		if (--it->second > 0)
+			return;
+		m_references.erase(it);
+
+		Texture2D* owner = texture->m_alias_of;
+		auto content = m_contents.find(texture);
+		if (content != m_contents.end()) {
+			auto entry = m_entries.find(content->second);
+			auto& textures = entry->second.textures;
+			textures.erase(std::remove_if(textures.begin(), textures.end(), [&](const auto& t) { return t.second == texture; }), textures.end());
+			if (textures.empty()) {
+				m_entries.erase(entry);
+			}
+			m_contents.erase(content);
+		}
+
+		if (owner) {
+			if (auto streamer = m_device->GetTextureStreamer()) {
+				streamer->Unregister(texture);
+			}
+			owner->m_aliases.erase(std::remove(owner->m_aliases.begin(), owner->m_aliases.end(), texture), owner->m_aliases.end());
+			delete texture;
+			Release(owner);
+		}
+		else {
+			Destroy(texture);
+		}
+	}
+
+	void TextureRegistry::Destroy(Texture2D* texture) {
+		if (auto streamer = m_device->GetTextureStreamer()) {
+			streamer->Unregister(texture);
+		}
+		vkDestroyImageView(m_device->Device(), texture->GetView(), nullptr);
+		vkUtilities::DestroyImage(m_device->Device(), texture->GetImage());
+		delete texture;
+	}
+
+	VkDeviceSize TextureRegistry::TextureBytes(const Texture2D& texture) {
+		VkDeviceSize size = 0;
+		for (auto& mip : texture.m_mips) {
+			size += mip.size;
+		}
+		return size > 0 ? size : VkDeviceSize(texture.m_width) * texture.m_height * 4;
+	}
+
+	void TextureRegistry::ReportScene() {
+		VkDeviceSize unique_bytes = 0;
+		for (auto& [texture, references] : m_references) {
+			if (texture->m_alias_of == nullptr) {
+				unique_bytes += TextureBytes(*texture);
+			}
+		}
+		std::cout << "Texture registry: " << m_stats.references << " texture references, " << m_stats.duplicates << " deduplicated, "
+			<< m_stats.skipped_decodes << " decodes skipped, " << (unique_bytes >> 20) << " MB unique, "
+			<< (m_stats.saved_bytes >> 20) << " MB VRAM saved" << std::endl;
+		m_stats = Stats{};
+	}
+
+	void TextureRegistry::CleanUp() {
+		// Aliases first, they hold references on their owners
+		std::vector<Texture2D*> textures;
+		for (auto& [texture, references] : m_references) {
+			textures.push_back(texture);
+		}
+		std::stable_partition(textures.begin(), textures.end(), [](const Texture2D* t) { return t->m_alias_of != nullptr; });
+		for (auto texture : textures) {
+			if (texture->m_alias_of) {
+				Texture2D* owner = texture->m_alias_of;
+				owner->m_aliases.erase(std::remove(owner->m_aliases.begin(), owner->m_aliases.end(), texture), owner->m_aliases.end());
+				delete texture;
+			}
+			else {
+				Destroy(texture);
+			}
+		}
+		m_references.clear();
+		m_contents.clear();
+		m_entries.clear();
+	}
+}
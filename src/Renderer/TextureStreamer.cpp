@@ -0,0 +1,388 @@
+#include "TextureStreamer.hpp"
+
+#include "GraphicsDevice.hpp"
+#include "VulkanUtilities.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace Diffuse {
+	TextureStreamer::TextureStreamer(GraphicsDevice* device, uint32_t frames_in_flight, VkDeviceSize vram_budget, VkDeviceSize upload_budget)
+		:m_device(device), m_vram_budget(vram_budget), m_upload_budget(upload_budget) {
+		m_staging.resize(frames_in_flight);
+		m_pending_descriptors.resize(frames_in_flight);
+		m_descriptor_versions.resize(frames_in_flight, 0);
+	}
+
+	uint32_t TextureStreamer::InitialResidentMip(const Texture2D& texture) const {
+		uint32_t mip = 0;
+		while (mip + 1 < texture.m_mip_levels && std::max(texture.m_mips[mip].width, texture.m_mips[mip].height) > s_resident_tail_extent) {
+			mip++;
+		}
+		return mip;
+	}
+
+	void TextureStreamer::Register(Texture2D* texture) {
+		m_textures.push_back(texture);
+		m_resident_bytes += texture->m_resident_size;
+		m_largest_mip = std::max(m_largest_mip, texture->m_mips[0].size);
+		m_largest_chain = std::max(m_largest_chain, static_cast<VkDeviceSize>(texture->m_mip_data.size()));
+	}
+
+	void TextureStreamer::Unregister(Texture2D* texture) {
+		m_descriptors.erase(texture);
+		for (auto& pending : m_pending_descriptors) {
+			pending.erase(std::remove(pending.begin(), pending.end(), texture), pending.end());
+		}
+		auto it = std::find(m_textures.begin(), m_textures.end(), texture);
+		if (it == m_textures.end())
+			return;
+		m_textures.erase(it);
+		m_resident_bytes -= texture->m_resident_size;
+	}
+
+	void TextureStreamer::RegisterDescriptor(Texture2D* texture, VkDescriptorSet descriptor_set, uint32_t binding, uint32_t frame_index,
+		uint32_t array_element, bool update_after_bind) {
+		if (texture == nullptr || !texture->m_streamed)
+			return;
+		m_descriptors[texture].push_back({ descriptor_set, binding, frame_index, array_element, update_after_bind });
+	}
+
+	void TextureStreamer::BeginFrame(uint32_t frame_index) {
+		m_frame++;
+		m_frame_index = frame_index;
+		m_stats.uploads = 0;
+		m_stats.evictions = 0;
+		m_stats.uploaded_bytes = 0;
+
+		// The frames that last used this slot's sets have finished, they can point at the new images
+		for (Texture2D* texture : m_pending_descriptors[frame_index]) {
+			WriteDescriptors(texture, frame_index);
+		}
+		m_pending_descriptors[frame_index].clear();
+
+		// The staging buffer of this slot is idle now, grow it if a newly loaded texture has a larger mip
+		Staging& staging = m_staging[frame_index];
+		VkDeviceSize capacity = std::max(m_upload_budget, m_device->GetUploadQueue()->IsAsync() ? m_largest_chain : m_largest_mip);
+		if (staging.capacity < capacity) {
+			vkUtilities::DestroyBuffer(m_device->Device(), staging.buffer);
+			MemoryAllocator::Tag tag(MemoryCategory::Staging, "texture streamer");
+			vkUtilities::CreateBuffer(capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+				staging.buffer, staging.memory, m_device->PhysicalDevice(), m_device->Device());
+			staging.mapped = static_cast<unsigned char*>(vkUtilities::MapBuffer(m_device->Device(), staging.buffer));
+			staging.capacity = capacity;
+		}
+	}
+
+	void TextureStreamer::Request(const SceneObject& object, const glm::mat4& model, const EditorCamera& camera, float viewport_height) {
+		if (!object.p_render)
+			return;
+
+		// Pixels covered by one world unit at a distance of one unit
+		float pixels_per_unit = 0.5f * viewport_height * std::abs(camera.GetProjection()[1][1]);
+		float scale = std::max({ glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2])) });
+		if (scale <= 0.0f)
+			return;
+
+		const glm::vec3& eye = camera.GetPosition();
+		for (auto node : object.p_model.GetLinearNodes()) {
+			if (!node->mesh)
+				continue;
+			for (Primitive* primitive : node->mesh->primitives) {
+				if (primitive->material_index < 0 || !primitive->bb.valid)
+					continue;
+				BoundingBox bb = primitive->bb.Transform(model);
+				float distance = std::max(glm::length(glm::clamp(eye, bb.min, bb.max) - eye), 0.01f);
+				float screen_density = pixels_per_unit / distance;
+
+				const Material& material = object.p_model.GetMaterial(primitive->material_index);
+				auto density = [&](uint8_t set) { return primitive->uv_density[set > 0 ? 1 : 0] / scale; };
+				RequestTexture(material.baseColorTexture, density(material.texCoordSets.baseColor), screen_density);
+				RequestTexture(material.metallicRoughnessTexture, density(material.texCoordSets.metallicRoughness), screen_density);
+				RequestTexture(material.normalTexture, density(material.texCoordSets.normal), screen_density);
+				RequestTexture(material.occlusionTexture, density(material.texCoordSets.occlusion), screen_density);
+				RequestTexture(material.emissiveTexture, density(material.texCoordSets.emissive), screen_density);
+			}
+		}
+	}
+
+	void TextureStreamer::RequestTexture(Texture2D* texture, float texcoords_per_unit, float pixels_per_unit) {
+		if (texture == nullptr || !texture->m_streamed)
+			return;
+		if (texture->m_alias_of)
+			texture = texture->m_alias_of;
+
+		// Texels per screen pixel along the larger axis picks the mip the sampler would use
+		float texels_per_unit = texcoords_per_unit * static_cast<float>(std::max(texture->m_width, texture->m_height));
+		float ratio = texels_per_unit / pixels_per_unit;
+		uint32_t mip = ratio > 1.0f ? static_cast<uint32_t>(std::floor(std::log2(ratio))) : 0;
+		mip = std::min(mip, texture->m_mip_levels - 1);
+
+		if (texture->m_last_used_frame != m_frame) {
+			texture->m_requested_mip = mip;
+			texture->m_last_used_frame = m_frame;
+		}
+		else {
+			texture->m_requested_mip = std::min(texture->m_requested_mip, mip);
+		}
+	}
+
+	void TextureStreamer::Update(VkCommandBuffer command_buffer) {
+		// Textures visible this frame that want finer mips, largest deficit first
+		std::vector<Texture2D*> candidates;
+		for (auto texture : m_textures) {
+			if (texture->m_last_used_frame == m_frame && texture->m_requested_mip < texture->m_resident_mip) {
+				candidates.push_back(texture);
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Texture2D* a, const Texture2D* b) {
+			return (a->m_resident_mip - a->m_requested_mip) > (b->m_resident_mip - b->m_requested_mip);
+		});
+
+		VkDeviceSize staging_offset = 0;
+		uint32_t pending = 0;
+		bool async = m_device->GetUploadQueue()->IsAsync();
+		for (auto texture : candidates) {
+			// The transfer queue uploads the already resident mips again
+			VkDeviceSize resident_bytes = 0;
+			if (async) {
+				for (uint32_t i = texture->m_resident_mip; i < texture->m_mip_levels; i++) {
+					resident_bytes += texture->m_mips[i].size;
+				}
+			}
+
+			// Stream towards the requested mip one level at a time until the frame's upload budget is used up.
+			// A single level larger than the budget is still allowed if nothing else was uploaded this frame.
+			uint32_t target = texture->m_resident_mip;
+			VkDeviceSize bytes = 0;
+			while (target > texture->m_requested_mip) {
+				VkDeviceSize level_size = texture->m_mips[target - 1].size;
+				if (staging_offset + resident_bytes + bytes + level_size > m_upload_budget && (staging_offset + bytes) > 0)
+					break;
+				bytes += level_size;
+				target--;
+			}
+			if (target == texture->m_resident_mip) {
+				pending++;
+				continue;
+			}
+
+			VkDeviceSize new_size = 0;
+			for (uint32_t i = target; i < texture->m_mip_levels; i++) {
+				new_size += texture->m_mips[i].size;
+			}
+			VkDeviceSize required = m_resident_bytes - texture->m_resident_size + new_size;
+			if (required > m_vram_budget && !Evict(required - m_vram_budget, texture, command_buffer)) {
+				pending++;
+				continue;
+			}
+
+			Rebuild(texture, target, command_buffer, staging_offset);
+			m_stats.uploads++;
+			m_stats.uploaded_bytes += bytes + resident_bytes;
+			if (target > texture->m_requested_mip) {
+				pending++;
+			}
+		}
+
+		m_stats.pending = pending;
+		m_stats.resident_bytes = m_resident_bytes;
+	}
+
+	bool TextureStreamer::Evict(VkDeviceSize required, Texture2D* keep, VkCommandBuffer command_buffer) {
+		// Least recently used textures holding mips finer than they currently need
+		std::vector<Texture2D*> victims;
+		for (auto texture : m_textures) {
+			if (texture == keep)
+				continue;
+			uint32_t needed = (texture->m_last_used_frame == m_frame) ? texture->m_requested_mip : InitialResidentMip(*texture);
+			if (texture->m_resident_mip < needed) {
+				victims.push_back(texture);
+			}
+		}
+		std::sort(victims.begin(), victims.end(), [](const Texture2D* a, const Texture2D* b) {
+			return a->m_last_used_frame < b->m_last_used_frame;
+		});
+
+		VkDeviceSize freed = 0;
+		for (auto texture : victims) {
+			if (freed >= required)
+				break;
+			uint32_t needed = (texture->m_last_used_frame == m_frame) ? texture->m_requested_mip : InitialResidentMip(*texture);
+			VkDeviceSize old_size = texture->m_resident_size;
+			VkDeviceSize staging_offset = 0;
+			Rebuild(texture, needed, command_buffer, staging_offset);
+			freed += old_size > texture->m_resident_size ? old_size - texture->m_resident_size : 0;
+			m_stats.evictions++;
+		}
+		return freed >= required;
+	}
+
+	void TextureStreamer::Rebuild(Texture2D* texture, uint32_t base_mip, VkCommandBuffer command_buffer, VkDeviceSize& staging_offset) {
+		uint32_t old_base = texture->m_resident_mip;
+
+		VkImage image;
+		VkDeviceMemory memory;
+		VkImageView view;
+		VkDeviceSize size;
+		texture->CreateMipImage(base_mip, image, memory, view, size);
+
+		// Uploads go to the transfer queue when there is one, it only has the CPU copy to read from
+		UploadQueue* upload_queue = m_device->GetUploadQueue();
+		bool transfer_queue = base_mip < old_base && upload_queue->IsAsync();
+		VkCommandBuffer upload_command_buffer = base_mip < old_base ? upload_queue->Begin(command_buffer) : command_buffer;
+		uint32_t upload_base = transfer_queue ? texture->m_mip_levels : old_base;
+
+		// The new image has not been used yet, so there is no earlier access to wait for
+		{
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.srcAccessMask = 0;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+			vkCmdPipelineBarrier(upload_command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
+		// Mips both images share are copied on the GPU. The frame still in flight may be sampling the old image, the barrier
+		// waits for those reads before changing its layout
+		if (!transfer_queue) {
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = texture->m_imageLayout;
+			barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = texture->m_texture_image;
+			barrier.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+			std::vector<VkImageCopy> copies;
+			for (uint32_t mip = std::max(base_mip, old_base); mip < texture->m_mip_levels; mip++) {
+				VkImageCopy copy{};
+				copy.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - old_base, 0, 1 };
+				copy.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - base_mip, 0, 1 };
+				copy.extent = { texture->m_mips[mip].width, texture->m_mips[mip].height, 1 };
+				copies.push_back(copy);
+			}
+			vkCmdCopyImage(command_buffer, texture->m_texture_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(copies.size()), copies.data());
+		}
+
+		// New fine mips come from the CPU copy
+		if (base_mip < upload_base) {
+			Staging& staging = m_staging[m_frame_index];
+			std::vector<VkBufferImageCopy> regions;
+			for (uint32_t mip = base_mip; mip < upload_base; mip++) {
+				const Texture2D::MipLevel& level = texture->m_mips[mip];
+				assert(staging_offset + level.size <= staging.capacity);
+				memcpy(staging.mapped + staging_offset, texture->m_mip_data.data() + level.offset, level.size);
+
+				VkBufferImageCopy region{};
+				region.bufferOffset = staging_offset;
+				region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, mip - base_mip, 0, 1 };
+				region.imageExtent = { level.width, level.height, 1 };
+				regions.push_back(region);
+				staging_offset += level.size;
+			}
+			vkCmdCopyBufferToImage(upload_command_buffer, staging.buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+				static_cast<uint32_t>(regions.size()), regions.data());
+		}
+
+		VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, VK_REMAINING_MIP_LEVELS, 0, 1 };
+		if (base_mip < old_base) {
+			upload_queue->HandOver(command_buffer, image, range, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+				VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+		}
+		else {
+			VkImageMemoryBarrier barrier{};
+			barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+			barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+			barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+			barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+			barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+			barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+			barrier.image = image;
+			barrier.subresourceRange = range;
+			vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+		}
+
+		// Frames in flight may still sample the old image, it goes once they have all finished
+		VkDevice device = m_device->Device();
+		VkImage old_image = texture->m_texture_image;
+		VkImageView old_view = texture->m_texture_image_view;
+		m_device->GetDeletionQueue()->Push([device, old_image, old_view]() {
+			vkDestroyImageView(device, old_view, nullptr);
+			vkUtilities::DestroyImage(device, old_image);
+		});
+
+		m_resident_bytes = m_resident_bytes - texture->m_resident_size + size;
+		texture->m_texture_image = image;
+		texture->m_texture_image_view = view;
+		texture->m_texture_image_memory = memory;
+		texture->m_resident_size = size;
+		texture->m_resident_mip = base_mip;
+		texture->UpdateDescriptor();
+
+		UpdateDescriptors(texture);
+		for (auto alias : texture->m_aliases) {
+			alias->SyncWithOwner();
+			UpdateDescriptors(alias);
+		}
+	}
+
+	void TextureStreamer::UpdateDescriptors(Texture2D* texture) {
+		WriteDescriptors(texture, m_frame_index);
+		for (uint32_t i = 0; i < m_pending_descriptors.size(); i++) {
+			auto& pending = m_pending_descriptors[i];
+			if (i != m_frame_index && std::find(pending.begin(), pending.end(), texture) == pending.end())
+				pending.push_back(texture);
+		}
+	}
+
+	void TextureStreamer::WriteDescriptors(Texture2D* texture, uint32_t frame_index) {
+		auto it = m_descriptors.find(texture);
+		if (it != m_descriptors.end()) {
+			std::vector<VkWriteDescriptorSet> writes;
+			bool invalidates = false;
+			for (auto& [descriptor_set, binding, frame, array_element, update_after_bind] : it->second) {
+				if (frame != frame_index)
+					continue;
+				VkWriteDescriptorSet write{};
+				write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+				write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+				write.dstSet = descriptor_set;
+				write.dstBinding = binding;
+				write.dstArrayElement = array_element;
+				write.descriptorCount = 1;
+				write.pImageInfo = &texture->m_descriptor;
+				writes.push_back(write);
+				invalidates |= !update_after_bind;
+			}
+			if (!writes.empty()) {
+				vkUpdateDescriptorSets(m_device->Device(), static_cast<uint32_t>(writes.size()), writes.data(), 0, nullptr);
+			}
+			if (invalidates) {
+				m_descriptor_versions[frame_index]++;
+			}
+		}
+	}
+
+	void TextureStreamer::CleanUp() {
+		std::cout << "Texture streaming: " << m_textures.size() << " textures, " << (m_resident_bytes >> 20) << " MB resident of "
+			<< (m_vram_budget >> 20) << " MB budget" << std::endl;
+		for (auto& staging : m_staging) {
+			vkUtilities::DestroyBuffer(m_device->Device(), staging.buffer);
+			staging = Staging{};
+		}
+	}
+}
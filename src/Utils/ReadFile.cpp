@@ -8,7 +8,7 @@ namespace Utils {
 		std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
 		if (!file.is_open()) {
-			throw std::runtime_error("failed to open file!");
+			throw std::runtime_error("failed to open file " + filename + "!");
 		}
 
 		size_t fileSize = (size_t)file.tellg();
@@ -0,0 +1,71 @@
+#include "WorkerPool.hpp"
+
+namespace Utils {
+	WorkerPool::WorkerPool(uint32_t thread_count) {
+		for (uint32_t i = 0; i < thread_count; i++) {
+			m_threads.emplace_back(&WorkerPool::Run, this, i + 1);
+		}
+	}
+
+	WorkerPool::~WorkerPool() {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_stop = true;
+		}
+		m_wake.notify_all();
+		for (auto& thread : m_threads) {
+			thread.join();
+		}
+	}
+
+	void WorkerPool::ParallelFor(uint32_t count, const std::function<void(uint32_t index, uint32_t worker)>& job) {
+		if (count == 0)
+			return;
+		if (m_threads.empty() || count == 1) {
+			for (uint32_t i = 0; i < count; i++) {
+				job(i, 0);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_job = &job;
+			m_count = count;
+			m_next = 0;
+			m_active = static_cast<uint32_t>(m_threads.size());
+			m_generation++;
+		}
+		m_wake.notify_all();
+		Work(0);
+
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_done.wait(lock, [this]() { return m_active == 0; });
+		m_job = nullptr;
+	}
+
+	void WorkerPool::Run(uint32_t worker) {
+		uint32_t generation = 0;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_wake.wait(lock, [&]() { return m_stop || m_generation != generation; });
+				if (m_stop)
+					return;
+				generation = m_generation;
+			}
+			Work(worker);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				if (--m_active == 0)
+					m_done.notify_one();
+			}
+		}
+	}
+
+	void WorkerPool::Work(uint32_t worker) {
+		for (uint32_t index = m_next++; index < m_count; index = m_next++) {
+			(*m_job)(index, worker);
+		}
+	}
+}
@@ -1,13 +1,53 @@
 #include "Application.hpp"
 
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
+
+// Reads the value of the flag at argv[i] into value and moves i past it, false if it is missing or not a number.
+// A following flag is not taken as the value
+static bool ReadCount(int argc, char** argv, int& i, uint32_t& value) {
+    const char* flag = argv[i];
+    if (i + 1 >= argc || argv[i + 1][0] == '-') {
+        std::cout << "Missing value for " << flag << std::endl;
+        return false;
+    }
+    const char* text = argv[++i];
+    char* end = nullptr;
+    unsigned long parsed = std::strtoul(text, &end, 10);
+    if (end == text || *end != '\0' || parsed > UINT32_MAX) {
+        std::cout << "Invalid value " << text << " for " << flag << std::endl;
+        return false;
+    }
+    value = static_cast<uint32_t>(parsed);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Diffuse::Config config;
+    uint32_t benchmark_frames = 0;
+    // --frames-in-flight N    number of frames the CPU may record ahead of the GPU (1 to 3)
+    // --benchmark N           render N frames, print the frame timings and exit
+    // Bad values are reported and the default is kept
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--frames-in-flight") == 0) {
+            ReadCount(argc, argv, i, config.frames_in_flight);
+        }
+        else if (std::strcmp(argv[i], "--benchmark") == 0) {
+            ReadCount(argc, argv, i, benchmark_frames);
+        }
+        else {
+            std::cout << "Unknown argument " << argv[i] << std::endl;
+        }
+    }
 
-int main(int argc, char** argv[]) {
     Diffuse::Application* app = new Diffuse::Application();
-    app->Init();
+    app->Init(config, benchmark_frames);
     app->Update();
     app->Destroy();
     delete app;
 
     return 0;
-}
\ No newline at end of file
+}